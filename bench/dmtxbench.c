@@ -0,0 +1,566 @@
+/*
+libdmtx wrappers - benchmark corpus and native baseline
+
+Copyright (C) 2009 Mike Laughton
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+Contact: mike@dragonflylogic.com
+*/
+
+/* $Id$ */
+
+/**
+ * dmtxbench writes the image corpus shared by the benchmark harnesses of
+ * every wrapper, and measures libdmtx alone on it so that each harness can
+ * tell its own overhead from the time spent in the library:
+ *
+ *   dmtxbench corpus DIR        write DIR/corpus.txt and one PNM per case
+ *   dmtxbench run DIR [ROUNDS]  decode and encode the corpus ROUNDS times
+ *
+ * corpus.txt holds one case per line:
+ *
+ *   decode NAME FILE WIDTH HEIGHT CHANNELS SYMBOLS MODULE ROTATION NOISE
+ *   encode NAME LENGTH
+ *
+ * Decode images hold SYMBOLS symbols of MODULE pixel modules rotated by
+ * ROTATION degrees, with +/- NOISE of uniform noise added to every sample.
+ * CHANNELS is 1 for mono (PGM) and 3 for RGB (PPM) images. Encode cases
+ * encode the first LENGTH characters of BENCH_PAYLOAD repeated.
+ *
+ * Every harness prints the same columns, see BenchPrintHeader().
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <dmtx.h>
+
+#define BENCH_PAYLOAD  "libdmtx benchmark payload 0123456789 "
+#define BENCH_ROUNDS   20
+#define BENCH_MAX_PATH 1024
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+typedef struct {
+   const char *name;
+   int width;
+   int height;
+   int channels;
+   int symbols;
+   int module;
+   int rotation;
+   int noise;
+} DecodeCase;
+
+typedef struct {
+   const char *name;
+   int length;
+} EncodeCase;
+
+/* Each group varies one property of the "base" case */
+static const DecodeCase decodeCases[] = {
+   { "base",       640,  480, 1,  1, 4,  0,  0 },
+   { "res-320",    320,  240, 1,  1, 4,  0,  0 },
+   { "res-1280",  1280,  960, 1,  1, 4,  0,  0 },
+   { "res-2048",  2048, 1536, 1,  1, 4,  0,  0 },
+   { "count-4",    640,  480, 1,  4, 4,  0,  0 },
+   { "count-16",  1280,  960, 1, 16, 4,  0,  0 },
+   { "module-2",   640,  480, 1,  1, 2,  0,  0 },
+   { "module-8",   640,  480, 1,  1, 8,  0,  0 },
+   { "rot-15",     640,  480, 1,  1, 4, 15,  0 },
+   { "rot-45",     640,  480, 1,  1, 4, 45,  0 },
+   { "noise-16",   640,  480, 1,  1, 4,  0, 16 },
+   { "noise-48",   640,  480, 1,  1, 4,  0, 48 },
+   { "rgb",        640,  480, 3,  1, 4,  0,  0 },
+   { "rgb-rot-30", 640,  480, 3,  1, 4, 30, 16 }
+};
+
+static const EncodeCase encodeCases[] = {
+   { "encode-16",   16 },
+   { "encode-64",   64 },
+   { "encode-256", 256 }
+};
+
+static unsigned long randState = 1;
+
+static int BenchCorpus(const char *dir);
+static int BenchRun(const char *dir, int rounds);
+static int BenchDecodeCase(const char *dir, char *line, int rounds);
+static int BenchEncodeCase(char *line, int rounds);
+static unsigned char *EncodeModules(const char *message, int *rows, int *cols);
+static void RenderSymbol(unsigned char *page, const DecodeCase *c,
+      const unsigned char *modules, int rows, int cols, double cx, double cy);
+static int WritePnm(const char *path, const unsigned char *pxl, int width,
+      int height, int channels);
+static unsigned char *ReadPnm(const char *path, int *width, int *height,
+      int *channels);
+static double ElapsedMs(DmtxTime start, DmtxTime end);
+static int CompareDouble(const void *a, const void *b);
+static void BenchPrintHeader(const char *binding, int rounds);
+static void BenchPrintRow(const char *name, int found, int expected,
+      double *ms, int count);
+static int NextRand(void);
+
+int
+main(int argc, char *argv[])
+{
+   if(argc >= 3 && strcmp(argv[1], "corpus") == 0)
+      return BenchCorpus(argv[2]);
+
+   if(argc >= 3 && strcmp(argv[1], "run") == 0)
+      return BenchRun(argv[2], (argc >= 4) ? atoi(argv[3]) : BENCH_ROUNDS);
+
+   fprintf(stderr, "usage: %s corpus DIR\n"
+         "       %s run DIR [ROUNDS]\n", argv[0], argv[0]);
+   return 2;
+}
+
+/**
+ * Write the corpus images and their manifest into dir, which must exist
+ */
+static int
+BenchCorpus(const char *dir)
+{
+   char path[BENCH_MAX_PATH], file[64], message[64];
+   unsigned char *page, *modules;
+   const DecodeCase *c;
+   FILE *manifest;
+   int i, j, rows, cols, grid, cell, sample;
+   size_t size;
+
+   sprintf(path, "%.*s/corpus.txt", BENCH_MAX_PATH - 16, dir);
+   manifest = fopen(path, "w");
+   if(manifest == NULL) {
+      perror(path);
+      return 1;
+   }
+
+   fprintf(manifest, "# decode NAME FILE WIDTH HEIGHT CHANNELS SYMBOLS MODULE ROTATION NOISE\n");
+   fprintf(manifest, "# encode NAME LENGTH\n");
+
+   for(i = 0; i < (int)(sizeof(decodeCases) / sizeof(decodeCases[0])); i++) {
+      c = &decodeCases[i];
+      size = (size_t)c->width * c->height * c->channels;
+      page = (unsigned char *)malloc(size);
+      if(page == NULL) {
+         fclose(manifest);
+         return 1;
+      }
+
+      /* Light background, slightly tinted in RGB */
+      for(j = 0; j < (int)size; j++)
+         page[j] = (c->channels == 3 && j % 3 == 2) ? 215 : 240;
+
+      /* Symbols are centered in the cells of a square grid */
+      for(grid = 1; grid * grid < c->symbols; grid++)
+         ;
+      cell = ((c->width < c->height) ? c->width : c->height) / grid;
+
+      for(j = 0; j < c->symbols; j++) {
+         sprintf(message, "corpus %s %d", c->name, j);
+         modules = EncodeModules(message, &rows, &cols);
+         if(modules == NULL) {
+            free(page);
+            fclose(manifest);
+            return 1;
+         }
+         RenderSymbol(page, c, modules, rows, cols,
+               (c->width - grid * cell) / 2 + (j % grid + 0.5) * cell,
+               (c->height - grid * cell) / 2 + (j / grid + 0.5) * cell);
+         free(modules);
+      }
+
+      /* Same noise sequence every time the corpus is written */
+      randState = (unsigned long)(i + 1);
+      for(j = 0; c->noise > 0 && j < (int)size; j++) {
+         sample = page[j] + NextRand() % (2 * c->noise + 1) - c->noise;
+         page[j] = (unsigned char)((sample < 0) ? 0 : (sample > 255) ? 255 : sample);
+      }
+
+      sprintf(file, "%s.%s", c->name, (c->channels == 1) ? "pgm" : "ppm");
+      sprintf(path, "%.*s/%s", BENCH_MAX_PATH - 80, dir, file);
+      if(WritePnm(path, page, c->width, c->height, c->channels) != 0) {
+         free(page);
+         fclose(manifest);
+         return 1;
+      }
+      free(page);
+
+      fprintf(manifest, "decode %s %s %d %d %d %d %d %d %d\n", c->name, file,
+            c->width, c->height, c->channels, c->symbols, c->module,
+            c->rotation, c->noise);
+   }
+
+   for(i = 0; i < (int)(sizeof(encodeCases) / sizeof(encodeCases[0])); i++)
+      fprintf(manifest, "encode %s %d\n", encodeCases[i].name,
+            encodeCases[i].length);
+
+   fclose(manifest);
+   return 0;
+}
+
+/**
+ * Run every case of the corpus manifest in dir
+ */
+static int
+BenchRun(const char *dir, int rounds)
+{
+   char path[BENCH_MAX_PATH], line[256];
+   FILE *manifest;
+   int failed = 0;
+
+   if(rounds < 1)
+      rounds = 1;
+
+   sprintf(path, "%.*s/corpus.txt", BENCH_MAX_PATH - 16, dir);
+   manifest = fopen(path, "r");
+   if(manifest == NULL) {
+      perror(path);
+      return 1;
+   }
+
+   BenchPrintHeader("native", rounds);
+
+   while(fgets(line, sizeof(line), manifest) != NULL) {
+      if(strncmp(line, "decode ", 7) == 0)
+         failed |= BenchDecodeCase(dir, line + 7, rounds);
+      else if(strncmp(line, "encode ", 7) == 0)
+         failed |= BenchEncodeCase(line + 7, rounds);
+   }
+
+   fclose(manifest);
+   return failed;
+}
+
+/**
+ * Decode one corpus image rounds times, each with a fresh DmtxDecode as a
+ * binding would
+ */
+static int
+BenchDecodeCase(const char *dir, char *line, int rounds)
+{
+   char name[64], file[64], path[BENCH_MAX_PATH];
+   unsigned char *pxl;
+   int width, height, channels, symbols, found, i;
+   double *ms;
+   DmtxImage *img;
+   DmtxDecode *dec;
+   DmtxRegion *reg;
+   DmtxMessage *msg;
+   DmtxTime start;
+
+   if(sscanf(line, "%63s %63s %*d %*d %*d %d", name, file, &symbols) != 3)
+      return 1;
+
+   sprintf(path, "%.*s/%s", BENCH_MAX_PATH - 80, dir, file);
+   pxl = ReadPnm(path, &width, &height, &channels);
+   if(pxl == NULL) {
+      fprintf(stderr, "Unable to read %s\n", path);
+      return 1;
+   }
+
+   ms = (double *)malloc(rounds * sizeof(double));
+   img = dmtxImageCreate(pxl, width, height,
+         (channels == 1) ? DmtxPack8bppK : DmtxPack24bppRGB);
+   if(ms == NULL || img == NULL) {
+      free(ms);
+      free(pxl);
+      return 1;
+   }
+
+   found = 0;
+   for(i = 0; i < rounds; i++) {
+      start = dmtxTimeNow();
+
+      found = 0;
+      dec = dmtxDecodeCreate(img, 1);
+      while(dec != NULL && found < symbols &&
+            (reg = dmtxRegionFindNext(dec, NULL)) != NULL) {
+         msg = dmtxDecodeMatrixRegion(dec, reg, DmtxUndefined);
+         if(msg != NULL) {
+            found++;
+            dmtxMessageDestroy(&msg);
+         }
+         dmtxRegionDestroy(&reg);
+      }
+      if(dec != NULL)
+         dmtxDecodeDestroy(&dec);
+
+      ms[i] = ElapsedMs(start, dmtxTimeNow());
+   }
+
+   BenchPrintRow(name, found, symbols, ms, rounds);
+
+   dmtxImageDestroy(&img);
+   free(ms);
+   free(pxl);
+
+   return 0;
+}
+
+/**
+ * Encode the payload of one encode case rounds times
+ */
+static int
+BenchEncodeCase(char *line, int rounds)
+{
+   char name[64], *payload;
+   int length, i, ok;
+   double *ms;
+   DmtxEncode *enc;
+   DmtxTime start;
+
+   if(sscanf(line, "%63s %d", name, &length) != 2 || length < 1)
+      return 1;
+
+   payload = (char *)malloc(length + 1);
+   ms = (double *)malloc(rounds * sizeof(double));
+   if(payload == NULL || ms == NULL) {
+      free(payload);
+      free(ms);
+      return 1;
+   }
+   for(i = 0; i < length; i++)
+      payload[i] = BENCH_PAYLOAD[i % (sizeof(BENCH_PAYLOAD) - 1)];
+   payload[length] = '\0';
+
+   ok = 0;
+   for(i = 0; i < rounds; i++) {
+      start = dmtxTimeNow();
+
+      enc = dmtxEncodeCreate();
+      if(enc != NULL) {
+         ok = (dmtxEncodeDataMatrix(enc, length, (unsigned char *)payload) == DmtxPass);
+         dmtxEncodeDestroy(&enc);
+      }
+
+      ms[i] = ElapsedMs(start, dmtxTimeNow());
+   }
+
+   BenchPrintRow(name, ok, 1, ms, rounds);
+
+   free(payload);
+   free(ms);
+
+   return 0;
+}
+
+/**
+ * Encode message with one pixel per module and no margin, and return its
+ * modules top row first, one byte per module (1 = dark)
+ */
+static unsigned char *
+EncodeModules(const char *message, int *rows, int *cols)
+{
+   DmtxEncode *enc;
+   unsigned char *modules, *row;
+   int x, y, stride;
+
+   enc = dmtxEncodeCreate();
+   if(enc == NULL)
+      return NULL;
+
+   dmtxEncodeSetProp(enc, DmtxPropPixelPacking, DmtxPack24bppRGB);
+   dmtxEncodeSetProp(enc, DmtxPropImageFlip, DmtxFlipNone);
+   dmtxEncodeSetProp(enc, DmtxPropModuleSize, 1);
+   dmtxEncodeSetProp(enc, DmtxPropMarginSize, 0);
+
+   if(dmtxEncodeDataMatrix(enc, strlen(message), (unsigned char *)message) == DmtxFail) {
+      dmtxEncodeDestroy(&enc);
+      return NULL;
+   }
+
+   *cols = dmtxImageGetProp(enc->image, DmtxPropWidth);
+   *rows = dmtxImageGetProp(enc->image, DmtxPropHeight);
+   stride = dmtxImageGetProp(enc->image, DmtxPropRowSizeBytes);
+
+   modules = (unsigned char *)malloc(*rows * *cols);
+   if(modules != NULL) {
+      for(y = 0; y < *rows; y++) {
+         row = enc->image->pxl + y * stride;
+         for(x = 0; x < *cols; x++)
+            modules[y * *cols + x] = (row[3 * x] < 128);
+      }
+   }
+
+   dmtxEncodeDestroy(&enc);
+
+   return modules;
+}
+
+/**
+ * Draw the dark modules of a symbol centered on (cx, cy), scaled to the
+ * module size of c and rotated by its rotation
+ */
+static void
+RenderSymbol(unsigned char *page, const DecodeCase *c,
+      const unsigned char *modules, int rows, int cols, double cx, double cy)
+{
+   double angle, cosA, sinA, dx, dy, u, v;
+   int x, y, x0, x1, y0, y1, col, row, reach, k;
+   unsigned char *p;
+   static const unsigned char ink[3] = { 40, 30, 90 };
+
+   angle = c->rotation * M_PI / 180.0;
+   cosA = cos(angle);
+   sinA = sin(angle);
+
+   reach = (int)((rows > cols ? rows : cols) * c->module * 0.75) + 2;
+   x0 = (cx - reach < 0) ? 0 : (int)(cx - reach);
+   x1 = (cx + reach > c->width) ? c->width : (int)(cx + reach);
+   y0 = (cy - reach < 0) ? 0 : (int)(cy - reach);
+   y1 = (cy + reach > c->height) ? c->height : (int)(cy + reach);
+
+   for(y = y0; y < y1; y++) {
+      for(x = x0; x < x1; x++) {
+         dx = x + 0.5 - cx;
+         dy = y + 0.5 - cy;
+         u = (cosA * dx + sinA * dy) / c->module + cols / 2.0;
+         v = (-sinA * dx + cosA * dy) / c->module + rows / 2.0;
+         if(u < 0.0 || v < 0.0)
+            continue;
+
+         col = (int)u;
+         row = (int)v;
+         if(col >= cols || row >= rows || !modules[row * cols + col])
+            continue;
+
+         p = page + ((size_t)y * c->width + x) * c->channels;
+         for(k = 0; k < c->channels; k++)
+            p[k] = (c->channels == 1) ? 20 : ink[k];
+      }
+   }
+}
+
+/**
+ * Write a binary PGM (1 channel) or PPM (3 channels)
+ */
+static int
+WritePnm(const char *path, const unsigned char *pxl, int width, int height,
+      int channels)
+{
+   FILE *fp;
+   size_t size;
+
+   fp = fopen(path, "wb");
+   if(fp == NULL) {
+      perror(path);
+      return 1;
+   }
+
+   size = (size_t)width * height * channels;
+   fprintf(fp, "P%c\n%d %d\n255\n", (channels == 1) ? '5' : '6', width, height);
+   if(fwrite(pxl, 1, size, fp) != size) {
+      fclose(fp);
+      return 1;
+   }
+
+   return (fclose(fp) == 0) ? 0 : 1;
+}
+
+/**
+ * Read a binary PGM or PPM as written by WritePnm
+ */
+static unsigned char *
+ReadPnm(const char *path, int *width, int *height, int *channels)
+{
+   FILE *fp;
+   unsigned char *pxl;
+   int type, maxval;
+   size_t size;
+
+   fp = fopen(path, "rb");
+   if(fp == NULL)
+      return NULL;
+
+   if(fscanf(fp, "P%d %d %d %d", &type, width, height, &maxval) != 4 ||
+         (type != 5 && type != 6) || maxval != 255 || fgetc(fp) == EOF) {
+      fclose(fp);
+      return NULL;
+   }
+
+   *channels = (type == 5) ? 1 : 3;
+   size = (size_t)*width * *height * *channels;
+   pxl = (unsigned char *)malloc(size);
+   if(pxl != NULL && fread(pxl, 1, size, fp) != size) {
+      free(pxl);
+      pxl = NULL;
+   }
+
+   fclose(fp);
+
+   return pxl;
+}
+
+static double
+ElapsedMs(DmtxTime start, DmtxTime end)
+{
+   return (end.sec - start.sec) * 1000.0 +
+         ((double)end.usec - (double)start.usec) / 1000.0;
+}
+
+static int
+CompareDouble(const void *a, const void *b)
+{
+   double da = *(const double *)a, db = *(const double *)b;
+
+   return (da < db) ? -1 : (da > db) ? 1 : 0;
+}
+
+/**
+ * Column header shared by all harnesses. alloc/decode and overhead are
+ * left as "-" here: the native run is the baseline the overhead of each
+ * binding is measured against.
+ */
+static void
+BenchPrintHeader(const char *binding, int rounds)
+{
+   printf("# %s, %d rounds per case\n", binding, rounds);
+   printf("# %-12s %7s %10s %9s %9s %12s %11s\n", "case", "found",
+         "per sec", "p50 ms", "p99 ms", "alloc/call", "overhead ms");
+}
+
+static void
+BenchPrintRow(const char *name, int found, int expected, double *ms,
+      int count)
+{
+   double total = 0.0;
+   char ratio[32];
+   int i;
+
+   for(i = 0; i < count; i++)
+      total += ms[i];
+   qsort(ms, count, sizeof(double), CompareDouble);
+
+   sprintf(ratio, "%d/%d", found, expected);
+   printf("  %-12s %7s %10.1f %9.3f %9.3f %12s %11s\n", name, ratio,
+         (total > 0.0) ? count * 1000.0 / total : 0.0, ms[count / 2],
+         ms[(count * 99) / 100], "-", "-");
+}
+
+/**
+ * Small LCG, so that the corpus is the same on every platform
+ */
+static int
+NextRand(void)
+{
+   randState = randState * 1103515245UL + 12345UL;
+
+   return (int)((randState >> 16) & 0x7fff);
+}
@@ -24,16 +24,70 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 #if ! TARGET_OS_IPHONE
 #import <Cocoa/Cocoa.h>
 #endif
+#import <CoreVideo/CoreVideo.h>
+
+// Named search settings for useProfile:
+typedef enum {
+	SHDataMatrixProfileDefault,
+	SHDataMatrixProfileFixedSizeLabel,	// crisp labels seen head-on by a fixed camera
+	SHDataMatrixProfileDenseDocument,	// many small barcodes on a flat scan
+	SHDataMatrixProfileFarFieldCamera	// small, low contrast barcodes at an angle
+} SHDataMatrixProfile;
 
 @interface SHDataMatrixReader : NSObject {
-    
+    CGRect _scanRect;
+    NSUInteger _maxImageSize;
+    NSUInteger _shrink;
+    NSMutableData *_pixelData;
+    NSMutableData *_lumaData;
+    void *_decodeState;
 }
 #pragma mark Allocation
 + (id)sharedDataMatrixReader;
+#pragma mark Properties
+// Part of the images to scan in unit coordinates (0.0 to 1.0, origin at the
+// top left). CGRectNull, the default, scans whole images.
+@property (nonatomic, assign) CGRect scanRect;
+// Images are scaled down to at most this many pixels on their longer side
+// before decoding (500 by default, 0 to decode them at their own size).
+// Pixel buffers are always decoded at their own size.
+@property (nonatomic, assign) NSUInteger maxImageSize;
+// Decode at 1/shrink of the resolution in each direction (1, the default,
+// for full resolution). Larger values are faster on big, sharp frames.
+@property (nonatomic, assign) NSUInteger shrink;
 #pragma mark Instance
 #if TARGET_OS_IPHONE
 - (NSString *)decodeBarcodeFromImage:(UIImage *)image;
 #else
 - (NSString *)decodeBarcodeFromImage:(NSImage *)image;
 #endif
+// Decodes like decodeBarcodeFromImage:, but first looks around previous
+// (the four corners of a barcode found before, e.g. in the previous video
+// frame) and only scans the rest of the image if nothing decodes there.
+// Either may be NULL; corners receives the four corners of the barcode
+// found. Corners are in the same unit coordinates as scanRect.
+#if TARGET_OS_IPHONE
+- (NSString *)decodeBarcodeFromImage:(UIImage *)image near:(const CGPoint *)previous corners:(CGPoint *)corners;
+#else
+- (NSString *)decodeBarcodeFromImage:(NSImage *)image near:(const CGPoint *)previous corners:(CGPoint *)corners;
+#endif
+// Decodes a camera frame in place, without drawing or copying it. Bi-planar
+// YCbCr frames are scanned on their luma (Y) plane; 32 bit BGRA and 8 bit
+// single component frames are also accepted. The decode state is kept
+// between frames of the same size, so that scanning video allocates no
+// memory per frame. previous and corners are as for
+// decodeBarcodeFromImage:near:corners: and may be NULL.
+- (NSString *)decodeBarcodeFromPixelBuffer:(CVPixelBufferRef)pixelBuffer near:(const CGPoint *)previous corners:(CGPoint *)corners;
+// Searches with the settings of a named profile (expected barcode size,
+// edge lengths, scan gap, skew and edge threshold) from now on.
+- (void)useProfile:(SHDataMatrixProfile)profile;
+// Fits the search settings and shrink to sample images (UIImage or NSImage,
+// prepared like those passed to decodeBarcodeFromImage:): the tightest
+// settings that still find every barcode the defaults find in them are used
+// from now on. Settings of the current profile and a shrink above 1 are
+// tried first. Returns the number of barcodes found ("symbols"), the
+// milliseconds all samples take with the defaults ("defaultMilliseconds")
+// and with the new settings ("profileMilliseconds"), their ratio
+// ("speedup") and the new shrink ("shrink"), or nil if no barcode is found.
+- (NSDictionary *)calibrateWithImages:(NSArray *)images;
 @end
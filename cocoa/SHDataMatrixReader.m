@@ -26,17 +26,100 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 #import "SHDataMatrixReader.h"
 
 #import "dmtx.h"
+#import "../convert/dmtxconvert.h"
+#import "../profile/dmtxprofile.h"
+#import "../core/dmtxcore.h"
+
+// libdmtx state kept between decodes, rebuilt when the geometry of the
+// pixels changes.
+typedef struct {
+	DmtxCoreDecoder decoder;
+	DmtxProfile profile;
+} SHDecodeState;
+
+// First barcode decoded by a scan, kept until the scan is over.
+typedef struct {
+	DmtxCoreArena text;
+	int messageSize;
+	int corners[8];
+	int found;
+} SHScanResult;
 
 @interface SHDataMatrixReader ()
 #if TARGET_OS_IPHONE
-- (NSData *)_ARGB8DataForImage:(UIImage *)image;
+- (const unsigned char *)_pixelsForImage:(UIImage *)image width:(int *)width height:(int *)height packing:(int *)packing;
 #else
-- (NSData *)_ARGB8DataForImage:(NSImage *)image;
+- (const unsigned char *)_pixelsForImage:(NSImage *)image width:(int *)width height:(int *)height packing:(int *)packing;
 #endif
+- (NSString *)_decodePixels:(const unsigned char *)pixels width:(int)width height:(int)height bytesPerRow:(int)bytesPerRow packing:(int)packing near:(const CGPoint *)previous corners:(CGPoint *)corners;
 @end
 
+// Restrict the scan grid of decode to rect, given in unit coordinates with
+// the origin at the top left, of an image of width by height pixels.
+static DmtxPassFail SHSetScanRect(DmtxDecode *decode, CGRect rect, int width, int height) {
+	int xMin = (int)(CGRectGetMinX(rect) * width);
+	int xMax = (int)(CGRectGetMaxX(rect) * width) - 1;
+	int yMin = (int)(CGRectGetMinY(rect) * height);
+	int yMax = (int)(CGRectGetMaxY(rect) * height) - 1;
+
+	if(xMin < 0) xMin = 0;
+	if(yMin < 0) yMin = 0;
+	if(xMax > width - 1) xMax = width - 1;
+	if(yMax > height - 1) yMax = height - 1;
+	if(xMin >= xMax || yMin >= yMax)
+		return DmtxFail;
+
+	return dmtxCoreSetImageBounds(decode, xMin, xMax, yMin, yMax);
+}
+
+// Result callback of the scan: keep the first barcode and stop.
+static int SHScanResultFound(void *context, const DmtxCoreResult *result) {
+	SHScanResult *first = (SHScanResult *)context;
+
+	if(dmtxCoreArenaAppend(&first->text, result->message, (size_t)result->messageSize) != DmtxPass)
+		return 0;
+	first->messageSize = result->messageSize;
+	memcpy(first->corners, result->corners, sizeof(first->corners));
+	first->found = 1;
+	return 0;
+}
+
+// libdmtx packing of the pixels of imageRef as they are stored, or
+// DmtxUndefined if they have to be drawn into a bitmap context first.
+// Unpremultiplied alpha is left to CoreGraphics, which premultiplies it.
+static int SHPackingOfImage(CGImageRef imageRef) {
+	if(CGImageGetBitsPerComponent(imageRef) != 8)
+		return DmtxUndefined;
+
+	size_t bitsPerPixel = CGImageGetBitsPerPixel(imageRef);
+	CGColorSpaceModel model = CGColorSpaceGetModel(CGImageGetColorSpace(imageRef));
+	CGImageAlphaInfo alpha = CGImageGetAlphaInfo(imageRef);
+	CGBitmapInfo byteOrder = CGImageGetBitmapInfo(imageRef) & kCGBitmapByteOrderMask;
+	BOOL little = byteOrder == kCGBitmapByteOrder32Little;
+
+	if(byteOrder != kCGBitmapByteOrderDefault && byteOrder != kCGBitmapByteOrder32Big && !little)
+		return DmtxUndefined;
+	if(model == kCGColorSpaceModelMonochrome && bitsPerPixel == 8 && alpha == kCGImageAlphaNone)
+		return DmtxPack8bppK;
+	if(model != kCGColorSpaceModelRGB)
+		return DmtxUndefined;
+	if(bitsPerPixel == 24 && alpha == kCGImageAlphaNone && !little)
+		return DmtxPack24bppRGB;
+	if(bitsPerPixel != 32)
+		return DmtxUndefined;
+	if(alpha == kCGImageAlphaPremultipliedFirst || alpha == kCGImageAlphaNoneSkipFirst)
+		return little ? DmtxPack32bppBGRX : DmtxPack32bppXRGB;
+	if(alpha == kCGImageAlphaPremultipliedLast || alpha == kCGImageAlphaNoneSkipLast)
+		return little ? DmtxPack32bppXBGR : DmtxPack32bppRGBX;
+	return DmtxUndefined;
+}
+
 @implementation SHDataMatrixReader
 
+@synthesize scanRect = _scanRect;
+@synthesize maxImageSize = _maxImageSize;
+@synthesize shrink = _shrink;
+
 #pragma mark Allocation
 
 + (id)sharedDataMatrixReader {
@@ -49,7 +132,17 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 - (id)init {
 	self = [super init];
 	if(self != nil) {
-
+		_scanRect = CGRectNull;
+		_maxImageSize = 500;
+		_shrink = 1;
+		_decodeState = calloc(1, sizeof(SHDecodeState));
+		if(_decodeState == NULL) {
+#if ! __has_feature(objc_arc)
+			[self release];
+#endif
+			return nil;
+		}
+		dmtxProfileInit(&((SHDecodeState *)_decodeState)->profile, DmtxProfileDefault);
 	}
 	return self;
 }
@@ -60,134 +153,348 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 #else
 - (NSString *)decodeBarcodeFromImage:(NSImage *)image {
 #endif
+	return [self decodeBarcodeFromImage:image near:NULL corners:NULL];
+}
 
-	NSMutableArray *messages = [NSMutableArray array];
-
-    NSData * imageData = [self _ARGB8DataForImage:image];
-	// Create dmtx image.
-	DmtxImage *dmtxImage = dmtxImageCreate((unsigned char*)[imageData bytes], 500, 500, DmtxPack32bppXRGB);
-	if(dmtxImage == NULL)
-    {
-#if ! __has_feature(objc_arc)
-        [imageData release];
+#if TARGET_OS_IPHONE
+- (NSString *)decodeBarcodeFromImage:(UIImage *)image near:(const CGPoint *)previous corners:(CGPoint *)corners {
+#else
+- (NSString *)decodeBarcodeFromImage:(NSImage *)image near:(const CGPoint *)previous corners:(CGPoint *)corners {
 #endif
+	@synchronized(self) {
+		int width, height, packing;
+		const unsigned char *pixels = [self _pixelsForImage:image width:&width height:&height packing:&packing];
+		if(pixels == NULL)
+			return nil;
+
+		return [self _decodePixels:pixels width:width height:height
+				bytesPerRow:width * (packing == DmtxPack8bppK ? 1 : 4) packing:packing near:previous corners:corners];
+	}
+}
+
+- (NSString *)decodeBarcodeFromPixelBuffer:(CVPixelBufferRef)pixelBuffer near:(const CGPoint *)previous corners:(CGPoint *)corners {
+	int packing;
+	switch(CVPixelBufferGetPixelFormatType(pixelBuffer)) {
+		case kCVPixelFormatType_420YpCbCr8BiPlanarVideoRange:
+		case kCVPixelFormatType_420YpCbCr8BiPlanarFullRange:
+		case kCVPixelFormatType_OneComponent8:
+			packing = DmtxPack8bppK;
+			break;
+		case kCVPixelFormatType_32BGRA:
+			packing = DmtxPack32bppBGRX;
+			break;
+		default:
+			return nil;
+	}
+
+	if(CVPixelBufferLockBaseAddress(pixelBuffer, kCVPixelBufferLock_ReadOnly) != kCVReturnSuccess)
 		return nil;
-    }
 
-	// Initialize dmtx decode struct for image.
-	DmtxDecode *dmtxDecode = dmtxDecodeCreate(dmtxImage, 1);
+	NSString *message = nil;
+	@synchronized(self) {
+		// The luma plane comes first in the bi-planar formats.
+		const unsigned char *pixels;
+		int width, height, bytesPerRow;
+		if(CVPixelBufferIsPlanar(pixelBuffer)) {
+			pixels = (const unsigned char *)CVPixelBufferGetBaseAddressOfPlane(pixelBuffer, 0);
+			width = (int)CVPixelBufferGetWidthOfPlane(pixelBuffer, 0);
+			height = (int)CVPixelBufferGetHeightOfPlane(pixelBuffer, 0);
+			bytesPerRow = (int)CVPixelBufferGetBytesPerRowOfPlane(pixelBuffer, 0);
+		} else {
+			pixels = (const unsigned char *)CVPixelBufferGetBaseAddress(pixelBuffer);
+			width = (int)CVPixelBufferGetWidth(pixelBuffer);
+			height = (int)CVPixelBufferGetHeight(pixelBuffer);
+			bytesPerRow = (int)CVPixelBufferGetBytesPerRow(pixelBuffer);
+		}
 
-	DmtxRegion *dmtxRegion;
-	DmtxMessage *dmtxMessage;
+		if(pixels != NULL)
+			message = [self _decodePixels:pixels width:width height:height bytesPerRow:bytesPerRow
+					packing:packing near:previous corners:corners];
+	}
 
-	// Loop once for each detected barcode region.
-	NSUInteger count;
-	for(count = 0; count < 1; count++) {
+	CVPixelBufferUnlockBaseAddress(pixelBuffer, kCVPixelBufferLock_ReadOnly);
 
-		// Find next barcode region within image.
-		dmtxRegion = dmtxRegionFindNext(dmtxDecode, NULL);
-		if(dmtxRegion == NULL)
-			break;
+	return message;
+}
 
-		// Decode region based on requested scan mode.
-		dmtxMessage = dmtxDecodeMatrixRegion(dmtxDecode, dmtxRegion, DmtxUndefined);
+- (void)useProfile:(SHDataMatrixProfile)profile {
+	@synchronized(self) {
+		SHDecodeState *state = (SHDecodeState *)_decodeState;
+		if(dmtxProfileInit(&state->profile, (int)profile) != DmtxPass)
+			dmtxProfileInit(&state->profile, DmtxProfileDefault);
+		// The next decode rebuilds the decode state with the new settings.
+		dmtxCoreDecoderClear(&state->decoder);
+	}
+}
 
-		if(dmtxMessage != NULL) {
-			// Convert C string to NSString.
-            NSString *message = [[NSString alloc] initWithBytes:dmtxMessage->output length:(NSUInteger)dmtxMessage->outputIdx encoding:NSASCIIStringEncoding];
-			[messages addObject:message];
+- (NSDictionary *)calibrateWithImages:(NSArray *)images {
+	NSUInteger count = [images count];
+	if(count == 0)
+		return nil;
 
-			// Free dmtx message memory.
-			dmtxMessageDestroy(&dmtxMessage);
+	@synchronized(self) {
+		SHDecodeState *state = (SHDecodeState *)_decodeState;
+		DmtxImage **samples = (DmtxImage **)calloc(count, sizeof(DmtxImage *));
+		if(samples == NULL)
+			return nil;
+
+		// The drawing buffer is reused by every image, so each sample keeps
+		// a copy of its pixels.
+		NSUInteger i;
+		for(i = 0; i < count; i++) {
+			int width, height, packing;
+			const unsigned char *pixels = [self _pixelsForImage:[images objectAtIndex:i]
+					width:&width height:&height packing:&packing];
+			if(pixels == NULL)
+				break;
+
+			size_t size = (size_t)width * (size_t)height * (packing == DmtxPack8bppK ? 1 : 4);
+			unsigned char *copy = (unsigned char *)malloc(size);
+			if(copy == NULL)
+				break;
+			memcpy(copy, pixels, size);
+
+			samples[i] = dmtxImageCreate(copy, width, height, packing);
+			if(samples[i] == NULL) {
+				free(copy);
+				break;
+			}
 		}
 
-		dmtxRegionDestroy(&dmtxRegion);
+		DmtxCalibration calib;
+		DmtxProfile start = state->profile;
+		start.shrink = _shrink > 1 ? (int)_shrink : DmtxUndefined;
+		BOOL found = (i == count && dmtxProfileCalibrate(&calib, samples, (int)count, &start, DmtxUndefined) == DmtxPass);
 
-		break;
+		for(i = 0; i < count && samples[i] != NULL; i++) {
+			free(samples[i]->pxl);
+			dmtxImageDestroy(&samples[i]);
+		}
+		free(samples);
+
+		if(!found)
+			return nil;
+
+		// The reader shrinks frames itself, so the profile is applied to
+		// decodes of the shrunk pixels.
+		_shrink = (NSUInteger)dmtxProfileGetShrink(&calib.profile);
+		calib.profile.shrink = DmtxUndefined;
+		state->profile = calib.profile;
+		dmtxCoreDecoderClear(&state->decoder);
+
+		return [NSDictionary dictionaryWithObjectsAndKeys:
+				[NSNumber numberWithInt:calib.symbolCount], @"symbols",
+				[NSNumber numberWithDouble:calib.defaultMs], @"defaultMilliseconds",
+				[NSNumber numberWithDouble:calib.profileMs], @"profileMilliseconds",
+				[NSNumber numberWithDouble:calib.speedup], @"speedup",
+				[NSNumber numberWithUnsignedInteger:_shrink], @"shrink",
+				nil];
 	}
+}
 
-	// Free dmtx decode memory.
-	dmtxDecodeDestroy(&dmtxDecode);
-
-	// Free dmtx image memory.
-	dmtxImageDestroy(&dmtxImage);
+- (NSString *)_decodePixels:(const unsigned char *)pixels width:(int)width height:(int)height bytesPerRow:(int)bytesPerRow packing:(int)packing near:(const CGPoint *)previous corners:(CGPoint *)corners {
+	int shrink = _shrink > 1 ? (int)_shrink : 1;
+
+	// Shrunk decodes read a luma copy of the pixels libdmtx would sample,
+	// one byte per pixel in a buffer a fraction of the size of the frame.
+	if(shrink > 1 && width >= shrink && height >= shrink) {
+		int lumaWidth = width / shrink;
+		int lumaHeight = height / shrink;
+		NSUInteger lumaSize = (NSUInteger)lumaWidth * (NSUInteger)lumaHeight;
+		if(_lumaData == nil)
+			_lumaData = [[NSMutableData alloc] initWithLength:lumaSize];
+		else if([_lumaData length] < lumaSize)
+			[_lumaData setLength:lumaSize];
+
+		if(_lumaData != nil && dmtxConvertShrink((unsigned char *)[_lumaData mutableBytes], lumaWidth,
+				pixels, bytesPerRow, width, height, packing, shrink, DmtxFlipNone) == DmtxPass) {
+			pixels = (const unsigned char *)[_lumaData bytes];
+			width = lumaWidth;
+			height = lumaHeight;
+			bytesPerRow = lumaWidth;
+			packing = DmtxPack8bppK;
+			shrink = 1;
+		}
+	}
 
-	if([messages count] > 0)
-		return [messages objectAtIndex:0];
-	else
+	SHDecodeState *state = (SHDecodeState *)_decodeState;
+	if(dmtxCoreDecoderPrepare(&state->decoder, (unsigned char *)pixels, width, height, bytesPerRow, packing, shrink) != DmtxPass)
 		return nil;
+	if(state->decoder.fresh)
+		dmtxProfileApply(state->decoder.decode, &state->profile);
+
+	CGRect scanRect = CGRectIsNull(_scanRect) ? CGRectMake(0.0f, 0.0f, 1.0f, 1.0f) : _scanRect;
+	SHScanResult first;
+	memset(&first, 0x00, sizeof(first));
+
+	// Regions whose message does not decode are skipped.
+	DmtxCoreScan scan;
+	dmtxCoreScanInit(&scan);
+	scan.maxCount = 1;
+	scan.result = SHScanResultFound;
+	scan.resultContext = &first;
+	dmtxCoreScanStart(&scan);
+
+	if(SHSetScanRect(state->decoder.decode, scanRect, width, height) == DmtxPass) {
+		// Look around the previous position first, allowing the barcode to
+		// move by half its size. Pixels tried there stay marked in the scan
+		// cache, so the full scan after a miss does not repeat them.
+		if(previous != NULL) {
+			int near[8];
+			NSUInteger i;
+			for(i = 0; i < 4; i++) {
+				near[2 * i] = (int)(previous[i].x * width);
+				near[2 * i + 1] = (int)(previous[i].y * height);
+			}
+			dmtxCoreScanNear(&scan, state->decoder.decode, near, -1);
+		}
+
+		if(!first.found && !scan.stopped)
+			dmtxCoreDecoderScan(&state->decoder, &scan);
+	}
+
+	NSString *message = nil;
+	if(first.found) {
+		// Convert C string to NSString.
+		message = [[NSString alloc] initWithBytes:first.text.data length:(NSUInteger)first.messageSize encoding:NSASCIIStringEncoding];
+#if ! __has_feature(objc_arc)
+		[message autorelease];
+#endif
+
+		// Corners are in pixels of the image, rows counted from the top.
+		if(corners != NULL) {
+			NSUInteger i;
+			for(i = 0; i < 4; i++)
+				corners[i] = CGPointMake((CGFloat)first.corners[2 * i] / width,
+						(CGFloat)first.corners[2 * i + 1] / height);
+		}
+	}
+
+	dmtxCoreArenaFree(&first.text);
+	dmtxCoreScanFree(&scan);
+
+	// The pixels are only borrowed for this call.
+	state->decoder.image->pxl = NULL;
+
+	return message;
 }
 
+// Draw image into the reused pixel buffer handed to libdmtx, scaled down to
+// maxImageSize. Grayscale images are drawn into an 8 bit gray context, a
+// quarter of the size of ARGB, since libdmtx would only reduce them to one
+// channel again. Images that keep their size and are stored in a layout
+// libdmtx knows are converted to luma from their data instead of drawn.
 #if TARGET_OS_IPHONE
-- (NSData *)_ARGB8DataForImage:(UIImage *)image {
+- (const unsigned char *)_pixelsForImage:(UIImage *)image width:(int *)width height:(int *)height packing:(int *)packing {
 #else
-- (NSData *)_ARGB8DataForImage:(NSImage *)image {
+- (const unsigned char *)_pixelsForImage:(NSImage *)image width:(int *)width height:(int *)height packing:(int *)packing {
 #endif
 
 #if TARGET_OS_IPHONE
 	// We have to deal with a CGImage.
 	CGImageRef imageRef = image.CGImage;
 #else
-	CGImageRef imageRef = [[[NSBitmapImageRep alloc] initWithData:[image TIFFRepresentation]] CGImage];
+	NSBitmapImageRep *imageRep = [[NSBitmapImageRep alloc] initWithData:[image TIFFRepresentation]];
+#if ! __has_feature(objc_arc)
+	[imageRep autorelease];
 #endif
-
-	// Calculate image dimensions (500 pixel should be enough for decoding).
-	NSUInteger aspectRatio = CGImageGetWidth(imageRef) / CGImageGetHeight(imageRef);
-	NSUInteger width = 500;
-	NSUInteger height = 500 / aspectRatio;
-	NSUInteger bytesPerRow = width * 4;
-
-	// Create color space object.
-	CGColorSpaceRef colorSpaceRef = CGColorSpaceCreateDeviceRGB();
-	if(colorSpaceRef == NULL)
+	CGImageRef imageRef = [imageRep CGImage];
+#endif
+	if(imageRef == NULL)
 		return NULL;
 
-	// Create context memory.
-	void *memory = malloc(bytesPerRow * height);
-	if(memory == NULL) {
-		CGColorSpaceRelease(colorSpaceRef);
+	// Calculate image dimensions, keeping the aspect ratio.
+	size_t imageWidth = CGImageGetWidth(imageRef);
+	size_t imageHeight = CGImageGetHeight(imageRef);
+	if(imageWidth == 0 || imageHeight == 0)
 		return NULL;
+	if(_maxImageSize > 0 && imageWidth >= imageHeight && imageWidth > _maxImageSize) {
+		imageHeight = imageHeight * _maxImageSize / imageWidth;
+		imageWidth = _maxImageSize;
+	} else if(_maxImageSize > 0 && imageHeight > imageWidth && imageHeight > _maxImageSize) {
+		imageWidth = imageWidth * _maxImageSize / imageHeight;
+		imageHeight = _maxImageSize;
+	}
+	if(imageWidth == 0) imageWidth = 1;
+	if(imageHeight == 0) imageHeight = 1;
+
+	CFDataRef sourceData = NULL;
+	size_t sourceBytesPerRow = CGImageGetBytesPerRow(imageRef);
+	int sourcePacking = DmtxUndefined;
+	if(imageWidth == CGImageGetWidth(imageRef) && imageHeight == CGImageGetHeight(imageRef))
+		sourcePacking = SHPackingOfImage(imageRef);
+	if(sourcePacking != DmtxUndefined)
+		sourceData = CGDataProviderCopyData(CGImageGetDataProvider(imageRef));
+	if(sourceData != NULL && (size_t)CFDataGetLength(sourceData) < sourceBytesPerRow * imageHeight) {
+		CFRelease(sourceData);
+		sourceData = NULL;
 	}
 
-	// Create bitmap context.
-	CGContextRef contextRef = CGBitmapContextCreate(memory, width, height, 8,
-			bytesPerRow, colorSpaceRef, kCGImageAlphaPremultipliedFirst);
-	if(contextRef == NULL) {
-		CGColorSpaceRelease(colorSpaceRef);
-		free(memory);
+	BOOL gray = sourceData != NULL || CGColorSpaceGetModel(CGImageGetColorSpace(imageRef)) == kCGColorSpaceModelMonochrome;
+	NSUInteger bytesPerPixel = gray ? 1 : 4;
+	NSUInteger bytesPerRow = imageWidth * bytesPerPixel;
+
+	// Grow the buffer kept from the previous image if needed.
+	if(_pixelData == nil)
+		_pixelData = [[NSMutableData alloc] initWithLength:bytesPerRow * imageHeight];
+	else if([_pixelData length] < bytesPerRow * imageHeight)
+		[_pixelData setLength:bytesPerRow * imageHeight];
+	if(_pixelData == nil) {
+		if(sourceData != NULL)
+			CFRelease(sourceData);
 		return NULL;
 	}
 
+	if(sourceData != NULL) {
+		unsigned char *data = (unsigned char *)[_pixelData mutableBytes];
+		dmtxConvertToLuma(data, (int)bytesPerRow, CFDataGetBytePtr(sourceData), (int)sourceBytesPerRow,
+				(int)imageWidth, (int)imageHeight, sourcePacking, 0);
+		CFRelease(sourceData);
+
+		*width = (int)imageWidth;
+		*height = (int)imageHeight;
+		*packing = DmtxPack8bppK;
+		return data;
+	}
+
+	// Create color space object.
+	CGColorSpaceRef colorSpaceRef = gray ? CGColorSpaceCreateDeviceGray() : CGColorSpaceCreateDeviceRGB();
+	if(colorSpaceRef == NULL)
+		return NULL;
+
+	// Create bitmap context drawing straight into the buffer.
+	unsigned char *data = (unsigned char *)[_pixelData mutableBytes];
+	CGContextRef contextRef = CGBitmapContextCreate(data, imageWidth, imageHeight, 8,
+			bytesPerRow, colorSpaceRef, gray ? kCGImageAlphaNone : kCGImageAlphaPremultipliedFirst);
+
 	// Release color space object.
 	CGColorSpaceRelease(colorSpaceRef);
 
-	// Scale image to desired size.
-	CGContextDrawImage(contextRef, CGRectMake(0.0f, 0.0f, (CGFloat)width,
-			(CGFloat)height), imageRef);
-
-	// Get context data.
-	unsigned char *data = (unsigned char *)CGBitmapContextGetData(contextRef);
-	if(data == NULL) {
-		CGContextRelease(contextRef);
-		free(memory);
+	if(contextRef == NULL)
 		return NULL;
-	}
 
-    NSData * imageData = [NSData dataWithBytes:data length:width*height*4];
+	// Scale image to desired size, over what the previous image left behind.
+	CGRect rect = CGRectMake(0.0f, 0.0f, (CGFloat)imageWidth, (CGFloat)imageHeight);
+	CGContextClearRect(contextRef, rect);
+	CGContextDrawImage(contextRef, rect, imageRef);
 
 	// Release bitmap context.
 	CGContextRelease(contextRef);
 
-	// Free context memory.
-	free(memory);
-
-	return imageData;
+	*width = (int)imageWidth;
+	*height = (int)imageHeight;
+	*packing = gray ? DmtxPack8bppK : DmtxPack32bppXRGB;
+	return data;
 }
 
-#if ! __has_feature(objc_arc)
 - (void)dealloc {
-    [super dealloc];
-}
+	dmtxCoreDecoderClear(&((SHDecodeState *)_decodeState)->decoder);
+	free(_decodeState);
+#if ! __has_feature(objc_arc)
+	[_pixelData release];
+	[_lumaData release];
+	[super dealloc];
 #endif
+}
 
 @end
@@ -0,0 +1,659 @@
+/*
+libdmtx wrappers - pixel conversion shared by the wrappers
+
+Copyright (C) 2009 Mike Laughton
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+Contact: mike@dragonflylogic.com
+*/
+
+/* $Id$ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <dmtx.h>
+#include "dmtxconvert.h"
+
+#if !defined(DMTX_CONVERT_NO_SIMD) && (defined(__GNUC__) || defined(_MSC_VER))
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define DMTX_CONVERT_X86
+#include <emmintrin.h>
+#include <tmmintrin.h>
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(_M_ARM64)
+#define DMTX_CONVERT_NEON
+#include <arm_neon.h>
+#endif
+#endif
+
+/* GCC and clang only emit the instructions of a kernel where allowed to */
+#ifdef __GNUC__
+#define DMTX_TARGET(isa) __attribute__((target(isa)))
+#else
+#define DMTX_TARGET(isa)
+#endif
+
+/* BT.601 weights in 1/256, adding up to 256 so that white stays 255 */
+#define DMTX_LUMA_R  77
+#define DMTX_LUMA_G 150
+#define DMTX_LUMA_B  29
+
+/* Converts width pixels of src to luma in dst; weights holds the weight
+   of each byte of a pixel */
+typedef void (*ConvertRowFunc)(unsigned char *dst, const unsigned char *src,
+      int width, const int *weights);
+
+static void RowLuma24Scalar(unsigned char *dst, const unsigned char *src,
+      int width, const int *weights);
+static void RowLuma32Scalar(unsigned char *dst, const unsigned char *src,
+      int width, const int *weights);
+static int ConvertDetect(void);
+static void ConvertSelect(int kernel);
+static int ConvertLayout(int packing, int *weights);
+
+static int convertKernel = DmtxUndefined;
+static ConvertRowFunc rowLuma24 = RowLuma24Scalar;
+static ConvertRowFunc rowLuma32 = RowLuma32Scalar;
+
+/**
+ * Kernel used by the conversions, detected on first use
+ */
+extern int
+dmtxConvertGetKernel(void)
+{
+   /* Threads racing here all store the same values */
+   if(convertKernel == DmtxUndefined)
+      ConvertSelect(ConvertDetect());
+
+   return convertKernel;
+}
+
+/**
+ * Use kernel instead of the detected one, e.g. to compare them. Fails if
+ * it was not built or the CPU lacks its instructions.
+ */
+extern DmtxPassFail
+dmtxConvertSetKernel(int kernel)
+{
+   int best = ConvertDetect();
+
+   if(kernel < DmtxConvertScalar || kernel > best)
+      return DmtxFail;
+#ifdef DMTX_CONVERT_NEON
+   if(kernel != DmtxConvertScalar && kernel != DmtxConvertNEON)
+      return DmtxFail;
+#endif
+
+   ConvertSelect(kernel);
+   return DmtxPass;
+}
+
+extern const char *
+dmtxConvertKernelName(int kernel)
+{
+   switch(kernel) {
+      case DmtxConvertSSE2:
+         return "sse2";
+      case DmtxConvertSSSE3:
+         return "ssse3";
+      case DmtxConvertAVX2:
+         return "avx2";
+      case DmtxConvertNEON:
+         return "neon";
+      default:
+         return "scalar";
+   }
+}
+
+/**
+ * Convert width x height pixels of src, packed as packing, to 8 bit luma
+ * in dst. With flip set the last row of src becomes the first of dst.
+ * Fails for packings other than 8 bit K and 24 or 32 bit RGB.
+ */
+extern DmtxPassFail
+dmtxConvertToLuma(unsigned char *dst, int dstRowBytes,
+      const unsigned char *src, int srcRowBytes, int width, int height,
+      int packing, int flip)
+{
+   ConvertRowFunc row;
+   int weights[4];
+   int bytes, y;
+
+   bytes = ConvertLayout(packing, weights);
+   if(bytes == 1) {
+      dmtxConvertRows(dst, dstRowBytes, src, srcRowBytes, width, height, flip);
+      return DmtxPass;
+   }
+   if(bytes == 0)
+      return DmtxFail;
+
+   dmtxConvertGetKernel();
+   row = (bytes == 3) ? rowLuma24 : rowLuma32;
+
+   for(y = 0; y < height; y++)
+      row(dst + (size_t)y * dstRowBytes, src + (size_t)(flip ? height - 1 - y : y) *
+            srcRowBytes, width, weights);
+
+   return DmtxPass;
+}
+
+/**
+ * Copy height rows of rowBytes bytes from src to dst, each with its own
+ * row size, last row first if flip is set. memcpy() is already vectorized
+ * by the C library; what is left is to make one call of contiguous rows.
+ */
+extern void
+dmtxConvertRows(unsigned char *dst, int dstRowBytes,
+      const unsigned char *src, int srcRowBytes, int rowBytes, int height,
+      int flip)
+{
+   int y;
+
+   if(!flip && dstRowBytes == rowBytes && srcRowBytes == rowBytes) {
+      memcpy(dst, src, (size_t)rowBytes * height);
+      return;
+   }
+
+   for(y = 0; y < height; y++)
+      memcpy(dst + (size_t)y * dstRowBytes, src + (size_t)(flip ? height - 1 - y : y) *
+            srcRowBytes, (size_t)rowBytes);
+}
+
+/**
+ * Write the luma of the pixels libdmtx reads for dmtxDecodeCreate(img,
+ * shrink) to dst, (width / shrink) x (height / shrink) pixels. libdmtx
+ * samples every shrink-th pixel of every shrink-th row starting from its
+ * own origin, the last row unless imageFlip holds DmtxFlipY; dst has the
+ * same orientation as src. Only 1 of shrink x shrink pixels is read, so
+ * this is plain C whatever the kernel.
+ */
+extern DmtxPassFail
+dmtxConvertShrink(unsigned char *dst, int dstRowBytes,
+      const unsigned char *src, int srcRowBytes, int width, int height,
+      int packing, int shrink, int imageFlip)
+{
+   const unsigned char *row, *pxl;
+   unsigned char *out;
+   int weights[4];
+   int bytes, outWidth, outHeight, x, y, step;
+
+   if(shrink < 1)
+      return DmtxFail;
+
+   if(shrink == 1)
+      return dmtxConvertToLuma(dst, dstRowBytes, src, srcRowBytes, width,
+            height, packing, 0);
+
+   bytes = ConvertLayout(packing, weights);
+   if(bytes == 0)
+      return DmtxFail;
+
+   outWidth = width / shrink;
+   outHeight = height / shrink;
+   step = bytes * shrink;
+
+   for(y = 0; y < outHeight; y++) {
+      if(imageFlip & DmtxFlipY)
+         row = src + (size_t)y * shrink * srcRowBytes;
+      else
+         row = src + (size_t)(height - 1 - (outHeight - 1 - y) * shrink) * srcRowBytes;
+      out = dst + (size_t)y * dstRowBytes;
+
+      if(bytes == 1) {
+         for(x = 0, pxl = row; x < outWidth; x++, pxl += step)
+            out[x] = *pxl;
+      }
+      else if(bytes == 3) {
+         for(x = 0, pxl = row; x < outWidth; x++, pxl += step)
+            out[x] = (unsigned char)((weights[0] * pxl[0] + weights[1] * pxl[1] +
+                  weights[2] * pxl[2] + 128) >> 8);
+      }
+      else {
+         for(x = 0, pxl = row; x < outWidth; x++, pxl += step)
+            out[x] = (unsigned char)((weights[0] * pxl[0] + weights[1] * pxl[1] +
+                  weights[2] * pxl[2] + weights[3] * pxl[3] + 128) >> 8);
+      }
+   }
+
+   return DmtxPass;
+}
+
+/**
+ * Create an 8 bit luma image of img shrunk by shrink. Decoding it at scale
+ * 1 finds the regions dmtxDecodeCreate(img, shrink) would, in the same
+ * coordinates, while reading one byte per pixel from a buffer 1/shrink^2
+ * of the size. Returns NULL if img's packing is not supported or memory
+ * runs out; destroy the image with dmtxConvertImageDestroy().
+ */
+extern DmtxImage *
+dmtxConvertShrinkImage(DmtxImage *img, int shrink)
+{
+   DmtxImage *small;
+   unsigned char *pxl;
+   int width, height, flip;
+
+   if(img == NULL || shrink < 1)
+      return NULL;
+
+   width = dmtxImageGetProp(img, DmtxPropWidth) / shrink;
+   height = dmtxImageGetProp(img, DmtxPropHeight) / shrink;
+   flip = dmtxImageGetProp(img, DmtxPropImageFlip);
+   if(width < 1 || height < 1)
+      return NULL;
+
+   pxl = (unsigned char *)malloc((size_t)width * height);
+   if(pxl == NULL)
+      return NULL;
+
+   if(dmtxConvertShrink(pxl, width, img->pxl, dmtxImageGetProp(img, DmtxPropRowSizeBytes),
+         dmtxImageGetProp(img, DmtxPropWidth), dmtxImageGetProp(img, DmtxPropHeight),
+         dmtxImageGetProp(img, DmtxPropPixelPacking), shrink, flip) != DmtxPass) {
+      free(pxl);
+      return NULL;
+   }
+
+   small = dmtxImageCreate(pxl, width, height, DmtxPack8bppK);
+   if(small == NULL) {
+      free(pxl);
+      return NULL;
+   }
+   dmtxImageSetProp(small, DmtxPropImageFlip, flip & DmtxFlipY);
+
+   return small;
+}
+
+/**
+ * Destroy an image created by dmtxConvertShrinkImage() along with its
+ * pixels. Does nothing if *img is NULL.
+ */
+extern DmtxPassFail
+dmtxConvertImageDestroy(DmtxImage **img)
+{
+   unsigned char *pxl;
+
+   if(img == NULL || *img == NULL)
+      return DmtxFail;
+
+   pxl = (*img)->pxl;
+   dmtxImageDestroy(img);
+   free(pxl);
+
+   return DmtxPass;
+}
+
+/**
+ * Bytes per pixel of packing, with the luma weight of each of them in
+ * weights, or 0 if packing is not supported
+ */
+static int
+ConvertLayout(int packing, int *weights)
+{
+   weights[0] = weights[1] = weights[2] = weights[3] = 0;
+
+   switch(packing) {
+      case DmtxPack8bppK:
+         weights[0] = 256;
+         return 1;
+      case DmtxPack24bppRGB:
+         weights[0] = DMTX_LUMA_R;
+         weights[1] = DMTX_LUMA_G;
+         weights[2] = DMTX_LUMA_B;
+         return 3;
+      case DmtxPack24bppBGR:
+         weights[0] = DMTX_LUMA_B;
+         weights[1] = DMTX_LUMA_G;
+         weights[2] = DMTX_LUMA_R;
+         return 3;
+      case DmtxPack32bppRGBX:
+         weights[0] = DMTX_LUMA_R;
+         weights[1] = DMTX_LUMA_G;
+         weights[2] = DMTX_LUMA_B;
+         return 4;
+      case DmtxPack32bppXRGB:
+         weights[1] = DMTX_LUMA_R;
+         weights[2] = DMTX_LUMA_G;
+         weights[3] = DMTX_LUMA_B;
+         return 4;
+      case DmtxPack32bppBGRX:
+         weights[0] = DMTX_LUMA_B;
+         weights[1] = DMTX_LUMA_G;
+         weights[2] = DMTX_LUMA_R;
+         return 4;
+      case DmtxPack32bppXBGR:
+         weights[1] = DMTX_LUMA_B;
+         weights[2] = DMTX_LUMA_G;
+         weights[3] = DMTX_LUMA_R;
+         return 4;
+      default:
+         return 0;
+   }
+}
+
+static void
+RowLuma24Scalar(unsigned char *dst, const unsigned char *src, int width,
+      const int *weights)
+{
+   int x;
+
+   for(x = 0; x < width; x++, src += 3)
+      dst[x] = (unsigned char)((weights[0] * src[0] + weights[1] * src[1] +
+            weights[2] * src[2] + 128) >> 8);
+}
+
+static void
+RowLuma32Scalar(unsigned char *dst, const unsigned char *src, int width,
+      const int *weights)
+{
+   int x;
+
+   for(x = 0; x < width; x++, src += 4)
+      dst[x] = (unsigned char)((weights[0] * src[0] + weights[1] * src[1] +
+            weights[2] * src[2] + weights[3] * src[3] + 128) >> 8);
+}
+
+#ifdef DMTX_CONVERT_X86
+
+/* Luma of the 4 pixels in px, one per 32 bit lane, as 32 bit values */
+static DMTX_TARGET("sse2") __m128i
+Luma4SSE2(__m128i px, __m128i weights)
+{
+   __m128i zero = _mm_setzero_si128();
+   __m128i lo, hi, sum;
+   __m128 even, odd;
+
+   /* Weighted pairs of 2 pixels each, then the sums of their pairs */
+   lo = _mm_madd_epi16(_mm_unpacklo_epi8(px, zero), weights);
+   hi = _mm_madd_epi16(_mm_unpackhi_epi8(px, zero), weights);
+   even = _mm_shuffle_ps(_mm_castsi128_ps(lo), _mm_castsi128_ps(hi), _MM_SHUFFLE(2, 0, 2, 0));
+   odd = _mm_shuffle_ps(_mm_castsi128_ps(lo), _mm_castsi128_ps(hi), _MM_SHUFFLE(3, 1, 3, 1));
+   sum = _mm_add_epi32(_mm_castps_si128(even), _mm_castps_si128(odd));
+
+   return _mm_srli_epi32(_mm_add_epi32(sum, _mm_set1_epi32(128)), 8);
+}
+
+static DMTX_TARGET("sse2") void
+RowLuma32SSE2(unsigned char *dst, const unsigned char *src, int width,
+      const int *weights)
+{
+   __m128i w, a, b;
+   int x;
+
+   w = _mm_setr_epi16((short)weights[0], (short)weights[1], (short)weights[2],
+         (short)weights[3], (short)weights[0], (short)weights[1],
+         (short)weights[2], (short)weights[3]);
+
+   for(x = 0; x + 8 <= width; x += 8) {
+      a = Luma4SSE2(_mm_loadu_si128((const __m128i *)(src + 4 * x)), w);
+      b = Luma4SSE2(_mm_loadu_si128((const __m128i *)(src + 4 * x + 16)), w);
+      a = _mm_packs_epi32(a, b);
+      _mm_storel_epi64((__m128i *)(dst + x), _mm_packus_epi16(a, a));
+   }
+
+   RowLuma32Scalar(dst + x, src + 4 * x, width - x, weights);
+}
+
+/* Spreads 4 packed 24 bit pixels over the 32 bit lanes Luma4SSE2 takes */
+#define DMTX_SPREAD24 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1
+
+static DMTX_TARGET("ssse3") void
+RowLuma24SSSE3(unsigned char *dst, const unsigned char *src, int width,
+      const int *weights)
+{
+   __m128i w, spread, a, b;
+   int x;
+
+   w = _mm_setr_epi16((short)weights[0], (short)weights[1], (short)weights[2], 0,
+         (short)weights[0], (short)weights[1], (short)weights[2], 0);
+   spread = _mm_setr_epi8(DMTX_SPREAD24);
+
+   /* Each load of 4 pixels reads 16 bytes, 4 past them */
+   for(x = 0; x + 10 <= width; x += 8) {
+      a = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + 3 * x)), spread);
+      b = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + 3 * x + 12)), spread);
+      a = _mm_packs_epi32(Luma4SSE2(a, w), Luma4SSE2(b, w));
+      _mm_storel_epi64((__m128i *)(dst + x), _mm_packus_epi16(a, a));
+   }
+
+   RowLuma24Scalar(dst + x, src + 3 * x, width - x, weights);
+}
+
+/* Luma4SSE2 on 8 pixels, 4 in each 128 bit lane */
+static DMTX_TARGET("avx2") __m256i
+Luma8AVX2(__m256i px, __m256i weights)
+{
+   __m256i zero = _mm256_setzero_si256();
+   __m256i lo, hi, sum;
+   __m256 even, odd;
+
+   lo = _mm256_madd_epi16(_mm256_unpacklo_epi8(px, zero), weights);
+   hi = _mm256_madd_epi16(_mm256_unpackhi_epi8(px, zero), weights);
+   even = _mm256_shuffle_ps(_mm256_castsi256_ps(lo), _mm256_castsi256_ps(hi), _MM_SHUFFLE(2, 0, 2, 0));
+   odd = _mm256_shuffle_ps(_mm256_castsi256_ps(lo), _mm256_castsi256_ps(hi), _MM_SHUFFLE(3, 1, 3, 1));
+   sum = _mm256_add_epi32(_mm256_castps_si256(even), _mm256_castps_si256(odd));
+
+   return _mm256_srli_epi32(_mm256_add_epi32(sum, _mm256_set1_epi32(128)), 8);
+}
+
+/* Store the 16 luma values of a and b (pixels 0-7 and 8-15) to dst. The
+   packs work within 128 bit lanes, so each is followed by a permute that
+   puts the pixels back in order. */
+static DMTX_TARGET("avx2") void
+StoreLuma16AVX2(unsigned char *dst, __m256i a, __m256i b)
+{
+   a = _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), _MM_SHUFFLE(3, 1, 2, 0));
+   a = _mm256_permute4x64_epi64(_mm256_packus_epi16(a, a), _MM_SHUFFLE(3, 1, 2, 0));
+   _mm_storeu_si128((__m128i *)dst, _mm256_castsi256_si128(a));
+}
+
+static DMTX_TARGET("avx2") void
+RowLuma32AVX2(unsigned char *dst, const unsigned char *src, int width,
+      const int *weights)
+{
+   __m256i w, a, b;
+   int x;
+
+   w = _mm256_setr_epi16((short)weights[0], (short)weights[1], (short)weights[2],
+         (short)weights[3], (short)weights[0], (short)weights[1],
+         (short)weights[2], (short)weights[3], (short)weights[0],
+         (short)weights[1], (short)weights[2], (short)weights[3],
+         (short)weights[0], (short)weights[1], (short)weights[2],
+         (short)weights[3]);
+
+   for(x = 0; x + 16 <= width; x += 16) {
+      a = Luma8AVX2(_mm256_loadu_si256((const __m256i *)(src + 4 * x)), w);
+      b = Luma8AVX2(_mm256_loadu_si256((const __m256i *)(src + 4 * x + 32)), w);
+      StoreLuma16AVX2(dst + x, a, b);
+   }
+
+   RowLuma32SSE2(dst + x, src + 4 * x, width - x, weights);
+}
+
+/* 8 packed 24 bit pixels spread over 32 bit lanes, 4 per 128 bit lane */
+static DMTX_TARGET("avx2") __m256i
+Load24AVX2(const unsigned char *src, __m256i spread)
+{
+   __m256i px;
+
+   px = _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)src));
+   px = _mm256_inserti128_si256(px, _mm_loadu_si128((const __m128i *)(src + 12)), 1);
+
+   return _mm256_shuffle_epi8(px, spread);
+}
+
+static DMTX_TARGET("avx2") void
+RowLuma24AVX2(unsigned char *dst, const unsigned char *src, int width,
+      const int *weights)
+{
+   __m256i w, spread, a, b;
+   int x;
+
+   w = _mm256_setr_epi16((short)weights[0], (short)weights[1], (short)weights[2], 0,
+         (short)weights[0], (short)weights[1], (short)weights[2], 0,
+         (short)weights[0], (short)weights[1], (short)weights[2], 0,
+         (short)weights[0], (short)weights[1], (short)weights[2], 0);
+   spread = _mm256_setr_epi8(DMTX_SPREAD24, DMTX_SPREAD24);
+
+   /* The last load reads 4 bytes past pixel 15 */
+   for(x = 0; x + 18 <= width; x += 16) {
+      a = Luma8AVX2(Load24AVX2(src + 3 * x, spread), w);
+      b = Luma8AVX2(Load24AVX2(src + 3 * x + 24, spread), w);
+      StoreLuma16AVX2(dst + x, a, b);
+   }
+
+   RowLuma24SSSE3(dst + x, src + 3 * x, width - x, weights);
+}
+
+#endif
+
+#ifdef DMTX_CONVERT_NEON
+
+static void
+RowLuma24NEON(unsigned char *dst, const unsigned char *src, int width,
+      const int *weights)
+{
+   uint8x8_t w0, w1, w2;
+   int x;
+
+   w0 = vdup_n_u8((uint8_t)weights[0]);
+   w1 = vdup_n_u8((uint8_t)weights[1]);
+   w2 = vdup_n_u8((uint8_t)weights[2]);
+
+   for(x = 0; x + 16 <= width; x += 16) {
+      uint8x16x3_t px = vld3q_u8(src + 3 * x);
+      uint16x8_t lo, hi;
+
+      lo = vmull_u8(vget_low_u8(px.val[0]), w0);
+      lo = vmlal_u8(lo, vget_low_u8(px.val[1]), w1);
+      lo = vmlal_u8(lo, vget_low_u8(px.val[2]), w2);
+      hi = vmull_u8(vget_high_u8(px.val[0]), w0);
+      hi = vmlal_u8(hi, vget_high_u8(px.val[1]), w1);
+      hi = vmlal_u8(hi, vget_high_u8(px.val[2]), w2);
+
+      /* Rounding narrow, (sum + 128) >> 8 */
+      vst1q_u8(dst + x, vcombine_u8(vrshrn_n_u16(lo, 8), vrshrn_n_u16(hi, 8)));
+   }
+
+   RowLuma24Scalar(dst + x, src + 3 * x, width - x, weights);
+}
+
+static void
+RowLuma32NEON(unsigned char *dst, const unsigned char *src, int width,
+      const int *weights)
+{
+   uint8x8_t w0, w1, w2, w3;
+   int x;
+
+   w0 = vdup_n_u8((uint8_t)weights[0]);
+   w1 = vdup_n_u8((uint8_t)weights[1]);
+   w2 = vdup_n_u8((uint8_t)weights[2]);
+   w3 = vdup_n_u8((uint8_t)weights[3]);
+
+   for(x = 0; x + 16 <= width; x += 16) {
+      uint8x16x4_t px = vld4q_u8(src + 4 * x);
+      uint16x8_t lo, hi;
+
+      lo = vmull_u8(vget_low_u8(px.val[0]), w0);
+      lo = vmlal_u8(lo, vget_low_u8(px.val[1]), w1);
+      lo = vmlal_u8(lo, vget_low_u8(px.val[2]), w2);
+      lo = vmlal_u8(lo, vget_low_u8(px.val[3]), w3);
+      hi = vmull_u8(vget_high_u8(px.val[0]), w0);
+      hi = vmlal_u8(hi, vget_high_u8(px.val[1]), w1);
+      hi = vmlal_u8(hi, vget_high_u8(px.val[2]), w2);
+      hi = vmlal_u8(hi, vget_high_u8(px.val[3]), w3);
+
+      vst1q_u8(dst + x, vcombine_u8(vrshrn_n_u16(lo, 8), vrshrn_n_u16(hi, 8)));
+   }
+
+   RowLuma32Scalar(dst + x, src + 4 * x, width - x, weights);
+}
+
+#endif
+
+/**
+ * Best kernel built that the CPU can run
+ */
+static int
+ConvertDetect(void)
+{
+#if defined(DMTX_CONVERT_X86) && defined(_MSC_VER)
+   int info[4], maxLeaf;
+
+   __cpuid(info, 0);
+   maxLeaf = info[0];
+   __cpuid(info, 1);
+
+   /* AVX2 also needs AVX state to be saved by the OS (OSXSAVE, XCR0) */
+   if(maxLeaf >= 7 && (info[2] & (1 << 27)) && (info[2] & (1 << 28)) &&
+         (_xgetbv(0) & 6) == 6) {
+      int ext[4];
+      __cpuidex(ext, 7, 0);
+      if(ext[1] & (1 << 5))
+         return DmtxConvertAVX2;
+   }
+   if(info[2] & (1 << 9))
+      return DmtxConvertSSSE3;
+   if(info[3] & (1 << 26))
+      return DmtxConvertSSE2;
+#elif defined(DMTX_CONVERT_X86)
+   __builtin_cpu_init();
+   if(__builtin_cpu_supports("avx2"))
+      return DmtxConvertAVX2;
+   if(__builtin_cpu_supports("ssse3"))
+      return DmtxConvertSSSE3;
+   if(__builtin_cpu_supports("sse2"))
+      return DmtxConvertSSE2;
+#elif defined(DMTX_CONVERT_NEON)
+   return DmtxConvertNEON;
+#endif
+   return DmtxConvertScalar;
+}
+
+static void
+ConvertSelect(int kernel)
+{
+   switch(kernel) {
+#ifdef DMTX_CONVERT_X86
+      case DmtxConvertAVX2:
+         rowLuma24 = RowLuma24AVX2;
+         rowLuma32 = RowLuma32AVX2;
+         break;
+      case DmtxConvertSSSE3:
+         rowLuma24 = RowLuma24SSSE3;
+         rowLuma32 = RowLuma32SSE2;
+         break;
+      case DmtxConvertSSE2:
+         rowLuma24 = RowLuma24Scalar;
+         rowLuma32 = RowLuma32SSE2;
+         break;
+#endif
+#ifdef DMTX_CONVERT_NEON
+      case DmtxConvertNEON:
+         rowLuma24 = RowLuma24NEON;
+         rowLuma32 = RowLuma32NEON;
+         break;
+#endif
+      default:
+         kernel = DmtxConvertScalar;
+         rowLuma24 = RowLuma24Scalar;
+         rowLuma32 = RowLuma32Scalar;
+         break;
+   }
+
+   convertKernel = kernel;
+}
@@ -0,0 +1,75 @@
+/*
+libdmtx wrappers - pixel conversion shared by the wrappers
+
+Copyright (C) 2009 Mike Laughton
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+Contact: mike@dragonflylogic.com
+*/
+
+/* $Id$ */
+
+/**
+ * The wrappers hand libdmtx whatever pixels their platform provides. These
+ * helpers adapt them where a copy is made anyway: 24 and 32 bit RGB in any
+ * byte order to 8 bit luma, row flips and stride changes, and the shrunk
+ * image libdmtx would sample for dmtxDecodeCreate(img, shrink).
+ *
+ * Luma rows are converted by SSE2, SSSE3 or AVX2 kernels on x86 and by
+ * NEON kernels on ARM, picked once at run time from the features of the
+ * CPU. Every kernel gives the same result as the plain C one, which is
+ * all that is built when DMTX_CONVERT_NO_SIMD is defined.
+ */
+
+#ifndef __DMTXCONVERT_H__
+#define __DMTXCONVERT_H__
+
+#include <dmtx.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+   DmtxConvertScalar,
+   DmtxConvertSSE2,
+   DmtxConvertSSSE3,
+   DmtxConvertAVX2,
+   DmtxConvertNEON
+} DmtxConvertKernel;
+
+extern int dmtxConvertGetKernel(void);
+extern DmtxPassFail dmtxConvertSetKernel(int kernel);
+extern const char *dmtxConvertKernelName(int kernel);
+
+extern DmtxPassFail dmtxConvertToLuma(unsigned char *dst, int dstRowBytes,
+      const unsigned char *src, int srcRowBytes, int width, int height,
+      int packing, int flip);
+extern void dmtxConvertRows(unsigned char *dst, int dstRowBytes,
+      const unsigned char *src, int srcRowBytes, int rowBytes, int height,
+      int flip);
+extern DmtxPassFail dmtxConvertShrink(unsigned char *dst, int dstRowBytes,
+      const unsigned char *src, int srcRowBytes, int width, int height,
+      int packing, int shrink, int imageFlip);
+
+extern DmtxImage *dmtxConvertShrinkImage(DmtxImage *img, int shrink);
+extern DmtxPassFail dmtxConvertImageDestroy(DmtxImage **img);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
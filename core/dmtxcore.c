@@ -0,0 +1,1243 @@
+/*
+libdmtx wrappers - decode loop shared by the wrappers
+
+Copyright (C) 2009 Mike Laughton
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+Contact: mike@dragonflylogic.com
+*/
+
+/* $Id$ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#ifdef _WIN32
+#include <windows.h>
+#include <process.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/time.h>
+#endif
+#include <dmtx.h>
+#include "../convert/dmtxconvert.h"
+#include "dmtxcore.h"
+
+/* Tiled scans use at most this many threads */
+#define DMTX_CORE_THREADS_MAX  64
+
+/* Seed margin around tiles when neither the scan nor the edge maximum
+   give one */
+#define DMTX_CORE_OVERLAP      32
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#ifdef _WIN32
+typedef CRITICAL_SECTION CoreMutex;
+typedef HANDLE CoreThread;
+#else
+typedef pthread_mutex_t CoreMutex;
+typedef pthread_t CoreThread;
+#endif
+
+/* A result of a tiled scan; its message is kept at offset of the job's
+   text until the results are handed over */
+typedef struct {
+   DmtxCoreResult result;
+   size_t offset;
+} CoreTileRecord;
+
+/* Work shared by the threads of a tiled scan. Tiles are handed out
+   through nextTile, results collected under lock. */
+typedef struct {
+   DmtxCoreScan *scan;
+   int tileCols;
+   int tileCount;
+   int tileWidth;
+   int tileHeight;
+   int overlap;
+   int bounds[4];
+   int nextTile;
+   int recordCount;
+   volatile int stop;
+   CoreMutex lock;
+   DmtxCoreArena records;
+   DmtxCoreArena text;
+} CoreTileJob;
+
+/* One thread of a tiled scan; worker 0 is the calling thread */
+typedef struct {
+   CoreTileJob *job;
+   DmtxDecode *dec;
+   int index;
+   DmtxCoreStats stats;
+   DmtxCoreArena text;
+} CoreWorker;
+
+static void CoreMutexInit(CoreMutex *mutex);
+static void CoreMutexDestroy(CoreMutex *mutex);
+static void CoreMutexLock(CoreMutex *mutex);
+static void CoreMutexUnlock(CoreMutex *mutex);
+static DmtxPassFail CoreThreadStart(CoreThread *thread, CoreWorker *worker);
+static void CoreThreadJoin(CoreThread thread);
+static void CoreCorners(DmtxRegion *reg, int scale, int height, int *corners);
+static void CoreClearCache(DmtxDecode *dec);
+static DmtxRegion *CoreFind(DmtxCoreScan *scan, DmtxDecode *dec,
+      DmtxCoreCancelFunc cancel, volatile int *stop, DmtxCoreStats *stats);
+static DmtxPassFail CoreRead(DmtxCoreScan *scan, DmtxDecode *dec,
+      DmtxRegion *reg, DmtxCoreArena *text, DmtxCoreStats *stats,
+      DmtxCoreResult *result);
+static int CoreDeliver(DmtxCoreScan *scan, const DmtxCoreResult *result);
+static DmtxPassFail CoreScanSerial(DmtxCoreScan *scan, DmtxDecode *dec);
+static DmtxPassFail CoreScanPyramid(DmtxCoreScan *scan, DmtxDecode *dec,
+      int ratio);
+static DmtxPassFail CoreScanTiles(DmtxCoreScan *scan, DmtxDecode *dec,
+      DmtxCoreDecoder *pool);
+static void CoreTileWork(CoreWorker *worker);
+static void CoreTileAdd(CoreWorker *worker, DmtxRegion *reg,
+      DmtxCoreResult *result);
+static DmtxPassFail CoreScan(DmtxCoreScan *scan, DmtxDecode *dec,
+      DmtxCoreDecoder *pool);
+
+/**
+ * Microseconds from an arbitrary origin, for timing decode stages.
+ * Windows' system time only moves every few milliseconds, so the
+ * performance counter is used there.
+ */
+extern double
+dmtxCoreClock(void)
+{
+#ifdef _WIN32
+   LARGE_INTEGER now, frequency;
+
+   QueryPerformanceCounter(&now);
+   QueryPerformanceFrequency(&frequency);
+   return (double)now.QuadPart * 1000000.0 / (double)frequency.QuadPart;
+#else
+   struct timeval now;
+
+   gettimeofday(&now, NULL);
+   return (double)now.tv_sec * 1000000.0 + (double)now.tv_usec;
+#endif
+}
+
+/**
+ * Add the times and counters of part to total
+ */
+extern void
+dmtxCoreStatsAdd(DmtxCoreStats *total, const DmtxCoreStats *part)
+{
+   total->setupUs += part->setupUs;
+   total->searchUs += part->searchUs;
+   total->decodeUs += part->decodeUs;
+   total->marshalUs += part->marshalUs;
+   total->regionsExamined += part->regionsExamined;
+   total->regionsRejected += part->regionsRejected;
+   total->bytesCopied += part->bytesCopied;
+}
+
+/**
+ * Number of threads for a threads setting, 0 meaning one per processor
+ */
+extern int
+dmtxCoreThreadCount(int threads)
+{
+   if(threads == 0) {
+#ifdef _WIN32
+      SYSTEM_INFO info;
+
+      GetSystemInfo(&info);
+      threads = (int)info.dwNumberOfProcessors;
+#else
+      threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+   }
+
+   if(threads < 1)
+      return 1;
+
+   return (threads > DMTX_CORE_THREADS_MAX) ? DMTX_CORE_THREADS_MAX : threads;
+}
+
+/**
+ * Bytes per pixel of the packings dmtxImageCreate() supports, 0 for the
+ * others
+ */
+extern int
+dmtxCoreBytesPerPixel(int packing)
+{
+   switch(packing) {
+      case DmtxPack8bppK:
+         return 1;
+      case DmtxPack24bppRGB:
+      case DmtxPack24bppBGR:
+      case DmtxPack24bppYCbCr:
+         return 3;
+      case DmtxPack32bppRGBX:
+      case DmtxPack32bppXRGB:
+      case DmtxPack32bppBGRX:
+      case DmtxPack32bppXBGR:
+      case DmtxPack32bppCMYK:
+         return 4;
+   }
+
+   return 0;
+}
+
+/**
+ * Append count bytes to arena, doubling its allocation as needed
+ */
+extern DmtxPassFail
+dmtxCoreArenaAppend(DmtxCoreArena *arena, const void *bytes, size_t count)
+{
+   size_t alloc;
+   unsigned char *data;
+
+   if(arena->size + count > arena->alloc) {
+      alloc = (arena->alloc == 0) ? 1024 : arena->alloc;
+      while(alloc < arena->size + count)
+         alloc *= 2;
+
+      data = (unsigned char *)realloc(arena->data, alloc);
+      if(data == NULL)
+         return DmtxFail;
+
+      arena->data = data;
+      arena->alloc = alloc;
+   }
+
+   if(count > 0)
+      memcpy(arena->data + arena->size, bytes, count);
+   arena->size += count;
+
+   return DmtxPass;
+}
+
+extern void
+dmtxCoreArenaFree(DmtxCoreArena *arena)
+{
+   free(arena->data);
+   memset(arena, 0x00, sizeof(DmtxCoreArena));
+}
+
+/**
+ * Restrict the scan grid of dec to x0..x1, y0..y1. The lower bounds are
+ * reset first so that libdmtx never sees a minimum above the maximum.
+ * Setting the bounds also rebuilds the scan grid.
+ */
+extern DmtxPassFail
+dmtxCoreSetBounds(DmtxDecode *dec, int x0, int x1, int y0, int y1)
+{
+   if(dmtxDecodeSetProp(dec, DmtxPropXmin, 0) != DmtxPass ||
+         dmtxDecodeSetProp(dec, DmtxPropYmin, 0) != DmtxPass ||
+         dmtxDecodeSetProp(dec, DmtxPropXmax, x1) != DmtxPass ||
+         dmtxDecodeSetProp(dec, DmtxPropYmax, y1) != DmtxPass ||
+         dmtxDecodeSetProp(dec, DmtxPropXmin, x0) != DmtxPass ||
+         dmtxDecodeSetProp(dec, DmtxPropYmin, y0) != DmtxPass)
+      return DmtxFail;
+
+   return DmtxPass;
+}
+
+/**
+ * Store the scan bounds of dec as x0, x1, y0, y1
+ */
+extern void
+dmtxCoreGetBounds(DmtxDecode *dec, int *bounds)
+{
+   bounds[0] = dmtxDecodeGetProp(dec, DmtxPropXmin);
+   bounds[1] = dmtxDecodeGetProp(dec, DmtxPropXmax);
+   bounds[2] = dmtxDecodeGetProp(dec, DmtxPropYmin);
+   bounds[3] = dmtxDecodeGetProp(dec, DmtxPropYmax);
+}
+
+/**
+ * Restrict the scan to the image pixels xMin..xMax, yMin..yMax (inclusive,
+ * rows counted from the top), clipped to the image. Fails if less than 3
+ * pixels of the image are left across.
+ */
+extern DmtxPassFail
+dmtxCoreSetImageBounds(DmtxDecode *dec, int xMin, int xMax, int yMin,
+      int yMax)
+{
+   int height = dmtxImageGetProp(dec->image, DmtxPropHeight);
+   int scale = dmtxDecodeGetProp(dec, DmtxPropScale);
+   int x0, x1, y0, y1;
+
+   x0 = (xMin > 0) ? xMin / scale : 0;
+   x1 = xMax / scale;
+   y0 = (height - 1 - yMax > 0) ? (height - 1 - yMax) / scale : 0;
+   y1 = (height - 1 - yMin) / scale;
+
+   if(x1 > dmtxDecodeGetProp(dec, DmtxPropWidth) - 1)
+      x1 = dmtxDecodeGetProp(dec, DmtxPropWidth) - 1;
+   if(y1 > dmtxDecodeGetProp(dec, DmtxPropHeight) - 1)
+      y1 = dmtxDecodeGetProp(dec, DmtxPropHeight) - 1;
+
+   if(x1 - x0 < 2 || y1 - y0 < 2)
+      return DmtxFail;
+
+   return dmtxCoreSetBounds(dec, x0, x1, y0, y1);
+}
+
+/**
+ * Scan bounds around corners (as returned in DmtxCoreResult), grown by
+ * padding image pixels on every side, or by half the size of the symbol
+ * if padding is negative, and clipped to the current bounds of dec. Fails
+ * if less than 3 pixels are left across.
+ */
+extern DmtxPassFail
+dmtxCoreNearBounds(DmtxDecode *dec, const int *corners, int padding,
+      int *bounds)
+{
+   int height = dmtxImageGetProp(dec->image, DmtxPropHeight);
+   int scale = dmtxDecodeGetProp(dec, DmtxPropScale);
+   int limits[4];
+   int left, right, top, bottom;
+   int i;
+
+   left = right = corners[0];
+   top = bottom = corners[1];
+   for(i = 2; i < 8; i += 2) {
+      if(corners[i] < left) left = corners[i];
+      if(corners[i] > right) right = corners[i];
+      if(corners[i + 1] < top) top = corners[i + 1];
+      if(corners[i + 1] > bottom) bottom = corners[i + 1];
+   }
+
+   if(padding < 0)
+      padding = ((right - left > bottom - top) ? right - left : bottom - top) / 2;
+
+   left -= padding;
+   right += padding;
+   top -= padding;
+   bottom += padding;
+   bounds[0] = (left > 0) ? left / scale : 0;
+   bounds[1] = right / scale;
+   bounds[2] = (height - 1 - bottom > 0) ? (height - 1 - bottom) / scale : 0;
+   bounds[3] = (height - 1 - top) / scale;
+
+   dmtxCoreGetBounds(dec, limits);
+   for(i = 0; i < 4; i += 2) {
+      if(bounds[i] < limits[i]) bounds[i] = limits[i];
+      if(bounds[i + 1] > limits[i + 1]) bounds[i + 1] = limits[i + 1];
+   }
+
+   /* libdmtx asserts a scan grid extent above 1 */
+   if(bounds[1] - bounds[0] < 2 || bounds[3] - bounds[2] < 2)
+      return DmtxFail;
+
+   return DmtxPass;
+}
+
+/**
+ * Give dst, a decode of the same image at the same scale, the search
+ * settings and scan bounds of src. The fields are copied as they are,
+ * since dmtxDecodeGetProp() rounds the square deviation to degrees.
+ */
+extern DmtxPassFail
+dmtxCoreCopySettings(DmtxDecode *dst, DmtxDecode *src)
+{
+   int bounds[4];
+
+   dst->edgeMin = src->edgeMin;
+   dst->edgeMax = src->edgeMax;
+   dst->scanGap = src->scanGap;
+   dst->squareDevn = src->squareDevn;
+   dst->sizeIdxExpected = src->sizeIdxExpected;
+   dst->edgeThresh = src->edgeThresh;
+
+   dmtxCoreGetBounds(src, bounds);
+
+   return dmtxCoreSetBounds(dst, bounds[0], bounds[1], bounds[2], bounds[3]);
+}
+
+/**
+ * Prepare a used decode for scanning a new frame of the same geometry,
+ * pxl or the pixels it had if pxl is NULL. libdmtx has no reset call, so
+ * the scan cache is cleared by hand and the scan grid is rebuilt by
+ * re-applying the scan bounds.
+ */
+extern void
+dmtxCoreRewind(DmtxDecode *dec, unsigned char *pxl)
+{
+   int bounds[4];
+
+   if(pxl != NULL)
+      dec->image->pxl = pxl;
+
+   CoreClearCache(dec);
+   dmtxCoreGetBounds(dec, bounds);
+   dmtxCoreSetBounds(dec, bounds[0], bounds[1], bounds[2], bounds[3]);
+}
+
+/**
+ * Corners of a region found by dec in pixels of the full image, rows
+ * counted from the top, ordered x,y of the (0,0) (1,0) (1,1) (0,1)
+ * corners of the symbol
+ */
+extern void
+dmtxCoreRegionCorners(DmtxDecode *dec, DmtxRegion *reg, int *corners)
+{
+   CoreCorners(reg, dmtxDecodeGetProp(dec, DmtxPropScale),
+         dmtxImageGetProp(dec->image, DmtxPropHeight), corners);
+}
+
+/**
+ * Two sets of corners are the same symbol, found from neighbouring tiles,
+ * when all agree to within an eighth of the symbol's edge length
+ */
+extern int
+dmtxCoreSameSymbol(const int *a, const int *b)
+{
+   int edge, tolerance, i;
+
+   edge = abs(a[2] - a[0]) + abs(a[3] - a[1]);
+   tolerance = (edge / 8 > 3) ? edge / 8 : 3;
+
+   for(i = 0; i < 8; i++) {
+      if(abs(a[i] - b[i]) > tolerance)
+         return 0;
+   }
+
+   return 1;
+}
+
+/**
+ * dmtxRegionFindNext that also gives up once cancel(context) returns
+ * non-zero. libdmtx is called with deadlines DMTX_CORE_POLL_MS apart and
+ * cancel in between; every grid location is only visited once, so a slice
+ * ending early loses nothing. A NULL cancel scans in one go.
+ */
+extern DmtxRegion *
+dmtxCoreFindNext(DmtxDecode *dec, DmtxTime *timeout, DmtxCoreCancelFunc cancel,
+      void *context)
+{
+   DmtxRegion *reg;
+   DmtxTime slice;
+
+   if(cancel == NULL)
+      return dmtxRegionFindNext(dec, timeout);
+
+   while(!cancel(context)) {
+      slice = dmtxTimeAdd(dmtxTimeNow(), DMTX_CORE_POLL_MS);
+      if(timeout != NULL && (timeout->sec < slice.sec ||
+            (timeout->sec == slice.sec && timeout->usec < slice.usec)))
+         slice = *timeout;
+
+      reg = dmtxRegionFindNext(dec, &slice);
+
+      /* Found one, scanned the whole grid or ran out of time */
+      if(reg != NULL || dec->grid.extent == 0 ||
+            dec->grid.extent < dec->grid.minExtent ||
+            (timeout != NULL && dmtxTimeExceeded(*timeout)))
+         return reg;
+   }
+
+   return NULL;
+}
+
+extern void
+dmtxCoreDecoderInit(DmtxCoreDecoder *decoder)
+{
+   memset(decoder, 0x00, sizeof(DmtxCoreDecoder));
+}
+
+/**
+ * Point decoder at pxl, rows rowBytes apart (0 if they are not padded),
+ * only creating a new image and decode when the geometry differs from the
+ * last frame. decoder->fresh tells whether the search settings have to be
+ * applied to decoder->decode again. Fails if rowBytes is too small or
+ * memory runs out.
+ */
+extern DmtxPassFail
+dmtxCoreDecoderPrepare(DmtxCoreDecoder *decoder, unsigned char *pxl,
+      int width, int height, int rowBytes, int packing, int shrink)
+{
+   int padBytes;
+
+   if(shrink < 1)
+      shrink = 1;
+
+   if(decoder->decode != NULL && decoder->width == width &&
+         decoder->height == height && decoder->rowBytes == rowBytes &&
+         decoder->packing == packing && decoder->shrink == shrink) {
+      dmtxCoreRewind(decoder->decode, pxl);
+      decoder->fresh = 0;
+      return DmtxPass;
+   }
+
+   dmtxCoreDecoderClear(decoder);
+
+   decoder->image = dmtxImageCreate(pxl, width, height, packing);
+   if(decoder->image == NULL)
+      return DmtxFail;
+
+   if(rowBytes > 0) {
+      padBytes = rowBytes - width * dmtxImageGetProp(decoder->image, DmtxPropBytesPerPixel);
+      if(padBytes < 0 || dmtxImageSetProp(decoder->image, DmtxPropRowPadBytes,
+            padBytes) != DmtxPass) {
+         dmtxImageDestroy(&decoder->image);
+         return DmtxFail;
+      }
+   }
+
+   decoder->decode = dmtxDecodeCreate(decoder->image, shrink);
+   if(decoder->decode == NULL) {
+      dmtxImageDestroy(&decoder->image);
+      return DmtxFail;
+   }
+
+   decoder->width = width;
+   decoder->height = height;
+   decoder->rowBytes = rowBytes;
+   decoder->packing = packing;
+   decoder->shrink = shrink;
+   decoder->fresh = 1;
+
+   return DmtxPass;
+}
+
+/**
+ * Free the decodes and image of decoder, so that the next prepare builds
+ * them anew (e.g. for different search settings)
+ */
+extern void
+dmtxCoreDecoderClear(DmtxCoreDecoder *decoder)
+{
+   int i;
+
+   for(i = 0; i < decoder->workerCount; i++) {
+      if(decoder->workers[i] != NULL)
+         dmtxDecodeDestroy(&decoder->workers[i]);
+   }
+   free(decoder->workers);
+
+   if(decoder->decode != NULL)
+      dmtxDecodeDestroy(&decoder->decode);
+   if(decoder->image != NULL)
+      dmtxImageDestroy(&decoder->image);
+
+   dmtxCoreDecoderInit(decoder);
+}
+
+/**
+ * dmtxCoreScanRun on decoder->decode, keeping the decodes of the tile
+ * workers in decoder for the following frames
+ */
+extern DmtxPassFail
+dmtxCoreDecoderScan(DmtxCoreDecoder *decoder, DmtxCoreScan *scan)
+{
+   if(decoder->decode == NULL)
+      return DmtxFail;
+
+   return CoreScan(scan, decoder->decode, decoder);
+}
+
+/**
+ * Defaults: every symbol, no timeout, as many corrections as possible, on
+ * the calling thread
+ */
+extern void
+dmtxCoreScanInit(DmtxCoreScan *scan)
+{
+   memset(scan, 0x00, sizeof(DmtxCoreScan));
+   scan->maxCount = DmtxUndefined;
+   scan->timeoutMs = DmtxUndefined;
+   scan->corrections = DmtxUndefined;
+   scan->threads = 1;
+   scan->tileOverlap = DmtxUndefined;
+   scan->pyramid = 1;
+}
+
+/**
+ * Start the timeout and result count of the scans that follow. Scans of
+ * the same frame (e.g. near the previous position, then everywhere) share
+ * them.
+ */
+extern void
+dmtxCoreScanStart(DmtxCoreScan *scan)
+{
+   scan->found = 0;
+   scan->stopped = 0;
+   scan->failed = 0;
+
+   if(scan->timeoutMs != DmtxUndefined)
+      scan->deadline = dmtxTimeAdd(dmtxTimeNow(), scan->timeoutMs);
+}
+
+/**
+ * Find and read the next region in the current bounds of dec, for
+ * wrappers stepping through a scan themselves. Unlike the other scans
+ * this neither calls scan->result nor counts the result. The message is
+ * valid until the next call. Fails when nothing is left, the scan was
+ * stopped or memory ran out.
+ */
+extern DmtxPassFail
+dmtxCoreScanNext(DmtxCoreScan *scan, DmtxDecode *dec, DmtxCoreResult *result)
+{
+   DmtxRegion *reg;
+   DmtxPassFail err;
+
+   if(scan->stopped || scan->failed)
+      return DmtxFail;
+
+   reg = CoreFind(scan, dec, scan->cancel, NULL, &scan->stats);
+   if(reg == NULL)
+      return DmtxFail;
+
+   scan->text.size = 0;
+   err = CoreRead(scan, dec, reg, &scan->text, &scan->stats, result);
+   if(err == DmtxPass && scan->inspect != NULL)
+      scan->inspect(scan->inspectContext, dec, reg, result);
+   dmtxRegionDestroy(&reg);
+
+   if(err != DmtxPass)
+      scan->failed = 1;
+
+   return err;
+}
+
+/**
+ * Scan the current bounds of dec, coarse-to-fine if scan->pyramid is a
+ * multiple of the scale of dec, on tiles if scan->threads is not 1, or
+ * else region by region. Results are handed to scan->result as they are
+ * found, those of tiled scans once every tile is done. Fails if memory
+ * runs out.
+ */
+extern DmtxPassFail
+dmtxCoreScanRun(DmtxCoreScan *scan, DmtxDecode *dec)
+{
+   return CoreScan(scan, dec, NULL);
+}
+
+/**
+ * Scan only around corners (see dmtxCoreNearBounds), restoring the scan
+ * bounds afterwards. Pixels tried there stay marked in the scan cache, so
+ * a full scan after a miss does not repeat them; scan->found tells whether
+ * one is needed.
+ */
+extern DmtxPassFail
+dmtxCoreScanNear(DmtxCoreScan *scan, DmtxDecode *dec, const int *corners,
+      int padding)
+{
+   int limits[4], bounds[4];
+   DmtxPassFail err = DmtxPass;
+
+   dmtxCoreGetBounds(dec, limits);
+
+   if(dmtxCoreNearBounds(dec, corners, padding, bounds) == DmtxPass &&
+         dmtxCoreSetBounds(dec, bounds[0], bounds[1], bounds[2], bounds[3]) == DmtxPass)
+      err = CoreScanSerial(scan, dec);
+
+   dmtxCoreSetBounds(dec, limits[0], limits[1], limits[2], limits[3]);
+
+   return err;
+}
+
+extern void
+dmtxCoreScanFree(DmtxCoreScan *scan)
+{
+   dmtxCoreArenaFree(&scan->text);
+}
+
+static DmtxPassFail
+CoreScan(DmtxCoreScan *scan, DmtxDecode *dec, DmtxCoreDecoder *pool)
+{
+   int ratio = scan->pyramid / dmtxDecodeGetProp(dec, DmtxPropScale);
+
+   if(ratio > 1)
+      return CoreScanPyramid(scan, dec, ratio);
+
+   if(scan->threads != 1 && dmtxCoreThreadCount(scan->threads) > 1)
+      return CoreScanTiles(scan, dec, pool);
+
+   return CoreScanSerial(scan, dec);
+}
+
+static void
+CoreCorners(DmtxRegion *reg, int scale, int height, int *corners)
+{
+   DmtxVector2 p[4];
+   int i;
+
+   p[0].X = p[0].Y = p[1].Y = p[3].X = 0.0;
+   p[1].X = p[3].Y = p[2].X = p[2].Y = 1.0;
+
+   for(i = 0; i < 4; i++) {
+      dmtxMatrix3VMultiplyBy(&p[i], reg->fit2raw);
+      corners[2 * i] = (int)(scale * p[i].X + 0.5);
+      corners[2 * i + 1] = height - 1 - (int)(scale * p[i].Y + 0.5);
+   }
+}
+
+static void
+CoreClearCache(DmtxDecode *dec)
+{
+   memset(dec->cache, 0x00, (size_t)dmtxDecodeGetProp(dec, DmtxPropWidth) *
+         (size_t)dmtxDecodeGetProp(dec, DmtxPropHeight));
+}
+
+/**
+ * Next region of dec before the deadline of scan, timed in stats. Tile
+ * workers pass the stop flag of their job, which is checked between
+ * slices like the result of cancel.
+ */
+static DmtxRegion *
+CoreFind(DmtxCoreScan *scan, DmtxDecode *dec, DmtxCoreCancelFunc cancel,
+      volatile int *stop, DmtxCoreStats *stats)
+{
+   DmtxRegion *reg = NULL;
+   DmtxTime slice, *timeout;
+   double start = dmtxCoreClock();
+
+   timeout = (scan->timeoutMs != DmtxUndefined) ? &scan->deadline : NULL;
+
+   if(stop == NULL) {
+      reg = dmtxCoreFindNext(dec, timeout, cancel, scan->cancelContext);
+      if(reg == NULL && cancel != NULL && cancel(scan->cancelContext))
+         scan->stopped = 1;
+   }
+   else {
+      while(!*stop) {
+         if(cancel != NULL && cancel(scan->cancelContext)) {
+            *stop = 1;
+            scan->stopped = 1;
+            break;
+         }
+
+         slice = dmtxTimeAdd(dmtxTimeNow(), DMTX_CORE_POLL_MS);
+         if(timeout != NULL && (timeout->sec < slice.sec ||
+               (timeout->sec == slice.sec && timeout->usec < slice.usec)))
+            slice = *timeout;
+
+         reg = dmtxRegionFindNext(dec, &slice);
+         if(reg != NULL || dec->grid.extent == 0 ||
+               dec->grid.extent < dec->grid.minExtent ||
+               (timeout != NULL && dmtxTimeExceeded(*timeout)))
+            break;
+      }
+   }
+
+   if(reg == NULL && timeout != NULL && dmtxTimeExceeded(*timeout))
+      scan->stopped = 1;
+
+   stats->searchUs += dmtxCoreClock() - start;
+
+   return reg;
+}
+
+/**
+ * Fill result from reg and decode its message into text. Fails only if
+ * memory runs out.
+ */
+static DmtxPassFail
+CoreRead(DmtxCoreScan *scan, DmtxDecode *dec, DmtxRegion *reg,
+      DmtxCoreArena *text, DmtxCoreStats *stats, DmtxCoreResult *result)
+{
+   DmtxMessage *msg;
+   DmtxPassFail err = DmtxPass;
+   double angle;
+   double start = dmtxCoreClock();
+
+   memset(result, 0x00, sizeof(DmtxCoreResult));
+   result->status = DmtxCoreUnreadable;
+   result->sizeIdx = reg->sizeIdx;
+   result->scale = dmtxDecodeGetProp(dec, DmtxPropScale);
+   dmtxCoreRegionCorners(dec, reg, result->corners);
+
+   angle = (2 * M_PI) + (atan2(reg->fit2raw[0][1], reg->fit2raw[1][1]) -
+         atan2(reg->fit2raw[1][0], reg->fit2raw[0][0])) / 2.0;
+   result->angle = (int)(angle * 180.0 / M_PI + 0.5) % 360;
+
+   if(scan->mosaic)
+      msg = dmtxDecodeMosaicRegion(dec, reg, scan->corrections);
+   else
+      msg = dmtxDecodeMatrixRegion(dec, reg, scan->corrections);
+
+   if(msg != NULL) {
+      /* Kept NUL terminated for the wrappers that want C strings */
+      if(dmtxCoreArenaAppend(text, msg->output, msg->outputIdx) == DmtxPass &&
+            dmtxCoreArenaAppend(text, "", 1) == DmtxPass) {
+         result->status = DmtxCoreDecoded;
+         result->message = text->data + text->size - msg->outputIdx - 1;
+         result->messageSize = msg->outputIdx;
+         result->padCount = msg->padCount;
+      }
+      else {
+         err = DmtxFail;
+      }
+      dmtxMessageDestroy(&msg);
+   }
+
+   result->decodeUs = dmtxCoreClock() - start;
+   stats->decodeUs += result->decodeUs;
+   stats->regionsExamined++;
+   if(result->status != DmtxCoreDecoded)
+      stats->regionsRejected++;
+
+   return err;
+}
+
+/**
+ * Hand result to scan->result if it is wanted, returning 0 once the scan
+ * has to stop
+ */
+static int
+CoreDeliver(DmtxCoreScan *scan, const DmtxCoreResult *result)
+{
+   double start;
+   int keepGoing = 1;
+
+   if(result->status != DmtxCoreDecoded &&
+         (result->status != DmtxCoreUnreadable || !scan->unreadable))
+      return !scan->stopped;
+
+   if(scan->result != NULL) {
+      start = dmtxCoreClock();
+      keepGoing = scan->result(scan->resultContext, result);
+      scan->stats.marshalUs += dmtxCoreClock() - start;
+   }
+   scan->stats.bytesCopied += result->messageSize;
+   scan->found++;
+
+   if(!keepGoing || (scan->maxCount != DmtxUndefined &&
+         scan->found >= scan->maxCount))
+      scan->stopped = 1;
+
+   return !scan->stopped;
+}
+
+static DmtxPassFail
+CoreScanSerial(DmtxCoreScan *scan, DmtxDecode *dec)
+{
+   DmtxCoreResult result;
+
+   while(!scan->stopped && dmtxCoreScanNext(scan, dec, &result) == DmtxPass) {
+      if(!CoreDeliver(scan, &result))
+         break;
+   }
+
+   return scan->failed ? DmtxFail : DmtxPass;
+}
+
+/**
+ * Locate candidate regions cheaply on the image shrunk by ratio more than
+ * dec, and decode each of them with dec, whose scan is limited to the
+ * candidate's box for that. dec keeps its scan cache across candidates, so
+ * symbols spanning several boxes are decoded once.
+ */
+static DmtxPassFail
+CoreScanPyramid(DmtxCoreScan *scan, DmtxDecode *dec, int ratio)
+{
+   DmtxImage *small;
+   DmtxDecode *coarse;
+   DmtxRegion *candidate;
+   DmtxCoreResult result;
+   DmtxVector2 p[4];
+   int scale = dmtxDecodeGetProp(dec, DmtxPropScale);
+   int height = dmtxImageGetProp(dec->image, DmtxPropHeight);
+   int full[4], box[4], pad, i;
+   double start;
+
+   /* libdmtx cannot scan an area under 2 pixels across, so one that small
+      needs no coarse pass */
+   dmtxCoreGetBounds(dec, full);
+   if(full[1] / ratio - full[0] / ratio < 2 || full[3] / ratio - full[2] / ratio < 2)
+      return CoreScanSerial(scan, dec);
+
+   /* Candidates are located on a luma copy of the pixels the shrunk decode
+      would sample, or on the image itself where its packing has none */
+   start = dmtxCoreClock();
+   small = dmtxConvertShrinkImage(dec->image, ratio * scale);
+   coarse = (small != NULL) ? dmtxDecodeCreate(small, 1) :
+         dmtxDecodeCreate(dec->image, ratio * scale);
+   scan->stats.setupUs += dmtxCoreClock() - start;
+   if(coarse == NULL) {
+      dmtxConvertImageDestroy(&small);
+      scan->failed = 1;
+      return DmtxFail;
+   }
+
+   /* Lengths shrink along with the image; shapes and thresholds do not */
+   dmtxCoreSetBounds(coarse, full[0] / ratio, full[1] / ratio,
+         full[2] / ratio, full[3] / ratio);
+   coarse->sizeIdxExpected = dec->sizeIdxExpected;
+   coarse->squareDevn = dec->squareDevn;
+   coarse->edgeThresh = dec->edgeThresh;
+   if(dec->edgeMax != DmtxUndefined)
+      coarse->edgeMax = dec->edgeMax / ratio;
+
+   while(!scan->stopped && !scan->failed &&
+         (candidate = CoreFind(scan, coarse, scan->cancel, NULL, &scan->stats)) != NULL) {
+      if(scan->inspect != NULL) {
+         memset(&result, 0x00, sizeof(DmtxCoreResult));
+         result.status = DmtxCoreCandidate;
+         result.sizeIdx = candidate->sizeIdx;
+         result.scale = ratio * scale;
+         CoreCorners(candidate, ratio * scale, height, result.corners);
+         scan->inspect(scan->inspectContext, coarse, candidate, &result);
+      }
+
+      /* Box of the candidate in dec's coordinates, with a margin for the
+         precision lost by shrinking */
+      p[0].X = p[0].Y = p[1].Y = p[3].X = 0.0;
+      p[1].X = p[3].Y = p[2].X = p[2].Y = 1.0;
+      for(i = 0; i < 4; i++) {
+         dmtxMatrix3VMultiplyBy(&p[i], candidate->fit2raw);
+         p[i].X *= ratio;
+         p[i].Y *= ratio;
+      }
+      dmtxRegionDestroy(&candidate);
+
+      box[0] = box[1] = (int)p[0].X;
+      box[2] = box[3] = (int)p[0].Y;
+      for(i = 1; i < 4; i++) {
+         if((int)p[i].X < box[0]) box[0] = (int)p[i].X;
+         if((int)p[i].X > box[1]) box[1] = (int)p[i].X;
+         if((int)p[i].Y < box[2]) box[2] = (int)p[i].Y;
+         if((int)p[i].Y > box[3]) box[3] = (int)p[i].Y;
+      }
+      pad = 2 * ratio + ((box[1] - box[0] > box[3] - box[2]) ?
+            box[1] - box[0] : box[3] - box[2]) / 4;
+      box[0] = (box[0] - pad > full[0]) ? box[0] - pad : full[0];
+      box[1] = (box[1] + pad < full[1]) ? box[1] + pad : full[1];
+      box[2] = (box[2] - pad > full[2]) ? box[2] - pad : full[2];
+      box[3] = (box[3] + pad < full[3]) ? box[3] + pad : full[3];
+
+      /* Decode at full size inside the box, unless clamping left it too
+         narrow for libdmtx's scan grid */
+      if(box[1] - box[0] >= 2 && box[3] - box[2] >= 2 &&
+            dmtxCoreSetBounds(dec, box[0], box[1], box[2], box[3]) == DmtxPass)
+         CoreScanSerial(scan, dec);
+   }
+
+   dmtxCoreSetBounds(dec, full[0], full[1], full[2], full[3]);
+   dmtxDecodeDestroy(&coarse);
+   dmtxConvertImageDestroy(&small);
+
+   return scan->failed ? DmtxFail : DmtxPass;
+}
+
+/**
+ * Split the current bounds of dec into overlapping tiles and scan them on
+ * several threads, the calling thread being one of them and scanning with
+ * dec; the others get decodes of their own over the same image, kept in
+ * pool if it is not NULL. Only the calling thread calls scan->cancel.
+ * Symbols straddling a tile edge are still found because region growth
+ * is not clipped to the scan bounds; the overlap only adds seed margin.
+ */
+static DmtxPassFail
+CoreScanTiles(DmtxCoreScan *scan, DmtxDecode *dec, DmtxCoreDecoder *pool)
+{
+   CoreTileJob job;
+   CoreWorker *workers;
+   CoreThread *threads;
+   CoreTileRecord *records;
+   DmtxDecode **decodes;
+   double aspect, start;
+   int threadCount, tileRows, started, i;
+
+   threadCount = dmtxCoreThreadCount(scan->threads);
+
+   memset(&job, 0x00, sizeof(job));
+   job.scan = scan;
+   dmtxCoreGetBounds(dec, job.bounds);
+
+   /* Two tiles per thread, so that workers finishing early pick up more */
+   aspect = (double)(job.bounds[1] - job.bounds[0] + 1) /
+         (job.bounds[3] - job.bounds[2] + 1);
+   job.tileCols = (int)ceil(sqrt(2.0 * threadCount * aspect));
+   if(job.tileCols < 1)
+      job.tileCols = 1;
+   tileRows = (2 * threadCount + job.tileCols - 1) / job.tileCols;
+   job.tileCount = job.tileCols * tileRows;
+   job.tileWidth = (job.bounds[1] - job.bounds[0] + job.tileCols) / job.tileCols;
+   job.tileHeight = (job.bounds[3] - job.bounds[2] + tileRows) / tileRows;
+
+   if(scan->tileOverlap != DmtxUndefined)
+      job.overlap = scan->tileOverlap;
+   else if(dec->edgeMax != DmtxUndefined)
+      job.overlap = dec->edgeMax;
+   else
+      job.overlap = DMTX_CORE_OVERLAP;
+
+   workers = (CoreWorker *)calloc(threadCount, sizeof(CoreWorker));
+   threads = (CoreThread *)calloc(threadCount, sizeof(CoreThread));
+   decodes = (DmtxDecode **)calloc(threadCount, sizeof(DmtxDecode *));
+   if(workers == NULL || threads == NULL || decodes == NULL) {
+      free(workers);
+      free(threads);
+      free(decodes);
+      scan->failed = 1;
+      return DmtxFail;
+   }
+
+   /* Decodes of the workers, reused from pool where it has them */
+   start = dmtxCoreClock();
+   decodes[0] = dec;
+   for(i = 1; i < threadCount; i++) {
+      if(pool != NULL && i - 1 < pool->workerCount) {
+         decodes[i] = pool->workers[i - 1];
+         pool->workers[i - 1] = NULL;
+         CoreClearCache(decodes[i]);
+      }
+      else {
+         decodes[i] = dmtxDecodeCreate(dec->image, dmtxDecodeGetProp(dec, DmtxPropScale));
+         if(decodes[i] == NULL)
+            break;
+      }
+      dmtxCoreCopySettings(decodes[i], dec);
+   }
+   threadCount = i;
+   scan->stats.setupUs += dmtxCoreClock() - start;
+
+   CoreMutexInit(&job.lock);
+
+   for(i = 0; i < threadCount; i++) {
+      workers[i].job = &job;
+      workers[i].dec = decodes[i];
+      workers[i].index = i;
+   }
+
+   for(started = 1; started < threadCount; started++) {
+      if(CoreThreadStart(&threads[started], &workers[started]) != DmtxPass)
+         break;
+   }
+
+   CoreTileWork(&workers[0]);
+
+   for(i = 1; i < started; i++)
+      CoreThreadJoin(threads[i]);
+
+   CoreMutexDestroy(&job.lock);
+
+   for(i = 0; i < threadCount; i++) {
+      dmtxCoreStatsAdd(&scan->stats, &workers[i].stats);
+      dmtxCoreArenaFree(&workers[i].text);
+      if(i > 0 && scan->finish != NULL)
+         scan->finish(scan->inspectContext, decodes[i]);
+   }
+
+   /* Scanning the tiles moved the bounds of dec */
+   dmtxCoreSetBounds(dec, job.bounds[0], job.bounds[1], job.bounds[2], job.bounds[3]);
+
+   /* Keep the decodes of the workers for the next frame */
+   if(pool != NULL && pool->workerCount < threadCount - 1) {
+      DmtxDecode **kept = (DmtxDecode **)realloc(pool->workers,
+            (threadCount - 1) * sizeof(DmtxDecode *));
+      if(kept != NULL) {
+         for(i = pool->workerCount; i < threadCount - 1; i++)
+            kept[i] = NULL;
+         pool->workers = kept;
+         pool->workerCount = threadCount - 1;
+      }
+   }
+   for(i = 1; i < threadCount; i++) {
+      if(pool != NULL && i - 1 < pool->workerCount)
+         pool->workers[i - 1] = decodes[i];
+      else
+         dmtxDecodeDestroy(&decodes[i]);
+   }
+
+   free(workers);
+   free(threads);
+   free(decodes);
+
+   /* Hand the de-duplicated results over on the calling thread */
+   records = (CoreTileRecord *)job.records.data;
+   for(i = 0; !scan->failed && i < job.recordCount; i++) {
+      if(records[i].result.status == DmtxCoreDecoded)
+         records[i].result.message = job.text.data + records[i].offset;
+      if(!CoreDeliver(scan, &records[i].result))
+         break;
+   }
+
+   dmtxCoreArenaFree(&job.records);
+   dmtxCoreArenaFree(&job.text);
+
+   return scan->failed ? DmtxFail : DmtxPass;
+}
+
+/**
+ * Body of a tile worker: scan tiles until none are left or the job stops
+ */
+static void
+CoreTileWork(CoreWorker *worker)
+{
+   CoreTileJob *job = worker->job;
+   DmtxCoreScan *scan = job->scan;
+   DmtxCoreCancelFunc cancel = (worker->index == 0) ? scan->cancel : NULL;
+   DmtxTime *timeout;
+   DmtxRegion *reg;
+   DmtxCoreResult result;
+   int tile, x0, x1, y0, y1;
+
+   timeout = (scan->timeoutMs != DmtxUndefined) ? &scan->deadline : NULL;
+
+   while(!job->stop) {
+      CoreMutexLock(&job->lock);
+      tile = job->nextTile++;
+      CoreMutexUnlock(&job->lock);
+      if(tile >= job->tileCount)
+         break;
+
+      x0 = job->bounds[0] + (tile % job->tileCols) * job->tileWidth - job->overlap;
+      y0 = job->bounds[2] + (tile / job->tileCols) * job->tileHeight - job->overlap;
+      x1 = x0 + job->tileWidth + 2 * job->overlap - 1;
+      y1 = y0 + job->tileHeight + 2 * job->overlap - 1;
+      if(x0 < job->bounds[0]) x0 = job->bounds[0];
+      if(y0 < job->bounds[2]) y0 = job->bounds[2];
+      if(x1 > job->bounds[1]) x1 = job->bounds[1];
+      if(y1 > job->bounds[3]) y1 = job->bounds[3];
+      if(x0 >= x1 || y0 >= y1 ||
+            dmtxCoreSetBounds(worker->dec, x0, x1, y0, y1) != DmtxPass)
+         continue;
+
+      while(!job->stop &&
+            (reg = CoreFind(scan, worker->dec, cancel, &job->stop, &worker->stats)) != NULL) {
+         worker->text.size = 0;
+         if(CoreRead(scan, worker->dec, reg, &worker->text, &worker->stats,
+               &result) == DmtxPass) {
+            CoreTileAdd(worker, reg, &result);
+         }
+         else {
+            scan->failed = 1;
+            job->stop = 1;
+         }
+         dmtxRegionDestroy(&reg);
+      }
+
+      if(timeout != NULL && dmtxTimeExceeded(*timeout))
+         job->stop = 1;
+   }
+}
+
+/**
+ * Add a worker's result to its job unless another tile reported the
+ * symbol already, in which case the copy that decoded is kept
+ */
+static void
+CoreTileAdd(CoreWorker *worker, DmtxRegion *reg, DmtxCoreResult *result)
+{
+   CoreTileJob *job = worker->job;
+   DmtxCoreScan *scan = job->scan;
+   CoreTileRecord record, *records;
+   int keep, i;
+
+   CoreMutexLock(&job->lock);
+
+   keep = (result->status == DmtxCoreDecoded || scan->unreadable);
+   records = (CoreTileRecord *)job->records.data;
+
+   for(i = 0; keep && i < job->recordCount; i++) {
+      if(!dmtxCoreSameSymbol(records[i].result.corners, result->corners))
+         continue;
+
+      if(records[i].result.status != DmtxCoreDecoded &&
+            result->status == DmtxCoreDecoded) {
+         records[i].result = *result;
+         records[i].result.message = NULL;
+         records[i].offset = job->text.size;
+         if(dmtxCoreArenaAppend(&job->text, result->message,
+               result->messageSize + 1) != DmtxPass) {
+            scan->failed = 1;
+            job->stop = 1;
+         }
+      }
+      result->status = DmtxCoreDuplicate;
+      keep = 0;
+   }
+
+   if(keep) {
+      record.result = *result;
+      record.result.message = NULL;
+      record.offset = job->text.size;
+      if((result->status == DmtxCoreDecoded && dmtxCoreArenaAppend(&job->text,
+            result->message, result->messageSize + 1) != DmtxPass) ||
+            dmtxCoreArenaAppend(&job->records, &record, sizeof(record)) != DmtxPass) {
+         scan->failed = 1;
+         job->stop = 1;
+      }
+      else {
+         job->recordCount++;
+         if(scan->maxCount != DmtxUndefined && job->recordCount >= scan->maxCount)
+            job->stop = 1;
+      }
+   }
+
+   if(scan->inspect != NULL)
+      scan->inspect(scan->inspectContext, worker->dec, reg, result);
+
+   CoreMutexUnlock(&job->lock);
+}
+
+#ifdef _WIN32
+static unsigned __stdcall
+CoreThreadMain(void *arg)
+{
+   CoreTileWork((CoreWorker *)arg);
+   return 0;
+}
+
+static void CoreMutexInit(CoreMutex *mutex) { InitializeCriticalSection(mutex); }
+static void CoreMutexDestroy(CoreMutex *mutex) { DeleteCriticalSection(mutex); }
+static void CoreMutexLock(CoreMutex *mutex) { EnterCriticalSection(mutex); }
+static void CoreMutexUnlock(CoreMutex *mutex) { LeaveCriticalSection(mutex); }
+
+static DmtxPassFail
+CoreThreadStart(CoreThread *thread, CoreWorker *worker)
+{
+   *thread = (HANDLE)_beginthreadex(NULL, 0, CoreThreadMain, worker, 0, NULL);
+
+   return (*thread != 0) ? DmtxPass : DmtxFail;
+}
+
+static void
+CoreThreadJoin(CoreThread thread)
+{
+   WaitForSingleObject(thread, INFINITE);
+   CloseHandle(thread);
+}
+#else
+static void *
+CoreThreadMain(void *arg)
+{
+   CoreTileWork((CoreWorker *)arg);
+   return NULL;
+}
+
+static void CoreMutexInit(CoreMutex *mutex) { pthread_mutex_init(mutex, NULL); }
+static void CoreMutexDestroy(CoreMutex *mutex) { pthread_mutex_destroy(mutex); }
+static void CoreMutexLock(CoreMutex *mutex) { pthread_mutex_lock(mutex); }
+static void CoreMutexUnlock(CoreMutex *mutex) { pthread_mutex_unlock(mutex); }
+
+static DmtxPassFail
+CoreThreadStart(CoreThread *thread, CoreWorker *worker)
+{
+   return (pthread_create(thread, NULL, CoreThreadMain, worker) == 0) ?
+         DmtxPass : DmtxFail;
+}
+
+static void
+CoreThreadJoin(CoreThread thread)
+{
+   pthread_join(thread, NULL);
+}
+#endif
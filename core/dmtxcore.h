@@ -0,0 +1,185 @@
+/*
+libdmtx wrappers - decode loop shared by the wrappers
+
+Copyright (C) 2009 Mike Laughton
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+Contact: mike@dragonflylogic.com
+*/
+
+/* $Id$ */
+
+/**
+ * Every wrapper finds and decodes regions the same way; this is that loop,
+ * so that the wrappers only turn its results into their own types.
+ *
+ * A DmtxCoreDecoder keeps the DmtxImage and DmtxDecode of one frame
+ * geometry and rewinds them for the next frame. A DmtxCoreScan runs over
+ * the current scan bounds of a decode, either on the calling thread, on
+ * overlapping tiles shared by several threads, or coarse-to-fine on a
+ * shrunk copy of the image, and hands every symbol to a callback with its
+ * corners in pixels of the full image, rows counted from the top.
+ *
+ * Scan bounds (DmtxPropXmin ...) are in libdmtx's coordinates: those of
+ * the shrunk image, rows counted from the bottom.
+ */
+
+#ifndef __DMTXCORE_H__
+#define __DMTXCORE_H__
+
+#include <stddef.h>
+#include <dmtx.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* How often a scan with a cancel callback calls it */
+#define DMTX_CORE_POLL_MS 50
+
+typedef enum {
+   DmtxCoreDecoded,       /* the region decoded */
+   DmtxCoreUnreadable,    /* a region was found, its message did not decode */
+   DmtxCoreDuplicate,     /* another tile found the same symbol already */
+   DmtxCoreCandidate      /* located by the coarse pass of a pyramid scan */
+} DmtxCoreStatus;
+
+typedef struct DmtxCoreStats_struct {
+   double setupUs;        /* creating and rewinding decodes */
+   double searchUs;       /* dmtxRegionFindNext */
+   double decodeUs;       /* dmtxDecodeMatrixRegion */
+   double marshalUs;      /* in the result callback */
+   long regionsExamined;
+   long regionsRejected;
+   long bytesCopied;
+} DmtxCoreStats;
+
+typedef struct DmtxCoreArena_struct {
+   unsigned char *data;
+   size_t size;
+   size_t alloc;
+} DmtxCoreArena;
+
+typedef struct DmtxCoreResult_struct {
+   int status;            /* DmtxCoreStatus */
+   int corners[8];        /* x,y of the (0,0) (1,0) (1,1) (0,1) corners */
+   int sizeIdx;
+   int angle;             /* in degrees, 0 to 359 */
+   int padCount;
+   int scale;             /* image pixels per pixel of the region's decode */
+   unsigned char *message;  /* NUL terminated, NULL unless decoded */
+   int messageSize;
+   double decodeUs;
+} DmtxCoreResult;
+
+/* Non-zero stops the scan */
+typedef int (*DmtxCoreCancelFunc)(void *context);
+
+/* Receives each result; returning 0 stops the scan. The message is only
+   valid until the callback returns. */
+typedef int (*DmtxCoreResultFunc)(void *context, const DmtxCoreResult *result);
+
+/* Sees every region a scan examines, on the thread scanning it */
+typedef void (*DmtxCoreInspectFunc)(void *context, DmtxDecode *dec,
+      DmtxRegion *reg, const DmtxCoreResult *result);
+
+/* Sees each decode of the tile workers once its last tile is done */
+typedef void (*DmtxCoreFinishFunc)(void *context, DmtxDecode *dec);
+
+typedef struct DmtxCoreScan_struct {
+   int maxCount;          /* results to stop after, DmtxUndefined for all */
+   int timeoutMs;         /* DmtxUndefined for no timeout */
+   int corrections;       /* as for dmtxDecodeMatrixRegion() */
+   int mosaic;
+   int unreadable;        /* also pass regions that do not decode */
+   int threads;           /* 0 for one per processor */
+   int tileOverlap;       /* DmtxUndefined for the edge maximum or 32 */
+   int pyramid;           /* shrink of the coarse pass, 1 for none */
+   DmtxCoreCancelFunc cancel;
+   void *cancelContext;
+   DmtxCoreResultFunc result;
+   void *resultContext;
+   DmtxCoreInspectFunc inspect;
+   DmtxCoreFinishFunc finish;
+   void *inspectContext;
+   DmtxCoreStats stats;
+   int found;             /* results passed since dmtxCoreScanStart() */
+   int stopped;           /* by the callbacks, the timeout or maxCount */
+   int failed;            /* out of memory */
+   DmtxTime deadline;
+   DmtxCoreArena text;
+} DmtxCoreScan;
+
+/* Frame state reused from one frame to the next */
+typedef struct DmtxCoreDecoder_struct {
+   DmtxImage *image;
+   DmtxDecode *decode;
+   DmtxDecode **workers;  /* decodes of the tile workers, kept for reuse */
+   int workerCount;
+   int width;
+   int height;
+   int rowBytes;
+   int packing;
+   int shrink;
+   int fresh;             /* decode was created by the last prepare */
+} DmtxCoreDecoder;
+
+extern double dmtxCoreClock(void);
+extern void dmtxCoreStatsAdd(DmtxCoreStats *total, const DmtxCoreStats *part);
+extern int dmtxCoreThreadCount(int threads);
+extern int dmtxCoreBytesPerPixel(int packing);
+
+extern DmtxPassFail dmtxCoreArenaAppend(DmtxCoreArena *arena,
+      const void *bytes, size_t count);
+extern void dmtxCoreArenaFree(DmtxCoreArena *arena);
+
+extern DmtxPassFail dmtxCoreSetBounds(DmtxDecode *dec, int x0, int x1,
+      int y0, int y1);
+extern void dmtxCoreGetBounds(DmtxDecode *dec, int *bounds);
+extern DmtxPassFail dmtxCoreSetImageBounds(DmtxDecode *dec, int xMin,
+      int xMax, int yMin, int yMax);
+extern DmtxPassFail dmtxCoreNearBounds(DmtxDecode *dec, const int *corners,
+      int padding, int *bounds);
+extern DmtxPassFail dmtxCoreCopySettings(DmtxDecode *dst, DmtxDecode *src);
+extern void dmtxCoreRewind(DmtxDecode *dec, unsigned char *pxl);
+extern void dmtxCoreRegionCorners(DmtxDecode *dec, DmtxRegion *reg,
+      int *corners);
+extern int dmtxCoreSameSymbol(const int *a, const int *b);
+extern DmtxRegion *dmtxCoreFindNext(DmtxDecode *dec, DmtxTime *timeout,
+      DmtxCoreCancelFunc cancel, void *context);
+
+extern void dmtxCoreDecoderInit(DmtxCoreDecoder *decoder);
+extern DmtxPassFail dmtxCoreDecoderPrepare(DmtxCoreDecoder *decoder,
+      unsigned char *pxl, int width, int height, int rowBytes, int packing,
+      int shrink);
+extern void dmtxCoreDecoderClear(DmtxCoreDecoder *decoder);
+extern DmtxPassFail dmtxCoreDecoderScan(DmtxCoreDecoder *decoder,
+      DmtxCoreScan *scan);
+
+extern void dmtxCoreScanInit(DmtxCoreScan *scan);
+extern void dmtxCoreScanStart(DmtxCoreScan *scan);
+extern DmtxPassFail dmtxCoreScanNext(DmtxCoreScan *scan, DmtxDecode *dec,
+      DmtxCoreResult *result);
+extern DmtxPassFail dmtxCoreScanRun(DmtxCoreScan *scan, DmtxDecode *dec);
+extern DmtxPassFail dmtxCoreScanNear(DmtxCoreScan *scan, DmtxDecode *dec,
+      const int *corners, int padding);
+extern void dmtxCoreScanFree(DmtxCoreScan *scan);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,203 @@
+/*
+Java wrapper for libdmtx
+
+Copyright (C) 2009 Mike Laughton
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+Contact: mike@dragonflylogic.com
+*/
+
+/* $Id$ */
+
+import java.awt.image.*;
+import java.io.*;
+import java.lang.management.ManagementFactory;
+import java.lang.reflect.Method;
+import java.util.*;
+import org.libdmtx.*;
+
+/**
+ * Decodes and encodes the shared benchmark corpus written by
+ * "bench/dmtxbench corpus DIR" (see "make bench" in the top directory) and
+ * prints the same columns as the other wrappers. When DIR/native.txt holds
+ * the timings of libdmtx alone, the overhead column is the median time the
+ * Java wrapper adds on top of it.
+ *
+ * Usage: java Bench corpus_dir [rounds]
+ */
+public class Bench {
+  public static final int SEARCH_TIMEOUT = 60000;
+  public static final String PAYLOAD = "libdmtx benchmark payload 0123456789 ";
+
+  private interface Work {
+    int run();
+  }
+
+  private static Map<String, Double> nativeTimes = new HashMap<String, Double>();
+
+  public static void main(String []args) throws IOException {
+    if (args.length < 1) {
+      System.out.println("Usage: java Bench corpus_dir [rounds]");
+      System.exit(2);
+    }
+    File corpus = new File(args[0]);
+    int rounds = (args.length > 1) ? Integer.parseInt(args[1]) : 20;
+
+    readNative(new File(corpus, "native.txt"));
+
+    System.out.println("# java, " + rounds + " rounds per case");
+    System.out.println(String.format("# %-12s %7s %10s %9s %9s %12s %11s",
+        "case", "found", "per sec", "p50 ms", "p99 ms", "alloc/call",
+        "overhead ms"));
+
+    BufferedReader manifest = new BufferedReader(
+        new FileReader(new File(corpus, "corpus.txt")));
+    String line;
+    while ((line = manifest.readLine()) != null) {
+      String []fields = line.trim().split("\\s+");
+      if (fields[0].equals("decode")) {
+        final BufferedImage image = readPnm(new File(corpus, fields[2]));
+        final int symbols = Integer.parseInt(fields[6]);
+        run(fields[1], symbols, rounds, new Work() {
+          public int run() {
+            DMTXTag []tags = DMTXImage.getTags(image, symbols, SEARCH_TIMEOUT);
+            return (tags == null) ? 0 : tags.length;
+          }
+        });
+      }
+      else if (fields[0].equals("encode")) {
+        int length = Integer.parseInt(fields[2]);
+        StringBuffer payload = new StringBuffer();
+        while (payload.length() < length)
+          payload.append(PAYLOAD);
+        final String id = payload.substring(0, length);
+        run(fields[1], 1, rounds, new Work() {
+          public int run() {
+            return (DMTXImage.createTag(id) != null) ? 1 : 0;
+          }
+        });
+      }
+    }
+    manifest.close();
+  }
+
+  private static void run(String aName, int aExpected, int aRounds,
+      Work aWork) {
+    double []times = new double[aRounds];
+    int found = 0;
+
+    long allocBefore = allocatedBytes();
+    for (int i = 0; i < aRounds; i++) {
+      long start = System.nanoTime();
+      found = aWork.run();
+      times[i] = (System.nanoTime() - start) / 1000000.0;
+    }
+    long allocAfter = allocatedBytes();
+
+    double total = 0.0;
+    for (double t : times)
+      total += t;
+    Arrays.sort(times);
+    double p50 = times[aRounds / 2];
+    double p99 = times[(aRounds * 99) / 100];
+
+    String alloc = (allocBefore < 0 || allocAfter < 0) ? "-" :
+        String.format("%.1f KB", (allocAfter - allocBefore) / 1024.0 / aRounds);
+    Double base = nativeTimes.get(aName);
+    String overhead = (base == null) ? "-" : String.format("%.3f", p50 - base);
+
+    System.out.println(String.format("  %-12s %7s %10.1f %9.3f %9.3f %12s %11s",
+        aName, found + "/" + aExpected,
+        (total > 0.0) ? aRounds * 1000.0 / total : 0.0, p50, p99, alloc,
+        overhead));
+  }
+
+  /**
+   * Bytes allocated on the Java heap by this thread so far, or -1 where the
+   * VM cannot tell (the method is specific to HotSpot's ThreadMXBean)
+   */
+  private static long allocatedBytes() {
+    try {
+      Object bean = ManagementFactory.getThreadMXBean();
+      Method method = Class.forName("com.sun.management.ThreadMXBean")
+          .getMethod("getThreadAllocatedBytes", long.class);
+      return ((Long)method.invoke(bean,
+          Long.valueOf(Thread.currentThread().getId()))).longValue();
+    } catch (Exception e) {
+      return -1;
+    }
+  }
+
+  private static void readNative(File aFile) throws IOException {
+    if (!aFile.exists())
+      return;
+
+    BufferedReader reader = new BufferedReader(new FileReader(aFile));
+    String line;
+    while ((line = reader.readLine()) != null) {
+      String []fields = line.trim().split("\\s+");
+      if (fields.length > 3 && !fields[0].startsWith("#"))
+        nativeTimes.put(fields[0], Double.valueOf(fields[3]));
+    }
+    reader.close();
+  }
+
+  /**
+   * Read a binary PGM or PPM as written by dmtxbench into a byte raster,
+   * which DMTXImage.getTags scans in place
+   */
+  private static BufferedImage readPnm(File aFile) throws IOException {
+    DataInputStream in = new DataInputStream(new BufferedInputStream(
+        new FileInputStream(aFile)));
+    try {
+      String type = readToken(in);
+      int width = Integer.parseInt(readToken(in));
+      int height = Integer.parseInt(readToken(in));
+      readToken(in); // maxval, always 255
+
+      boolean gray = type.equals("P5");
+      BufferedImage image = new BufferedImage(width, height,
+          gray ? BufferedImage.TYPE_BYTE_GRAY : BufferedImage.TYPE_3BYTE_BGR);
+      byte []data = ((DataBufferByte)image.getRaster().getDataBuffer()).getData();
+      in.readFully(data);
+
+      // PPM holds RGB, the raster BGR
+      for (int i = 0; !gray && i < data.length; i += 3) {
+        byte r = data[i];
+        data[i] = data[i + 2];
+        data[i + 2] = r;
+      }
+      return image;
+    } finally {
+      in.close();
+    }
+  }
+
+  private static String readToken(DataInputStream aIn) throws IOException {
+    StringBuffer token = new StringBuffer();
+    int c;
+    while ((c = aIn.read()) != -1) {
+      if (Character.isWhitespace((char)c)) {
+        if (token.length() > 0)
+          break;
+      }
+      else {
+        token.append((char)c);
+      }
+    }
+    return token.toString();
+  }
+}
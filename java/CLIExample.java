@@ -41,10 +41,9 @@ public class CLIExample {
     try {
       testImage = ImageIO.read(new File(aFile));
 
-      DMTXImage lDImg = new DMTXImage(testImage);
-
+      // Byte rasters (e.g. most decoded PNG/JPEG files) are scanned in place
       long startTime = System.currentTimeMillis();
-      tags = lDImg.getTags(4, SEARCH_TIMEOUT);
+      tags = DMTXImage.getTags(testImage, 4, SEARCH_TIMEOUT);
       decodingTime = System.currentTimeMillis() - startTime;
     } catch (Exception e) {
       System.out.println(e);
@@ -60,9 +59,57 @@ public class CLIExample {
     else {
       System.out.println("No tag found");
     }
+
+    // Stop scanning as soon as the first tag decodes
+    if (testImage != null) {
+      new DMTXImage(testImage).scanTags(SEARCH_TIMEOUT, new DMTXTagListener() {
+        public boolean tagFound(DMTXTag aTag) {
+          System.out.println("First tag: " + aTag.id);
+          return false;
+        }
+      });
+
+      // Where the time of a decode went
+      DMTXDecoder decoder = new DMTXDecoder();
+      decoder.getTags(new DMTXImage(testImage), 4, SEARCH_TIMEOUT);
+      System.out.println("Decode stats: " + decoder.getLastStats());
+
+      // Fit the search settings to the images this decoder will see
+      DMTXCalibration calib = DMTXProfile.calibrate(
+          new DMTXImage[] { new DMTXImage(testImage) },
+          new DMTXProfile(DMTXProfile.FIXED_SIZE_LABEL), SEARCH_TIMEOUT);
+      if (calib != null) {
+        System.out.println("Calibrated: " + calib + " (" +
+            calib.getSpeedup() + "x)");
+        decoder.setProfile(calib.profile);
+        decoder.getTags(new DMTXImage(testImage), 4, SEARCH_TIMEOUT);
+        System.out.println("Decode stats: " + decoder.getLastStats());
+      }
+      decoder.close();
+    }
+  }
+
+  // Multi-page PNM and uncompressed TIFF files are decoded from a mapping
+  // of the file, one page at a time
+  public static void decodePages(String aFile) throws java.io.IOException {
+    DMTXPageFile pages = new DMTXPageFile(new File(aFile));
+    DMTXDecoder decoder = new DMTXDecoder();
+    try {
+      DMTXTag [][]found = decoder.getTags(pages, 4, SEARCH_TIMEOUT);
+      for (int i = 0; i < found.length; i++) {
+        for (DMTXTag tag : found[i])
+          System.out.println("Page " + i + ": " + tag.id);
+      }
+    } finally {
+      decoder.close();
+      pages.close();
+    }
   }
 
-  public static void main(String []args) {
-    new CLIExample(args[0]);
+  public static void main(String []args) throws Exception {
+    if (args[0].matches("(?i).*\\.(pgm|ppm|pnm|tif|tiff)"))
+      decodePages(args[0]);
+    else
+      new CLIExample(args[0]);
   }
 }
@@ -0,0 +1,61 @@
+/* DO NOT EDIT THIS FILE - it is machine generated */
+#include <jni.h>
+/* Header for class org_libdmtx_DMTXDecoder */
+
+#ifndef _Included_org_libdmtx_DMTXDecoder
+#define _Included_org_libdmtx_DMTXDecoder
+#ifdef __cplusplus
+extern "C" {
+#endif
+/*
+ * Class:     org_libdmtx_DMTXDecoder
+ * Method:    nativeCreate
+ * Signature: ()J
+ */
+JNIEXPORT jlong JNICALL Java_org_libdmtx_DMTXDecoder_nativeCreate
+  (JNIEnv *, jclass);
+
+/*
+ * Class:     org_libdmtx_DMTXDecoder
+ * Method:    nativeGetTags
+ * Signature: (JII[III[I[I[III)[Ljava/lang/Object;
+ */
+JNIEXPORT jobjectArray JNICALL Java_org_libdmtx_DMTXDecoder_nativeGetTags
+  (JNIEnv *, jclass, jlong, jint, jint, jintArray, jint, jint, jintArray, jintArray, jintArray, jint, jint);
+
+/*
+ * Class:     org_libdmtx_DMTXDecoder
+ * Method:    nativeGetTagsDirect
+ * Signature: (JLjava/nio/ByteBuffer;IIIIII[I[I[III)[Ljava/lang/Object;
+ */
+JNIEXPORT jobjectArray JNICALL Java_org_libdmtx_DMTXDecoder_nativeGetTagsDirect
+  (JNIEnv *, jclass, jlong, jobject, jint, jint, jint, jint, jint, jint, jintArray, jintArray, jintArray, jint, jint);
+
+/*
+ * Class:     org_libdmtx_DMTXDecoder
+ * Method:    nativeGetStats
+ * Signature: (J[J)V
+ */
+JNIEXPORT void JNICALL Java_org_libdmtx_DMTXDecoder_nativeGetStats
+  (JNIEnv *, jclass, jlong, jlongArray);
+
+/*
+ * Class:     org_libdmtx_DMTXDecoder
+ * Method:    nativeSetProfile
+ * Signature: (J[I)V
+ */
+JNIEXPORT void JNICALL Java_org_libdmtx_DMTXDecoder_nativeSetProfile
+  (JNIEnv *, jclass, jlong, jintArray);
+
+/*
+ * Class:     org_libdmtx_DMTXDecoder
+ * Method:    nativeDestroy
+ * Signature: (J)V
+ */
+JNIEXPORT void JNICALL Java_org_libdmtx_DMTXDecoder_nativeDestroy
+  (JNIEnv *, jclass, jlong);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -25,11 +25,438 @@ Contact: mike@dragonflylogic.com
 /* $Id$ */
 
 #include "org_libdmtx_DMTXImage.h"
+#include "org_libdmtx_DMTXDecoder.h"
+#include "org_libdmtx_DMTXProfile.h"
 #include <stdio.h>
 #include <string.h>
 #include <math.h>
 #include <malloc.h>
+#include <stdint.h>
 #include <dmtx.h>
+#include "../../convert/dmtxconvert.h"
+#include "../../profile/dmtxprofile.h"
+#include "../../core/dmtxcore.h"
+
+/* Classes, constructors and fields resolved once in JNI_OnLoad */
+static jclass    gImageClass;
+static jclass    gTagClass;
+static jclass    gPointClass;
+static jclass    gByteArrayClass;
+static jclass    gModulesClass;
+static jclass    gThreadClass;
+static jclass    gListenerClass;
+static jclass    gIllegalArgumentClass;
+static jclass    gOutOfMemoryClass;
+static jmethodID gImageConstructor;
+static jmethodID gModulesConstructor;
+static jmethodID gTagConstructor;
+static jmethodID gPointConstructor;
+static jmethodID gThreadCurrent;
+static jmethodID gThreadIsInterrupted;
+static jmethodID gListenerTagFound;
+static jfieldID  gImageWidth;
+static jfieldID  gImageHeight;
+static jfieldID  gImageData;
+
+static void ThrowIllegalArgument(JNIEnv *aEnv, const char *aMessage);
+static void ThrowOutOfMemory(JNIEnv *aEnv, const char *aMessage);
+static void CacheTrim(jlong aMaxBytes);
+
+/**
+ * Find a class and keep a global reference to it
+ */
+static jclass
+FindGlobalClass(JNIEnv *aEnv, const char *aName)
+{
+   jclass lLocal, lGlobal;
+
+   lLocal = (*aEnv)->FindClass(aEnv, aName);
+   if(lLocal == NULL)
+      return NULL;
+
+   lGlobal = (jclass)(*aEnv)->NewGlobalRef(aEnv, lLocal);
+   (*aEnv)->DeleteLocalRef(aEnv, lLocal);
+
+   return lGlobal;
+}
+
+/**
+ * Drop the cached global references
+ */
+static void
+ReleaseCache(JNIEnv *aEnv)
+{
+   if(gImageClass != NULL)
+      (*aEnv)->DeleteGlobalRef(aEnv, gImageClass);
+   if(gTagClass != NULL)
+      (*aEnv)->DeleteGlobalRef(aEnv, gTagClass);
+   if(gPointClass != NULL)
+      (*aEnv)->DeleteGlobalRef(aEnv, gPointClass);
+   if(gByteArrayClass != NULL)
+      (*aEnv)->DeleteGlobalRef(aEnv, gByteArrayClass);
+   if(gModulesClass != NULL)
+      (*aEnv)->DeleteGlobalRef(aEnv, gModulesClass);
+   if(gThreadClass != NULL)
+      (*aEnv)->DeleteGlobalRef(aEnv, gThreadClass);
+   if(gListenerClass != NULL)
+      (*aEnv)->DeleteGlobalRef(aEnv, gListenerClass);
+   if(gIllegalArgumentClass != NULL)
+      (*aEnv)->DeleteGlobalRef(aEnv, gIllegalArgumentClass);
+   if(gOutOfMemoryClass != NULL)
+      (*aEnv)->DeleteGlobalRef(aEnv, gOutOfMemoryClass);
+
+   gImageClass = gTagClass = gPointClass = gByteArrayClass = NULL;
+   gModulesClass = gThreadClass = gListenerClass = NULL;
+   gIllegalArgumentClass = gOutOfMemoryClass = NULL;
+   gImageConstructor = gTagConstructor = gPointConstructor = NULL;
+   gModulesConstructor = gThreadCurrent = gThreadIsInterrupted = NULL;
+   gListenerTagFound = NULL;
+   gImageWidth = gImageHeight = gImageData = NULL;
+}
+
+/**
+ * Resolve the classes, methods and fields used by every call, so that no
+ * reflection lookups are needed while decoding
+ */
+JNIEXPORT jint JNICALL
+JNI_OnLoad(JavaVM *aVM, void *aReserved)
+{
+   JNIEnv *lEnv;
+
+   if((*aVM)->GetEnv(aVM, (void **)&lEnv, JNI_VERSION_1_4) != JNI_OK)
+      return JNI_ERR;
+
+   gImageClass = FindGlobalClass(lEnv, "org/libdmtx/DMTXImage");
+   gTagClass = FindGlobalClass(lEnv, "org/libdmtx/DMTXTag");
+   gPointClass = FindGlobalClass(lEnv, "java/awt/Point");
+   gByteArrayClass = FindGlobalClass(lEnv, "[B");
+   gModulesClass = FindGlobalClass(lEnv, "org/libdmtx/DMTXModules");
+   gThreadClass = FindGlobalClass(lEnv, "java/lang/Thread");
+   gListenerClass = FindGlobalClass(lEnv, "org/libdmtx/DMTXTagListener");
+   gIllegalArgumentClass = FindGlobalClass(lEnv, "java/lang/IllegalArgumentException");
+   gOutOfMemoryClass = FindGlobalClass(lEnv, "java/lang/OutOfMemoryError");
+   if(gImageClass == NULL || gTagClass == NULL || gPointClass == NULL ||
+         gByteArrayClass == NULL || gModulesClass == NULL ||
+         gThreadClass == NULL || gListenerClass == NULL ||
+         gIllegalArgumentClass == NULL || gOutOfMemoryClass == NULL) {
+      ReleaseCache(lEnv);
+      return JNI_ERR;
+   }
+
+   gImageConstructor = (*lEnv)->GetMethodID(lEnv, gImageClass, "<init>", "(II[I)V");
+   gTagConstructor = (*lEnv)->GetMethodID(
+      lEnv, gTagClass, "<init>",
+      "(Ljava/lang/String;Ljava/awt/Point;Ljava/awt/Point;Ljava/awt/Point;Ljava/awt/Point;)V"
+   );
+   gPointConstructor = (*lEnv)->GetMethodID(lEnv, gPointClass, "<init>", "(II)V");
+   gModulesConstructor = (*lEnv)->GetMethodID(lEnv, gModulesClass, "<init>", "(II[B)V");
+   gImageWidth = (*lEnv)->GetFieldID(lEnv, gImageClass, "width", "I");
+   gImageHeight = (*lEnv)->GetFieldID(lEnv, gImageClass, "height", "I");
+   gImageData = (*lEnv)->GetFieldID(lEnv, gImageClass, "data", "[I");
+   gThreadCurrent = (*lEnv)->GetStaticMethodID(lEnv, gThreadClass,
+         "currentThread", "()Ljava/lang/Thread;");
+   gThreadIsInterrupted = (*lEnv)->GetMethodID(lEnv, gThreadClass,
+         "isInterrupted", "()Z");
+   gListenerTagFound = (*lEnv)->GetMethodID(lEnv, gListenerClass,
+         "tagFound", "(Lorg/libdmtx/DMTXTag;)Z");
+   if(gImageConstructor == NULL || gTagConstructor == NULL ||
+         gPointConstructor == NULL || gModulesConstructor == NULL ||
+         gImageWidth == NULL ||
+         gImageHeight == NULL || gImageData == NULL ||
+         gThreadCurrent == NULL || gThreadIsInterrupted == NULL ||
+         gListenerTagFound == NULL) {
+      ReleaseCache(lEnv);
+      return JNI_ERR;
+   }
+
+   return JNI_VERSION_1_4;
+}
+
+JNIEXPORT void JNICALL
+JNI_OnUnload(JavaVM *aVM, void *aReserved)
+{
+   JNIEnv *lEnv;
+
+   if((*aVM)->GetEnv(aVM, (void **)&lEnv, JNI_VERSION_1_4) == JNI_OK)
+      ReleaseCache(lEnv);
+
+   CacheTrim(0);
+}
+
+/*
+ * Optional LRU cache of finished encodes, keyed on the kind of output and
+ * the ID. It is shared by all threads and guarded by the monitor of the
+ * DMTXImage class. A budget of 0 (the default) disables it.
+ */
+#define CACHE_BUCKETS 1024
+#define CACHE_IMAGE   1
+#define CACHE_MODULES 2
+
+typedef struct CacheEntry {
+   struct CacheEntry *prev;   /* LRU list, most recently used first */
+   struct CacheEntry *next;
+   struct CacheEntry *chain;  /* next entry in the same bucket */
+   uint32_t hash;
+   int kind;
+   int info[2];               /* width and height, or rows and cols */
+   int idSize;
+   int valueSize;
+   unsigned char bytes[1];    /* ID followed by value */
+} CacheEntry;
+
+static struct {
+   CacheEntry *buckets[CACHE_BUCKETS];
+   CacheEntry *head;
+   CacheEntry *tail;
+   jlong hits;
+   jlong misses;
+   jlong bytes;
+   jlong maxBytes;
+} gEncodeCache;
+
+static uint32_t
+CacheHash(int aKind, const char *aID, int aIDSize)
+{
+   uint32_t lHash = 2166136261U; /* FNV-1a */
+   int i;
+
+   lHash = (lHash ^ (unsigned char)aKind) * 16777619U;
+   for(i = 0; i < aIDSize; i++)
+      lHash = (lHash ^ (unsigned char)aID[i]) * 16777619U;
+
+   return lHash;
+}
+
+static CacheEntry *
+CacheFind(int aKind, const char *aID, int aIDSize, uint32_t aHash)
+{
+   CacheEntry *lEntry;
+
+   for(lEntry = gEncodeCache.buckets[aHash % CACHE_BUCKETS]; lEntry != NULL;
+         lEntry = lEntry->chain) {
+      if(lEntry->hash == aHash && lEntry->kind == aKind &&
+            lEntry->idSize == aIDSize && memcmp(lEntry->bytes, aID, aIDSize) == 0)
+         return lEntry;
+   }
+
+   return NULL;
+}
+
+static void
+CacheUnlink(CacheEntry *aEntry)
+{
+   if(aEntry->prev != NULL)
+      aEntry->prev->next = aEntry->next;
+   else
+      gEncodeCache.head = aEntry->next;
+
+   if(aEntry->next != NULL)
+      aEntry->next->prev = aEntry->prev;
+   else
+      gEncodeCache.tail = aEntry->prev;
+}
+
+static void
+CachePushFront(CacheEntry *aEntry)
+{
+   aEntry->prev = NULL;
+   aEntry->next = gEncodeCache.head;
+   if(gEncodeCache.head != NULL)
+      gEncodeCache.head->prev = aEntry;
+   else
+      gEncodeCache.tail = aEntry;
+   gEncodeCache.head = aEntry;
+}
+
+static void
+CacheRemove(CacheEntry *aEntry)
+{
+   CacheEntry **lLink = &gEncodeCache.buckets[aEntry->hash % CACHE_BUCKETS];
+
+   while(*lLink != aEntry)
+      lLink = &(*lLink)->chain;
+   *lLink = aEntry->chain;
+
+   CacheUnlink(aEntry);
+   gEncodeCache.bytes -= sizeof(CacheEntry) + aEntry->idSize + aEntry->valueSize;
+   free(aEntry);
+}
+
+static void
+CacheTrim(jlong aMaxBytes)
+{
+   while(gEncodeCache.tail != NULL && gEncodeCache.bytes > aMaxBytes)
+      CacheRemove(gEncodeCache.tail);
+}
+
+/**
+ * Look up an encode; the caller holds the cache monitor for as long as it
+ * uses the returned entry
+ */
+static CacheEntry *
+CacheGet(int aKind, const char *aID, int aIDSize)
+{
+   CacheEntry *lEntry;
+
+   if(gEncodeCache.maxBytes == 0)
+      return NULL;
+
+   lEntry = CacheFind(aKind, aID, aIDSize, CacheHash(aKind, aID, aIDSize));
+   if(lEntry == NULL) {
+      gEncodeCache.misses++;
+      return NULL;
+   }
+
+   CacheUnlink(lEntry);
+   CachePushFront(lEntry);
+   gEncodeCache.hits++;
+
+   return lEntry;
+}
+
+/**
+ * Store a copy of an encode, evicting the least recently used entries to
+ * stay within budget; the caller holds the cache monitor
+ */
+static void
+CachePut(int aKind, const char *aID, int aIDSize, int aInfo0, int aInfo1,
+      const void *aValue, int aValueSize)
+{
+   CacheEntry *lEntry;
+   uint32_t    lHash;
+   jlong       lSize = sizeof(CacheEntry) + aIDSize + aValueSize;
+
+   if(lSize > gEncodeCache.maxBytes)
+      return;
+
+   /* Another thread may have encoded the same ID meanwhile */
+   lHash = CacheHash(aKind, aID, aIDSize);
+   lEntry = CacheFind(aKind, aID, aIDSize, lHash);
+   if(lEntry != NULL)
+      CacheRemove(lEntry);
+
+   CacheTrim(gEncodeCache.maxBytes - lSize);
+
+   lEntry = (CacheEntry *)malloc(lSize);
+   if(lEntry == NULL)
+      return;
+
+   lEntry->hash = lHash;
+   lEntry->kind = aKind;
+   lEntry->info[0] = aInfo0;
+   lEntry->info[1] = aInfo1;
+   lEntry->idSize = aIDSize;
+   lEntry->valueSize = aValueSize;
+   memcpy(lEntry->bytes, aID, aIDSize);
+   memcpy(lEntry->bytes + aIDSize, aValue, aValueSize);
+
+   lEntry->chain = gEncodeCache.buckets[lHash % CACHE_BUCKETS];
+   gEncodeCache.buckets[lHash % CACHE_BUCKETS] = lEntry;
+   CachePushFront(lEntry);
+   gEncodeCache.bytes += lSize;
+}
+
+/**
+ * Create the DMTXImage of a 32bpp RGBX raster
+ */
+static jobject
+CreateImage(JNIEnv *aEnv, int aWidth, int aHeight, const void *aPixels)
+{
+   jintArray lJavaData;
+   jobject   lResult;
+
+   lJavaData = (*aEnv)->NewIntArray(aEnv, aWidth * aHeight);
+   if(lJavaData == NULL)
+      return NULL;
+
+   (*aEnv)->SetIntArrayRegion(aEnv, lJavaData, 0, aWidth * aHeight, (const jint *)aPixels);
+
+   lResult = (*aEnv)->NewObject(aEnv, gImageClass, gImageConstructor, aWidth, aHeight, lJavaData);
+   (*aEnv)->DeleteLocalRef(aEnv, lJavaData);
+
+   return lResult;
+}
+
+/**
+ * Create the DMTXModules of a packed module matrix
+ */
+static jobject
+CreateModules(JNIEnv *aEnv, int aRows, int aCols, const void *aBits)
+{
+   jbyteArray lJavaData;
+   jobject    lResult;
+   int        lSize = aRows * ((aCols + 7) / 8);
+
+   lJavaData = (*aEnv)->NewByteArray(aEnv, lSize);
+   if(lJavaData == NULL)
+      return NULL;
+
+   (*aEnv)->SetByteArrayRegion(aEnv, lJavaData, 0, lSize, (const jbyte *)aBits);
+
+   lResult = (*aEnv)->NewObject(aEnv, gModulesClass, gModulesConstructor, aRows, aCols, lJavaData);
+   (*aEnv)->DeleteLocalRef(aEnv, lJavaData);
+
+   return lResult;
+}
+
+JNIEXPORT void JNICALL
+Java_org_libdmtx_DMTXImage_setEncodeCacheSize(JNIEnv *aEnv, jclass aClass, jlong aMaxBytes)
+{
+   if(aMaxBytes < 0) {
+      ThrowIllegalArgument(aEnv, "cache size must not be negative");
+      return;
+   }
+
+   (*aEnv)->MonitorEnter(aEnv, gImageClass);
+   gEncodeCache.maxBytes = aMaxBytes;
+   CacheTrim(aMaxBytes);
+   (*aEnv)->MonitorExit(aEnv, gImageClass);
+}
+
+JNIEXPORT void JNICALL
+Java_org_libdmtx_DMTXImage_clearEncodeCache(JNIEnv *aEnv, jclass aClass)
+{
+   (*aEnv)->MonitorEnter(aEnv, gImageClass);
+   CacheTrim(0);
+   gEncodeCache.hits = gEncodeCache.misses = 0;
+   (*aEnv)->MonitorExit(aEnv, gImageClass);
+}
+
+JNIEXPORT jlong JNICALL
+Java_org_libdmtx_DMTXImage_getEncodeCacheHits(JNIEnv *aEnv, jclass aClass)
+{
+   jlong lValue;
+
+   (*aEnv)->MonitorEnter(aEnv, gImageClass);
+   lValue = gEncodeCache.hits;
+   (*aEnv)->MonitorExit(aEnv, gImageClass);
+
+   return lValue;
+}
+
+JNIEXPORT jlong JNICALL
+Java_org_libdmtx_DMTXImage_getEncodeCacheMisses(JNIEnv *aEnv, jclass aClass)
+{
+   jlong lValue;
+
+   (*aEnv)->MonitorEnter(aEnv, gImageClass);
+   lValue = gEncodeCache.misses;
+   (*aEnv)->MonitorExit(aEnv, gImageClass);
+
+   return lValue;
+}
+
+JNIEXPORT jlong JNICALL
+Java_org_libdmtx_DMTXImage_getEncodeCacheBytes(JNIEnv *aEnv, jclass aClass)
+{
+   jlong lValue;
+
+   (*aEnv)->MonitorEnter(aEnv, gImageClass);
+   lValue = gEncodeCache.bytes;
+   (*aEnv)->MonitorExit(aEnv, gImageClass);
+
+   return lValue;
+}
 
 /**
  * Construct from ID (static factory method since JNI doesn't allow native
@@ -38,217 +465,1207 @@ Contact: mike@dragonflylogic.com
 JNIEXPORT jobject JNICALL
 Java_org_libdmtx_DMTXImage_createTag(JNIEnv *aEnv, jclass aClass, jstring aID)
 {
-   DmtxEncode *lEncoded;
-   jclass      lImageClass;
-   jmethodID   lConstructor;
-   jobject     lResult;
-   jintArray   lJavaData;
-   int         lW, lH, lBPP;
-   jint       *lPixels;
+   DmtxEncode   *lEncoded;
+   DmtxPassFail  lStatus;
+   CacheEntry   *lCached;
+   jobject       lResult;
+   int           lW, lH, lBPP, lIDSize;
 
    /* Convert ID into string */
    const char *sStrID = (*aEnv)->GetStringUTFChars(aEnv, aID, NULL);
+   if(sStrID == NULL)
+      return NULL;
+   lIDSize = strlen(sStrID);
+
+   /* Repeated IDs are copied straight out of the cache */
+   (*aEnv)->MonitorEnter(aEnv, gImageClass);
+   lCached = CacheGet(CACHE_IMAGE, sStrID, lIDSize);
+   if(lCached != NULL) {
+      lResult = CreateImage(aEnv, lCached->info[0], lCached->info[1],
+            lCached->bytes + lCached->idSize);
+      (*aEnv)->MonitorExit(aEnv, gImageClass);
+      (*aEnv)->ReleaseStringUTFChars(aEnv, aID, sStrID);
+      return lResult;
+   }
+   (*aEnv)->MonitorExit(aEnv, gImageClass);
 
    /* Create Data Matrix */
    lEncoded = dmtxEncodeCreate();
+   if(lEncoded == NULL) {
+      (*aEnv)->ReleaseStringUTFChars(aEnv, aID, sStrID);
+      return NULL;
+   }
 
    dmtxEncodeSetProp(lEncoded, DmtxPropPixelPacking, DmtxPack32bppRGBX);
    dmtxEncodeSetProp(lEncoded, DmtxPropImageFlip, DmtxFlipNone);
 
-   dmtxEncodeDataMatrix(lEncoded, strlen(sStrID), (unsigned char *)sStrID);
-
-   /* Finished with ID, so release it */
-   (*aEnv)->ReleaseStringUTFChars(aEnv, aID, sStrID);
-
-   /* Find DMTXImage class */
-   lImageClass = (*aEnv)->FindClass(aEnv, "org/libdmtx/DMTXImage");
-   if(lImageClass == NULL)
-      return NULL;
-
-   /* Find constructor */
-   lConstructor = (*aEnv)->GetMethodID(aEnv, lImageClass, "<init>", "(II[I)V");
-   if(lConstructor == NULL)
+   lStatus = dmtxEncodeDataMatrix(lEncoded, lIDSize, (unsigned char *)sStrID);
+   if(lStatus == DmtxFail) {
+      (*aEnv)->ReleaseStringUTFChars(aEnv, aID, sStrID);
+      dmtxEncodeDestroy(&lEncoded);
       return NULL;
+   }
 
    /* Get properties from image */
    lW = dmtxImageGetProp(lEncoded->image, DmtxPropWidth);
    lH = dmtxImageGetProp(lEncoded->image, DmtxPropHeight);
    lBPP = dmtxImageGetProp(lEncoded->image, DmtxPropBytesPerPixel);
 
-   if(lBPP != 4)
-      return NULL;
-
-   /* Copy Pixel Data */
-   lJavaData = (*aEnv)->NewIntArray(aEnv, lW * lH);
-   lPixels = (*aEnv)->GetIntArrayElements(aEnv, lJavaData, NULL);
+   lResult = NULL;
+   if(lBPP == 4) {
+      /* Copy Pixel Data into a new Image instance */
+      lResult = CreateImage(aEnv, lW, lH, lEncoded->image->pxl);
 
-   memcpy(lPixels, lEncoded->image->pxl, lW * lH * 4);
-
-   (*aEnv)->ReleaseIntArrayElements(aEnv, lJavaData, lPixels, 0);
+      (*aEnv)->MonitorEnter(aEnv, gImageClass);
+      CachePut(CACHE_IMAGE, sStrID, lIDSize, lW, lH, lEncoded->image->pxl, lW * lH * 4);
+      (*aEnv)->MonitorExit(aEnv, gImageClass);
+   }
 
-   /* Create Image instance */
-   lResult = (*aEnv)->NewObject(aEnv, lImageClass, lConstructor, lW, lH, lJavaData);
-   if(lResult == NULL)
-      return NULL;
+   /* Finished with ID, so release it */
+   (*aEnv)->ReleaseStringUTFChars(aEnv, aID, sStrID);
 
    /* Destroy original image */
    dmtxEncodeDestroy(&lEncoded);
 
-   /* Free local references */
-   (*aEnv)->DeleteLocalRef(aEnv, lJavaData);
-   (*aEnv)->DeleteLocalRef(aEnv, lImageClass);
-
    return lResult;
 }
 
 /**
- * Decode the image, returning tags found (as DMTXTag objects)
+ * Encode an ID and return its module matrix as a DMTXModules, one bit per
+ * module, without copying out a rendered image
  */
-JNIEXPORT jobjectArray JNICALL
-Java_org_libdmtx_DMTXImage_getTags(JNIEnv *aEnv, jobject aImage,
-      jint aTagCount, jint lSearchTimeout)
+JNIEXPORT jobject JNICALL
+Java_org_libdmtx_DMTXImage_createModules(JNIEnv *aEnv, jclass aClass, jstring aID)
 {
-   jclass        lImageClass, lTagClass, lPointClass;
-   jmethodID     lTagConstructor, lPointConstructor;
-   jfieldID      lWidth, lHeight, lData;
-   DmtxImage    *lImage;
-   DmtxDecode   *lDecode;
-   DmtxRegion   *lRegion;
-   DmtxTime      lTimeout;
-   int           lW, lH, lI;
-   jintArray     lJavaData;
-   jint         *lPixels;
-   jobject      *lTags;
-   jobjectArray  lResult;
-   int           lTagCount = 0;
+   DmtxEncode    *lEncoded;
+   DmtxPassFail   lStatus;
+   CacheEntry    *lCached;
+   unsigned char *lBits;
+   jobject        lResult;
+   int            lRows, lCols, lRowBytes, lRow, lCol, lIDSize;
 
-   /* Find DMTXImage class */
-   lImageClass = (*aEnv)->FindClass(aEnv, "org/libdmtx/DMTXImage");
-   if(lImageClass == NULL)
+   /* Convert ID into string */
+   const char *sStrID = (*aEnv)->GetStringUTFChars(aEnv, aID, NULL);
+   if(sStrID == NULL)
       return NULL;
+   lIDSize = strlen(sStrID);
 
-   /* Find Tag class */
-   lTagClass = (*aEnv)->FindClass(aEnv, "org/libdmtx/DMTXTag");
-   if(lTagClass == NULL)
-      return NULL;
+   (*aEnv)->MonitorEnter(aEnv, gImageClass);
+   lCached = CacheGet(CACHE_MODULES, sStrID, lIDSize);
+   if(lCached != NULL) {
+      lResult = CreateModules(aEnv, lCached->info[0], lCached->info[1],
+            lCached->bytes + lCached->idSize);
+      (*aEnv)->MonitorExit(aEnv, gImageClass);
+      (*aEnv)->ReleaseStringUTFChars(aEnv, aID, sStrID);
+      return lResult;
+   }
+   (*aEnv)->MonitorExit(aEnv, gImageClass);
 
-   /* Find Point class */
-   lPointClass = (*aEnv)->FindClass(aEnv, "java/awt/Point");
-   if(lPointClass == NULL)
+   /* libdmtx always renders, so keep that raster as small as possible */
+   lEncoded = dmtxEncodeCreate();
+   if(lEncoded == NULL) {
+      (*aEnv)->ReleaseStringUTFChars(aEnv, aID, sStrID);
       return NULL;
+   }
 
-   /* Find constructors */
-   lTagConstructor = (*aEnv)->GetMethodID(
-      aEnv, lTagClass, "<init>",
-      "(Ljava/lang/String;Ljava/awt/Point;Ljava/awt/Point;Ljava/awt/Point;Ljava/awt/Point;)V"
-   );
+   dmtxEncodeSetProp(lEncoded, DmtxPropModuleSize, 1);
+   dmtxEncodeSetProp(lEncoded, DmtxPropMarginSize, 0);
 
-   lPointConstructor = (*aEnv)->GetMethodID(aEnv, lPointClass, "<init>", "(II)V");
-   if(lTagConstructor == NULL || lPointConstructor == NULL)
+   lStatus = dmtxEncodeDataMatrix(lEncoded, lIDSize, (unsigned char *)sStrID);
+   if(lStatus == DmtxFail) {
+      (*aEnv)->ReleaseStringUTFChars(aEnv, aID, sStrID);
+      dmtxEncodeDestroy(&lEncoded);
       return NULL;
+   }
 
-   /* Find fields */
-   lWidth = (*aEnv)->GetFieldID(aEnv, lImageClass, "width", "I");
-   lHeight = (*aEnv)->GetFieldID(aEnv, lImageClass, "height", "I");
-   lData = (*aEnv)->GetFieldID(aEnv, lImageClass, "data", "[I");
+   lRows = dmtxGetSymbolAttribute(DmtxSymAttribSymbolRows, lEncoded->region.sizeIdx);
+   lCols = dmtxGetSymbolAttribute(DmtxSymAttribSymbolCols, lEncoded->region.sizeIdx);
+   lRowBytes = (lCols + 7) / 8;
 
-   if(lWidth == NULL || lHeight == NULL || lData == NULL)
+   lBits = (unsigned char *)calloc(lRows, lRowBytes);
+   if(lBits == NULL) {
+      (*aEnv)->ReleaseStringUTFChars(aEnv, aID, sStrID);
+      dmtxEncodeDestroy(&lEncoded);
       return NULL;
+   }
 
-   /* Get fields */
-   lW = (*aEnv)->GetIntField(aEnv, aImage, lWidth);
-   lH = (*aEnv)->GetIntField(aEnv, aImage, lHeight);
+   /* libdmtx counts symbol rows from the bottom */
+   for(lRow = 0; lRow < lRows; lRow++) {
+      unsigned char *lOut = lBits + (lRows - 1 - lRow) * lRowBytes;
 
-   lJavaData = (*aEnv)->GetObjectField(aEnv, aImage, lData);
-   lPixels = (*aEnv)->GetIntArrayElements(aEnv, lJavaData, NULL);
+      for(lCol = 0; lCol < lCols; lCol++) {
+         if(dmtxSymbolModuleStatus(lEncoded->message, lEncoded->region.sizeIdx,
+               lRow, lCol) & DmtxModuleOnRGB)
+            lOut[lCol >> 3] |= 0x80 >> (lCol & 7);
+      }
+   }
 
-   /* Create DmtxImage object */
-   lImage = dmtxImageCreate((unsigned char *)lPixels, lW, lH, DmtxPack32bppRGBX);
-   if(lImage == NULL)
-      return NULL;
+   dmtxEncodeDestroy(&lEncoded);
 
-   /* Create DmtxDecode object */
-   lDecode = dmtxDecodeCreate(lImage, 1);
-   if(lDecode == NULL)
+   /* Copy the packed modules in one go */
+   lResult = CreateModules(aEnv, lRows, lCols, lBits);
+
+   (*aEnv)->MonitorEnter(aEnv, gImageClass);
+   CachePut(CACHE_MODULES, sStrID, lIDSize, lRows, lCols, lBits, lRows * lRowBytes);
+   (*aEnv)->MonitorExit(aEnv, gImageClass);
+
+   (*aEnv)->ReleaseStringUTFChars(aEnv, aID, sStrID);
+   free(lBits);
+
+   return lResult;
+}
+
+/* Native state behind org.libdmtx.DMTXDecoder */
+typedef struct {
+   DmtxCoreDecoder decoder;
+   unsigned char *luma;
+   size_t         lumaSize;
+   DmtxProfile    profile;
+   DmtxCoreStats  stats;
+} DecoderState;
+
+/* Fields of org.libdmtx.DMTXDecodeStats, in the order of DmtxCoreStats */
+#define DECODE_STATS_FIELDS 7
+
+/* Fields of a DMTXProfile, in the order of DMTXProfile.getValues() */
+#define PROFILE_FIELDS 6
+
+/* Tag found by a scan, before any Java objects are created for it */
+typedef struct {
+   char *message;
+   int   length;
+   jint  corners[8];
+} FoundTag;
+
+/* Tags collected by AddTag, up to capacity */
+typedef struct {
+   FoundTag *tags;
+   int       count;
+   int       capacity;
+   int       failed;
+} TagList;
+
+/* DMTXImage.scanTags listener and what it was handed so far */
+typedef struct {
+   JNIEnv  *env;
+   jobject  listener;
+   jint     count;
+} TagListener;
+
+static void InitScan(DmtxCoreScan *aScan, JNIEnv *aEnv, jint aTagCount,
+      jint aSearchTimeout, TagList *aList);
+static int FinishScan(DmtxCoreScan *aScan, TagList *aList, FoundTag **aTags);
+static int CollectTags(JNIEnv *aEnv, DmtxDecode *aDecode, jint aTagCount,
+      jint aSearchTimeout, FoundTag **aTags);
+static int AddTag(void *aContext, const DmtxCoreResult *aResult);
+static int HandTag(void *aContext, const DmtxCoreResult *aResult);
+static int ScanInterrupted(void *aEnv);
+static jobject CreateTag(JNIEnv *aEnv, const FoundTag *aTag);
+static jobjectArray CreateTags(JNIEnv *aEnv, FoundTag *aTags, int aTagCount);
+static jobjectArray CreateTagData(JNIEnv *aEnv, FoundTag *aTags,
+      int aTagCount, jintArray aCorners);
+static jobjectArray CreateResults(JNIEnv *aEnv, FoundTag *aTags,
+      int aTagCount, jintArray aCorners);
+static void FreeTags(FoundTag *aTags, int aTagCount);
+
+/**
+ * Convert the int[] data of a DMTXImage to a new 8 bit luma image, so that
+ * the array is only pinned while it is read once and libdmtx then reads a
+ * single byte per pixel. Destroy the image with dmtxConvertImageDestroy().
+ */
+static DmtxImage *
+CreateLumaImage(JNIEnv *aEnv, jobject aImage, int *aH)
+{
+   DmtxImage     *lImage;
+   unsigned char *lLuma;
+   int            lW, lH, lPacking;
+   jint           lOne = 1;
+   jintArray      lJavaData;
+   jint          *lPixels;
+
+   /* Get fields */
+   lW = (*aEnv)->GetIntField(aEnv, aImage, gImageWidth);
+   lH = (*aEnv)->GetIntField(aEnv, aImage, gImageHeight);
+   *aH = lH;
+
+   lJavaData = (*aEnv)->GetObjectField(aEnv, aImage, gImageData);
+   if(lJavaData == NULL || lW <= 0 || lH <= 0 ||
+         (*aEnv)->GetArrayLength(aEnv, lJavaData) / lW < lH) {
+      if(lJavaData != NULL)
+         (*aEnv)->DeleteLocalRef(aEnv, lJavaData);
+      ThrowIllegalArgument(aEnv, "Image data is smaller than width * height");
       return NULL;
+   }
 
-   /* Allocate temporary Tag array */
-   lTags = (jobject *)malloc(aTagCount * sizeof(jobject));
-   if(lTags == NULL)
+   lLuma = (unsigned char *)malloc((size_t)lW * lH);
+   if(lLuma == NULL) {
+      (*aEnv)->DeleteLocalRef(aEnv, lJavaData);
+      ThrowOutOfMemory(aEnv, "Unable to allocate the luma image");
       return NULL;
+   }
 
-   /* Find all tags that we can inside timeout */
-   lTimeout = dmtxTimeAdd(dmtxTimeNow(), lSearchTimeout);
+   /* The ints hold 0xXXRRGGBB, so blue comes first on little-endian CPUs */
+   lPacking = (*(unsigned char *)&lOne == 1) ? DmtxPack32bppBGRX : DmtxPack32bppXRGB;
 
-   while(lTagCount < aTagCount && (lRegion = dmtxRegionFindNext(lDecode, &lTimeout))) {
-      jstring sStringID;
-      DmtxMessage *lMessage = dmtxDecodeMatrixRegion(lDecode, lRegion, DmtxUndefined);
+   lPixels = (jint *)(*aEnv)->GetPrimitiveArrayCritical(aEnv, lJavaData, NULL);
+   if(lPixels != NULL) {
+      dmtxConvertToLuma(lLuma, lW, (const unsigned char *)lPixels, lW * 4,
+            lW, lH, lPacking, 0);
+      (*aEnv)->ReleasePrimitiveArrayCritical(aEnv, lJavaData, lPixels, JNI_ABORT);
+   }
+   (*aEnv)->DeleteLocalRef(aEnv, lJavaData);
 
-      if(lMessage != NULL) {
-         DmtxVector2 lCorner1, lCorner2, lCorner3, lCorner4;
-         jobject lJCorner1, lJCorner2, lJCorner3, lJCorner4;
+   /* A NULL array already left an OutOfMemoryError pending */
+   if(lPixels == NULL) {
+      free(lLuma);
+      return NULL;
+   }
 
-         /* Calculate position of Tag */
-         lCorner1.X = lCorner1.Y = lCorner2.Y = lCorner4.X = 0.0;
-         lCorner2.X = lCorner4.Y = lCorner3.X = lCorner3.Y = 1.0;
+   lImage = dmtxImageCreate(lLuma, lW, lH, DmtxPack8bppK);
+   if(lImage == NULL) {
+      free(lLuma);
+      ThrowOutOfMemory(aEnv, "Unable to create the image");
+   }
 
-         dmtxMatrix3VMultiplyBy(&lCorner1, lRegion->fit2raw);
-         dmtxMatrix3VMultiplyBy(&lCorner2, lRegion->fit2raw);
-         dmtxMatrix3VMultiplyBy(&lCorner3, lRegion->fit2raw);
-         dmtxMatrix3VMultiplyBy(&lCorner4, lRegion->fit2raw);
+   return lImage;
+}
 
-         /* Create Location instances for corners */
-         lJCorner1 = (*aEnv)->NewObject(aEnv, lPointClass, lPointConstructor,
-               (int) lCorner1.X, (int) (lH - lCorner1.Y - 1));
+/**
+ * Decode the int[] data of a DMTXImage, returning DMTXTag objects, or the
+ * raw messages if aCorners is not NULL
+ */
+static jobjectArray
+GetImageTags(JNIEnv *aEnv, jobject aImage, jint aTagCount,
+      jint aSearchTimeout, jintArray aCorners)
+{
+   DmtxImage    *lImage;
+   DmtxDecode   *lDecode;
+   FoundTag     *lTags;
+   int           lH, lTagCount;
+   jobjectArray  lResult;
 
-         lJCorner2 = (*aEnv)->NewObject(aEnv, lPointClass, lPointConstructor,
-               (int) lCorner2.X, (int) (lH - lCorner2.Y - 1));
+   lImage = CreateLumaImage(aEnv, aImage, &lH);
+   if(lImage == NULL)
+      return NULL;
 
-         lJCorner3 = (*aEnv)->NewObject(aEnv, lPointClass, lPointConstructor,
-               (int) lCorner3.X, (int) (lH - lCorner3.Y - 1));
+   lResult = NULL;
 
-         lJCorner4 = (*aEnv)->NewObject(aEnv, lPointClass, lPointConstructor,
-               (int) lCorner4.X, (int) (lH - lCorner4.Y - 1));
+   lDecode = dmtxDecodeCreate(lImage, 1);
+   if(lDecode != NULL) {
+      lTagCount = CollectTags(aEnv, lDecode, aTagCount, aSearchTimeout, &lTags);
+      if(lTagCount >= 0) {
+         lResult = CreateResults(aEnv, lTags, lTagCount, aCorners);
+         FreeTags(lTags, lTagCount);
+      }
+      else {
+         ThrowOutOfMemory(aEnv, "Unable to allocate the decode results");
+      }
+      dmtxDecodeDestroy(&lDecode);
+   }
+   else {
+      ThrowOutOfMemory(aEnv, "Unable to create the decode");
+   }
+   dmtxConvertImageDestroy(&lImage);
 
-         /* Decode Message */
-         sStringID = (*aEnv)->NewStringUTF(aEnv, lMessage->output);
+   return lResult;
+}
 
-         /* Create Tag instance */
-         lTags[lTagCount] = (*aEnv)->NewObject(aEnv, lTagClass, lTagConstructor,
-               sStringID, lJCorner1, lJCorner2, lJCorner3, lJCorner4);
-         if(lTags[lTagCount] == NULL)
-            return NULL;
+/**
+ * Decode the image, returning tags found (as DMTXTag objects)
+ */
+JNIEXPORT jobjectArray JNICALL
+Java_org_libdmtx_DMTXImage_getTags(JNIEnv *aEnv, jobject aImage,
+      jint aTagCount, jint lSearchTimeout)
+{
+   return GetImageTags(aEnv, aImage, aTagCount, lSearchTimeout, NULL);
+}
 
-         /* Increment Count */
-         lTagCount++;
+/**
+ * Decode the image, returning the raw message of each tag found and
+ * storing their corners in aCorners
+ */
+JNIEXPORT jobjectArray JNICALL
+Java_org_libdmtx_DMTXImage_getTagData(JNIEnv *aEnv, jobject aImage,
+      jint aTagCount, jint aSearchTimeout, jintArray aCorners)
+{
+   return GetImageTags(aEnv, aImage, aTagCount, aSearchTimeout, aCorners);
+}
 
-         /* Free Message */
-         dmtxMessageDestroy(&lMessage);
-      }
+/**
+ * Decode the image, handing each DMTXTag to aListener as soon as it
+ * decodes. Stops when the listener returns false or throws, when the
+ * timeout runs out or when the thread is interrupted. Returns the number
+ * of tags handed to the listener.
+ */
+JNIEXPORT jint JNICALL
+Java_org_libdmtx_DMTXImage_scanTags(JNIEnv *aEnv, jobject aImage,
+      jint aSearchTimeout, jobject aListener)
+{
+   DmtxImage    *lImage;
+   DmtxDecode   *lDecode;
+   DmtxCoreScan  lScan;
+   TagListener   lListener;
+   int           lH;
 
-      /* Free Region */
-      dmtxRegionDestroy(&lRegion);
+   if(aListener == NULL) {
+      ThrowIllegalArgument(aEnv, "Listener must not be null");
+      return 0;
    }
 
-   /* Free DMTX Structures */
-   dmtxDecodeDestroy(&lDecode);
-   dmtxImageDestroy(&lImage);
-
-   /* Release Image Data */
-   (*aEnv)->ReleaseIntArrayElements(aEnv, lJavaData, lPixels, 0);
+   lImage = CreateLumaImage(aEnv, aImage, &lH);
+   if(lImage == NULL)
+      return 0;
+   lDecode = dmtxDecodeCreate(lImage, 1);
 
-   /* Create result array */
-   lResult = (*aEnv)->NewObjectArray(aEnv, lTagCount, lTagClass, NULL);
+   lListener.env = aEnv;
+   lListener.listener = aListener;
+   lListener.count = 0;
 
-   for(lI = 0; lI < lTagCount; lI++) {
-      (*aEnv)->SetObjectArrayElement(aEnv, lResult, lI, lTags[lI]);
+   /* Hand each tag over before looking for the next one */
+   if(lDecode != NULL) {
+      InitScan(&lScan, aEnv, DmtxUndefined, aSearchTimeout, NULL);
+      lScan.result = HandTag;
+      lScan.resultContext = &lListener;
+      dmtxCoreScanStart(&lScan);
+      dmtxCoreScanRun(&lScan, lDecode);
+      dmtxCoreScanFree(&lScan);
+      dmtxDecodeDestroy(&lDecode);
+   }
+   else {
+      ThrowOutOfMemory(aEnv, "Unable to create the decode");
    }
+   dmtxConvertImageDestroy(&lImage);
 
-   /* Free local references */
-   (*aEnv)->DeleteLocalRef(aEnv, lJavaData);
-   (*aEnv)->DeleteLocalRef(aEnv, lImageClass);
-   (*aEnv)->DeleteLocalRef(aEnv, lTagClass);
-   (*aEnv)->DeleteLocalRef(aEnv, lPointClass);
+   return lListener.count;
+}
 
-   return lResult;
+/**
+ * Throw an IllegalArgumentException with the given message
+ */
+static void
+ThrowIllegalArgument(JNIEnv *aEnv, const char *aMessage)
+{
+   (*aEnv)->ThrowNew(aEnv, gIllegalArgumentClass, aMessage);
+}
+
+/**
+ * Throw an OutOfMemoryError with the given message, so that a failed
+ * allocation does not look like an image without tags
+ */
+static void
+ThrowOutOfMemory(JNIEnv *aEnv, const char *aMessage)
+{
+   (*aEnv)->ThrowNew(aEnv, gOutOfMemoryClass, aMessage);
+}
+
+/**
+ * Check the geometry of caller supplied pixels against the size of their
+ * buffer, returning the bytes per pixel of aPacking (0 with an exception
+ * pending if the arguments are invalid)
+ */
+static int
+CheckPixels(JNIEnv *aEnv, jint aW, jint aH, jint aStride, jint aPacking,
+      jlong aCapacity)
+{
+   int lBPP;
+
+   switch(aPacking) {
+      case DmtxPack8bppK:
+         lBPP = 1;
+         break;
+      case DmtxPack24bppRGB:
+      case DmtxPack24bppBGR:
+         lBPP = 3;
+         break;
+      case DmtxPack32bppRGBX:
+      case DmtxPack32bppXRGB:
+      case DmtxPack32bppBGRX:
+      case DmtxPack32bppXBGR:
+         lBPP = 4;
+         break;
+      default:
+         ThrowIllegalArgument(aEnv, "Unsupported pixel packing");
+         return 0;
+   }
+
+   if(aW <= 0 || aH <= 0 || aStride < (jlong)aW * lBPP) {
+      ThrowIllegalArgument(aEnv, "Invalid image dimensions or stride");
+      return 0;
+   }
+
+   if((jlong)aStride * (aH - 1) + (jlong)aW * lBPP > aCapacity) {
+      ThrowIllegalArgument(aEnv, "Buffer is too small for the given dimensions");
+      return 0;
+   }
+
+   return lBPP;
+}
+
+/**
+ * Decode pixels in place without making any JNI calls, so that it is safe
+ * to use on memory from GetPrimitiveArrayCritical. Returns the number of
+ * tags found, or -1 if out of memory; the geometry has been checked by
+ * CheckPixels() already, so that is the only way the image or decode can
+ * fail to be created. The caller throws once it may make JNI calls again.
+ */
+static int
+ScanPixels(unsigned char *aPixels, jint aW, jint aH, jint aStride,
+      jint aPacking, jint aTagCount, jint aSearchTimeout, FoundTag **aTags)
+{
+   DmtxCoreDecoder lDecoder;
+   int             lCount = -1;
+
+   *aTags = NULL;
+
+   dmtxCoreDecoderInit(&lDecoder);
+   if(dmtxCoreDecoderPrepare(&lDecoder, aPixels, aW, aH, aStride, aPacking,
+         1) == DmtxPass)
+      lCount = CollectTags(NULL, lDecoder.decode, aTagCount, aSearchTimeout,
+            aTags);
+   dmtxCoreDecoderClear(&lDecoder);
+
+   return lCount;
+}
+
+/**
+ * Decode the pixels of a direct ByteBuffer where they are, returning
+ * DMTXTag objects, or the raw messages if aCorners is not NULL
+ */
+JNIEXPORT jobjectArray JNICALL
+Java_org_libdmtx_DMTXImage_nativeGetTagsDirect(JNIEnv *aEnv, jclass aClass,
+      jobject aBuffer, jint aW, jint aH, jint aStride, jint aPacking,
+      jint aTagCount, jint aSearchTimeout, jintArray aCorners)
+{
+   unsigned char *lPixels;
+   jlong          lCapacity;
+   int            lBPP, lCount;
+   FoundTag      *lTags;
+   jobjectArray   lResult;
+
+   lPixels = (unsigned char *)(*aEnv)->GetDirectBufferAddress(aEnv, aBuffer);
+   lCapacity = (*aEnv)->GetDirectBufferCapacity(aEnv, aBuffer);
+   if(lPixels == NULL || lCapacity < 0) {
+      ThrowIllegalArgument(aEnv, "Buffer is not a direct buffer");
+      return NULL;
+   }
+
+   lBPP = CheckPixels(aEnv, aW, aH, aStride, aPacking, lCapacity);
+   if(lBPP == 0)
+      return NULL;
+
+   lCount = ScanPixels(lPixels, aW, aH, aStride, aPacking, aTagCount,
+         aSearchTimeout, &lTags);
+   if(lCount < 0) {
+      ThrowOutOfMemory(aEnv, "Unable to decode the buffer");
+      return NULL;
+   }
+
+   lResult = CreateResults(aEnv, lTags, lCount, aCorners);
+   FreeTags(lTags, lCount);
+
+   return lResult;
+}
+
+/**
+ * Decode the pixels of a byte[] (e.g. the bank of a DataBufferByte) while
+ * it is pinned with GetPrimitiveArrayCritical
+ */
+JNIEXPORT jobjectArray JNICALL
+Java_org_libdmtx_DMTXImage_nativeGetTagsArray(JNIEnv *aEnv, jclass aClass,
+      jbyteArray aData, jint aOffset, jint aW, jint aH, jint aStride,
+      jint aPacking, jint aTagCount, jint aSearchTimeout, jintArray aCorners)
+{
+   unsigned char *lPixels;
+   jsize          lLength;
+   int            lBPP, lCount;
+   FoundTag      *lTags;
+   jobjectArray   lResult;
+
+   lLength = (*aEnv)->GetArrayLength(aEnv, aData);
+   if(aOffset < 0 || aOffset > lLength) {
+      ThrowIllegalArgument(aEnv, "Offset is outside the array");
+      return NULL;
+   }
+
+   lBPP = CheckPixels(aEnv, aW, aH, aStride, aPacking, lLength - aOffset);
+   if(lBPP == 0)
+      return NULL;
+
+   /* No JNI calls are allowed (and the GC may be held off) until released */
+   lPixels = (unsigned char *)(*aEnv)->GetPrimitiveArrayCritical(aEnv, aData, NULL);
+   if(lPixels == NULL)
+      return NULL;
+
+   lCount = ScanPixels(lPixels + aOffset, aW, aH, aStride, aPacking,
+         aTagCount, aSearchTimeout, &lTags);
+
+   (*aEnv)->ReleasePrimitiveArrayCritical(aEnv, aData, lPixels, JNI_ABORT);
+
+   /* Thrown only now that JNI calls are allowed again */
+   if(lCount < 0) {
+      ThrowOutOfMemory(aEnv, "Unable to decode the array");
+      return NULL;
+   }
+
+   lResult = CreateResults(aEnv, lTags, lCount, aCorners);
+   FreeTags(lTags, lCount);
+
+   return lResult;
+}
+
+/**
+ * Allocate the native state of a DMTXDecoder
+ */
+JNIEXPORT jlong JNICALL
+Java_org_libdmtx_DMTXDecoder_nativeCreate(JNIEnv *aEnv, jclass aClass)
+{
+   DecoderState *lState;
+
+   lState = (DecoderState *)calloc(1, sizeof(DecoderState));
+   if(lState != NULL)
+      dmtxProfileInit(&lState->profile, DmtxProfileDefault);
+
+   return (jlong)(intptr_t)lState;
+}
+
+/**
+ * Decode aPixels, reusing the DmtxDecode of the previous call when the
+ * geometry and packing are unchanged. The scan is limited to aRegion (x, y,
+ * width, height with rows counted from the top) if given. If aNear holds
+ * the corners of a tag from the previous frame, the box around them is
+ * scanned first and the rest only if no tag decodes there. With
+ * aPyramidShrink above 1 that full scan is done coarse-to-fine. The pixels
+ * only need to stay valid during the call.
+ */
+static jobjectArray
+DecoderScan(JNIEnv *aEnv, DecoderState *aState, unsigned char *aPixels,
+      jint aW, jint aH, jint aStride, jint aPacking, jint aTagCount,
+      jint aSearchTimeout, jintArray aCorners, jintArray aRegion,
+      jintArray aNear, jint aPadding, jint aPyramidShrink)
+{
+   DmtxCoreScan  lScan;
+   DmtxDecode   *lDecode;
+   TagList       lList;
+   jint          lRegion[4], lNear[8];
+   FoundTag     *lTags;
+   int           lTagCount;
+   jobjectArray  lResult;
+   double        lStart;
+
+   memset(&aState->stats, 0x00, sizeof(DmtxCoreStats));
+   lStart = dmtxCoreClock();
+
+   if(aRegion != NULL)
+      (*aEnv)->GetIntArrayRegion(aEnv, aRegion, 0, 4, lRegion);
+   if(aNear != NULL)
+      (*aEnv)->GetIntArrayRegion(aEnv, aNear, 0, 8, lNear);
+
+   /* The callers have checked the geometry, so only memory can run out */
+   if(dmtxCoreDecoderPrepare(&aState->decoder, aPixels, aW, aH, aStride,
+         aPacking, 1) != DmtxPass) {
+      ThrowOutOfMemory(aEnv, "Unable to create the image or decode");
+      return NULL;
+   }
+   lDecode = aState->decoder.decode;
+   if(aState->decoder.fresh)
+      dmtxProfileApply(lDecode, &aState->profile);
+
+   /* Setting the bounds also rebuilds the scan grid for the new frame */
+   if(aRegion == NULL)
+      dmtxCoreSetBounds(lDecode, 0, aW - 1, 0, aH - 1);
+   else if(dmtxCoreSetImageBounds(lDecode, lRegion[0], lRegion[0] + lRegion[2] - 1,
+         lRegion[1], lRegion[1] + lRegion[3] - 1) != DmtxPass) {
+      aState->decoder.image->pxl = NULL;
+      ThrowIllegalArgument(aEnv, "Scan region is outside the image");
+      return NULL;
+   }
+
+   aState->stats.setupUs = dmtxCoreClock() - lStart;
+
+   InitScan(&lScan, aEnv, aTagCount, aSearchTimeout, &lList);
+   lScan.pyramid = (aPyramidShrink > 1) ? aPyramidShrink : 1;
+   dmtxCoreScanStart(&lScan);
+
+   /* Look around the previous position first. Pixels tried there stay
+      marked in the scan cache, so a full scan after a miss skips them. */
+   if(aNear != NULL)
+      dmtxCoreScanNear(&lScan, lDecode, lNear, aPadding);
+   if(lScan.found == 0 && !lScan.stopped)
+      dmtxCoreDecoderScan(&aState->decoder, &lScan);
+
+   /* The caller only guarantees the pixels for the duration of this call */
+   aState->decoder.image->pxl = NULL;
+
+   dmtxCoreStatsAdd(&aState->stats, &lScan.stats);
+   lTagCount = FinishScan(&lScan, &lList, &lTags);
+   if(lTagCount < 0) {
+      ThrowOutOfMemory(aEnv, "Unable to allocate the decode results");
+      return NULL;
+   }
+
+   lStart = dmtxCoreClock();
+   lResult = CreateResults(aEnv, lTags, lTagCount, aCorners);
+   FreeTags(lTags, lTagCount);
+   aState->stats.marshalUs += dmtxCoreClock() - lStart;
+
+   return lResult;
+}
+
+/**
+ * Decode the int[] data of a DMTXImage with DecoderScan. The ints are
+ * converted to luma in a buffer kept by the decoder, so the array is only
+ * pinned while it is read once.
+ */
+JNIEXPORT jobjectArray JNICALL
+Java_org_libdmtx_DMTXDecoder_nativeGetTags(JNIEnv *aEnv, jclass aClass,
+      jlong aHandle, jint aW, jint aH, jintArray aData, jint aTagCount,
+      jint aSearchTimeout, jintArray aCorners, jintArray aRegion,
+      jintArray aNear, jint aPadding, jint aPyramidShrink)
+{
+   DecoderState  *lState = (DecoderState *)(intptr_t)aHandle;
+   unsigned char *lLuma;
+   jint          *lPixels;
+   jint           lOne = 1;
+   jboolean       lIsCopy;
+   jobjectArray   lResult;
+   double         lSetup;
+   size_t         lSize;
+
+   if(aW <= 0 || aH <= 0 || (*aEnv)->GetArrayLength(aEnv, aData) / aW < aH) {
+      ThrowIllegalArgument(aEnv, "Image data is smaller than width * height");
+      return NULL;
+   }
+
+   lSetup = dmtxCoreClock();
+   lSize = (size_t)aW * aH;
+   if(lState->lumaSize < lSize) {
+      lLuma = (unsigned char *)realloc(lState->luma, lSize);
+      if(lLuma == NULL) {
+         ThrowOutOfMemory(aEnv, "Unable to allocate the luma image");
+         return NULL;
+      }
+      lState->luma = lLuma;
+      lState->lumaSize = lSize;
+   }
+
+   lPixels = (jint *)(*aEnv)->GetPrimitiveArrayCritical(aEnv, aData, &lIsCopy);
+   if(lPixels == NULL)
+      return NULL;
+
+   /* The ints hold 0xXXRRGGBB, so blue comes first on little-endian CPUs */
+   dmtxConvertToLuma(lState->luma, aW, (const unsigned char *)lPixels, aW * 4,
+         aW, aH, (*(unsigned char *)&lOne == 1) ? DmtxPack32bppBGRX :
+         DmtxPack32bppXRGB, 0);
+   (*aEnv)->ReleasePrimitiveArrayCritical(aEnv, aData, lPixels, JNI_ABORT);
+   lSetup = dmtxCoreClock() - lSetup;
+
+   lResult = DecoderScan(aEnv, lState, lState->luma, aW, aH, aW,
+         DmtxPack8bppK, aTagCount, aSearchTimeout, aCorners, aRegion,
+         aNear, aPadding, aPyramidShrink);
+
+   /* The conversion counts as setup, as does the copy some VMs hand out
+      instead of pinning the array */
+   lState->stats.setupUs += lSetup;
+   lState->stats.bytesCopied += (long)lSize;
+   if(lIsCopy == JNI_TRUE)
+      lState->stats.bytesCopied += (long)lSize * 4;
+
+   return lResult;
+}
+
+/**
+ * Decode the pixels of a direct ByteBuffer in place with DecoderScan, e.g.
+ * 8 bpp luminance frames from a mono camera
+ */
+JNIEXPORT jobjectArray JNICALL
+Java_org_libdmtx_DMTXDecoder_nativeGetTagsDirect(JNIEnv *aEnv, jclass aClass,
+      jlong aHandle, jobject aBuffer, jint aW, jint aH, jint aStride,
+      jint aPacking, jint aTagCount, jint aSearchTimeout, jintArray aCorners,
+      jintArray aRegion, jintArray aNear, jint aPadding, jint aPyramidShrink)
+{
+   unsigned char *lPixels;
+   jlong          lCapacity;
+   int            lBPP;
+
+   lPixels = (unsigned char *)(*aEnv)->GetDirectBufferAddress(aEnv, aBuffer);
+   lCapacity = (*aEnv)->GetDirectBufferCapacity(aEnv, aBuffer);
+   if(lPixels == NULL || lCapacity < 0) {
+      ThrowIllegalArgument(aEnv, "Buffer is not a direct buffer");
+      return NULL;
+   }
+
+   lBPP = CheckPixels(aEnv, aW, aH, aStride, aPacking, lCapacity);
+   if(lBPP == 0)
+      return NULL;
+
+   /* Direct buffers are not moved by the garbage collector, so the scan
+      can keep checking for interrupts */
+   return DecoderScan(aEnv, (DecoderState *)(intptr_t)aHandle, lPixels, aW,
+         aH, aStride, aPacking, aTagCount, aSearchTimeout, aCorners,
+         aRegion, aNear, aPadding, aPyramidShrink);
+}
+
+/**
+ * Copy the stats of the last decode of a DMTXDecoder into aStats, in the
+ * order of the fields of DmtxCoreStats
+ */
+JNIEXPORT void JNICALL
+Java_org_libdmtx_DMTXDecoder_nativeGetStats(JNIEnv *aEnv, jclass aClass,
+      jlong aHandle, jlongArray aStats)
+{
+   DecoderState *lState = (DecoderState *)(intptr_t)aHandle;
+   jlong         lValues[DECODE_STATS_FIELDS];
+
+   if((*aEnv)->GetArrayLength(aEnv, aStats) < DECODE_STATS_FIELDS) {
+      ThrowIllegalArgument(aEnv, "Stats array is too short");
+      return;
+   }
+
+   lValues[0] = (jlong)lState->stats.setupUs;
+   lValues[1] = (jlong)lState->stats.searchUs;
+   lValues[2] = (jlong)lState->stats.decodeUs;
+   lValues[3] = (jlong)lState->stats.marshalUs;
+   lValues[4] = lState->stats.regionsExamined;
+   lValues[5] = lState->stats.regionsRejected;
+   lValues[6] = lState->stats.bytesCopied;
+
+   (*aEnv)->SetLongArrayRegion(aEnv, aStats, 0, DECODE_STATS_FIELDS, lValues);
+}
+
+/**
+ * Free the native state of a DMTXDecoder
+ */
+JNIEXPORT void JNICALL
+Java_org_libdmtx_DMTXDecoder_nativeDestroy(JNIEnv *aEnv, jclass aClass,
+      jlong aHandle)
+{
+   DecoderState *lState = (DecoderState *)(intptr_t)aHandle;
+
+   if(lState == NULL)
+      return;
+
+   dmtxCoreDecoderClear(&lState->decoder);
+
+   free(lState->luma);
+   free(lState);
+}
+
+/**
+ * Read the settings of a DMTXProfile (see PROFILE_FIELDS). Java never
+ * shrinks images, so neither does the profile.
+ */
+static void
+ProfileFromValues(const jint *aValues, DmtxProfile *aProfile)
+{
+   aProfile->sizeIdxExpected = aValues[0];
+   aProfile->edgeMin = aValues[1];
+   aProfile->edgeMax = aValues[2];
+   aProfile->scanGap = aValues[3];
+   aProfile->squareDevn = aValues[4];
+   aProfile->edgeThresh = aValues[5];
+   aProfile->shrink = 1;
+}
+
+static void
+ProfileToValues(const DmtxProfile *aProfile, jint *aValues)
+{
+   aValues[0] = aProfile->sizeIdxExpected;
+   aValues[1] = aProfile->edgeMin;
+   aValues[2] = aProfile->edgeMax;
+   aValues[3] = aProfile->scanGap;
+   aValues[4] = aProfile->squareDevn;
+   aValues[5] = aProfile->edgeThresh;
+}
+
+/**
+ * Store the profile used by the following decodes of a DMTXDecoder, or the
+ * defaults if aValues is null. The DmtxDecode is rebuilt by the next decode
+ * so that no setting of the previous profile is left behind.
+ */
+JNIEXPORT void JNICALL
+Java_org_libdmtx_DMTXDecoder_nativeSetProfile(JNIEnv *aEnv, jclass aClass,
+      jlong aHandle, jintArray aValues)
+{
+   DecoderState *lState = (DecoderState *)(intptr_t)aHandle;
+   jint          lValues[PROFILE_FIELDS];
+
+   if(aValues == NULL) {
+      dmtxProfileInit(&lState->profile, DmtxProfileDefault);
+   }
+   else {
+      if((*aEnv)->GetArrayLength(aEnv, aValues) < PROFILE_FIELDS) {
+         ThrowIllegalArgument(aEnv, "Profile array is too short");
+         return;
+      }
+      (*aEnv)->GetIntArrayRegion(aEnv, aValues, 0, PROFILE_FIELDS, lValues);
+      ProfileFromValues(lValues, &lState->profile);
+   }
+
+   dmtxCoreDecoderClear(&lState->decoder);
+}
+
+/**
+ * Store the settings of a named profile in aValues, returning false if
+ * there is no such profile
+ */
+JNIEXPORT jboolean JNICALL
+Java_org_libdmtx_DMTXProfile_nativeInit(JNIEnv *aEnv, jclass aClass,
+      jint aName, jintArray aValues)
+{
+   DmtxProfile lProfile;
+   jint        lValues[PROFILE_FIELDS];
+
+   if(dmtxProfileInit(&lProfile, aName) != DmtxPass)
+      return JNI_FALSE;
+
+   ProfileToValues(&lProfile, lValues);
+   (*aEnv)->SetIntArrayRegion(aEnv, aValues, 0, PROFILE_FIELDS, lValues);
+
+   return JNI_TRUE;
+}
+
+/**
+ * Calibrate a profile on the luma of aSamples, starting from the settings
+ * in aValues and storing the result there. The milliseconds all samples
+ * take with the defaults and with the result go to aMillis. Returns the
+ * number of tags found with the defaults, 0 if none were.
+ */
+JNIEXPORT jint JNICALL
+Java_org_libdmtx_DMTXProfile_nativeCalibrate(JNIEnv *aEnv, jclass aClass,
+      jobjectArray aSamples, jintArray aValues, jint aSearchTimeout,
+      jdoubleArray aMillis)
+{
+   DmtxImage      **lImages;
+   DmtxProfile      lStart;
+   DmtxCalibration  lCalib;
+   jint             lValues[PROFILE_FIELDS];
+   jdouble          lMillis[2];
+   jobject          lSample;
+   jint             lTagCount = 0;
+   int              i, lCount, lH;
+
+   if((*aEnv)->GetArrayLength(aEnv, aValues) < PROFILE_FIELDS ||
+         (*aEnv)->GetArrayLength(aEnv, aMillis) < 2) {
+      ThrowIllegalArgument(aEnv, "Result arrays are too short");
+      return 0;
+   }
+
+   lCount = (*aEnv)->GetArrayLength(aEnv, aSamples);
+   lImages = (DmtxImage **)calloc(lCount, sizeof(DmtxImage *));
+   if(lImages == NULL)
+      return 0;
+
+   for(i = 0; i < lCount; i++) {
+      lSample = (*aEnv)->GetObjectArrayElement(aEnv, aSamples, i);
+      if(lSample == NULL) {
+         ThrowIllegalArgument(aEnv, "Sample must not be null");
+         break;
+      }
+      lImages[i] = CreateLumaImage(aEnv, lSample, &lH);
+      (*aEnv)->DeleteLocalRef(aEnv, lSample);
+      if(lImages[i] == NULL)
+         break;
+   }
+
+   if(i == lCount) {
+      (*aEnv)->GetIntArrayRegion(aEnv, aValues, 0, PROFILE_FIELDS, lValues);
+      ProfileFromValues(lValues, &lStart);
+
+      if(dmtxProfileCalibrate(&lCalib, lImages, lCount, &lStart,
+            aSearchTimeout) == DmtxPass) {
+         ProfileToValues(&lCalib.profile, lValues);
+         (*aEnv)->SetIntArrayRegion(aEnv, aValues, 0, PROFILE_FIELDS, lValues);
+         lMillis[0] = lCalib.defaultMs;
+         lMillis[1] = lCalib.profileMs;
+         (*aEnv)->SetDoubleArrayRegion(aEnv, aMillis, 0, 2, lMillis);
+         lTagCount = lCalib.symbolCount;
+      }
+   }
+
+   for(i = 0; i < lCount && lImages[i] != NULL; i++)
+      dmtxConvertImageDestroy(&lImages[i]);
+   free(lImages);
+
+   return lTagCount;
+}
+
+/**
+ * Set up aScan for up to aTagCount tags inside the timeout, collected into
+ * aList unless that is NULL. If aEnv is not NULL the scan also stops when
+ * the calling Java thread is interrupted.
+ */
+static void
+InitScan(DmtxCoreScan *aScan, JNIEnv *aEnv, jint aTagCount,
+      jint aSearchTimeout, TagList *aList)
+{
+   dmtxCoreScanInit(aScan);
+   aScan->maxCount = aTagCount;
+   aScan->timeoutMs = aSearchTimeout;
+
+   if(aEnv != NULL) {
+      aScan->cancel = ScanInterrupted;
+      aScan->cancelContext = aEnv;
+   }
+
+   if(aList != NULL) {
+      memset(aList, 0x00, sizeof(TagList));
+      aList->capacity = aTagCount;
+      aScan->result = AddTag;
+      aScan->resultContext = aList;
+   }
+}
+
+/**
+ * Free aScan and pass the tags it collected to *aTags. Returns their
+ * number, or -1 (having freed them) if out of memory.
+ */
+static int
+FinishScan(DmtxCoreScan *aScan, TagList *aList, FoundTag **aTags)
+{
+   int lFailed = aScan->failed || aList->failed;
+
+   dmtxCoreScanFree(aScan);
+
+   *aTags = aList->tags;
+   if(lFailed) {
+      FreeTags(aList->tags, aList->count);
+      *aTags = NULL;
+      return -1;
+   }
+
+   return aList->count;
+}
+
+/**
+ * Find and decode up to aTagCount regions of aDecode inside the timeout,
+ * storing their messages and corners in *aTags. If aEnv is not NULL the
+ * scan also stops when the calling Java thread is interrupted. Returns the
+ * number of tags found, or -1 if out of memory.
+ */
+static int
+CollectTags(JNIEnv *aEnv, DmtxDecode *aDecode, jint aTagCount,
+      jint aSearchTimeout, FoundTag **aTags)
+{
+   DmtxCoreScan lScan;
+   TagList      lList;
+
+   InitScan(&lScan, aEnv, aTagCount, aSearchTimeout, &lList);
+   dmtxCoreScanStart(&lScan);
+   dmtxCoreScanRun(&lScan, aDecode);
+
+   return FinishScan(&lScan, &lList, aTags);
+}
+
+/**
+ * Result callback keeping a terminated copy of each message in a TagList
+ */
+static int
+AddTag(void *aContext, const DmtxCoreResult *aResult)
+{
+   TagList  *lList = (TagList *)aContext;
+   FoundTag *lTag;
+
+   if(lList->count >= lList->capacity)
+      return 0;
+
+   /* Allocate temporary Tag array */
+   if(lList->tags == NULL) {
+      lList->tags = (FoundTag *)malloc(lList->capacity * sizeof(FoundTag));
+      if(lList->tags == NULL) {
+         lList->failed = 1;
+         return 0;
+      }
+   }
+
+   lTag = &lList->tags[lList->count];
+   lTag->message = (char *)malloc(aResult->messageSize + 1);
+   if(lTag->message == NULL) {
+      lList->failed = 1;
+      return 0;
+   }
+   memcpy(lTag->message, aResult->message, aResult->messageSize + 1);
+   lTag->length = aResult->messageSize;
+   memcpy(lTag->corners, aResult->corners, sizeof(lTag->corners));
+   lList->count++;
+
+   return 1;
+}
+
+/**
+ * Result callback handing each tag to a DMTXImage.scanTags listener,
+ * stopping the scan when it returns false or throws
+ */
+static int
+HandTag(void *aContext, const DmtxCoreResult *aResult)
+{
+   TagListener *lListener = (TagListener *)aContext;
+   JNIEnv      *lEnv = lListener->env;
+   FoundTag     lFound;
+   jobject      lTag;
+   jboolean     lMore;
+
+   lFound.message = (char *)aResult->message;
+   lFound.length = aResult->messageSize;
+   memcpy(lFound.corners, aResult->corners, sizeof(lFound.corners));
+
+   lTag = CreateTag(lEnv, &lFound);
+   if(lTag == NULL)
+      return 0;
+
+   lMore = (*lEnv)->CallBooleanMethod(lEnv, lListener->listener,
+         gListenerTagFound, lTag);
+   (*lEnv)->DeleteLocalRef(lEnv, lTag);
+   lListener->count++;
+
+   return lMore == JNI_TRUE && !(*lEnv)->ExceptionCheck(lEnv);
+}
+
+/**
+ * Check whether the current Java thread has been interrupted, e.g. by
+ * Future.cancel(true), without clearing its interrupt status
+ */
+static int
+IsInterrupted(JNIEnv *aEnv)
+{
+   jobject  lThread;
+   jboolean lInterrupted;
+
+   lThread = (*aEnv)->CallStaticObjectMethod(aEnv, gThreadClass, gThreadCurrent);
+   if(lThread == NULL)
+      return 1;
+
+   lInterrupted = (*aEnv)->CallBooleanMethod(aEnv, lThread, gThreadIsInterrupted);
+   (*aEnv)->DeleteLocalRef(aEnv, lThread);
+
+   return lInterrupted == JNI_TRUE;
+}
+
+/**
+ * Cancel callback of scans on a Java thread
+ */
+static int
+ScanInterrupted(void *aEnv)
+{
+   return IsInterrupted((JNIEnv *)aEnv);
+}
+
+/**
+ * Create the DMTXTag object of a found tag (NULL with an exception pending
+ * if out of memory)
+ */
+static jobject
+CreateTag(JNIEnv *aEnv, const FoundTag *aTag)
+{
+   jobject lJCorner[4];
+   jstring sStringID;
+   jobject lTag;
+   int     lJ;
+
+   /* Create Location instances for corners */
+   for(lJ = 0; lJ < 4; lJ++)
+      lJCorner[lJ] = (*aEnv)->NewObject(aEnv, gPointClass, gPointConstructor,
+            aTag->corners[2 * lJ], aTag->corners[2 * lJ + 1]);
+
+   /* Decode Message */
+   sStringID = (*aEnv)->NewStringUTF(aEnv, aTag->message);
+
+   /* Create Tag instance */
+   lTag = (*aEnv)->NewObject(aEnv, gTagClass, gTagConstructor,
+         sStringID, lJCorner[0], lJCorner[1], lJCorner[2], lJCorner[3]);
+
+   /* Free local references, which would otherwise pile up per tag */
+   for(lJ = 0; lJ < 4; lJ++)
+      (*aEnv)->DeleteLocalRef(aEnv, lJCorner[lJ]);
+   (*aEnv)->DeleteLocalRef(aEnv, sStringID);
+
+   return lTag;
+}
+
+/**
+ * Create the DMTXTag array for tags found by CollectTags
+ */
+static jobjectArray
+CreateTags(JNIEnv *aEnv, FoundTag *aTags, int aTagCount)
+{
+   jobjectArray  lResult;
+   int           lI;
+
+   /* Create result array */
+   lResult = (*aEnv)->NewObjectArray(aEnv, aTagCount, gTagClass, NULL);
+
+   for(lI = 0; lResult != NULL && lI < aTagCount; lI++) {
+      jobject lTag = CreateTag(aEnv, &aTags[lI]);
+
+      if(lTag == NULL) {
+         lResult = NULL;
+         break;
+      }
+
+      (*aEnv)->SetObjectArrayElement(aEnv, lResult, lI, lTag);
+      (*aEnv)->DeleteLocalRef(aEnv, lTag);
+   }
+
+   return lResult;
+}
+
+/**
+ * Return the messages of tags found by CollectTags as a byte[][] and store
+ * their corners (x,y for corner1 to corner4) at aCorners[8 * i]. Tags that
+ * do not fit in aCorners are dropped.
+ */
+static jobjectArray
+CreateTagData(JNIEnv *aEnv, FoundTag *aTags, int aTagCount, jintArray aCorners)
+{
+   jobjectArray  lResult;
+   jsize         lCapacity;
+   int           lI;
+
+   lCapacity = (*aEnv)->GetArrayLength(aEnv, aCorners) / 8;
+   if(aTagCount > lCapacity)
+      aTagCount = lCapacity;
+
+   lResult = (*aEnv)->NewObjectArray(aEnv, aTagCount, gByteArrayClass, NULL);
+
+   for(lI = 0; lResult != NULL && lI < aTagCount; lI++) {
+      jbyteArray lMessage = (*aEnv)->NewByteArray(aEnv, aTags[lI].length);
+
+      if(lMessage == NULL) {
+         lResult = NULL;
+         break;
+      }
+
+      (*aEnv)->SetByteArrayRegion(aEnv, lMessage, 0, aTags[lI].length,
+            (const jbyte *)aTags[lI].message);
+      (*aEnv)->SetIntArrayRegion(aEnv, aCorners, lI * 8, 8,
+            aTags[lI].corners);
+      (*aEnv)->SetObjectArrayElement(aEnv, lResult, lI, lMessage);
+      (*aEnv)->DeleteLocalRef(aEnv, lMessage);
+   }
+
+   return lResult;
+}
+
+/**
+ * DMTXTag objects when aCorners is NULL, otherwise see CreateTagData
+ */
+static jobjectArray
+CreateResults(JNIEnv *aEnv, FoundTag *aTags, int aTagCount, jintArray aCorners)
+{
+   if(aCorners == NULL)
+      return CreateTags(aEnv, aTags, aTagCount);
+
+   return CreateTagData(aEnv, aTags, aTagCount, aCorners);
+}
+
+/**
+ * Free tags returned by CollectTags
+ */
+static void
+FreeTags(FoundTag *aTags, int aTagCount)
+{
+   int lI;
+
+   for(lI = 0; lI < aTagCount; lI++)
+      free(aTags[lI].message);
+   free(aTags);
 }
@@ -15,6 +15,54 @@ extern "C" {
 JNIEXPORT jobject JNICALL Java_org_libdmtx_DMTXImage_createTag
   (JNIEnv *, jclass, jstring);
 
+/*
+ * Class:     org_libdmtx_DMTXImage
+ * Method:    createModules
+ * Signature: (Ljava/lang/String;)Lorg/libdmtx/DMTXModules;
+ */
+JNIEXPORT jobject JNICALL Java_org_libdmtx_DMTXImage_createModules
+  (JNIEnv *, jclass, jstring);
+
+/*
+ * Class:     org_libdmtx_DMTXImage
+ * Method:    setEncodeCacheSize
+ * Signature: (J)V
+ */
+JNIEXPORT void JNICALL Java_org_libdmtx_DMTXImage_setEncodeCacheSize
+  (JNIEnv *, jclass, jlong);
+
+/*
+ * Class:     org_libdmtx_DMTXImage
+ * Method:    clearEncodeCache
+ * Signature: ()V
+ */
+JNIEXPORT void JNICALL Java_org_libdmtx_DMTXImage_clearEncodeCache
+  (JNIEnv *, jclass);
+
+/*
+ * Class:     org_libdmtx_DMTXImage
+ * Method:    getEncodeCacheHits
+ * Signature: ()J
+ */
+JNIEXPORT jlong JNICALL Java_org_libdmtx_DMTXImage_getEncodeCacheHits
+  (JNIEnv *, jclass);
+
+/*
+ * Class:     org_libdmtx_DMTXImage
+ * Method:    getEncodeCacheMisses
+ * Signature: ()J
+ */
+JNIEXPORT jlong JNICALL Java_org_libdmtx_DMTXImage_getEncodeCacheMisses
+  (JNIEnv *, jclass);
+
+/*
+ * Class:     org_libdmtx_DMTXImage
+ * Method:    getEncodeCacheBytes
+ * Signature: ()J
+ */
+JNIEXPORT jlong JNICALL Java_org_libdmtx_DMTXImage_getEncodeCacheBytes
+  (JNIEnv *, jclass);
+
 /*
  * Class:     org_libdmtx_DMTXImage
  * Method:    getTags
@@ -23,6 +71,38 @@ JNIEXPORT jobject JNICALL Java_org_libdmtx_DMTXImage_createTag
 JNIEXPORT jobjectArray JNICALL Java_org_libdmtx_DMTXImage_getTags
   (JNIEnv *, jobject, jint, jint);
 
+/*
+ * Class:     org_libdmtx_DMTXImage
+ * Method:    getTagData
+ * Signature: (II[I)[[B
+ */
+JNIEXPORT jobjectArray JNICALL Java_org_libdmtx_DMTXImage_getTagData
+  (JNIEnv *, jobject, jint, jint, jintArray);
+
+/*
+ * Class:     org_libdmtx_DMTXImage
+ * Method:    scanTags
+ * Signature: (ILorg/libdmtx/DMTXTagListener;)I
+ */
+JNIEXPORT jint JNICALL Java_org_libdmtx_DMTXImage_scanTags
+  (JNIEnv *, jobject, jint, jobject);
+
+/*
+ * Class:     org_libdmtx_DMTXImage
+ * Method:    nativeGetTagsDirect
+ * Signature: (Ljava/nio/ByteBuffer;IIIIII[I)[Ljava/lang/Object;
+ */
+JNIEXPORT jobjectArray JNICALL Java_org_libdmtx_DMTXImage_nativeGetTagsDirect
+  (JNIEnv *, jclass, jobject, jint, jint, jint, jint, jint, jint, jintArray);
+
+/*
+ * Class:     org_libdmtx_DMTXImage
+ * Method:    nativeGetTagsArray
+ * Signature: ([BIIIIIII[I)[Ljava/lang/Object;
+ */
+JNIEXPORT jobjectArray JNICALL Java_org_libdmtx_DMTXImage_nativeGetTagsArray
+  (JNIEnv *, jclass, jbyteArray, jint, jint, jint, jint, jint, jint, jint, jintArray);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,29 @@
+/* DO NOT EDIT THIS FILE - it is machine generated */
+#include <jni.h>
+/* Header for class org_libdmtx_DMTXProfile */
+
+#ifndef _Included_org_libdmtx_DMTXProfile
+#define _Included_org_libdmtx_DMTXProfile
+#ifdef __cplusplus
+extern "C" {
+#endif
+/*
+ * Class:     org_libdmtx_DMTXProfile
+ * Method:    nativeInit
+ * Signature: (I[I)Z
+ */
+JNIEXPORT jboolean JNICALL Java_org_libdmtx_DMTXProfile_nativeInit
+  (JNIEnv *, jclass, jint, jintArray);
+
+/*
+ * Class:     org_libdmtx_DMTXProfile
+ * Method:    nativeCalibrate
+ * Signature: ([Lorg/libdmtx/DMTXImage;[II[D)I
+ */
+JNIEXPORT jint JNICALL Java_org_libdmtx_DMTXProfile_nativeCalibrate
+  (JNIEnv *, jclass, jobjectArray, jintArray, jint, jdoubleArray);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,69 @@
+/*
+Java wrapper for libdmtx
+
+Copyright (C) 2009 Pete Calvert
+Copyright (C) 2009 Dikran Seropian
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+Contact: mike@dragonflylogic.com
+*/
+
+
+/* $Id$ */
+
+package org.libdmtx;
+
+/**
+ * Result of DMTXProfile.calibrate. Times are those of decoding all samples
+ * once, the fastest of a few rounds.
+ */
+public class DMTXCalibration {
+  /**
+   * The calibrated settings
+   */
+  public DMTXProfile profile;
+
+  /**
+   * Tags found in the samples with the default settings
+   */
+  public int tagCount;
+
+  /**
+   * Milliseconds taken with the default settings and with profile
+   */
+  public double defaultMillis;
+  public double profileMillis;
+
+  DMTXCalibration(DMTXProfile aProfile, int aTagCount, double aDefaultMillis,
+      double aProfileMillis) {
+    profile       = aProfile;
+    tagCount      = aTagCount;
+    defaultMillis = aDefaultMillis;
+    profileMillis = aProfileMillis;
+  }
+
+  /**
+   * How many times faster profile decodes the samples than the defaults
+   */
+  public double getSpeedup() {
+    return (profileMillis > 0.0) ? defaultMillis / profileMillis : 1.0;
+  }
+
+  public String toString() {
+    return profile + ": " + tagCount + " tags, " + defaultMillis + "ms -> " +
+        profileMillis + "ms";
+  }
+}
@@ -0,0 +1,85 @@
+/*
+Java wrapper for libdmtx
+
+Copyright (C) 2009 Pete Calvert
+Copyright (C) 2009 Dikran Seropian
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+Contact: mike@dragonflylogic.com
+*/
+
+/* $Id$ */
+
+package org.libdmtx;
+
+/**
+ * Where the time of a DMTXDecoder call went and what it went through (see
+ * DMTXDecoder.getLastStats). Times are in microseconds.
+ */
+public class DMTXDecodeStats {
+  /**
+   * Preparing the native image and decoder, including the shrunk copy of
+   * pyramid scans
+   */
+  public long setupMicros;
+
+  /**
+   * Locating candidate regions
+   */
+  public long searchMicros;
+
+  /**
+   * Decoding the candidates found
+   */
+  public long decodeMicros;
+
+  /**
+   * Creating the Java results
+   */
+  public long marshalMicros;
+
+  /**
+   * Candidate regions decoded, and how many of them did not decode
+   */
+  public long regionsExamined;
+  public long regionsRejected;
+
+  /**
+   * Message bytes copied out of libdmtx, plus the pixels if the VM handed
+   * the native code a copy of the image array
+   */
+  public long bytesCopied;
+
+  /**
+   * Construct from the values stored by the native code, in field order
+   */
+  DMTXDecodeStats(long[] aValues) {
+    setupMicros     = aValues[0];
+    searchMicros    = aValues[1];
+    decodeMicros    = aValues[2];
+    marshalMicros   = aValues[3];
+    regionsExamined = aValues[4];
+    regionsRejected = aValues[5];
+    bytesCopied     = aValues[6];
+  }
+
+  public String toString() {
+    return "setup " + setupMicros + "us, search " + searchMicros +
+        "us, decode " + decodeMicros + "us, marshal " + marshalMicros +
+        "us, " + regionsExamined + " regions (" + regionsRejected +
+        " rejected), " + bytesCopied + " bytes copied";
+  }
+}
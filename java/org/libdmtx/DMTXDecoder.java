@@ -0,0 +1,325 @@
+/*
+Java wrapper for libdmtx
+
+Copyright (C) 2009 Pete Calvert
+Copyright (C) 2009 Dikran Seropian
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+Contact: mike@dragonflylogic.com
+*/
+
+/* $Id$ */
+
+package org.libdmtx;
+
+import java.io.IOException;
+import java.nio.ByteBuffer;
+
+/**
+ * Reusable decoder for scanning a sequence of images (e.g. video frames).
+ * The native decoder state is kept between calls and only rebuilt when the
+ * image dimensions or pixel packing change. Call close() when finished with it.
+ */
+public class DMTXDecoder {
+  /**
+   * Load external library
+   */
+  static {
+    System.loadLibrary("dmtx");
+  }
+
+  /**
+   * Native decoder state (0 once closed)
+   */
+  private long handle;
+
+  /**
+   * Scan region (x, y, width, height in pixels, rows counted from the top),
+   * or null to scan whole images
+   */
+  private int[] region;
+
+  /**
+   * Pixels added around the previous corners by getTagsNear and
+   * getTagDataNear (negative for half the size of the tag)
+   */
+  private int nearPadding = -1;
+
+  /**
+   * Shrink factor used to locate tags before decoding them at full size
+   * (1 to scan at full size only)
+   */
+  private int pyramidShrink = 1;
+
+  /**
+   * Stats of the last decode, or null before the first one
+   */
+  private DMTXDecodeStats lastStats;
+
+  public DMTXDecoder() {
+    handle = nativeCreate();
+    if(handle == 0)
+      throw new OutOfMemoryError("Unable to allocate native decoder");
+  }
+
+  /**
+   * Decode the image, returning tags found (as DMTXTag objects)
+   */
+  public synchronized DMTXTag[] getTags(DMTXImage aImage, int aMaxTagCount,
+      int aSearchTimeout) {
+    if(handle == 0)
+      throw new IllegalStateException("DMTXDecoder has been closed");
+
+    Object[] lResult = nativeGetTags(handle, aImage.width, aImage.height,
+        aImage.data, aMaxTagCount, aSearchTimeout, null, region, null,
+        nearPadding, pyramidShrink);
+    lastStats = readStats();
+
+    return (DMTXTag[])lResult;
+  }
+
+  /**
+   * Decode the image like getTags(), but return the raw message bytes of
+   * each tag and store its corners in aCorners (see DMTXImage.getTagData)
+   */
+  public synchronized byte[][] getTagData(DMTXImage aImage, int aMaxTagCount,
+      int aSearchTimeout, int[] aCorners) {
+    if(handle == 0)
+      throw new IllegalStateException("DMTXDecoder has been closed");
+
+    Object[] lResult = nativeGetTags(handle, aImage.width, aImage.height,
+        aImage.data, aMaxTagCount, aSearchTimeout, aCorners, region, null,
+        nearPadding, pyramidShrink);
+    lastStats = readStats();
+
+    return (byte[][])lResult;
+  }
+
+  /**
+   * Decode pixels held in a direct ByteBuffer in place, laid out as given
+   * by aPacking (e.g. DMTXImage.PACK_8BPP_K for frames from a mono camera)
+   * with rows aStride bytes apart from the buffer's address
+   */
+  public synchronized DMTXTag[] getTags(ByteBuffer aPixels, int aWidth,
+      int aHeight, int aStride, int aPacking, int aMaxTagCount,
+      int aSearchTimeout) {
+    if(handle == 0)
+      throw new IllegalStateException("DMTXDecoder has been closed");
+    if(!aPixels.isDirect())
+      throw new IllegalArgumentException("ByteBuffer must be direct");
+
+    Object[] lResult = nativeGetTagsDirect(handle, aPixels, aWidth, aHeight,
+        aStride, aPacking, aMaxTagCount, aSearchTimeout, null, region, null,
+        nearPadding, pyramidShrink);
+    lastStats = readStats();
+
+    return (DMTXTag[])lResult;
+  }
+
+  /**
+   * Decode every page of aFile in place, returning the tags found on each
+   * page (indexed like the pages). All pages go through this decoder, so
+   * pages of the same size share its scan buffers.
+   */
+  public synchronized DMTXTag[][] getTags(DMTXPageFile aFile,
+      int aMaxTagCount, int aSearchTimeout) throws IOException {
+    DMTXTag[][] lPages = new DMTXTag[aFile.getPageCount()][];
+
+    for(int i = 0; i < lPages.length; i++) {
+      lPages[i] = getTags(aFile.getPixels(i), aFile.getWidth(i),
+          aFile.getHeight(i), aFile.getStride(i), aFile.getPacking(i),
+          aMaxTagCount, aSearchTimeout);
+      if(lPages[i] == null)
+        lPages[i] = new DMTXTag[0];
+    }
+    return lPages;
+  }
+
+  /**
+   * Like getTags(ByteBuffer, ...), returning the results as getTagData() does
+   */
+  public synchronized byte[][] getTagData(ByteBuffer aPixels, int aWidth,
+      int aHeight, int aStride, int aPacking, int aMaxTagCount,
+      int aSearchTimeout, int[] aCorners) {
+    if(handle == 0)
+      throw new IllegalStateException("DMTXDecoder has been closed");
+    if(!aPixels.isDirect())
+      throw new IllegalArgumentException("ByteBuffer must be direct");
+
+    Object[] lResult = nativeGetTagsDirect(handle, aPixels, aWidth, aHeight,
+        aStride, aPacking, aMaxTagCount, aSearchTimeout, aCorners, region,
+        null, nearPadding, pyramidShrink);
+    lastStats = readStats();
+
+    return (byte[][])lResult;
+  }
+
+  /**
+   * Decode an image in which a tag is expected close to aPrevious, e.g. as
+   * found in the previous frame. Only the box around its corners is scanned
+   * first; the rest of the image is only scanned if no tag decodes there.
+   */
+  public synchronized DMTXTag[] getTagsNear(DMTXImage aImage, int aMaxTagCount,
+      int aSearchTimeout, DMTXTag aPrevious) {
+    if(handle == 0)
+      throw new IllegalStateException("DMTXDecoder has been closed");
+
+    int[] lNear = {
+      aPrevious.corner1.x, aPrevious.corner1.y,
+      aPrevious.corner2.x, aPrevious.corner2.y,
+      aPrevious.corner3.x, aPrevious.corner3.y,
+      aPrevious.corner4.x, aPrevious.corner4.y
+    };
+
+    Object[] lResult = nativeGetTags(handle, aImage.width, aImage.height,
+        aImage.data, aMaxTagCount, aSearchTimeout, null, region, lNear,
+        nearPadding, pyramidShrink);
+    lastStats = readStats();
+
+    return (DMTXTag[])lResult;
+  }
+
+  /**
+   * Decode like getTagData(), looking around aPrevious first (the 8 corner
+   * coordinates of a tag as stored by getTagData)
+   */
+  public synchronized byte[][] getTagDataNear(DMTXImage aImage,
+      int aMaxTagCount, int aSearchTimeout, int[] aPrevious, int[] aCorners) {
+    if(handle == 0)
+      throw new IllegalStateException("DMTXDecoder has been closed");
+    if(aPrevious.length < 8)
+      throw new IllegalArgumentException("aPrevious must hold 8 coordinates");
+
+    Object[] lResult = nativeGetTags(handle, aImage.width, aImage.height,
+        aImage.data, aMaxTagCount, aSearchTimeout, aCorners, region,
+        aPrevious, nearPadding, pyramidShrink);
+    lastStats = readStats();
+
+    return (byte[][])lResult;
+  }
+
+  /**
+   * Time spent in each stage of the last getTags* or getTagData* call and
+   * the regions it examined, or null if nothing was decoded yet
+   */
+  public synchronized DMTXDecodeStats getLastStats() {
+    return lastStats;
+  }
+
+  /**
+   * Only scan the given part of images (rows counted from the top)
+   */
+  public synchronized void setScanRegion(int aX, int aY, int aWidth,
+      int aHeight) {
+    if(aWidth <= 0 || aHeight <= 0)
+      throw new IllegalArgumentException("Empty scan region");
+
+    region = new int[] { aX, aY, aWidth, aHeight };
+  }
+
+  /**
+   * Scan whole images again
+   */
+  public synchronized void clearScanRegion() {
+    region = null;
+  }
+
+  /**
+   * Set the pixels added on every side of the previous corners by
+   * getTagsNear and getTagDataNear (negative for half the size of the tag)
+   */
+  public synchronized void setNearPadding(int aPadding) {
+    nearPadding = aPadding;
+  }
+
+  /**
+   * Locate tags on images shrunk by aShrink first and then only decode at
+   * full size around the candidates found. Much faster on large images
+   * holding small tags. 1, the default, scans at full size only.
+   */
+  public synchronized void setPyramidShrink(int aShrink) {
+    if(aShrink < 1)
+      throw new IllegalArgumentException("Shrink must be at least 1");
+
+    pyramidShrink = aShrink;
+  }
+
+  /**
+   * Search images with the settings of aProfile (see DMTXProfile), or with
+   * libdmtx's defaults again if it is null. Later changes to aProfile have
+   * no effect until it is set again.
+   */
+  public synchronized void setProfile(DMTXProfile aProfile) {
+    if(handle == 0)
+      throw new IllegalStateException("DMTXDecoder has been closed");
+
+    nativeSetProfile(handle, (aProfile != null) ? aProfile.getValues() : null);
+  }
+
+  /**
+   * Release the native decoder state
+   */
+  public synchronized void close() {
+    if(handle != 0) {
+      nativeDestroy(handle);
+      handle = 0;
+    }
+  }
+
+  protected void finalize() throws Throwable {
+    try {
+      close();
+    } finally {
+      super.finalize();
+    }
+  }
+
+  private static native long nativeCreate();
+
+  /**
+   * Returns DMTXTag[] if aCorners is null, byte[][] otherwise. aRegion and
+   * aNear may be null.
+   */
+  private static native Object[] nativeGetTags(long aHandle, int aWidth,
+      int aHeight, int[] aData, int aMaxTagCount, int aSearchTimeout,
+      int[] aCorners, int[] aRegion, int[] aNear, int aPadding,
+      int aPyramidShrink);
+
+  private static native Object[] nativeGetTagsDirect(long aHandle,
+      ByteBuffer aPixels, int aWidth, int aHeight, int aStride, int aPacking,
+      int aMaxTagCount, int aSearchTimeout, int[] aCorners, int[] aRegion,
+      int[] aNear, int aPadding, int aPyramidShrink);
+
+  private DMTXDecodeStats readStats() {
+    long[] lValues = new long[7];
+    nativeGetStats(handle, lValues);
+    return new DMTXDecodeStats(lValues);
+  }
+
+  /**
+   * Stores the stats of the last decode in aStats, in the field order of
+   * DMTXDecodeStats
+   */
+  private static native void nativeGetStats(long aHandle, long[] aStats);
+
+  /**
+   * Stores the settings of DMTXProfile.getValues() (null for the defaults)
+   * for the following decodes
+   */
+  private static native void nativeSetProfile(long aHandle, int[] aValues);
+
+  private static native void nativeDestroy(long aHandle);
+}
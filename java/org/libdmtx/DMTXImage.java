@@ -26,6 +26,17 @@ Contact: mike@dragonflylogic.com
 package org.libdmtx;
 
 import java.awt.image.BufferedImage;
+import java.awt.image.DataBufferByte;
+import java.awt.image.DataBufferInt;
+import java.awt.image.PixelInterleavedSampleModel;
+import java.awt.image.SinglePixelPackedSampleModel;
+import java.awt.image.WritableRaster;
+import java.nio.ByteBuffer;
+import java.util.concurrent.Callable;
+import java.util.concurrent.ExecutorService;
+import java.util.concurrent.Executors;
+import java.util.concurrent.Future;
+import java.util.concurrent.ThreadFactory;
 
 public class DMTXImage {
   /**
@@ -35,6 +46,18 @@ public class DMTXImage {
     System.loadLibrary("dmtx");
   }
 
+  /**
+   * Pixel packings accepted by the static getTags() methods (the values of
+   * libdmtx's DmtxPackOrder)
+   */
+  public static final int PACK_8BPP_K      = 300;
+  public static final int PACK_24BPP_RGB   = 500;
+  public static final int PACK_24BPP_BGR   = 501;
+  public static final int PACK_32BPP_RGBX  = 600;
+  public static final int PACK_32BPP_XRGB  = 601;
+  public static final int PACK_32BPP_BGRX  = 602;
+  public static final int PACK_32BPP_XBGR  = 603;
+
   /**
    * Image Data - 1 'int' per pixel, packed with RGB (8bits each, 8bits padding)
    */
@@ -70,11 +93,185 @@ public class DMTXImage {
    */
   public static native DMTXImage createTag(String aID);
 
+  /**
+   * Encode aID and return only the symbol's module matrix, without
+   * rendering an image
+   */
+  public static native DMTXModules createModules(String aID);
+
+  /**
+   * Bound the native cache of finished encodes used by createTag and
+   * createModules to aMaxBytes; repeated IDs are then copied from the cache
+   * instead of being encoded again. 0 (the default) disables the cache.
+   */
+  public static native void setEncodeCacheSize(long aMaxBytes);
+
+  /**
+   * Drop all cached encodes and reset the hit and miss counters
+   */
+  public static native void clearEncodeCache();
+
+  public static native long getEncodeCacheHits();
+  public static native long getEncodeCacheMisses();
+
+  /**
+   * Bytes currently held by the encode cache
+   */
+  public static native long getEncodeCacheBytes();
+
   /**
    * Decode the image, returning tags found (as DMTXTag objects)
    */
   public native DMTXTag[] getTags(int aMaxTagCount, int searchTimeout);
 
+  /**
+   * Decode the image on a shared pool of worker threads (one per
+   * processor) and return at once. Future.cancel(true) interrupts the
+   * worker, which stops scanning within a few milliseconds. Decodes running
+   * on other threads can be interrupted the same way; getTags() then
+   * returns the tags found so far, leaving the interrupt status set.
+   */
+  public Future<DMTXTag[]> getTagsAsync(final int aMaxTagCount,
+      final int aSearchTimeout) {
+    return getDecodePool().submit(new Callable<DMTXTag[]>() {
+      public DMTXTag[] call() {
+        return getTags(aMaxTagCount, aSearchTimeout);
+      }
+    });
+  }
+
+  /**
+   * Decode the image, handing each tag to aListener as soon as it decodes
+   * instead of collecting them all first. The scan stops when the listener
+   * returns false, so waiting for the first tag only costs as much as
+   * finding it. Returns the number of tags handed to the listener.
+   */
+  public native int scanTags(int aSearchTimeout, DMTXTagListener aListener);
+
+  /**
+   * Decode the image without creating DMTXTag and Point objects: returns
+   * the raw message bytes of each tag found and stores its corners as x,y
+   * pairs (corner1 to corner4) at aCorners[8 * i]. aCorners can be reused
+   * between calls and limits the result to aCorners.length / 8 tags.
+   */
+  public native byte[][] getTagData(int aMaxTagCount, int aSearchTimeout,
+      int[] aCorners);
+
+  /**
+   * Decode pixels held in a direct ByteBuffer without copying them. Rows
+   * are aStride bytes apart, starting at the buffer's address (its position
+   * is ignored), with pixels laid out as given by aPacking.
+   */
+  public static DMTXTag[] getTags(ByteBuffer aPixels, int aWidth, int aHeight,
+      int aStride, int aPacking, int aMaxTagCount, int aSearchTimeout) {
+    if(!aPixels.isDirect())
+      throw new IllegalArgumentException("ByteBuffer must be direct");
+
+    return (DMTXTag[])nativeGetTagsDirect(aPixels, aWidth, aHeight, aStride,
+        aPacking, aMaxTagCount, aSearchTimeout, null);
+  }
+
+  /**
+   * Like getTags(ByteBuffer, ...), returning the results as getTagData() does
+   */
+  public static byte[][] getTagData(ByteBuffer aPixels, int aWidth,
+      int aHeight, int aStride, int aPacking, int aMaxTagCount,
+      int aSearchTimeout, int[] aCorners) {
+    if(!aPixels.isDirect())
+      throw new IllegalArgumentException("ByteBuffer must be direct");
+
+    return (byte[][])nativeGetTagsDirect(aPixels, aWidth, aHeight, aStride,
+        aPacking, aMaxTagCount, aSearchTimeout, aCorners);
+  }
+
+  /**
+   * Decode pixels held in a byte array (starting at aOffset) without
+   * copying them. The array is pinned for the whole scan, which may hold
+   * off garbage collection, so keep aSearchTimeout short.
+   */
+  public static DMTXTag[] getTags(byte[] aPixels, int aOffset, int aWidth,
+      int aHeight, int aStride, int aPacking, int aMaxTagCount,
+      int aSearchTimeout) {
+    return (DMTXTag[])nativeGetTagsArray(aPixels, aOffset, aWidth, aHeight,
+        aStride, aPacking, aMaxTagCount, aSearchTimeout, null);
+  }
+
+  /**
+   * Like getTags(byte[], ...), returning the results as getTagData() does
+   */
+  public static byte[][] getTagData(byte[] aPixels, int aOffset, int aWidth,
+      int aHeight, int aStride, int aPacking, int aMaxTagCount,
+      int aSearchTimeout, int[] aCorners) {
+    return (byte[][])nativeGetTagsArray(aPixels, aOffset, aWidth, aHeight,
+        aStride, aPacking, aMaxTagCount, aSearchTimeout, aCorners);
+  }
+
+  /**
+   * Decode a BufferedImage. Byte rasters (TYPE_3BYTE_BGR, TYPE_4BYTE_ABGR
+   * and TYPE_BYTE_GRAY) are scanned in place and unpadded TYPE_INT_RGB and
+   * TYPE_INT_ARGB rasters are read without a copy; other images are
+   * converted through getRGB() first.
+   */
+  public static DMTXTag[] getTags(BufferedImage aImage, int aMaxTagCount,
+      int aSearchTimeout) {
+    int lPacking;
+
+    switch(aImage.getType()) {
+      case BufferedImage.TYPE_3BYTE_BGR:
+        lPacking = PACK_24BPP_BGR;
+        break;
+      case BufferedImage.TYPE_4BYTE_ABGR:
+      case BufferedImage.TYPE_4BYTE_ABGR_PRE:
+        lPacking = PACK_32BPP_XBGR;
+        break;
+      case BufferedImage.TYPE_BYTE_GRAY:
+        lPacking = PACK_8BPP_K;
+        break;
+      default:
+        lPacking = 0;
+    }
+
+    WritableRaster lRaster = aImage.getRaster();
+    if(lPacking != 0 &&
+        lRaster.getDataBuffer() instanceof DataBufferByte &&
+        lRaster.getSampleModel() instanceof PixelInterleavedSampleModel) {
+      DataBufferByte lBuffer = (DataBufferByte)lRaster.getDataBuffer();
+      PixelInterleavedSampleModel lModel =
+          (PixelInterleavedSampleModel)lRaster.getSampleModel();
+
+      if(lBuffer.getNumBanks() == 1) {
+        int lStride = lModel.getScanlineStride();
+        int lOffset = lBuffer.getOffset()
+            - lRaster.getSampleModelTranslateY() * lStride
+            - lRaster.getSampleModelTranslateX() * lModel.getPixelStride();
+
+        return (DMTXTag[])nativeGetTagsArray(lBuffer.getData(), lOffset,
+            aImage.getWidth(), aImage.getHeight(), lStride, lPacking,
+            aMaxTagCount, aSearchTimeout, null);
+      }
+    }
+
+    /* These ints are what getRGB() would return, give or take the alpha
+       that is ignored anyway */
+    if((aImage.getType() == BufferedImage.TYPE_INT_RGB ||
+        aImage.getType() == BufferedImage.TYPE_INT_ARGB) &&
+        lRaster.getDataBuffer() instanceof DataBufferInt &&
+        lRaster.getSampleModel() instanceof SinglePixelPackedSampleModel) {
+      DataBufferInt lBuffer = (DataBufferInt)lRaster.getDataBuffer();
+      SinglePixelPackedSampleModel lModel =
+          (SinglePixelPackedSampleModel)lRaster.getSampleModel();
+
+      if(lBuffer.getNumBanks() == 1 && lBuffer.getOffset() == 0 &&
+          lModel.getScanlineStride() == aImage.getWidth() &&
+          lRaster.getSampleModelTranslateX() == 0 &&
+          lRaster.getSampleModelTranslateY() == 0)
+        return new DMTXImage(aImage.getWidth(), aImage.getHeight(),
+            lBuffer.getData()).getTags(aMaxTagCount, aSearchTimeout);
+    }
+
+    return new DMTXImage(aImage).getTags(aMaxTagCount, aSearchTimeout);
+  }
+
   /**
    * Generate a BufferedImage from the image and return it
    */
@@ -87,4 +284,35 @@ public class DMTXImage {
 
     return lReturn;
   }
+
+  /**
+   * Worker threads of getTagsAsync, created on first use. They are daemon
+   * threads so that an idle pool never keeps the VM alive.
+   */
+  private static ExecutorService decodePool;
+
+  private static synchronized ExecutorService getDecodePool() {
+    if(decodePool == null) {
+      decodePool = Executors.newFixedThreadPool(
+          Runtime.getRuntime().availableProcessors(), new ThreadFactory() {
+        public Thread newThread(Runnable aTask) {
+          Thread lThread = new Thread(aTask, "libdmtx decode");
+          lThread.setDaemon(true);
+          return lThread;
+        }
+      });
+    }
+    return decodePool;
+  }
+
+  /**
+   * These return DMTXTag[] if aCorners is null, byte[][] otherwise
+   */
+  private static native Object[] nativeGetTagsDirect(ByteBuffer aPixels,
+      int aWidth, int aHeight, int aStride, int aPacking, int aMaxTagCount,
+      int aSearchTimeout, int[] aCorners);
+
+  private static native Object[] nativeGetTagsArray(byte[] aPixels,
+      int aOffset, int aWidth, int aHeight, int aStride, int aPacking,
+      int aMaxTagCount, int aSearchTimeout, int[] aCorners);
 }
@@ -0,0 +1,63 @@
+/*
+Java wrapper for libdmtx
+
+Copyright (C) 2009 Pete Calvert
+Copyright (C) 2009 Dikran Seropian
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+Contact: mike@dragonflylogic.com
+*/
+
+/* $Id$ */
+
+package org.libdmtx;
+
+/**
+ * Module matrix of an encoded symbol (see DMTXImage.createModules)
+ */
+public class DMTXModules {
+  /**
+   * Symbol size in modules
+   */
+  public int rows;
+  public int cols;
+
+  /**
+   * One bit per module (1 = dark), most significant bit first, top row
+   * first, each row padded to a whole byte
+   */
+  public byte[] modules;
+
+  /**
+   * Simple constructor (saves a lot of JNI code)
+   */
+  public DMTXModules(int aRows, int aCols, byte[] aModules) {
+    rows    = aRows;
+    cols    = aCols;
+    modules = aModules;
+  }
+
+  /**
+   * Bytes per row of modules
+   */
+  public int getRowBytes() {
+    return (cols + 7) / 8;
+  }
+
+  public boolean isDark(int aRow, int aCol) {
+    return (modules[aRow * getRowBytes() + (aCol >> 3)] & (0x80 >> (aCol & 7))) != 0;
+  }
+}
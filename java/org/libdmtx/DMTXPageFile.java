@@ -0,0 +1,381 @@
+/*
+Java wrapper for libdmtx
+
+Copyright (C) 2009 Pete Calvert
+Copyright (C) 2009 Dikran Seropian
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+Contact: mike@dragonflylogic.com
+*/
+
+/* $Id$ */
+
+package org.libdmtx;
+
+import java.io.File;
+import java.io.IOException;
+import java.io.RandomAccessFile;
+import java.nio.ByteBuffer;
+import java.nio.channels.FileChannel;
+import java.util.ArrayList;
+import java.util.List;
+
+/**
+ * The pages of an uncompressed image file, memory-mapped so that
+ * DMTXDecoder.getTags(DMTXPageFile, ...) decodes them in place. Reads
+ * binary PGM/PPM files (several images may follow each other), baseline
+ * TIFF files whose pages are uncompressed with 8 bits per sample, and files
+ * of raw frames. Each page is mapped on its own, so files may be larger
+ * than 2 GB. Call close() when finished with it.
+ */
+public class DMTXPageFile {
+  private static class Page {
+    long offset;
+    int length;
+    int width;
+    int height;
+    int stride;
+    int packing;
+    /** Strips gathered from a TIFF page not stored in one piece, or null */
+    long[] strips;
+  }
+
+  private RandomAccessFile file;
+  private FileChannel channel;
+  private long size;
+  private List<Page> pages = new ArrayList<Page>();
+
+  /** Window read by byteAt() while parsing headers */
+  private ByteBuffer window = ByteBuffer.allocate(4096);
+  private long windowStart = -1;
+
+  /** Byte order of the TIFF being read */
+  private boolean bigEndian;
+
+  /**
+   * Open a PNM or TIFF file, telling them apart by their header
+   */
+  public DMTXPageFile(File aFile) throws IOException {
+    open(aFile);
+    try {
+      if(size >= 8 && ((byteAt(0) == 'I' && byteAt(1) == 'I') ||
+          (byteAt(0) == 'M' && byteAt(1) == 'M')))
+        readTiffPages();
+      else
+        readPnmPages();
+    } catch(IOException e) {
+      close();
+      throw e;
+    }
+  }
+
+  /**
+   * Open a file of raw frames of aWidth by aHeight pixels, laid out as given
+   * by aPacking with rows aStride bytes apart, following each other after
+   * aHeaderBytes of header. A partial frame at the end is ignored.
+   */
+  public DMTXPageFile(File aFile, int aHeaderBytes, int aWidth, int aHeight,
+      int aStride, int aPacking) throws IOException {
+    if(aWidth <= 0 || aHeight <= 0 || aStride <= 0)
+      throw new IllegalArgumentException("Invalid frame geometry");
+
+    open(aFile);
+    long lFrameBytes = (long)aStride * aHeight;
+    if(lFrameBytes > Integer.MAX_VALUE) {
+      close();
+      throw new IllegalArgumentException("Frames too large to map");
+    }
+    for(long lPos = aHeaderBytes; size - lPos >= lFrameBytes;
+        lPos += lFrameBytes)
+      addPage(lPos, aWidth, aHeight, aStride, aPacking, null);
+  }
+
+  public int getPageCount() {
+    return pages.size();
+  }
+
+  public int getWidth(int aPage) {
+    return pages.get(aPage).width;
+  }
+
+  public int getHeight(int aPage) {
+    return pages.get(aPage).height;
+  }
+
+  public int getStride(int aPage) {
+    return pages.get(aPage).stride;
+  }
+
+  /**
+   * Pixel packing of a page (one of the DMTXImage.PACK_ constants)
+   */
+  public int getPacking(int aPage) {
+    return pages.get(aPage).packing;
+  }
+
+  /**
+   * Pixels of a page as a direct buffer, top row first. Pages stored in one
+   * piece are a read-only mapping of the file; TIFF pages scattered over
+   * several runs of strips are gathered into a new buffer.
+   */
+  public ByteBuffer getPixels(int aPage) throws IOException {
+    if(channel == null)
+      throw new IllegalStateException("DMTXPageFile has been closed");
+
+    Page lPage = pages.get(aPage);
+    if(lPage.strips == null)
+      return channel.map(FileChannel.MapMode.READ_ONLY, lPage.offset,
+          lPage.length);
+
+    ByteBuffer lPixels = ByteBuffer.allocateDirect(lPage.length);
+    for(int i = 0; i < lPage.strips.length && lPixels.hasRemaining();
+        i += 2) {
+      ByteBuffer lStrip = lPixels.slice();
+      if(lStrip.remaining() > lPage.strips[i + 1])
+        lStrip.limit((int)lPage.strips[i + 1]);
+      while(lStrip.hasRemaining())
+        if(channel.read(lStrip, lPage.strips[i] + lStrip.position()) < 0)
+          throw new IOException("TIFF strip past the end of the file");
+      lPixels.position(lPixels.position() + lStrip.limit());
+    }
+    if(lPixels.hasRemaining())
+      throw new IOException("TIFF strips shorter than the page");
+    lPixels.clear();
+    return lPixels;
+  }
+
+  public synchronized void close() {
+    try {
+      if(file != null)
+        file.close();
+    } catch(IOException e) {
+      // Nothing was written
+    }
+    file = null;
+    channel = null;
+  }
+
+  private void open(File aFile) throws IOException {
+    file = new RandomAccessFile(aFile, "r");
+    channel = file.getChannel();
+    size = channel.size();
+  }
+
+  private void addPage(long aOffset, int aWidth, int aHeight, int aStride,
+      int aPacking, long[] aStrips) {
+    Page lPage = new Page();
+    lPage.offset = aOffset;
+    lPage.length = aStride * aHeight;
+    lPage.width = aWidth;
+    lPage.height = aHeight;
+    lPage.stride = aStride;
+    lPage.packing = aPacking;
+    lPage.strips = aStrips;
+    pages.add(lPage);
+  }
+
+  /**
+   * Byte at aPos (0 to 255), or -1 past the end of the file
+   */
+  private int byteAt(long aPos) throws IOException {
+    if(aPos < 0 || aPos >= size)
+      return -1;
+    if(windowStart < 0 || aPos < windowStart ||
+        aPos >= windowStart + window.limit()) {
+      window.clear();
+      while(window.hasRemaining() &&
+          channel.read(window, aPos + window.position()) > 0)
+        ;
+      window.flip();
+      windowStart = aPos;
+    }
+    return window.get((int)(aPos - windowStart)) & 0xff;
+  }
+
+  private static boolean isWhitespace(int aByte) {
+    return aByte == ' ' || (aByte >= '\t' && aByte <= '\r');
+  }
+
+  /**
+   * Binary PGM (P5) and PPM (P6) images with a maxval up to 255, any
+   * number of them back to back
+   */
+  private void readPnmPages() throws IOException {
+    long[] lPos = { 0 };
+
+    while(byteAt(lPos[0]) == 'P') {
+      int lType = byteAt(lPos[0] + 1);
+      if(lType != '5' && lType != '6')
+        throw new IOException("Not a binary PGM or PPM file");
+      int lBytesPerPixel = (lType == '5') ? 1 : 3;
+
+      lPos[0] += 2;
+      int lWidth = pnmNumber(lPos);
+      int lHeight = pnmNumber(lPos);
+      int lMaxval = pnmNumber(lPos);
+      if(lWidth <= 0 || lHeight <= 0 || lMaxval <= 0 || lMaxval > 255)
+        throw new IOException("Unsupported PNM header");
+      lPos[0]++; // the single whitespace ending the header
+
+      long lBytes = (long)lWidth * lHeight * lBytesPerPixel;
+      if(lBytes > size - lPos[0] || lBytes > Integer.MAX_VALUE)
+        throw new IOException("PNM image truncated");
+      addPage(lPos[0], lWidth, lHeight, lWidth * lBytesPerPixel,
+          (lBytesPerPixel == 1) ? DMTXImage.PACK_8BPP_K :
+          DMTXImage.PACK_24BPP_RGB, null);
+
+      lPos[0] += lBytes;
+      while(isWhitespace(byteAt(lPos[0])))
+        lPos[0]++;
+    }
+    if(pages.isEmpty() || lPos[0] != size)
+      throw new IOException("Not a binary PGM or PPM file");
+  }
+
+  /**
+   * Next number of a PNM header, skipping whitespace and comments; -1 if
+   * there is none
+   */
+  private int pnmNumber(long[] aPos) throws IOException {
+    int lByte;
+    while((lByte = byteAt(aPos[0])) != -1) {
+      if(lByte == '#') {
+        while((lByte = byteAt(aPos[0])) != -1 && lByte != '\n')
+          aPos[0]++;
+      }
+      else if(isWhitespace(lByte))
+        aPos[0]++;
+      else
+        break;
+    }
+
+    int lValue = 0, lDigits = 0;
+    while((lByte = byteAt(aPos[0])) >= '0' && lByte <= '9' &&
+        lValue < 0x1000000) {
+      lValue = lValue * 10 + (lByte - '0');
+      aPos[0]++;
+      lDigits++;
+    }
+    return (lDigits > 0) ? lValue : -1;
+  }
+
+  private long tiffU16(long aPos) throws IOException {
+    int b0 = byteAt(aPos), b1 = byteAt(aPos + 1);
+    if(b1 < 0)
+      return 0;
+    return bigEndian ? (b0 << 8) | b1 : (b1 << 8) | b0;
+  }
+
+  private long tiffU32(long aPos) throws IOException {
+    long lLow = tiffU16(aPos + (bigEndian ? 2 : 0));
+    long lHigh = tiffU16(aPos + (bigEndian ? 0 : 2));
+    return (lHigh << 16) | lLow;
+  }
+
+  /**
+   * Value number aIndex of the SHORT or LONG directory entry at aEntry, 0
+   * if there is no such value
+   */
+  private long tiffValue(long aEntry, long aIndex) throws IOException {
+    long lType = tiffU16(aEntry + 2);
+    long lCount = tiffU32(aEntry + 4);
+    int lValueSize = (lType == 3) ? 2 : 4;
+
+    if((lType != 3 && lType != 4) || aIndex >= lCount)
+      return 0;
+    long lAt = (lCount * lValueSize <= 4) ? aEntry + 8 : tiffU32(aEntry + 8);
+    lAt += aIndex * lValueSize;
+    return (lType == 3) ? tiffU16(lAt) : tiffU32(lAt);
+  }
+
+  /**
+   * Every directory of a baseline TIFF, each page being uncompressed, 8
+   * bits per sample, chunky and gray or RGB(X)
+   */
+  private void readTiffPages() throws IOException {
+    bigEndian = (byteAt(0) == 'M');
+    if(tiffU16(2) != 42)
+      throw new IOException("Not a TIFF file");
+
+    long lIfd = tiffU32(4);
+    for(long lDirectories = 1; lIfd != 0; lDirectories++) {
+      long lEntries = tiffU16(lIfd);
+      long lWidth = 0, lHeight = 0, lBits = 1, lCompression = 1;
+      long lSamples = 1, lPlanar = 1, lOffsets = 0, lCounts = 0;
+
+      // Directories past the end or in a loop
+      if(lDirectories > size / 12 || lIfd + 2 + lEntries * 12 + 4 > size)
+        throw new IOException("Corrupt TIFF directory");
+
+      for(long e = 0; e < lEntries; e++) {
+        long lEntry = lIfd + 2 + e * 12;
+        switch((int)tiffU16(lEntry)) {
+          case 256: lWidth = tiffValue(lEntry, 0); break;
+          case 257: lHeight = tiffValue(lEntry, 0); break;
+          case 258: lBits = tiffValue(lEntry, 0); break;
+          case 259: lCompression = tiffValue(lEntry, 0); break;
+          case 273: lOffsets = lEntry; break;
+          case 277: lSamples = tiffValue(lEntry, 0); break;
+          case 279: lCounts = lEntry; break;
+          case 284: lPlanar = tiffValue(lEntry, 0); break;
+        }
+      }
+
+      int lPacking;
+      if(lSamples == 1)
+        lPacking = DMTXImage.PACK_8BPP_K;
+      else if(lSamples == 3)
+        lPacking = DMTXImage.PACK_24BPP_RGB;
+      else if(lSamples == 4)
+        lPacking = DMTXImage.PACK_32BPP_RGBX;
+      else
+        throw new IOException("Unsupported TIFF samples per pixel");
+      if(lWidth == 0 || lHeight == 0 || lBits != 8 || lCompression != 1 ||
+          (lPlanar != 1 && lSamples > 1) || lOffsets == 0 || lCounts == 0)
+        throw new IOException("Unsupported TIFF page");
+
+      long lStride = lWidth * lSamples;
+      long lBytes = lStride * lHeight;
+      if(lBytes > Integer.MAX_VALUE)
+        throw new IOException("TIFF page too large to map");
+
+      // Usually the strips follow each other and the page is mapped as is
+      long lStrips = tiffU32(lOffsets + 4);
+      long lFirst = tiffValue(lOffsets, 0), lRun = lFirst;
+      for(long s = 0; s < lStrips && lRun == tiffValue(lOffsets, s); s++)
+        lRun += tiffValue(lCounts, s);
+
+      long[] lGather = null;
+      if(lRun - lFirst < lBytes) {
+        if(lStrips > lHeight)
+          throw new IOException("Corrupt TIFF strips");
+        lGather = new long[(int)lStrips * 2];
+        for(int s = 0; s < lStrips; s++) {
+          lGather[s * 2] = tiffValue(lOffsets, s);
+          lGather[s * 2 + 1] = tiffValue(lCounts, s);
+        }
+      }
+      else if(lFirst + lBytes > size)
+        throw new IOException("TIFF page past the end of the file");
+
+      addPage(lFirst, (int)lWidth, (int)lHeight, (int)lStride, lPacking,
+          lGather);
+      lIfd = tiffU32(lIfd + 2 + lEntries * 12);
+    }
+    if(pages.isEmpty())
+      throw new IOException("TIFF file without pages");
+  }
+}
@@ -0,0 +1,154 @@
+/*
+Java wrapper for libdmtx
+
+Copyright (C) 2009 Pete Calvert
+Copyright (C) 2009 Dikran Seropian
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+Contact: mike@dragonflylogic.com
+*/
+
+
+/* $Id$ */
+
+package org.libdmtx;
+
+/**
+ * Search settings of a DMTXDecoder (see DMTXDecoder.setProfile). Fields
+ * left at UNDEFINED keep libdmtx's defaults. Start from one of the named
+ * profiles, or let calibrate() fit them to sample images.
+ */
+public class DMTXProfile {
+  /**
+   * Load external library
+   */
+  static {
+    System.loadLibrary("dmtx");
+  }
+
+  public static final int UNDEFINED = -1;
+
+  /**
+   * Named profiles: libdmtx's defaults, crisp labels seen head-on by a
+   * fixed camera (set sizeIdx to the printed size), many small symbols on
+   * a flat scan, and small low contrast symbols at an angle in a large
+   * frame
+   */
+  public static final int DEFAULT          = 0;
+  public static final int FIXED_SIZE_LABEL = 1;
+  public static final int DENSE_DOCUMENT   = 2;
+  public static final int FAR_FIELD_CAMERA = 3;
+
+  /**
+   * Symbol size expected, as an index into libdmtx's table of sizes (0 is
+   * 10x10, 24 is 8x18), or -1 for any, -2 for any square and -3 for any
+   * rectangular size
+   */
+  public int sizeIdx = UNDEFINED;
+
+  /**
+   * Range of the edge lengths of the symbols searched for, in pixels
+   */
+  public int edgeMin = UNDEFINED;
+  public int edgeMax = UNDEFINED;
+
+  /**
+   * Pixels skipped between scan lines
+   */
+  public int scanGap = UNDEFINED;
+
+  /**
+   * Degrees the corners of a symbol may deviate from square
+   */
+  public int squareDevn = UNDEFINED;
+
+  /**
+   * Minimum edge strength of the symbol borders
+   */
+  public int edgeThresh = UNDEFINED;
+
+  /**
+   * The default profile
+   */
+  public DMTXProfile() {
+  }
+
+  /**
+   * One of the named profiles (DEFAULT, FIXED_SIZE_LABEL ...)
+   */
+  public DMTXProfile(int aName) {
+    int[] lValues = new int[6];
+    if(!nativeInit(aName, lValues))
+      throw new IllegalArgumentException("Unknown profile " + aName);
+    setValues(lValues);
+  }
+
+  /**
+   * Find the tightest settings that still decode every tag found in
+   * aSamples with the defaults, and how long both take. The settings of
+   * aStart (which may be null) other than UNDEFINED are tried first.
+   * Returns null if no tag is found in the samples.
+   */
+  public static DMTXCalibration calibrate(DMTXImage[] aSamples,
+      DMTXProfile aStart, int aSearchTimeout) {
+    if(aSamples.length == 0)
+      throw new IllegalArgumentException("No samples given");
+
+    int[] lValues = (aStart != null) ? aStart.getValues() :
+        new DMTXProfile().getValues();
+    double[] lMillis = new double[2];
+    int lTagCount = nativeCalibrate(aSamples, lValues, aSearchTimeout, lMillis);
+    if(lTagCount <= 0)
+      return null;
+
+    DMTXProfile lProfile = new DMTXProfile();
+    lProfile.setValues(lValues);
+    return new DMTXCalibration(lProfile, lTagCount, lMillis[0], lMillis[1]);
+  }
+
+  /**
+   * The settings in the order the native code uses
+   */
+  int[] getValues() {
+    return new int[] { sizeIdx, edgeMin, edgeMax, scanGap, squareDevn,
+        edgeThresh };
+  }
+
+  private void setValues(int[] aValues) {
+    sizeIdx    = aValues[0];
+    edgeMin    = aValues[1];
+    edgeMax    = aValues[2];
+    scanGap    = aValues[3];
+    squareDevn = aValues[4];
+    edgeThresh = aValues[5];
+  }
+
+  public String toString() {
+    return "size " + sizeIdx + ", edges " + edgeMin + "-" + edgeMax +
+        ", gap " + scanGap + ", deviation " + squareDevn + ", threshold " +
+        edgeThresh;
+  }
+
+  private static native boolean nativeInit(int aName, int[] aValues);
+
+  /**
+   * Stores the calibrated settings in aValues and the milliseconds taken
+   * with the defaults and with them in aMillis. Returns the number of
+   * tags found with the defaults.
+   */
+  private static native int nativeCalibrate(DMTXImage[] aSamples,
+      int[] aValues, int aSearchTimeout, double[] aMillis);
+}
@@ -24,11 +24,13 @@ Contact: libdmtx@fernsroth.com
 
 using System;
 using System.Collections.Generic;
+using System.Diagnostics;
 using System.IO;
 using System.Runtime.InteropServices;
 using System.Drawing;
 using System.Drawing.Imaging;
 using System.Text;
+using System.Threading;
 
 namespace Libdmtx {
     /// <summary>
@@ -38,8 +40,22 @@ namespace Libdmtx {
         const byte RETURN_NO_MEMORY = 1;
         const byte RETURN_INVALID_ARGUMENT = 2;
         const byte RETURN_ENCODE_ERROR = 3;
+        const byte RETURN_CANCELLED = 4;
+        const byte RETURN_FILE_ERROR = 5;
         public const int DmtxUndefined = -1; // defined in "dmtx.h"
 
+        // DmtxPackOrder values (defined in "dmtx.h") matching GDI+ layouts
+        internal const UInt32 PACK_8BPP_K = 300;
+        internal const UInt32 PACK_24BPP_BGR = 501;
+        internal const UInt32 PACK_32BPP_BGRX = 602;
+
+        // Output formats of dmtx_encode_batch
+        const UInt32 BATCH_MODULES = 1;
+        const UInt32 BATCH_SHEET = 2;
+
+        // Flags of dmtx_decode_diagnose
+        const UInt32 DIAGNOSE_OVERLAY = 1;
+
         /// <summary>
         /// Gets the version of the underlying libdmtx used.
         /// </summary>
@@ -68,9 +84,147 @@ namespace Libdmtx {
         /// </code>
         /// </example>
         public static DmtxDecoded[] Decode(Bitmap b, DecodeOptions options) {
-            List<DmtxDecoded> results = new List<DmtxDecoded>();
-            Decode(b, options, delegate(DmtxDecoded d) { results.Add(d); });
-            return results.ToArray();
+            return Decode(b, options, (DecodeStats)null);
+        }
+
+        /// <summary>
+        /// Decodes a bitmap like <see cref="Decode(Bitmap,DecodeOptions)"/>
+        /// and reports where the time went.
+        /// </summary>
+        /// <param name="b">The bitmap to decode.</param>
+        /// <param name="options">The options used for decoding.</param>
+        /// <param name="stats">Receives the timings and counters of the
+        /// decode; may be null. Collecting them costs a few clock reads per
+        /// region.</param>
+        /// <returns>An array of decoded symbols, one for each symbol found.</returns>
+        public static DmtxDecoded[] Decode(Bitmap b, DecodeOptions options, DecodeStats stats) {
+            IntPtr buffer = IntPtr.Zero;
+            UInt32 bufferSize = 0;
+            UInt32 recordCount = 0;
+            byte[] flat;
+            byte status;
+            Stopwatch watch = Stopwatch.StartNew();
+            TimeSpan setup, marshal;
+            try {
+                UInt32 packing;
+                BitmapData bd = LockForDecode(b, out packing);
+                setup = watch.Elapsed;
+                try {
+                    status = DmtxDecodeResults(
+                        bd.Scan0,
+                        (UInt32)b.Width,
+                        (UInt32)b.Height,
+                        (UInt32)bd.Stride,
+                        packing,
+                        options,
+                        null, 0,
+                        out buffer,
+                        out bufferSize,
+                        out recordCount,
+                        stats);
+                } finally {
+                    b.UnlockBits(bd);
+                }
+                marshal = watch.Elapsed;
+                flat = TakeResults(buffer, bufferSize);
+            } catch (Exception ex) {
+                throw new DmtxException("Error calling native function.", ex);
+            }
+            CheckDecodeStatus(status);
+            DmtxDecoded[] results = ToDecodedArray(flat, recordCount);
+            AddManagedStats(stats, setup, watch.Elapsed - marshal, results, bufferSize);
+            return results;
+        }
+
+        /// <summary>
+        /// Decodes 8 bpp luminance pixels, e.g. a frame from a mono camera,
+        /// in place without making a bitmap of them first.
+        /// </summary>
+        /// <param name="pixels">The pixels, top row first.</param>
+        /// <param name="width">The width of the image in pixels.</param>
+        /// <param name="height">The height of the image in pixels.</param>
+        /// <param name="stride">The distance between rows in bytes.</param>
+        /// <param name="options">The options used for decoding.</param>
+        /// <returns>An array of decoded symbols, one for each symbol found.</returns>
+        public static DmtxDecoded[] DecodeGray(byte[] pixels, int width, int height, int stride, DecodeOptions options) {
+            return DecodeGray(pixels, width, height, stride, options, null);
+        }
+
+        /// <summary>
+        /// Same as <see cref="DecodeGray(byte[],int,int,int,DecodeOptions)"/>,
+        /// filling <paramref name="stats"/> (may be null) like
+        /// <see cref="Decode(Bitmap,DecodeOptions,DecodeStats)"/>.
+        /// </summary>
+        public static DmtxDecoded[] DecodeGray(byte[] pixels, int width, int height, int stride,
+            DecodeOptions options, DecodeStats stats) {
+            IntPtr buffer = IntPtr.Zero;
+            UInt32 bufferSize = 0;
+            UInt32 recordCount = 0;
+            byte[] flat;
+            byte status;
+            Stopwatch watch = Stopwatch.StartNew();
+            TimeSpan setup, marshal;
+            CheckGrayPixels(pixels, width, height, stride);
+            try {
+                GCHandle handle = GCHandle.Alloc(pixels, GCHandleType.Pinned);
+                setup = watch.Elapsed;
+                try {
+                    status = DmtxDecodeResults(
+                        handle.AddrOfPinnedObject(),
+                        (UInt32)width,
+                        (UInt32)height,
+                        (UInt32)stride,
+                        PACK_8BPP_K,
+                        options,
+                        null, 0,
+                        out buffer,
+                        out bufferSize,
+                        out recordCount,
+                        stats);
+                } finally {
+                    handle.Free();
+                }
+                marshal = watch.Elapsed;
+                flat = TakeResults(buffer, bufferSize);
+            } catch (Exception ex) {
+                throw new DmtxException("Error calling native function.", ex);
+            }
+            CheckDecodeStatus(status);
+            DmtxDecoded[] results = ToDecodedArray(flat, recordCount);
+            AddManagedStats(stats, setup, watch.Elapsed - marshal, results, bufferSize);
+            return results;
+        }
+
+        /// <summary>
+        /// Adds the managed side of a decode to the stats libdmtx filled in:
+        /// locking or pinning the pixels is setup, and unpacking the result
+        /// buffer into <see cref="DmtxDecoded"/> objects is marshalling.
+        /// </summary>
+        internal static void AddManagedStats(DecodeStats stats, TimeSpan setup, TimeSpan marshal,
+            DmtxDecoded[] results, UInt32 bufferSize) {
+            if (stats == null) {
+                return;
+            }
+            stats.SetupMicroseconds += (UInt32)(setup.Ticks / 10);
+            stats.MarshalMicroseconds += (UInt32)(marshal.Ticks / 10);
+            // The buffer is copied into managed memory once, then every
+            // payload into its own array
+            stats.BytesCopied += bufferSize;
+            foreach (DmtxDecoded decoded in results) {
+                stats.BytesCopied += (UInt32)decoded.Data.Length;
+            }
+        }
+
+        internal static void CheckGrayPixels(byte[] pixels, int width, int height, int stride) {
+            if (pixels == null) {
+                throw new ArgumentNullException("pixels");
+            }
+            if (width <= 0 || height <= 0 || stride < width) {
+                throw new DmtxInvalidArgumentException("Invalid image dimensions.");
+            }
+            if ((long)stride * (height - 1) + width > pixels.Length) {
+                throw new DmtxInvalidArgumentException("Buffer is too small for the given dimensions.");
+            }
         }
 
         public static DmtxDecoded[] Decode(
@@ -105,8 +259,8 @@ namespace Libdmtx {
             Exception decodeException = null;
             byte status;
             try {
-                int bitmapStride;
-                byte[] pxl = BitmapToByteArray(b, out bitmapStride);
+                UInt32 packing;
+                BitmapData bd = LockForDecode(b, out packing);
 
                 DmtxDiagnosticImageCallback diagnosticImageCallbackParam = null;
                 if (DiagnosticImageCallback != null) {
@@ -124,46 +278,544 @@ namespace Libdmtx {
                     };
                 }
 
-                status = DmtxDecode(
-                    pxl,
-                    (UInt32)b.Width,
-                    (UInt32)b.Height,
-                    (UInt32)bitmapStride,
-                    options,
-                    diagnosticImageCallbackParam, diagnosticImageStyle,
-                    delegate(DecodedInternal dmtxDecodeResult) {
-                        DmtxDecoded result;
-                        try {
-                            result = new DmtxDecoded();
-                            result.Corners = dmtxDecodeResult.Corners;
-                            result.SymbolInfo = dmtxDecodeResult.SymbolInfo;
-                            result.Data = new byte[dmtxDecodeResult.DataSize];
-                            for (int dataIdx = 0; dataIdx < dmtxDecodeResult.DataSize; dataIdx++) {
-                                result.Data[dataIdx] = Marshal.ReadByte(dmtxDecodeResult.Data, dataIdx);
+                // The locked bits are decoded in place, no copy is made
+                try {
+                    status = DmtxDecodePixels(
+                        bd.Scan0,
+                        (UInt32)b.Width,
+                        (UInt32)b.Height,
+                        (UInt32)bd.Stride,
+                        packing,
+                        options,
+                        diagnosticImageCallbackParam, diagnosticImageStyle,
+                        delegate(DecodedInternal dmtxDecodeResult) {
+                            try {
+                                Callback(ToDecoded(dmtxDecodeResult));
+                                return true;
+                            } catch (Exception ex) {
+                                decodeException = ex;
+                                return false;
                             }
-                            Callback(result);
-                            return true;
-                        } catch (Exception ex) {
-                            decodeException = ex;
-                            return false;
-                        }
-                    });
+                        });
+                } finally {
+                    b.UnlockBits(bd);
+                }
             } catch (Exception ex) {
                 throw new DmtxException("Error calling native function.", ex);
             }
             if (decodeException != null) {
                 throw decodeException;
             }
+            CheckDecodeStatus(status);
+        }
+
+        /// <summary>
+        /// Decodes a bitmap and reports what the scan made of every candidate
+        /// region it found: where it was, which edges were traced and whether
+        /// it decoded.
+        /// </summary>
+        /// <remarks>
+        /// The records are collected while scanning and come back in one
+        /// buffer with the results, so unlike the diagnostic image of
+        /// <see cref="Decode(Bitmap,DecodeOptions,DiagnosticImageStyles,out Bitmap)"/>
+        /// this adds little to the decode and can be left on for a sample
+        /// of production traffic. With <paramref name="overlay"/> set the
+        /// scan cache is returned as well, see <see cref="DecodeDiagnostics.Overlay"/>.
+        /// </remarks>
+        /// <example>
+        /// <code>
+        ///   DecodeDiagnostics diag = Dmtx.Diagnose(bm, new DecodeOptions(), false);
+        ///   foreach (RegionDiagnostic region in diag.Regions) {
+        ///     Console.WriteLine(region.Status + " at " + region.Seed.X + "," + region.Seed.Y);
+        ///   }
+        /// </code>
+        /// </example>
+        public static DecodeDiagnostics Diagnose(Bitmap b, DecodeOptions options, bool overlay) {
+            IntPtr buffer = IntPtr.Zero, diagBuffer = IntPtr.Zero;
+            UInt32 bufferSize = 0, diagBufferSize = 0;
+            UInt32 recordCount = 0;
+            byte[] flat, diagFlat;
+            byte status;
+            try {
+                UInt32 packing;
+                BitmapData bd = LockForDecode(b, out packing);
+                try {
+                    status = DmtxDecodeDiagnose(
+                        bd.Scan0,
+                        (UInt32)b.Width,
+                        (UInt32)b.Height,
+                        (UInt32)bd.Stride,
+                        packing,
+                        options,
+                        overlay ? DIAGNOSE_OVERLAY : 0,
+                        out buffer,
+                        out bufferSize,
+                        out recordCount,
+                        out diagBuffer,
+                        out diagBufferSize);
+                } finally {
+                    b.UnlockBits(bd);
+                }
+                flat = TakeResults(buffer, bufferSize);
+                diagFlat = TakeResults(diagBuffer, diagBufferSize);
+            } catch (Exception ex) {
+                throw new DmtxException("Error calling native function.", ex);
+            }
+            CheckDecodeStatus(status);
+
+            DecodeDiagnostics diagnostics = ReadDiagnostics(diagFlat);
+            diagnostics.Results = ToDecodedArray(flat, recordCount);
+            return diagnostics;
+        }
+
+        /// <summary>
+        /// Unpacks a dmtx_decode_diagnose buffer: a header, the region
+        /// records and the overlay, all at the offsets the header gives.
+        /// </summary>
+        internal static DecodeDiagnostics ReadDiagnostics(byte[] flat) {
+            DecodeDiagnostics diagnostics = new DecodeDiagnostics();
+            GCHandle handle = GCHandle.Alloc(flat, GCHandleType.Pinned);
+            try {
+                long basePtr = handle.AddrOfPinnedObject().ToInt64();
+                DiagnosticsInternal header = (DiagnosticsInternal)Marshal.PtrToStructure(
+                    new IntPtr(basePtr), typeof(DiagnosticsInternal));
+                int recordSize = Marshal.SizeOf(typeof(RegionDiagnostic));
+                diagnostics.Regions = new RegionDiagnostic[header.RegionCount];
+                for (int r = 0; r < diagnostics.Regions.Length; r++) {
+                    diagnostics.Regions[r] = (RegionDiagnostic)Marshal.PtrToStructure(
+                        new IntPtr(basePtr + header.RegionOffset + r * recordSize), typeof(RegionDiagnostic));
+                }
+                if (header.OverlayWidth > 0 && header.OverlayHeight > 0) {
+                    diagnostics.OverlayWidth = (int)header.OverlayWidth;
+                    diagnostics.OverlayHeight = (int)header.OverlayHeight;
+                    diagnostics.Overlay = new byte[header.OverlayWidth * header.OverlayHeight];
+                    Buffer.BlockCopy(flat, (int)header.OverlayOffset, diagnostics.Overlay, 0, diagnostics.Overlay.Length);
+                }
+            } finally {
+                handle.Free();
+            }
+            return diagnostics;
+        }
+
+        /// <summary>
+        /// Starts decoding a bitmap on the native thread pool and returns at
+        /// once. The bitmap is copied before this returns, so it may be
+        /// changed or disposed right away.
+        /// </summary>
+        /// <remarks>
+        /// <paramref name="callback"/> (may be null) is called on a pool
+        /// thread when the decode has finished. Every operation must be
+        /// finished with <see cref="EndDecode"/>, which blocks until the
+        /// results are ready. <see cref="DmtxDecodeOperation.Cancel"/> stops
+        /// the scan within a few milliseconds.
+        /// </remarks>
+        /// <example>
+        /// <code>
+        ///   DmtxDecodeOperation op = Dmtx.BeginDecode(bm, new DecodeOptions(), null, null);
+        ///   ...
+        ///   if (userPressedCancel) {
+        ///     op.Cancel();
+        ///   }
+        ///   try {
+        ///     DmtxDecoded[] decodeResults = Dmtx.EndDecode(op);
+        ///   } catch (DmtxCancelledException) {
+        ///   }
+        /// </code>
+        /// </example>
+        public static DmtxDecodeOperation BeginDecode(
+            Bitmap b,
+            DecodeOptions options,
+            AsyncCallback callback,
+            object state) {
+            DmtxDecodeOperation operation = new DmtxDecodeOperation(callback, state);
+            byte status;
+            try {
+                UInt32 packing;
+                BitmapData bd = LockForDecode(b, out packing);
+                try {
+                    status = operation.Start(bd.Scan0, (UInt32)b.Width, (UInt32)b.Height,
+                        (UInt32)bd.Stride, packing, options);
+                } finally {
+                    b.UnlockBits(bd);
+                }
+            } catch (Exception ex) {
+                throw new DmtxException("Error calling native function.", ex);
+            }
+            CheckDecodeStatus(status);
+            return operation;
+        }
+
+        /// <summary>
+        /// Waits for a decode started with <see cref="BeginDecode"/> and
+        /// returns the symbols it found.
+        /// </summary>
+        /// <exception cref="DmtxCancelledException">The operation was cancelled
+        /// before it finished.</exception>
+        public static DmtxDecoded[] EndDecode(IAsyncResult asyncResult) {
+            DmtxDecodeOperation operation = asyncResult as DmtxDecodeOperation;
+            if (operation == null) {
+                throw new ArgumentException("Not a result of BeginDecode.", "asyncResult");
+            }
+            return operation.End();
+        }
+
+        /// <summary>
+        /// Decodes several bitmaps in one native call, returning the symbols
+        /// found in each bitmap (indexed like <paramref name="bitmaps"/>).
+        /// </summary>
+        /// <remarks>
+        /// The bitmaps are locked and handed to libdmtx without copying, and
+        /// all results come back in one buffer. With
+        /// <see cref="DecodeOptions.Threads"/> above 1 (or 0) the bitmaps
+        /// are decoded in parallel, one bitmap per thread at a time.
+        /// </remarks>
+        /// <example>
+        /// <code>
+        ///   DmtxDecoded[][] pages = Dmtx.DecodeBatch(bitmaps, new DecodeOptions { Threads = 0 });
+        ///   for (int i = 0; i &lt; pages.Length; i++) {
+        ///     Console.WriteLine("Page " + i + ": " + pages[i].Length + " symbols");
+        ///   }
+        /// </code>
+        /// </example>
+        public static DmtxDecoded[][] DecodeBatch(Bitmap[] bitmaps, DecodeOptions options) {
+            BitmapData[] locked = new BitmapData[bitmaps.Length];
+            FrameInternal[] frames = new FrameInternal[bitmaps.Length];
+            IntPtr buffer = IntPtr.Zero;
+            UInt32 bufferSize = 0;
+            UInt32 recordCount = 0;
+            byte[] flat;
+            byte status;
+            try {
+                try {
+                    for (int i = 0; i < bitmaps.Length; i++) {
+                        Bitmap b = bitmaps[i];
+                        locked[i] = LockForDecode(b, out frames[i].Packing);
+                        frames[i].Image = locked[i].Scan0;
+                        frames[i].Width = (UInt32)b.Width;
+                        frames[i].Height = (UInt32)b.Height;
+                        frames[i].Stride = (UInt32)locked[i].Stride;
+                    }
+
+                    status = DmtxDecodeBatch(
+                        frames,
+                        (UInt32)frames.Length,
+                        options,
+                        out buffer,
+                        out bufferSize,
+                        out recordCount);
+                } finally {
+                    for (int i = 0; i < bitmaps.Length; i++) {
+                        if (locked[i] != null) {
+                            bitmaps[i].UnlockBits(locked[i]);
+                        }
+                    }
+                }
+
+                flat = TakeResults(buffer, bufferSize);
+            } catch (Exception ex) {
+                throw new DmtxException("Error calling native function.", ex);
+            }
+            CheckDecodeStatus(status);
+
+            List<DmtxDecoded>[] results = new List<DmtxDecoded>[bitmaps.Length];
+            for (int i = 0; i < results.Length; i++) {
+                results[i] = new List<DmtxDecoded>();
+            }
+            ReadResultRecords(flat, recordCount, delegate(UInt32 frameIndex, DmtxDecoded d) {
+                results[frameIndex].Add(d);
+            });
+
+            DmtxDecoded[][] ret = new DmtxDecoded[bitmaps.Length][];
+            for (int i = 0; i < ret.Length; i++) {
+                ret[i] = results[i].ToArray();
+            }
+            return ret;
+        }
+
+        /// <summary>
+        /// Decodes every page of a PNM or TIFF file, returning the symbols
+        /// found on each page.
+        /// </summary>
+        /// <remarks>
+        /// The file is memory-mapped and its pages are decoded in place,
+        /// without going through <see cref="Bitmap"/>. Supported are binary
+        /// PGM/PPM files (several images may follow each other) and TIFF
+        /// files whose pages are uncompressed with 8 bits per sample. Pages
+        /// are spread over <see cref="DecodeOptions.Threads"/> like
+        /// <see cref="DecodeBatch"/>.
+        /// </remarks>
+        /// <example>
+        /// <code>
+        ///   DmtxDecoded[][] pages = Dmtx.DecodeFile("scans.tif", new DecodeOptions());
+        /// </code>
+        /// </example>
+        public static DmtxDecoded[][] DecodeFile(string path, DecodeOptions options) {
+            return DecodeFile(path, new FileLayout(), options);
+        }
+
+        /// <summary>
+        /// Same as <see cref="DecodeFile(string,DecodeOptions)"/> with the
+        /// format given by <paramref name="layout"/>, which is how files of
+        /// raw frames are read.
+        /// </summary>
+        public static DmtxDecoded[][] DecodeFile(string path, FileLayout layout, DecodeOptions options) {
+            IntPtr buffer = IntPtr.Zero;
+            UInt32 bufferSize = 0;
+            UInt32 recordCount = 0;
+            UInt32 pageCount = 0;
+            byte[] flat;
+            byte status;
+            try {
+                status = DmtxDecodeFile(
+                    path,
+                    layout,
+                    options,
+                    out buffer,
+                    out bufferSize,
+                    out recordCount,
+                    out pageCount);
+                flat = TakeResults(buffer, bufferSize);
+            } catch (Exception ex) {
+                throw new DmtxException("Error calling native function.", ex);
+            }
+            if (status == RETURN_FILE_ERROR) {
+                throw new DmtxFileException("Unable to read file '" + path + "'.");
+            } else if (status == RETURN_INVALID_ARGUMENT) {
+                throw new DmtxInvalidArgumentException("Unsupported file or invalid options configuration.");
+            }
+            CheckDecodeStatus(status);
+
+            List<DmtxDecoded>[] results = new List<DmtxDecoded>[pageCount];
+            for (int i = 0; i < results.Length; i++) {
+                results[i] = new List<DmtxDecoded>();
+            }
+            ReadResultRecords(flat, recordCount, delegate(UInt32 frameIndex, DmtxDecoded d) {
+                results[frameIndex].Add(d);
+            });
+
+            DmtxDecoded[][] ret = new DmtxDecoded[pageCount][];
+            for (int i = 0; i < ret.Length; i++) {
+                ret[i] = results[i].ToArray();
+            }
+            return ret;
+        }
+
+        /// <summary>
+        /// Gets decode options holding the search settings of a named
+        /// profile. They are a starting point for
+        /// <see cref="Calibrate(Bitmap[],DecodeOptions)"/>.
+        /// </summary>
+        /// <param name="profile">The profile.</param>
+        /// <returns>New options with the profile's search settings.</returns>
+        /// <example>
+        /// Labels of a production line that only ever prints 16x16 symbols:
+        /// <code>
+        ///   DecodeOptions o = Dmtx.GetProfile(DecodeProfile.FixedSizeLabel);
+        ///   o.SizeIdxExpected = CodeSize.Symbol16x16;
+        /// </code>
+        /// </example>
+        public static DecodeOptions GetProfile(DecodeProfile profile) {
+            DecodeOptions options = new DecodeOptions();
+            byte status;
+            try {
+                status = DmtxDecodeProfile((Int32)profile, options);
+            } catch (Exception ex) {
+                throw new DmtxException("Error calling native function.", ex);
+            }
+            CheckDecodeStatus(status);
+            return options;
+        }
+
+        /// <summary>
+        /// Finds the tightest search settings that still decode every symbol
+        /// found in sample images with the default settings, and measures
+        /// how much faster they are.
+        /// </summary>
+        /// <remarks>
+        /// The symbol size, edge lengths, scan gap, squareness and shrink are
+        /// derived from the symbols found; settings already made in
+        /// <paramref name="options"/> (e.g. a profile from
+        /// <see cref="GetProfile"/>) are tried first. Settings are then
+        /// loosened one at a time until all symbols decode again. A
+        /// <see cref="DecodeOptions.Shrink"/> of 1 lets the calibration
+        /// pick one. Only one symbol size can be expected, so samples
+        /// holding several sizes yield the common shape, or none.
+        /// </remarks>
+        /// <param name="samples">Images typical of what will be decoded.</param>
+        /// <param name="options">The options to start from; not changed.</param>
+        /// <returns>The calibrated options and the timings.</returns>
+        /// <exception cref="DmtxInvalidArgumentException">No symbol was
+        /// found in the samples.</exception>
+        public static DecodeCalibration Calibrate(Bitmap[] samples, DecodeOptions options) {
+            BitmapData[] locked = new BitmapData[samples.Length];
+            FrameInternal[] frames = new FrameInternal[samples.Length];
+            DecodeCalibration calibration = new DecodeCalibration();
+            calibration.Options = options.Copy();
+            byte status;
+            try {
+                try {
+                    for (int i = 0; i < samples.Length; i++) {
+                        Bitmap b = samples[i];
+                        locked[i] = LockForDecode(b, out frames[i].Packing);
+                        frames[i].Image = locked[i].Scan0;
+                        frames[i].Width = (UInt32)b.Width;
+                        frames[i].Height = (UInt32)b.Height;
+                        frames[i].Stride = (UInt32)locked[i].Stride;
+                    }
+
+                    status = DmtxDecodeCalibrate(
+                        frames,
+                        (UInt32)frames.Length,
+                        calibration.Options,
+                        out calibration.SymbolCount,
+                        out calibration.DefaultMilliseconds,
+                        out calibration.ProfileMilliseconds);
+                } finally {
+                    for (int i = 0; i < samples.Length; i++) {
+                        if (locked[i] != null) {
+                            samples[i].UnlockBits(locked[i]);
+                        }
+                    }
+                }
+            } catch (Exception ex) {
+                throw new DmtxException("Error calling native function.", ex);
+            }
+            if (status == RETURN_INVALID_ARGUMENT) {
+                throw new DmtxInvalidArgumentException("No symbol found in the samples.");
+            }
+            CheckDecodeStatus(status);
+            return calibration;
+        }
+
+        internal delegate void ResultRecordCallback(UInt32 frameIndex, DmtxDecoded decoded);
+
+        /// <summary>
+        /// Copies a native result buffer with a single transfer and frees it.
+        /// </summary>
+        internal static byte[] TakeResults(IntPtr buffer, UInt32 bufferSize) {
+            try {
+                byte[] flat = new byte[bufferSize];
+                if (bufferSize > 0) {
+                    Marshal.Copy(buffer, flat, 0, flat.Length);
+                }
+                return flat;
+            } finally {
+                if (buffer != IntPtr.Zero) {
+                    DmtxFreeResults(buffer);
+                }
+            }
+        }
+
+        internal static DmtxDecoded[] ToDecodedArray(byte[] flat, UInt32 recordCount) {
+            DmtxDecoded[] results = new DmtxDecoded[recordCount];
+            int r = 0;
+            ReadResultRecords(flat, recordCount, delegate(UInt32 frameIndex, DmtxDecoded d) {
+                results[r++] = d;
+            });
+            return results;
+        }
+
+        /// <summary>
+        /// Walks a flat native result buffer that was copied in one piece:
+        /// <paramref name="recordCount"/> fixed size records followed by the
+        /// payloads they point to.
+        /// </summary>
+        internal static void ReadResultRecords(byte[] flat, UInt32 recordCount, ResultRecordCallback callback) {
+            if (recordCount == 0) {
+                return;
+            }
+            int recordSize = Marshal.SizeOf(typeof(ResultRecordInternal));
+            GCHandle handle = GCHandle.Alloc(flat, GCHandleType.Pinned);
+            try {
+                long basePtr = handle.AddrOfPinnedObject().ToInt64();
+                for (int r = 0; r < recordCount; r++) {
+                    ResultRecordInternal record = (ResultRecordInternal)Marshal.PtrToStructure(
+                        new IntPtr(basePtr + r * recordSize), typeof(ResultRecordInternal));
+                    DmtxDecoded decoded = new DmtxDecoded();
+                    decoded.SymbolInfo = record.SymbolInfo;
+                    decoded.Corners = record.Corners;
+                    decoded.Data = new byte[record.DataSize];
+                    Buffer.BlockCopy(flat, (int)record.DataOffset, decoded.Data, 0, decoded.Data.Length);
+                    callback(record.FrameIndex, decoded);
+                }
+            } finally {
+                handle.Free();
+            }
+        }
+
+        internal static DmtxDecoded ToDecoded(DecodedInternal dmtxDecodeResult) {
+            DmtxDecoded result = new DmtxDecoded();
+            result.Corners = dmtxDecodeResult.Corners;
+            result.SymbolInfo = dmtxDecodeResult.SymbolInfo;
+            result.Data = new byte[dmtxDecodeResult.DataSize];
+            if (result.Data.Length > 0) {
+                Marshal.Copy(dmtxDecodeResult.Data, result.Data, 0, result.Data.Length);
+            }
+            return result;
+        }
+
+        internal static void CheckDecodeStatus(byte status) {
             if (status == RETURN_NO_MEMORY) {
                 throw new DmtxOutOfMemoryException("Not enough memory.");
             } else if (status == RETURN_INVALID_ARGUMENT) {
                 throw new DmtxInvalidArgumentException("Invalid options configuration.");
+            } else if (status == RETURN_CANCELLED) {
+                throw new DmtxCancelledException("The decode was cancelled.");
             } else if (status > 0) {
                 throw new DmtxException("Unknown error.");
             }
         }
 
-        private static byte[] BitmapToByteArray(Bitmap b, out int stride) {
+        /// <summary>
+        /// Locks the bits of a bitmap for reading by libdmtx. 32 bpp and
+        /// grayscale 8 bpp bitmaps are locked in their own format; anything
+        /// else is converted to 24 bpp by GDI+.
+        /// </summary>
+        internal static BitmapData LockForDecode(Bitmap b, out UInt32 packing) {
+            PixelFormat lockFormat;
+            switch (b.PixelFormat) {
+                case PixelFormat.Format32bppArgb:
+                case PixelFormat.Format32bppPArgb:
+                case PixelFormat.Format32bppRgb:
+                    lockFormat = b.PixelFormat;
+                    packing = PACK_32BPP_BGRX;
+                    break;
+                case PixelFormat.Format8bppIndexed:
+                    if (IsGrayscalePalette(b.Palette)) {
+                        lockFormat = PixelFormat.Format8bppIndexed;
+                        packing = PACK_8BPP_K;
+                        break;
+                    }
+                    goto default;
+                default:
+                    lockFormat = PixelFormat.Format24bppRgb;
+                    packing = PACK_24BPP_BGR;
+                    break;
+            }
+
+            Rectangle rect = new Rectangle(0, 0, b.Width, b.Height);
+            BitmapData bd = b.LockBits(rect, ImageLockMode.ReadOnly, lockFormat);
+            if (bd.Stride < 0) {
+                b.UnlockBits(bd);
+                throw new DmtxInvalidArgumentException("Bottom-up bitmaps are not supported.");
+            }
+            return bd;
+        }
+
+        private static bool IsGrayscalePalette(ColorPalette palette) {
+            Color[] entries = palette.Entries;
+            if (entries.Length != 256) {
+                return false;
+            }
+            for (int i = 0; i < entries.Length; i++) {
+                if (entries[i].R != i || entries[i].G != i || entries[i].B != i) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        internal static byte[] BitmapToByteArray(Bitmap b, out int stride) {
             Rectangle rect = new Rectangle(0, 0, b.Width, b.Height);
             BitmapData bd = b.LockBits(rect, ImageLockMode.ReadOnly, PixelFormat.Format24bppRgb);
             try {
@@ -208,115 +860,818 @@ namespace Libdmtx {
             } else if ((status > 0) || (result == IntPtr.Zero)) {
                 throw new DmtxException("Unknown error.");
             }
-
-            DmtxEncoded ret;
-            EncodedInternal intResult = null;
+
+            DmtxEncoded ret;
+            EncodedInternal intResult = null;
+            try {
+                intResult = (EncodedInternal)Marshal.PtrToStructure(result, typeof(EncodedInternal));
+                ret = new DmtxEncoded();
+                ret.SymbolInfo = intResult.SymbolInfo;
+                ret.Bitmap = new Bitmap((int)intResult.Width, (int)intResult.Height, PixelFormat.Format24bppRgb);
+                Rectangle rect = new Rectangle(0, 0, ret.Bitmap.Width, ret.Bitmap.Height);
+                BitmapData bd = ret.Bitmap.LockBits(rect, ImageLockMode.WriteOnly, PixelFormat.Format24bppRgb);
+                try {
+                    DmtxCopyEncodeResult(intResult.Data, (UInt32)Math.Abs(bd.Stride), bd.Scan0);
+                } finally {
+                    ret.Bitmap.UnlockBits(bd);
+                }
+            } catch (Exception ex) {
+                throw new DmtxException("Error parsing encode result.", ex);
+            } finally {
+                try {
+                    if (intResult != null) {
+                        DmtxFreeEncodeResult(intResult.Data);
+                    }
+                } catch (Exception ex) {
+                    throw new DmtxException("Error freeing memory.", ex);
+                }
+            }
+            return ret;
+        }
+
+        /// <summary>
+        /// Encodes data into a DataMatrix symbol, returning only its module
+        /// matrix instead of a rendered bitmap.
+        /// </summary>
+        /// <remarks>
+        /// <see cref="EncodeOptions.MarginSize"/> and
+        /// <see cref="EncodeOptions.ModuleSize"/> are ignored, and mosaic
+        /// symbols are not supported.
+        /// </remarks>
+        /// <example>
+        /// <code>
+        ///   DmtxEncodedModules m = Dmtx.EncodeModules(Encoding.ASCII.GetBytes("test"), new EncodeOptions());
+        ///   for (int row = 0; row &lt; m.Rows; row++) {
+        ///     for (int col = 0; col &lt; m.Cols; col++) {
+        ///       Console.Write(m.IsDark(row, col) ? "#" : " ");
+        ///     }
+        ///     Console.WriteLine();
+        ///   }
+        /// </code>
+        /// </example>
+        public static DmtxEncodedModules EncodeModules(byte[] data, EncodeOptions options) {
+            SymbolInfo symbolInfo = new SymbolInfo();
+            IntPtr modules = IntPtr.Zero;
+            UInt32 modulesSize = 0;
+            byte status;
+            byte[] bits;
+            try {
+                status = DmtxEncodeModules(data, (UInt16)data.Length, options, symbolInfo, out modules, out modulesSize);
+                bits = TakeResults(modules, modulesSize);
+            } catch (Exception ex) {
+                throw new DmtxException("Encoding error.", ex);
+            }
+            if (status == RETURN_NO_MEMORY) {
+                throw new DmtxOutOfMemoryException("Not enough memory.");
+            } else if (status == RETURN_INVALID_ARGUMENT) {
+                throw new DmtxInvalidArgumentException("Invalid options configuration.");
+            } else if (status == RETURN_ENCODE_ERROR) {
+                throw new DmtxException("Error while encoding.");
+            } else if (status > 0) {
+                throw new DmtxException("Unknown error.");
+            }
+
+            DmtxEncodedModules ret = new DmtxEncodedModules();
+            ret.SymbolInfo = symbolInfo;
+            ret.Modules = bits;
+            return ret;
+        }
+
+        /// <summary>
+        /// Encodes many payloads with the same options on a pool of native
+        /// threads and returns all bitmaps in one sheet.
+        /// </summary>
+        /// <param name="data">The payloads to encode.</param>
+        /// <param name="options">The options used for every payload.</param>
+        /// <param name="threads">Number of worker threads, 0 for one per processor.</param>
+        /// <returns>The sheet with the bitmaps stacked from top to bottom, in payload order.</returns>
+        /// <example>
+        /// <code>
+        ///   DmtxEncodedSheet sheet = Dmtx.EncodeSheet(labels, new EncodeOptions(), 0);
+        ///   for (int i = 0; i &lt; sheet.Bounds.Length; i++) {
+        ///     g.DrawImage(sheet.Bitmap, x, y, sheet.Bounds[i], GraphicsUnit.Pixel);
+        ///   }
+        /// </code>
+        /// </example>
+        public static DmtxEncodedSheet EncodeSheet(byte[][] data, EncodeOptions options, int threads) {
+            IntPtr buffer;
+            UInt32 sheetWidth, sheetHeight, sheetStride;
+            DmtxEncodedSheet ret = new DmtxEncodedSheet();
+
+            EncodeBatch(data, options, BATCH_SHEET, threads, out buffer, out sheetWidth, out sheetHeight, out sheetStride);
+            try {
+                ret.SymbolInfo = new SymbolInfo[data.Length];
+                ret.Bounds = new Rectangle[data.Length];
+                for (int i = 0; i < data.Length; i++) {
+                    EncodeRecordInternal record = ReadEncodeRecord(buffer, i);
+                    ret.SymbolInfo[i] = record.SymbolInfo;
+                    ret.Bounds[i] = new Rectangle((int)record.X, (int)record.Y, (int)record.Width, (int)record.Height);
+                }
+                if (data.Length > 0) {
+                    // Wrap the native sheet and copy it into a bitmap of its own
+                    IntPtr scan0 = new IntPtr(buffer.ToInt64() + data.Length * Marshal.SizeOf(typeof(EncodeRecordInternal)));
+                    using (Bitmap native = new Bitmap((int)sheetWidth, (int)sheetHeight, (int)sheetStride, PixelFormat.Format24bppRgb, scan0)) {
+                        ret.Bitmap = native.Clone(new Rectangle(0, 0, native.Width, native.Height), PixelFormat.Format24bppRgb);
+                    }
+                }
+            } catch (Exception ex) {
+                throw new DmtxException("Error parsing encode result.", ex);
+            } finally {
+                DmtxFreeResults(buffer);
+            }
+            return ret;
+        }
+
+        /// <summary>
+        /// Encodes many payloads with the same options on a pool of native
+        /// threads, returning only their module matrices.
+        /// </summary>
+        /// <param name="data">The payloads to encode.</param>
+        /// <param name="options">The options used for every payload, see <see cref="EncodeModules"/>.</param>
+        /// <param name="threads">Number of worker threads, 0 for one per processor.</param>
+        /// <returns>One module matrix per payload, in payload order.</returns>
+        public static DmtxEncodedModules[] EncodeModulesBatch(byte[][] data, EncodeOptions options, int threads) {
+            IntPtr buffer;
+            UInt32 sheetWidth, sheetHeight, sheetStride;
+            DmtxEncodedModules[] ret = new DmtxEncodedModules[data.Length];
+
+            EncodeBatch(data, options, BATCH_MODULES, threads, out buffer, out sheetWidth, out sheetHeight, out sheetStride);
+            try {
+                for (int i = 0; i < data.Length; i++) {
+                    EncodeRecordInternal record = ReadEncodeRecord(buffer, i);
+                    ret[i] = new DmtxEncodedModules();
+                    ret[i].SymbolInfo = record.SymbolInfo;
+                    ret[i].Modules = new byte[record.DataSize];
+                    Marshal.Copy(new IntPtr(buffer.ToInt64() + record.DataOffset), ret[i].Modules, 0, ret[i].Modules.Length);
+                }
+            } catch (Exception ex) {
+                throw new DmtxException("Error parsing encode result.", ex);
+            } finally {
+                DmtxFreeResults(buffer);
+            }
+            return ret;
+        }
+
+        private static void EncodeBatch(byte[][] data, EncodeOptions options, UInt32 format, int threads,
+            out IntPtr buffer, out UInt32 sheetWidth, out UInt32 sheetHeight, out UInt32 sheetStride) {
+            // Payloads go down back to back with their sizes alongside
+            int total = 0;
+            UInt16[] sizes = new UInt16[data.Length];
+            for (int i = 0; i < data.Length; i++) {
+                if (data[i].Length > UInt16.MaxValue) {
+                    throw new DmtxInvalidArgumentException("Payload " + i + " is too large.");
+                }
+                sizes[i] = (UInt16)data[i].Length;
+                total += data[i].Length;
+            }
+            byte[] texts = new byte[total];
+            total = 0;
+            for (int i = 0; i < data.Length; i++) {
+                Buffer.BlockCopy(data[i], 0, texts, total, data[i].Length);
+                total += data[i].Length;
+            }
+
+            UInt32 bufferSize, failedIndex;
+            byte status;
+            try {
+                status = DmtxEncodeBatch(texts, sizes, (UInt32)data.Length, options, format, (Int16)threads,
+                    out buffer, out bufferSize, out sheetWidth, out sheetHeight, out sheetStride, out failedIndex);
+            } catch (Exception ex) {
+                throw new DmtxException("Encoding error.", ex);
+            }
+            if (status == RETURN_NO_MEMORY) {
+                throw new DmtxOutOfMemoryException("Not enough memory.");
+            } else if (status == RETURN_INVALID_ARGUMENT) {
+                throw new DmtxInvalidArgumentException("Invalid options configuration.");
+            } else if (status == RETURN_ENCODE_ERROR) {
+                throw new DmtxException("Error while encoding payload " + failedIndex + ".");
+            } else if (status > 0) {
+                throw new DmtxException("Unknown error.");
+            }
+        }
+
+        private static EncodeRecordInternal ReadEncodeRecord(IntPtr buffer, int index) {
+            int recordSize = Marshal.SizeOf(typeof(EncodeRecordInternal));
+            return (EncodeRecordInternal)Marshal.PtrToStructure(
+                new IntPtr(buffer.ToInt64() + index * recordSize), typeof(EncodeRecordInternal));
+        }
+
+        /// <summary>
+        /// Byte budget of the native cache of finished encodes used by
+        /// <see cref="Encode"/> and <see cref="EncodeModules"/>. Repeated
+        /// payloads encoded with the same options are then copied from
+        /// the cache instead of being encoded again. 0 (the default)
+        /// disables the cache.
+        /// </summary>
+        /// <example>
+        /// <code>
+        ///   Dmtx.EncodeCacheLimit = 16 * 1024 * 1024;
+        ///   // ... encode labels ...
+        ///   EncodeCacheStats stats = Dmtx.GetEncodeCacheStats();
+        ///   Console.WriteLine("{0} hits, {1} misses", stats.Hits, stats.Misses);
+        /// </code>
+        /// </example>
+        public static UInt32 EncodeCacheLimit {
+            get { return GetEncodeCacheStats().MaxBytes; }
+            set {
+                try {
+                    DmtxEncodeCacheSetLimit(value);
+                } catch (Exception ex) {
+                    throw new DmtxException("Error configuring the encode cache.", ex);
+                }
+            }
+        }
+
+        public static EncodeCacheStats GetEncodeCacheStats() {
+            EncodeCacheStats stats = new EncodeCacheStats();
+            try {
+                DmtxEncodeCacheStats(stats);
+            } catch (Exception ex) {
+                throw new DmtxException("Error reading encode cache statistics.", ex);
+            }
+            return stats;
+        }
+
+        /// <summary>
+        /// Drops all cached encodes and resets the hit and miss counters.
+        /// </summary>
+        public static void ClearEncodeCache() {
+            try {
+                DmtxEncodeCacheClear();
+            } catch (Exception ex) {
+                throw new DmtxException("Error clearing the encode cache.", ex);
+            }
+        }
+
+        public static Bitmap PnmToBitmap(Stream pnmInputStream) {
+            // read header
+            if (ReadLine(pnmInputStream) != "P6") {
+                throw new Exception("Invalid PNM file format. Header was invalid.");
+            }
+            string widthHeightLine = ReadLine(pnmInputStream);
+            string[] widthHeightParts = widthHeightLine.Split(' ');
+            int width = int.Parse(widthHeightParts[0]);
+            int height = int.Parse(widthHeightParts[1]);
+            ReadLine(pnmInputStream); // ignore max value
+
+            Bitmap result = new Bitmap(width, height, PixelFormat.Format24bppRgb);
+
+            // transfer pixel data to bitmap
+            Rectangle rect = new Rectangle(0, 0, width, height);
+            BitmapData bd = result.LockBits(rect, ImageLockMode.WriteOnly, PixelFormat.Format24bppRgb);
+            try {
+                byte[] buffer = new byte[height * bd.Stride];
+                for (int y = 0; y < height; y++) {
+                    int rowOffset = y * bd.Stride;
+                    pnmInputStream.Read(buffer, rowOffset, width * 3);
+                }
+
+                Marshal.Copy(buffer, 0, bd.Scan0, buffer.Length);
+            } finally {
+                result.UnlockBits(bd);
+            }
+
+            return result;
+        }
+
+        private static string ReadLine(Stream stream) {
+            StringBuilder result = new StringBuilder();
+            int b;
+            while ((b = stream.ReadByte()) != '\n') {
+                result.Append((char)b);
+            }
+            return result.ToString();
+        }
+
+        [UnmanagedFunctionPointer(CallingConvention.Cdecl)]
+        internal delegate bool DmtxDecodeCallback(DecodedInternal dmtxDecodeResult);
+
+        [UnmanagedFunctionPointer(CallingConvention.Cdecl)]
+        private delegate void DmtxDiagnosticImageCallback(IntPtr data, uint totalBytes, uint headerSize);
+
+        [UnmanagedFunctionPointer(CallingConvention.Cdecl)]
+        internal delegate void DmtxDecodeDoneCallback();
+
+        [DllImport("libdmtx.dll", EntryPoint = "dmtx_decode_pixels")]
+        private static extern byte
+        DmtxDecodePixels(
+            [In] IntPtr image,
+            [In] UInt32 width,
+            [In] UInt32 height,
+            [In] UInt32 bitmapStride,
+            [In] UInt32 packing,
+            [In] DecodeOptions options,
+            [In] DmtxDiagnosticImageCallback diagnosticImageCallback,
+            [In] DiagnosticImageStyles diagnosticImageStyle,
+            [In] DmtxDecodeCallback decodeCallback);
+
+        [DllImport("libdmtx.dll", EntryPoint = "dmtx_decode_results")]
+        private static extern byte
+        DmtxDecodeResults(
+            [In] IntPtr image,
+            [In] UInt32 width,
+            [In] UInt32 height,
+            [In] UInt32 bitmapStride,
+            [In] UInt32 packing,
+            [In] DecodeOptions options,
+            [In] DmtxDiagnosticImageCallback diagnosticImageCallback,
+            [In] DiagnosticImageStyles diagnosticImageStyle,
+            [Out] out IntPtr results,
+            [Out] out UInt32 resultsSize,
+            [Out] out UInt32 recordCount,
+            [In, Out] DecodeStats stats);
+
+        [DllImport("libdmtx.dll", EntryPoint = "dmtx_decode_diagnose")]
+        private static extern byte
+        DmtxDecodeDiagnose(
+            [In] IntPtr image,
+            [In] UInt32 width,
+            [In] UInt32 height,
+            [In] UInt32 bitmapStride,
+            [In] UInt32 packing,
+            [In] DecodeOptions options,
+            [In] UInt32 flags,
+            [Out] out IntPtr results,
+            [Out] out UInt32 resultsSize,
+            [Out] out UInt32 recordCount,
+            [Out] out IntPtr diagnostics,
+            [Out] out UInt32 diagnosticsSize);
+
+        [DllImport("libdmtx.dll", EntryPoint = "dmtx_decode_begin")]
+        internal static extern byte
+        DmtxDecodeBegin(
+            [In] IntPtr image,
+            [In] UInt32 width,
+            [In] UInt32 height,
+            [In] UInt32 bitmapStride,
+            [In] UInt32 packing,
+            [In] DecodeOptions options,
+            [In] DmtxDecodeDoneCallback doneCallback,
+            [Out] out IntPtr job);
+
+        [DllImport("libdmtx.dll", EntryPoint = "dmtx_decode_cancel")]
+        internal static extern void
+        DmtxDecodeCancel([In] IntPtr job);
+
+        [DllImport("libdmtx.dll", EntryPoint = "dmtx_decode_end")]
+        internal static extern byte
+        DmtxDecodeEnd(
+            [In] IntPtr job,
+            [Out] out IntPtr results,
+            [Out] out UInt32 resultsSize,
+            [Out] out UInt32 recordCount);
+
+        [DllImport("libdmtx.dll", EntryPoint = "dmtx_decoder_create")]
+        internal static extern byte
+        DmtxDecoderCreate(
+            [Out] out IntPtr decoder,
+            [In] DecodeOptions options);
+
+        [DllImport("libdmtx.dll", EntryPoint = "dmtx_decoder_decode")]
+        internal static extern byte
+        DmtxDecoderDecode(
+            [In] IntPtr decoder,
+            [In] IntPtr image,
+            [In] UInt32 width,
+            [In] UInt32 height,
+            [In] UInt32 bitmapStride,
+            [In] UInt32 packing,
+            [In] DmtxDecodeCallback decodeCallback);
+
+        [DllImport("libdmtx.dll", EntryPoint = "dmtx_decoder_track")]
+        internal static extern byte
+        DmtxDecoderTrack(
+            [In] IntPtr decoder,
+            [In] IntPtr image,
+            [In] UInt32 width,
+            [In] UInt32 height,
+            [In] UInt32 bitmapStride,
+            [In] UInt32 packing,
+            [In] Corners previous,
+            [In] Int16 padding,
+            [Out] out IntPtr results,
+            [Out] out UInt32 resultsSize,
+            [Out] out UInt32 recordCount);
+
+        [DllImport("libdmtx.dll", EntryPoint = "dmtx_decoder_get_stats")]
+        internal static extern void
+        DmtxDecoderGetStats(
+            [In] IntPtr decoder,
+            [In, Out] DecodeStats stats);
+
+        [DllImport("libdmtx.dll", EntryPoint = "dmtx_decoder_destroy")]
+        internal static extern void
+        DmtxDecoderDestroy([In] IntPtr decoder);
+
+        [DllImport("libdmtx.dll", EntryPoint = "dmtx_decode_batch")]
+        private static extern byte
+        DmtxDecodeBatch(
+            [In] FrameInternal[] frames,
+            [In] UInt32 frameCount,
+            [In] DecodeOptions options,
+            [Out] out IntPtr results,
+            [Out] out UInt32 resultsSize,
+            [Out] out UInt32 recordCount);
+
+        [DllImport("libdmtx.dll", EntryPoint = "dmtx_decode_file", CharSet = CharSet.Unicode)]
+        private static extern byte
+        DmtxDecodeFile(
+            [In] string path,
+            [In] FileLayout layout,
+            [In] DecodeOptions options,
+            [Out] out IntPtr results,
+            [Out] out UInt32 resultsSize,
+            [Out] out UInt32 recordCount,
+            [Out] out UInt32 pageCount);
+
+        [DllImport("libdmtx.dll", EntryPoint = "dmtx_decode_profile")]
+        private static extern byte
+        DmtxDecodeProfile(
+            [In] Int32 profile,
+            [In, Out] DecodeOptions options);
+
+        [DllImport("libdmtx.dll", EntryPoint = "dmtx_decode_calibrate")]
+        private static extern byte
+        DmtxDecodeCalibrate(
+            [In] FrameInternal[] frames,
+            [In] UInt32 frameCount,
+            [In, Out] DecodeOptions options,
+            [Out] out UInt32 symbolCount,
+            [Out] out double defaultMilliseconds,
+            [Out] out double profileMilliseconds);
+
+        [DllImport("libdmtx.dll", EntryPoint = "dmtx_free_results")]
+        internal static extern void
+        DmtxFreeResults([In] IntPtr results);
+
+        [DllImport("libdmtx.dll", EntryPoint = "dmtx_encode")]
+        private static extern byte
+        DmtxEncode(
+            [In] byte[] plain_text,
+            [In] UInt16 text_size,
+            [Out] out IntPtr result,
+            [In] EncodeOptions options);
+
+        [DllImport("libdmtx.dll", EntryPoint = "dmtx_encode_modules")]
+        private static extern byte
+        DmtxEncodeModules(
+            [In] byte[] plain_text,
+            [In] UInt16 text_size,
+            [In] EncodeOptions options,
+            [In, Out] SymbolInfo symbolInfo,
+            [Out] out IntPtr modules,
+            [Out] out UInt32 modulesSize);
+
+        [DllImport("libdmtx.dll", EntryPoint = "dmtx_encode_batch")]
+        private static extern byte
+        DmtxEncodeBatch(
+            [In] byte[] texts,
+            [In] UInt16[] textSizes,
+            [In] UInt32 count,
+            [In] EncodeOptions options,
+            [In] UInt32 format,
+            [In] Int16 threads,
+            [Out] out IntPtr results,
+            [Out] out UInt32 resultsSize,
+            [Out] out UInt32 sheetWidth,
+            [Out] out UInt32 sheetHeight,
+            [Out] out UInt32 sheetStride,
+            [Out] out UInt32 failedIndex);
+
+        [DllImport("libdmtx.dll", EntryPoint = "dmtx_encode_cache_set_limit")]
+        private static extern void
+        DmtxEncodeCacheSetLimit([In] UInt32 maxBytes);
+
+        [DllImport("libdmtx.dll", EntryPoint = "dmtx_encode_cache_clear")]
+        private static extern void
+        DmtxEncodeCacheClear();
+
+        [DllImport("libdmtx.dll", EntryPoint = "dmtx_encode_cache_stats")]
+        private static extern void
+        DmtxEncodeCacheStats([In, Out] EncodeCacheStats stats);
+
+        [DllImport("libdmtx.dll", EntryPoint = "dmtx_copy_encode_result")]
+        private static extern void
+        DmtxCopyEncodeResult(
+            [In] IntPtr data,
+            [In] UInt32 stride,
+            [In] IntPtr bitmap);
+
+        [DllImport("libdmtx.dll", EntryPoint = "dmtx_free_encode_result")]
+        private static extern void
+        DmtxFreeEncodeResult([In] IntPtr data);
+
+        [DllImport("libdmtx.dll", EntryPoint = "dmtx_version", CharSet = CharSet.Ansi)]
+        private static extern string
+        DmtxVersion();
+    }
+
+    /// <summary>
+    /// Decoder that keeps its native image and scan buffers between calls.
+    /// Use it to decode a stream of frames with the same options; the native
+    /// state is only rebuilt when the frame size changes.
+    /// </summary>
+    /// <example>
+    /// <code>
+    ///   using (DmtxDecoder decoder = new DmtxDecoder(new DecodeOptions())) {
+    ///     foreach (Bitmap frame in frames) {
+    ///       DmtxDecoded[] decodeResults = decoder.Decode(frame);
+    ///     }
+    ///   }
+    /// </code>
+    /// </example>
+    public class DmtxDecoder : IDisposable {
+        private IntPtr _decoder;
+        private DecodeStats _lastStats;
+
+        public DmtxDecoder(DecodeOptions options) {
+            byte status;
+            try {
+                status = Dmtx.DmtxDecoderCreate(out _decoder, options);
+            } catch (Exception ex) {
+                throw new DmtxException("Error calling native function.", ex);
+            }
+            Dmtx.CheckDecodeStatus(status);
+        }
+
+        ~DmtxDecoder() {
+            Dispose(false);
+        }
+
+        /// <summary>
+        /// Timings and counters of the last frame decoded, or null before
+        /// the first. Each decode replaces the object rather than changing
+        /// it, so it can be kept. For callback decodes the marshalling time
+        /// includes the time spent in the callback.
+        /// </summary>
+        public DecodeStats LastStats {
+            get { return _lastStats; }
+        }
+
+        /// <summary>
+        /// Decodes a bitmap returning all symbols found in the image.
+        /// </summary>
+        public DmtxDecoded[] Decode(Bitmap b) {
+            return DecodeNear(b, null, -1);
+        }
+
+        /// <summary>
+        /// Decodes a bitmap in which a symbol is expected close to where it
+        /// was found before, e.g. the next frame of a tracked part. The box
+        /// around <paramref name="previous"/>, grown by half the symbol size
+        /// on every side, is scanned first; the whole bitmap is only scanned
+        /// if no symbol decodes there.
+        /// </summary>
+        public DmtxDecoded[] DecodeNear(Bitmap b, Corners previous) {
+            return DecodeNear(b, previous, -1);
+        }
+
+        /// <summary>
+        /// Same as <see cref="DecodeNear(Bitmap,Corners)"/>, growing the
+        /// box by <paramref name="padding"/> pixels (negative for the
+        /// default of half the symbol size).
+        /// </summary>
+        public DmtxDecoded[] DecodeNear(Bitmap b, Corners previous, int padding) {
+            if (_decoder == IntPtr.Zero) {
+                throw new ObjectDisposedException("DmtxDecoder");
+            }
+            UInt32 packing;
+            BitmapData bd;
+            Stopwatch watch = Stopwatch.StartNew();
+            try {
+                bd = Dmtx.LockForDecode(b, out packing);
+            } catch (Exception ex) {
+                throw new DmtxException("Error calling native function.", ex);
+            }
+            try {
+                return Track(bd.Scan0, b.Width, b.Height, bd.Stride, packing, previous, padding,
+                    watch.Elapsed);
+            } finally {
+                b.UnlockBits(bd);
+            }
+        }
+
+        /// <summary>
+        /// Decodes 8 bpp luminance pixels in place, like
+        /// <see cref="Dmtx.DecodeGray"/>. Frames of the same size reuse the
+        /// scan buffers of the decoder.
+        /// </summary>
+        public DmtxDecoded[] DecodeGray(byte[] pixels, int width, int height, int stride) {
+            return DecodeGrayNear(pixels, width, height, stride, null, -1);
+        }
+
+        /// <summary>
+        /// Decodes 8 bpp luminance pixels looking around
+        /// <paramref name="previous"/> first, like
+        /// <see cref="DecodeNear(Bitmap,Corners,int)"/>.
+        /// </summary>
+        public DmtxDecoded[] DecodeGrayNear(byte[] pixels, int width, int height, int stride,
+            Corners previous, int padding) {
+            if (_decoder == IntPtr.Zero) {
+                throw new ObjectDisposedException("DmtxDecoder");
+            }
+            Stopwatch watch = Stopwatch.StartNew();
+            Dmtx.CheckGrayPixels(pixels, width, height, stride);
+            GCHandle handle = GCHandle.Alloc(pixels, GCHandleType.Pinned);
+            try {
+                return Track(handle.AddrOfPinnedObject(), width, height, stride, Dmtx.PACK_8BPP_K,
+                    previous, padding, watch.Elapsed);
+            } finally {
+                handle.Free();
+            }
+        }
+
+        private DmtxDecoded[] Track(IntPtr scan0, int width, int height, int stride, UInt32 packing,
+            Corners previous, int padding, TimeSpan setup) {
+            IntPtr buffer = IntPtr.Zero;
+            UInt32 bufferSize = 0;
+            UInt32 recordCount = 0;
+            byte[] flat;
+            byte status;
+            DecodeStats stats = new DecodeStats();
+            Stopwatch watch;
+            try {
+                status = Dmtx.DmtxDecoderTrack(
+                    _decoder,
+                    scan0,
+                    (UInt32)width,
+                    (UInt32)height,
+                    (UInt32)stride,
+                    packing,
+                    previous,
+                    (Int16)Math.Max(-1, Math.Min(padding, Int16.MaxValue)),
+                    out buffer,
+                    out bufferSize,
+                    out recordCount);
+                Dmtx.DmtxDecoderGetStats(_decoder, stats);
+                watch = Stopwatch.StartNew();
+                flat = Dmtx.TakeResults(buffer, bufferSize);
+            } catch (Exception ex) {
+                throw new DmtxException("Error calling native function.", ex);
+            }
+            Dmtx.CheckDecodeStatus(status);
+            DmtxDecoded[] results = Dmtx.ToDecodedArray(flat, recordCount);
+            Dmtx.AddManagedStats(stats, setup, watch.Elapsed, results, bufferSize);
+            _lastStats = stats;
+            return results;
+        }
+
+        public void Decode(Bitmap b, Dmtx.DecodeCallback Callback) {
+            Exception decodeException = null;
+            byte status;
+            if (_decoder == IntPtr.Zero) {
+                throw new ObjectDisposedException("DmtxDecoder");
+            }
             try {
-                intResult = (EncodedInternal)Marshal.PtrToStructure(result, typeof(EncodedInternal));
-                ret = new DmtxEncoded();
-                ret.SymbolInfo = intResult.SymbolInfo;
-                ret.Bitmap = new Bitmap((int)intResult.Width, (int)intResult.Height, PixelFormat.Format24bppRgb);
-                Rectangle rect = new Rectangle(0, 0, ret.Bitmap.Width, ret.Bitmap.Height);
-                BitmapData bd = ret.Bitmap.LockBits(rect, ImageLockMode.WriteOnly, PixelFormat.Format24bppRgb);
+                UInt32 packing;
+                BitmapData bd = Dmtx.LockForDecode(b, out packing);
                 try {
-                    DmtxCopyEncodeResult(intResult.Data, (UInt32)Math.Abs(bd.Stride), bd.Scan0);
+                    status = Dmtx.DmtxDecoderDecode(
+                        _decoder,
+                        bd.Scan0,
+                        (UInt32)b.Width,
+                        (UInt32)b.Height,
+                        (UInt32)bd.Stride,
+                        packing,
+                        delegate(DecodedInternal dmtxDecodeResult) {
+                            try {
+                                Callback(Dmtx.ToDecoded(dmtxDecodeResult));
+                                return true;
+                            } catch (Exception ex) {
+                                decodeException = ex;
+                                return false;
+                            }
+                        });
                 } finally {
-                    ret.Bitmap.UnlockBits(bd);
+                    b.UnlockBits(bd);
                 }
+                DecodeStats stats = new DecodeStats();
+                Dmtx.DmtxDecoderGetStats(_decoder, stats);
+                _lastStats = stats;
             } catch (Exception ex) {
-                throw new DmtxException("Error parsing encode result.", ex);
-            } finally {
-                try {
-                    if (intResult != null) {
-                        DmtxFreeEncodeResult(intResult.Data);
-                    }
-                } catch (Exception ex) {
-                    throw new DmtxException("Error freeing memory.", ex);
-                }
+                throw new DmtxException("Error calling native function.", ex);
             }
-            return ret;
+            if (decodeException != null) {
+                throw decodeException;
+            }
+            Dmtx.CheckDecodeStatus(status);
         }
 
-        public static Bitmap PnmToBitmap(Stream pnmInputStream) {
-            // read header
-            if (ReadLine(pnmInputStream) != "P6") {
-                throw new Exception("Invalid PNM file format. Header was invalid.");
+        public void Dispose() {
+            Dispose(true);
+            GC.SuppressFinalize(this);
+        }
+
+        protected virtual void Dispose(bool disposing) {
+            if (_decoder != IntPtr.Zero) {
+                Dmtx.DmtxDecoderDestroy(_decoder);
+                _decoder = IntPtr.Zero;
             }
-            string widthHeightLine = ReadLine(pnmInputStream);
-            string[] widthHeightParts = widthHeightLine.Split(' ');
-            int width = int.Parse(widthHeightParts[0]);
-            int height = int.Parse(widthHeightParts[1]);
-            ReadLine(pnmInputStream); // ignore max value
+        }
+    }
 
-            Bitmap result = new Bitmap(width, height, PixelFormat.Format24bppRgb);
+    /// <summary>
+    /// A decode running on the native thread pool, started with
+    /// <see cref="Dmtx.BeginDecode"/> and finished with
+    /// <see cref="Dmtx.EndDecode"/>.
+    /// </summary>
+    public class DmtxDecodeOperation : IAsyncResult {
+        private readonly AsyncCallback _callback;
+        private readonly object _state;
+        private readonly ManualResetEvent _done = new ManualResetEvent(false);
+        private readonly Dmtx.DmtxDecodeDoneCallback _doneCallback;
+        private GCHandle _running;
+        private IntPtr _job;
+        private bool _completed;
+        private bool _ended;
 
-            // transfer pixel data to bitmap
-            Rectangle rect = new Rectangle(0, 0, width, height);
-            BitmapData bd = result.LockBits(rect, ImageLockMode.WriteOnly, PixelFormat.Format24bppRgb);
-            try {
-                byte[] buffer = new byte[height * bd.Stride];
-                for (int y = 0; y < height; y++) {
-                    int rowOffset = y * bd.Stride;
-                    pnmInputStream.Read(buffer, rowOffset, width * 3);
-                }
+        internal DmtxDecodeOperation(AsyncCallback callback, object state) {
+            _callback = callback;
+            _state = state;
+            _doneCallback = OnDone;
+        }
 
-                Marshal.Copy(buffer, 0, bd.Scan0, buffer.Length);
-            } finally {
-                result.UnlockBits(bd);
+        internal byte Start(IntPtr image, UInt32 width, UInt32 height, UInt32 stride,
+            UInt32 packing, DecodeOptions options) {
+            // The native job may finish before DmtxDecodeBegin returns, so
+            // OnDone waits for the lock until _job is known. The handle
+            // keeps the callback alive while only native code refers to it.
+            lock (this) {
+                _running = GCHandle.Alloc(this);
+                byte status = Dmtx.DmtxDecodeBegin(image, width, height, stride,
+                    packing, options, _doneCallback, out _job);
+                if (_job == IntPtr.Zero) {
+                    _running.Free();
+                }
+                return status;
             }
-
-            return result;
         }
 
-        private static string ReadLine(Stream stream) {
-            StringBuilder result = new StringBuilder();
-            int b;
-            while ((b = stream.ReadByte()) != '\n') {
-                result.Append((char)b);
+        private void OnDone() {
+            lock (this) {
+                _completed = true;
+                _done.Set();
+                _running.Free();
+            }
+            if (_callback != null) {
+                _callback(this);
             }
-            return result.ToString();
         }
 
-        [UnmanagedFunctionPointer(CallingConvention.Cdecl)]
-        private delegate bool DmtxDecodeCallback(DecodedInternal dmtxDecodeResult);
-
-        [UnmanagedFunctionPointer(CallingConvention.Cdecl)]
-        private delegate void DmtxDiagnosticImageCallback(IntPtr data, uint totalBytes, uint headerSize);
+        /// <summary>
+        /// Asks the decode to stop. <see cref="Dmtx.EndDecode"/> then throws
+        /// <see cref="DmtxCancelledException"/> unless the decode had already
+        /// finished.
+        /// </summary>
+        public void Cancel() {
+            lock (this) {
+                if (!_ended) {
+                    Dmtx.DmtxDecodeCancel(_job);
+                }
+            }
+        }
 
-        [DllImport("libdmtx.dll", EntryPoint = "dmtx_decode")]
-        private static extern byte
-        DmtxDecode(
-            [In] byte[] image,
-            [In] UInt32 width,
-            [In] UInt32 height,
-            [In] UInt32 bitmapStride,
-            [In] DecodeOptions options,
-            [In] DmtxDiagnosticImageCallback diagnosticImageCallback,
-            [In] DiagnosticImageStyles diagnosticImageStyle,
-            [In] DmtxDecodeCallback decodeCallback);
+        internal DmtxDecoded[] End() {
+            IntPtr buffer = IntPtr.Zero;
+            UInt32 bufferSize = 0;
+            UInt32 recordCount = 0;
+            byte[] flat;
+            byte status;
+            lock (this) {
+                if (_ended) {
+                    throw new InvalidOperationException("EndDecode was already called for this operation.");
+                }
+                _ended = true;
+            }
+            try {
+                status = Dmtx.DmtxDecodeEnd(_job, out buffer, out bufferSize, out recordCount);
+                flat = Dmtx.TakeResults(buffer, bufferSize);
+            } catch (Exception ex) {
+                throw new DmtxException("Error calling native function.", ex);
+            }
+            Dmtx.CheckDecodeStatus(status);
+            return Dmtx.ToDecodedArray(flat, recordCount);
+        }
 
-        [DllImport("libdmtx.dll", EntryPoint = "dmtx_encode")]
-        private static extern byte
-        DmtxEncode(
-            [In] byte[] plain_text,
-            [In] UInt16 text_size,
-            [Out] out IntPtr result,
-            [In] EncodeOptions options);
+        public object AsyncState {
+            get { return _state; }
+        }
 
-        [DllImport("libdmtx.dll", EntryPoint = "dmtx_copy_encode_result")]
-        private static extern void
-        DmtxCopyEncodeResult(
-            [In] IntPtr data,
-            [In] UInt32 stride,
-            [In] IntPtr bitmap);
+        public WaitHandle AsyncWaitHandle {
+            get { return _done; }
+        }
 
-        [DllImport("libdmtx.dll", EntryPoint = "dmtx_free_encode_result")]
-        private static extern void
-        DmtxFreeEncodeResult([In] IntPtr data);
+        public bool CompletedSynchronously {
+            get { return false; }
+        }
 
-        [DllImport("libdmtx.dll", EntryPoint = "dmtx_version", CharSet = CharSet.Ansi)]
-        private static extern string
-        DmtxVersion();
+        public bool IsCompleted {
+            get {
+                lock (this) {
+                    return _completed;
+                }
+            }
+        }
     }
 
     public enum DiagnosticImageStyles : uint {
@@ -412,6 +1767,75 @@ namespace Libdmtx {
         AutoFast = -2
     }
 
+    /// <summary>
+    /// File formats read by <see cref="Dmtx.DecodeFile(string,FileLayout,DecodeOptions)"/>.
+    /// </summary>
+    public enum FileFormat : uint {
+        Auto = 0,
+        Pnm = 1,
+        Tiff = 2,
+        Raw = 3
+    }
+
+    /// <summary>
+    /// Pixel layouts of raw frames (DmtxPackOrder values).
+    /// </summary>
+    public enum RawPacking : uint {
+        Gray8 = 300,
+        Rgb24 = 500,
+        Bgr24 = 501,
+        Rgbx32 = 600,
+        Bgrx32 = 602
+    }
+
+    /// <summary>
+    /// Named search settings, see <see cref="Dmtx.GetProfile"/>.
+    /// </summary>
+    public enum DecodeProfile {
+        /// <summary>libdmtx's defaults.</summary>
+        Default = 0,
+        /// <summary>Crisp printed labels seen head-on by a fixed camera.
+        /// Set <see cref="DecodeOptions.SizeIdxExpected"/> to the printed
+        /// size.</summary>
+        FixedSizeLabel = 1,
+        /// <summary>Many small symbols on a flat scan.</summary>
+        DenseDocument = 2,
+        /// <summary>Small, low contrast symbols at an angle in a large
+        /// frame.</summary>
+        FarFieldCamera = 3
+    }
+
+    /// <summary>
+    /// Where <see cref="Dmtx.DecodeFile(string,FileLayout,DecodeOptions)"/>
+    /// finds the pages of a file. PNM and TIFF files describe their pages
+    /// themselves; raw files hold frames of <see cref="Width"/> by
+    /// <see cref="Height"/> pixels, <see cref="Stride"/> bytes per row,
+    /// back to back after <see cref="HeaderBytes"/> bytes of header.
+    /// </summary>
+    [StructLayout(LayoutKind.Sequential)]
+    public class FileLayout {
+        public FileFormat Format = FileFormat.Auto;
+        public UInt32 Width;
+        public UInt32 Height;
+        public UInt32 Stride;
+        public RawPacking Packing = RawPacking.Gray8;
+        public UInt32 HeaderBytes;
+
+        public FileLayout() { }
+
+        /// <summary>
+        /// Layout of a file of raw frames.
+        /// </summary>
+        public FileLayout(int width, int height, int stride, RawPacking packing, int headerBytes) {
+            Format = FileFormat.Raw;
+            Width = (UInt32)width;
+            Height = (UInt32)height;
+            Stride = (UInt32)stride;
+            Packing = packing;
+            HeaderBytes = (UInt32)headerBytes;
+        }
+    }
+
     /// <summary>
     /// Options used for decoding using <see cref="Dmtx.Decode(Bitmap,DecodeOptions)"/>
     /// </summary>
@@ -432,6 +1856,32 @@ namespace Libdmtx {
         public Int16 CorrectionsMax = Dmtx.DmtxUndefined;
         public CodeType CodeType = CodeType.DataMatrix;
         public Int16 Shrink = 1;
+
+        /// <summary>
+        /// Number of worker threads. Values above 1 split the image into
+        /// overlapping tiles that are scanned in parallel; 0 uses one thread
+        /// per processor. Results are then reported in no particular order.
+        /// </summary>
+        public Int16 Threads = 1;
+
+        /// <summary>
+        /// Pixels shared by neighbouring tiles when <see cref="Threads"/> is
+        /// used. Defaults to <see cref="EdgeMax"/> if set, otherwise 32.
+        /// </summary>
+        public Int16 TileOverlap = Dmtx.DmtxUndefined;
+
+        /// <summary>
+        /// Values above <see cref="Shrink"/> enable a coarse-to-fine decode:
+        /// candidate symbols are located on the image shrunk by this factor
+        /// and then decoded at <see cref="Shrink"/>, scanning only their
+        /// surroundings. Speeds up large images holding small symbols.
+        /// Takes precedence over <see cref="Threads"/>.
+        /// </summary>
+        public Int16 PyramidShrink = Dmtx.DmtxUndefined;
+
+        internal DecodeOptions Copy() {
+            return (DecodeOptions)MemberwiseClone();
+        }
     }
 
     /// <summary>
@@ -540,6 +1990,24 @@ namespace Libdmtx {
         public UInt32 DataSize;
     }
 
+    [StructLayout(LayoutKind.Sequential)]
+    internal struct FrameInternal {
+        public IntPtr Image;
+        public UInt32 Width;
+        public UInt32 Height;
+        public UInt32 Stride;
+        public UInt32 Packing;
+    }
+
+    [StructLayout(LayoutKind.Sequential)]
+    internal class ResultRecordInternal {
+        public UInt32 FrameIndex;
+        public SymbolInfo SymbolInfo;
+        public Corners Corners;
+        public UInt32 DataOffset;
+        public UInt32 DataSize;
+    }
+
     /// <summary>
     /// Returned from <see cref="Dmtx.Encode"/>.
     /// </summary>
@@ -555,6 +2023,207 @@ namespace Libdmtx {
         public Bitmap Bitmap;
     }
 
+    /// <summary>
+    /// The module matrix of an encoded symbol, see <see cref="Dmtx.EncodeModules"/>.
+    /// </summary>
+    public class DmtxEncodedModules {
+        /// <summary>
+        /// Information about the symbol that was created.
+        /// </summary>
+        public SymbolInfo SymbolInfo;
+
+        /// <summary>
+        /// One bit per module (1 = dark), most significant bit first. Rows
+        /// are <see cref="RowBytes"/> apart, top row first.
+        /// </summary>
+        public byte[] Modules;
+
+        public int Rows {
+            get { return SymbolInfo.Rows; }
+        }
+
+        public int Cols {
+            get { return SymbolInfo.Cols; }
+        }
+
+        public int RowBytes {
+            get { return (SymbolInfo.Cols + 7) / 8; }
+        }
+
+        public bool IsDark(int row, int col) {
+            return (Modules[row * RowBytes + (col >> 3)] & (0x80 >> (col & 7))) != 0;
+        }
+    }
+
+    /// <summary>
+    /// Bitmaps of many payloads in one sheet, see <see cref="Dmtx.EncodeSheet"/>.
+    /// </summary>
+    public class DmtxEncodedSheet {
+        /// <summary>
+        /// The sheet holding every symbol on a white background.
+        /// </summary>
+        public Bitmap Bitmap;
+
+        /// <summary>
+        /// Where each payload's symbol is in <see cref="Bitmap"/>.
+        /// </summary>
+        public Rectangle[] Bounds;
+
+        /// <summary>
+        /// Information about each symbol that was created.
+        /// </summary>
+        public SymbolInfo[] SymbolInfo;
+    }
+
+    [StructLayout(LayoutKind.Sequential)]
+    internal class EncodeRecordInternal {
+        public SymbolInfo SymbolInfo;
+        public UInt32 X;
+        public UInt32 Y;
+        public UInt32 Width;
+        public UInt32 Height;
+        public UInt32 DataOffset;
+        public UInt32 DataSize;
+    }
+
+    /// <summary>
+    /// Counters of the encode cache, see <see cref="Dmtx.EncodeCacheLimit"/>.
+    /// </summary>
+    [StructLayout(LayoutKind.Sequential)]
+    public class EncodeCacheStats {
+        public UInt32 Hits;
+        public UInt32 Misses;
+        public UInt32 Entries;
+        public UInt32 Bytes;
+        public UInt32 MaxBytes;
+    }
+
+    /// <summary>
+    /// Where the time of a decode went, see
+    /// <see cref="Dmtx.Decode(Bitmap,DecodeOptions,DecodeStats)"/> and
+    /// <see cref="DmtxDecoder.LastStats"/>. Times are in microseconds; for a
+    /// tiled decode (<see cref="DecodeOptions.Threads"/>) they are summed
+    /// over the worker threads.
+    /// </summary>
+    [StructLayout(LayoutKind.Sequential)]
+    public class DecodeStats {
+        /// <summary>Locking the pixels and creating the scan buffers.</summary>
+        public UInt32 SetupMicroseconds;
+        /// <summary>Looking for candidate regions.</summary>
+        public UInt32 SearchMicroseconds;
+        /// <summary>Sampling and error correcting candidate regions.</summary>
+        public UInt32 DecodeMicroseconds;
+        /// <summary>Handing results over to managed code.</summary>
+        public UInt32 MarshalMicroseconds;
+        /// <summary>Candidate regions found by the search.</summary>
+        public UInt32 RegionsExamined;
+        /// <summary>Candidate regions whose message failed to decode.</summary>
+        public UInt32 RegionsRejected;
+        /// <summary>Result bytes copied on the way to the caller.</summary>
+        public UInt32 BytesCopied;
+    }
+
+    /// <summary>
+    /// Result of <see cref="Dmtx.Calibrate(Bitmap[],DecodeOptions)"/>.
+    /// Times are those of decoding all samples once, the fastest of a few
+    /// rounds.
+    /// </summary>
+    public class DecodeCalibration {
+        /// <summary>The options with the calibrated search settings.</summary>
+        public DecodeOptions Options;
+        /// <summary>Symbols found in the samples with the defaults.</summary>
+        public UInt32 SymbolCount;
+        /// <summary>Time taken with the default settings.</summary>
+        public double DefaultMilliseconds;
+        /// <summary>Time taken with <see cref="Options"/>.</summary>
+        public double ProfileMilliseconds;
+
+        /// <summary>How many times faster <see cref="Options"/> decode the
+        /// samples than the defaults.</summary>
+        public double Speedup {
+            get {
+                return (ProfileMilliseconds > 0.0) ? DefaultMilliseconds / ProfileMilliseconds : 1.0;
+            }
+        }
+    }
+
+    /// <summary>
+    /// What the scan made of a candidate region, see <see cref="RegionDiagnostic.Status"/>.
+    /// </summary>
+    public enum RegionStatus : ushort {
+        /// <summary>The message decoded and is among the results.</summary>
+        Decoded = 0,
+        /// <summary>A symbol was located but its message failed to decode.</summary>
+        Unreadable = 1,
+        /// <summary>The symbol was already found from a neighbouring tile.</summary>
+        Duplicate = 2,
+        /// <summary>Located on the shrunk image of a pyramid scan
+        /// (<see cref="DecodeOptions.PyramidShrink"/>); the records that
+        /// follow it tell how it decoded at full size.</summary>
+        Candidate = 3
+    }
+
+    /// <summary>
+    /// One candidate region found by <see cref="Dmtx.Diagnose"/>. Points are
+    /// image pixels with rows counted from the top, like
+    /// <see cref="DmtxDecoded.Corners"/>.
+    /// </summary>
+    [StructLayout(LayoutKind.Sequential)]
+    public class RegionDiagnostic {
+        public Corners Corners;
+        /// <summary>The scan grid location the region was grown from.</summary>
+        public DmtxPoint Seed;
+        /// <summary>Points on the solid finder edges.</summary>
+        public DmtxPoint EdgeLeft;
+        public DmtxPoint EdgeBottom;
+        /// <summary>Points on the alternating timing edges.</summary>
+        public DmtxPoint EdgeTop;
+        public DmtxPoint EdgeRight;
+        public UInt16 Rows;
+        public UInt16 Cols;
+        public RegionStatus Status;
+        /// <summary>+1 for a dark symbol on a light background, -1 for the reverse.</summary>
+        public Int16 Polarity;
+        /// <summary>Time spent sampling and error correcting the region.</summary>
+        public UInt32 DecodeMicroseconds;
+    }
+
+    /// <summary>
+    /// Returned from <see cref="Dmtx.Diagnose"/>.
+    /// </summary>
+    public class DecodeDiagnostics {
+        /// <summary>
+        /// The symbols decoded, as <see cref="Dmtx.Decode(Bitmap,DecodeOptions)"/>
+        /// would return them.
+        /// </summary>
+        public DmtxDecoded[] Results;
+
+        /// <summary>
+        /// Every candidate region in the order the scan found them.
+        /// </summary>
+        public RegionDiagnostic[] Regions;
+
+        /// <summary>
+        /// libdmtx's scan cache if asked for, otherwise null: one byte per
+        /// pixel of the image shrunk by <see cref="DecodeOptions.Shrink"/>,
+        /// top row first. Bit 0x80 marks pixels the scan visited (edge
+        /// traces and the area of decoded symbols), 0x40 edge pixels
+        /// assigned to a region and the low bits the directions of the trace.
+        /// </summary>
+        public byte[] Overlay;
+        public int OverlayWidth;
+        public int OverlayHeight;
+    }
+
+    [StructLayout(LayoutKind.Sequential)]
+    internal class DiagnosticsInternal {
+        public UInt32 RegionCount;
+        public UInt32 RegionOffset;
+        public UInt32 OverlayWidth;
+        public UInt32 OverlayHeight;
+        public UInt32 OverlayOffset;
+    }
+
     [StructLayout(LayoutKind.Sequential)]
     internal class EncodedInternal {
         public SymbolInfo SymbolInfo;
@@ -590,4 +2259,25 @@ namespace Libdmtx {
         public DmtxInvalidArgumentException(string message, Exception innerException)
             : base(message, innerException) { }
     }
+
+    /// <summary>
+    /// Thrown when a file passed to <see cref="Dmtx.DecodeFile(string,DecodeOptions)"/>
+    /// cannot be opened or mapped.
+    /// </summary>
+    public class DmtxFileException : DmtxException {
+        public DmtxFileException() { }
+        public DmtxFileException(string message) : base(message) { }
+        public DmtxFileException(string message, Exception innerException)
+            : base(message, innerException) { }
+    }
+
+    /// <summary>
+    /// Thrown when a decode was cancelled before it finished.
+    /// </summary>
+    public class DmtxCancelledException : DmtxException {
+        public DmtxCancelledException() { }
+        public DmtxCancelledException(string message) : base(message) { }
+        public DmtxCancelledException(string message, Exception innerException)
+            : base(message, innerException) { }
+    }
 }
\ No newline at end of file
@@ -24,10 +24,14 @@ Contact: libdmtx@fernsroth.com
 
 using System;
 using System.Collections.Generic;
+using System.Diagnostics;
 using System.Drawing.Imaging;
+using System.Globalization;
 using System.Reflection;
+using System.Runtime.InteropServices;
 using System.Text;
 using System.Text.RegularExpressions;
+using System.Threading;
 using NUnit.Framework;
 using System.Drawing;
 using System.IO;
@@ -70,6 +74,25 @@ namespace Libdmtx {
             Assert.AreEqual("Test2", data2);
         }
 
+        [Test]
+        public void TestDecodeResultsMatchCallback() {
+            Bitmap bm = GetBitmapFromResource("Libdmtx.TestImages.Test002.png");
+            DecodeOptions opt = new DecodeOptions();
+            List<DmtxDecoded> callbackResults = new List<DmtxDecoded>();
+            Dmtx.Decode(bm, opt, d => callbackResults.Add(d));
+            DmtxDecoded[] flatResults = Dmtx.Decode(bm, opt);
+            Assert.AreEqual(callbackResults.Count, flatResults.Length);
+            for (int i = 0; i < flatResults.Length; i++) {
+                Assert.AreEqual(callbackResults[i].Data, flatResults[i].Data);
+                Assert.AreEqual(callbackResults[i].SymbolInfo.Rows, flatResults[i].SymbolInfo.Rows);
+                Assert.AreEqual(callbackResults[i].SymbolInfo.Cols, flatResults[i].SymbolInfo.Cols);
+                Assert.AreEqual(callbackResults[i].Corners.Corner0.X, flatResults[i].Corners.Corner0.X);
+                Assert.AreEqual(callbackResults[i].Corners.Corner0.Y, flatResults[i].Corners.Corner0.Y);
+                Assert.AreEqual(callbackResults[i].Corners.Corner3.X, flatResults[i].Corners.Corner3.X);
+                Assert.AreEqual(callbackResults[i].Corners.Corner3.Y, flatResults[i].Corners.Corner3.Y);
+            }
+        }
+
         [Test]
         public void TestDecodeWithCallbackThrowException() {
             Bitmap bm = GetBitmapFromResource("Libdmtx.TestImages.Test002.png");
@@ -87,6 +110,345 @@ namespace Libdmtx {
             }
         }
 
+        [Test]
+        public void TestDecoderReuse() {
+            Bitmap bm1 = GetBitmapFromResource("Libdmtx.TestImages.Test001.png");
+            Bitmap bm2 = GetBitmapFromResource("Libdmtx.TestImages.Test002.png");
+            using (DmtxDecoder decoder = new DmtxDecoder(new DecodeOptions())) {
+                for (int pass = 0; pass < 2; pass++) {
+                    DmtxDecoded[] decodeResults = decoder.Decode(bm1);
+                    Assert.AreEqual(1, decodeResults.Length);
+                    Assert.AreEqual("Test", Encoding.ASCII.GetString(decodeResults[0].Data).TrimEnd('\0'));
+
+                    decodeResults = decoder.Decode(bm2);
+                    Assert.AreEqual(2, decodeResults.Length);
+                    Assert.AreEqual("Test1", Encoding.ASCII.GetString(decodeResults[0].Data).TrimEnd('\0'));
+                    Assert.AreEqual("Test2", Encoding.ASCII.GetString(decodeResults[1].Data).TrimEnd('\0'));
+                }
+
+                // same frame twice in a row exercises the rewind path
+                Assert.AreEqual(2, decoder.Decode(bm2).Length);
+            }
+        }
+
+        [Test]
+        public void TestDecoderTrack() {
+            Bitmap bm = GetBitmapFromResource("Libdmtx.TestImages.Test002.png");
+            using (DmtxDecoder decoder = new DmtxDecoder(new DecodeOptions())) {
+                DmtxDecoded[] decodeResults = decoder.Decode(bm);
+                Assert.AreEqual(2, decodeResults.Length);
+
+                // a hit around the previous position skips the other symbol
+                DmtxDecoded[] tracked = decoder.DecodeNear(bm, decodeResults[1].Corners, 4);
+                Assert.AreEqual(1, tracked.Length);
+                Assert.AreEqual(Encoding.ASCII.GetString(decodeResults[1].Data),
+                    Encoding.ASCII.GetString(tracked[0].Data));
+
+                // a miss falls back to the whole frame
+                Corners nowhere = new Corners();
+                nowhere.Corner0 = new DmtxPoint();
+                nowhere.Corner1 = new DmtxPoint();
+                nowhere.Corner2 = new DmtxPoint();
+                nowhere.Corner3 = new DmtxPoint();
+                Assert.AreEqual(2, decoder.DecodeNear(bm, nowhere, 0).Length);
+                Assert.AreEqual(2, decoder.Decode(bm).Length);
+            }
+        }
+
+        [Test]
+        public void TestDecodeTiled() {
+            Bitmap bm = GetBitmapFromResource("Libdmtx.TestImages.Test002.png");
+            DecodeOptions opt = new DecodeOptions { Threads = 4 };
+            DmtxDecoded[] decodeResults = Dmtx.Decode(bm, opt);
+
+            // symbols found by several tiles must only be reported once
+            Assert.AreEqual(2, decodeResults.Length);
+            List<string> data = new List<string>();
+            foreach (DmtxDecoded decoded in decodeResults) {
+                data.Add(Encoding.ASCII.GetString(decoded.Data).TrimEnd('\0'));
+            }
+            data.Sort();
+            Assert.AreEqual("Test1", data[0]);
+            Assert.AreEqual("Test2", data[1]);
+        }
+
+        [Test]
+        public void TestDecodePyramid() {
+            Bitmap bm = GetBitmapFromResource("Libdmtx.TestImages.Test002.png");
+            DecodeOptions opt = new DecodeOptions { PyramidShrink = 2 };
+            DmtxDecoded[] decodeResults = Dmtx.Decode(bm, opt);
+
+            // located on the shrunk image, decoded at full size
+            Assert.AreEqual(2, decodeResults.Length);
+            List<string> data = new List<string>();
+            foreach (DmtxDecoded decoded in decodeResults) {
+                data.Add(Encoding.ASCII.GetString(decoded.Data).TrimEnd('\0'));
+            }
+            data.Sort();
+            Assert.AreEqual("Test1", data[0]);
+            Assert.AreEqual("Test2", data[1]);
+        }
+
+        [Test]
+        public void TestDecodeAsync() {
+            Bitmap bm = GetBitmapFromResource("Libdmtx.TestImages.Test002.png");
+            DmtxDecodeOperation op = Dmtx.BeginDecode(bm, new DecodeOptions(), null, "state");
+            Assert.AreEqual("state", op.AsyncState);
+            Assert.IsTrue(op.AsyncWaitHandle.WaitOne(10000, false));
+            Assert.IsTrue(op.IsCompleted);
+            Assert.AreEqual(2, Dmtx.EndDecode(op).Length);
+
+            // the callback may end the operation itself
+            DmtxDecoded[] fromCallback = null;
+            ManualResetEvent called = new ManualResetEvent(false);
+            Dmtx.BeginDecode(bm, new DecodeOptions(), delegate(IAsyncResult ar) {
+                fromCallback = Dmtx.EndDecode(ar);
+                called.Set();
+            }, null);
+            Assert.IsTrue(called.WaitOne(10000, false));
+            Assert.AreEqual(2, fromCallback.Length);
+        }
+
+        [Test]
+        public void TestDecodeAsyncCancel() {
+            // noise keeps the scan busy for much longer than the test waits
+            Bitmap noise = new Bitmap(3000, 3000, PixelFormat.Format24bppRgb);
+            BitmapData bd = noise.LockBits(new Rectangle(0, 0, noise.Width, noise.Height),
+                ImageLockMode.WriteOnly, PixelFormat.Format24bppRgb);
+            byte[] pixels = new byte[bd.Stride * noise.Height];
+            new Random(1).NextBytes(pixels);
+            Marshal.Copy(pixels, 0, bd.Scan0, pixels.Length);
+            noise.UnlockBits(bd);
+
+            DmtxDecodeOperation op = Dmtx.BeginDecode(noise, new DecodeOptions(), null, null);
+            noise.Dispose();
+            op.Cancel();
+            Assert.IsTrue(op.AsyncWaitHandle.WaitOne(5000, false));
+            try {
+                Dmtx.EndDecode(op);
+                Assert.Fail("Cancelled decode returned results.");
+            } catch (DmtxCancelledException) {
+            }
+        }
+
+        [Test]
+        public void TestDecodeBatch() {
+            Bitmap bm1 = GetBitmapFromResource("Libdmtx.TestImages.Test001.png");
+            Bitmap bm2 = GetBitmapFromResource("Libdmtx.TestImages.Test002.png");
+            Bitmap[] bitmaps = new[] { bm1, bm2, bm1 };
+            foreach (Int16 threads in new Int16[] { 1, 2 }) {
+                DmtxDecoded[][] decodeResults = Dmtx.DecodeBatch(bitmaps, new DecodeOptions { Threads = threads });
+                Assert.AreEqual(3, decodeResults.Length);
+                Assert.AreEqual(1, decodeResults[0].Length);
+                Assert.AreEqual("Test", Encoding.ASCII.GetString(decodeResults[0][0].Data).TrimEnd('\0'));
+                Assert.AreEqual(2, decodeResults[1].Length);
+                Assert.AreEqual("Test1", Encoding.ASCII.GetString(decodeResults[1][0].Data).TrimEnd('\0'));
+                Assert.AreEqual("Test2", Encoding.ASCII.GetString(decodeResults[1][1].Data).TrimEnd('\0'));
+                Assert.AreEqual(1, decodeResults[2].Length);
+                Assert.AreEqual("Test", Encoding.ASCII.GetString(decodeResults[2][0].Data).TrimEnd('\0'));
+            }
+            Assert.AreEqual(0, Dmtx.DecodeBatch(new Bitmap[0], new DecodeOptions()).Length);
+        }
+
+        [Test]
+        public void TestDecodeFile() {
+            Bitmap bm1 = GetBitmapFromResource("Libdmtx.TestImages.Test001.png");
+            Bitmap bm2 = GetBitmapFromResource("Libdmtx.TestImages.Test002.png");
+            string path = Path.GetTempFileName();
+            try {
+                // Two PGM images in one file
+                using (Stream stream = File.Create(path)) {
+                    foreach (Bitmap bm in new[] { bm1, bm2 }) {
+                        byte[] header = Encoding.ASCII.GetBytes("P5\n# page\n" + bm.Width + " " + bm.Height + "\n255\n");
+                        byte[] pixels = GrayPixels(bm);
+                        stream.Write(header, 0, header.Length);
+                        stream.Write(pixels, 0, pixels.Length);
+                    }
+                }
+                DmtxDecoded[][] pages = Dmtx.DecodeFile(path, new DecodeOptions());
+                Assert.AreEqual(2, pages.Length);
+                Assert.AreEqual(1, pages[0].Length);
+                Assert.AreEqual("Test", Encoding.ASCII.GetString(pages[0][0].Data).TrimEnd('\0'));
+                Assert.AreEqual(2, pages[1].Length);
+
+                // Raw frames after a header
+                using (Stream stream = File.Create(path)) {
+                    byte[] pixels = GrayPixels(bm1);
+                    stream.Write(new byte[16], 0, 16);
+                    stream.Write(pixels, 0, pixels.Length);
+                    stream.Write(pixels, 0, pixels.Length);
+                }
+                FileLayout raw = new FileLayout(bm1.Width, bm1.Height, bm1.Width, RawPacking.Gray8, 16);
+                pages = Dmtx.DecodeFile(path, raw, new DecodeOptions { Threads = 2 });
+                Assert.AreEqual(2, pages.Length);
+                Assert.AreEqual("Test", Encoding.ASCII.GetString(pages[1][0].Data).TrimEnd('\0'));
+
+                // Uncompressed TIFF
+                ImageCodecInfo tiffCodec = Array.Find(ImageCodecInfo.GetImageEncoders(),
+                    delegate(ImageCodecInfo codec) { return codec.MimeType == "image/tiff"; });
+                EncoderParameters parameters = new EncoderParameters(1);
+                parameters.Param[0] = new EncoderParameter(System.Drawing.Imaging.Encoder.Compression,
+                    (long)EncoderValue.CompressionNone);
+                ConvertBitmap(bm2, PixelFormat.Format24bppRgb).Save(path, tiffCodec, parameters);
+                pages = Dmtx.DecodeFile(path, new DecodeOptions());
+                Assert.AreEqual(1, pages.Length);
+                Assert.AreEqual(2, pages[0].Length);
+            } finally {
+                File.Delete(path);
+            }
+            try {
+                Dmtx.DecodeFile(path, new DecodeOptions());
+                Assert.Fail("Expected DmtxFileException");
+            } catch (DmtxFileException) {
+            }
+        }
+
+        [Test]
+        public void TestDecode32bppArgb() {
+            Bitmap bm = ConvertBitmap(GetBitmapFromResource("Libdmtx.TestImages.Test001.png"), PixelFormat.Format32bppArgb);
+            DmtxDecoded[] decodeResults = Dmtx.Decode(bm, new DecodeOptions());
+            Assert.AreEqual(1, decodeResults.Length);
+            Assert.AreEqual("Test", Encoding.ASCII.GetString(decodeResults[0].Data).TrimEnd('\0'));
+        }
+
+        [Test]
+        public void TestDecode8bppGrayscale() {
+            Bitmap bm = ToGrayscale8bpp(GetBitmapFromResource("Libdmtx.TestImages.Test002.png"));
+            DmtxDecoded[] decodeResults = Dmtx.Decode(bm, new DecodeOptions());
+            Assert.AreEqual(2, decodeResults.Length);
+            Assert.AreEqual("Test1", Encoding.ASCII.GetString(decodeResults[0].Data).TrimEnd('\0'));
+            Assert.AreEqual("Test2", Encoding.ASCII.GetString(decodeResults[1].Data).TrimEnd('\0'));
+        }
+
+        [Test]
+        public void TestDecodeGrayPixels() {
+            Bitmap bm = GetBitmapFromResource("Libdmtx.TestImages.Test002.png");
+            // Rows padded past the width, as camera frames often are
+            int stride = bm.Width + 13;
+            byte[] pixels = new byte[stride * bm.Height];
+            for (int y = 0; y < bm.Height; y++) {
+                for (int x = 0; x < bm.Width; x++) {
+                    pixels[y * stride + x] = (byte)(bm.GetPixel(x, y).GetBrightness() * 255);
+                }
+            }
+            DmtxDecoded[] decodeResults = Dmtx.DecodeGray(pixels, bm.Width, bm.Height, stride, new DecodeOptions());
+            Assert.AreEqual(2, decodeResults.Length);
+            Assert.AreEqual("Test1", Encoding.ASCII.GetString(decodeResults[0].Data).TrimEnd('\0'));
+            Assert.AreEqual("Test2", Encoding.ASCII.GetString(decodeResults[1].Data).TrimEnd('\0'));
+
+            using (DmtxDecoder decoder = new DmtxDecoder(new DecodeOptions())) {
+                Assert.AreEqual(2, decoder.DecodeGray(pixels, bm.Width, bm.Height, stride).Length);
+            }
+
+            try {
+                Dmtx.DecodeGray(pixels, bm.Width, bm.Height + 1, stride, new DecodeOptions());
+                Assert.Fail("Expected DmtxInvalidArgumentException");
+            } catch (DmtxInvalidArgumentException) {
+            }
+        }
+
+        [Test]
+        public void TestDecodeStats() {
+            Bitmap bm = GetBitmapFromResource("Libdmtx.TestImages.Test002.png");
+            DecodeStats stats = new DecodeStats();
+            DmtxDecoded[] decodeResults = Dmtx.Decode(bm, new DecodeOptions(), stats);
+            Assert.AreEqual(2, decodeResults.Length);
+            Assert.GreaterOrEqual(stats.RegionsExamined, 2u);
+            Assert.LessOrEqual(stats.RegionsRejected, stats.RegionsExamined);
+            Assert.Greater(stats.SearchMicroseconds, 0u);
+            Assert.Greater(stats.BytesCopied, 0u);
+
+            using (DmtxDecoder decoder = new DmtxDecoder(new DecodeOptions())) {
+                Assert.IsNull(decoder.LastStats);
+                decoder.Decode(bm);
+                DecodeStats first = decoder.LastStats;
+                Assert.IsNotNull(first);
+                Assert.AreEqual(stats.RegionsExamined, first.RegionsExamined);
+                decoder.Decode(bm);
+                Assert.AreNotSame(first, decoder.LastStats);
+            }
+        }
+
+        [Test]
+        public void TestDiagnose() {
+            Bitmap bm = GetBitmapFromResource("Libdmtx.TestImages.Test002.png");
+            DecodeDiagnostics diag = Dmtx.Diagnose(bm, new DecodeOptions(), false);
+            Assert.AreEqual(2, diag.Results.Length);
+            Assert.IsNull(diag.Overlay);
+            int decoded = 0;
+            foreach (RegionDiagnostic region in diag.Regions) {
+                Assert.Less((int)region.Seed.X, bm.Width);
+                Assert.Less((int)region.Seed.Y, bm.Height);
+                if (region.Status == RegionStatus.Decoded) {
+                    decoded++;
+                }
+            }
+            Assert.AreEqual(2, decoded);
+
+            diag = Dmtx.Diagnose(bm, new DecodeOptions(), true);
+            Assert.AreEqual(bm.Width, diag.OverlayWidth);
+            Assert.AreEqual(bm.Height, diag.OverlayHeight);
+            Assert.AreEqual(bm.Width * bm.Height, diag.Overlay.Length);
+            // The area of each decoded symbol is marked as visited
+            RegionDiagnostic first = Array.Find(diag.Regions,
+                delegate(RegionDiagnostic r) { return r.Status == RegionStatus.Decoded; });
+            int cx = (first.Corners.Corner0.X + first.Corners.Corner3.X) / 2;
+            int cy = (first.Corners.Corner0.Y + first.Corners.Corner3.Y) / 2;
+            Assert.AreNotEqual(0, diag.Overlay[cy * diag.OverlayWidth + cx] & 0x80);
+        }
+
+        [Test]
+        public void TestProfile() {
+            DecodeOptions opt = Dmtx.GetProfile(DecodeProfile.Default);
+            Assert.AreEqual(CodeSize.SymbolShapeAuto, opt.SizeIdxExpected);
+            Assert.AreEqual(Dmtx.DmtxUndefined, opt.ScanGap);
+            Assert.AreEqual(1, opt.Shrink);
+
+            opt = Dmtx.GetProfile(DecodeProfile.FixedSizeLabel);
+            Assert.AreEqual(2, opt.ScanGap);
+            Assert.AreEqual(15, opt.SquareDevn);
+
+            try {
+                Dmtx.GetProfile((DecodeProfile)42);
+                Assert.Fail("Expected DmtxInvalidArgumentException");
+            } catch (DmtxInvalidArgumentException) {
+            }
+        }
+
+        [Test]
+        public void TestCalibrate() {
+            Bitmap bm = GetBitmapFromResource("Libdmtx.TestImages.Test002.png");
+            DecodeCalibration calib = Dmtx.Calibrate(new Bitmap[] { bm, bm }, new DecodeOptions());
+            Assert.AreEqual(4u, calib.SymbolCount);
+            Assert.Greater(calib.DefaultMilliseconds, 0.0);
+            Assert.Greater(calib.Speedup, 0.0);
+
+            // The calibrated options still find both symbols
+            DmtxDecoded[] decodeResults = Dmtx.Decode(bm, calib.Options);
+            Assert.AreEqual(2, decodeResults.Length);
+
+            try {
+                Dmtx.Calibrate(new Bitmap[] { new Bitmap(64, 64, PixelFormat.Format24bppRgb) }, new DecodeOptions());
+                Assert.Fail("Expected DmtxInvalidArgumentException");
+            } catch (DmtxInvalidArgumentException) {
+            }
+        }
+
+        [Test]
+        public void TestEncodeModules() {
+            DmtxEncodedModules m = Dmtx.EncodeModules(Encoding.ASCII.GetBytes("123456"), new EncodeOptions());
+            Assert.AreEqual(10, m.Rows);
+            Assert.AreEqual(10, m.Cols);
+            Assert.AreEqual(m.Rows * m.RowBytes, m.Modules.Length);
+            for (int i = 0; i < m.Rows; i++) {
+                // Solid finder pattern on the left and bottom edges
+                Assert.IsTrue(m.IsDark(i, 0));
+                Assert.IsTrue(m.IsDark(m.Rows - 1, i));
+                // Alternating timing pattern along the top edge
+                Assert.AreEqual(i % 2 == 0, m.IsDark(0, i));
+            }
+        }
+
         [Test]
         public void TestEncode() {
             Bitmap expectedBitmap = GetBitmapFromResource("Libdmtx.TestImages.Test001.png");
@@ -97,6 +459,64 @@ namespace Libdmtx {
             AssertAreEqual(expectedBitmap, encodeResults.Bitmap);
         }
 
+        [Test]
+        public void TestEncodeBatch() {
+            byte[][] data = new byte[][] {
+                Encoding.ASCII.GetBytes("123456"),
+                Encoding.ASCII.GetBytes("Test"),
+                Encoding.ASCII.GetBytes("A longer label payload 0123456789")
+            };
+
+            DmtxEncodedModules[] modules = Dmtx.EncodeModulesBatch(data, new EncodeOptions(), 0);
+            Assert.AreEqual(data.Length, modules.Length);
+            for (int i = 0; i < data.Length; i++) {
+                DmtxEncodedModules single = Dmtx.EncodeModules(data[i], new EncodeOptions());
+                Assert.AreEqual(single.Rows, modules[i].Rows);
+                Assert.AreEqual(single.Cols, modules[i].Cols);
+                CollectionAssert.AreEqual(single.Modules, modules[i].Modules);
+            }
+
+            DmtxEncodedSheet sheet = Dmtx.EncodeSheet(data, new EncodeOptions(), 2);
+            Assert.AreEqual(data.Length, sheet.Bounds.Length);
+            int y = 0;
+            for (int i = 0; i < data.Length; i++) {
+                Assert.AreEqual(y, sheet.Bounds[i].Y);
+                y += sheet.Bounds[i].Height;
+                Bitmap single = Dmtx.Encode(data[i], new EncodeOptions()).Bitmap;
+                AssertAreEqual(single, sheet.Bitmap.Clone(sheet.Bounds[i], PixelFormat.Format24bppRgb));
+            }
+            Assert.AreEqual(y, sheet.Bitmap.Height);
+        }
+
+        [Test]
+        public void TestEncodeCache() {
+            Bitmap expectedBitmap = GetBitmapFromResource("Libdmtx.TestImages.Test001.png");
+            byte[] data = Encoding.ASCII.GetBytes("Test");
+            Dmtx.EncodeCacheLimit = 1024 * 1024;
+            try {
+                Dmtx.ClearEncodeCache();
+                Dmtx.Encode(data, new EncodeOptions());
+                DmtxEncoded cached = Dmtx.Encode(data, new EncodeOptions());
+                AssertAreEqual(expectedBitmap, cached.Bitmap);
+                Assert.AreEqual(12, cached.SymbolInfo.Rows);
+
+                EncodeCacheStats stats = Dmtx.GetEncodeCacheStats();
+                Assert.AreEqual(1, stats.Misses);
+                Assert.AreEqual(1, stats.Hits);
+                Assert.AreEqual(1, stats.Entries);
+                Assert.IsTrue(stats.Bytes <= stats.MaxBytes);
+
+                // A different option is a different entry
+                EncodeOptions big = new EncodeOptions();
+                big.ModuleSize = 10;
+                Dmtx.Encode(data, big);
+                Assert.AreEqual(2, Dmtx.GetEncodeCacheStats().Misses);
+            } finally {
+                Dmtx.EncodeCacheLimit = 0;
+            }
+            Assert.AreEqual(0, Dmtx.GetEncodeCacheStats().Entries);
+        }
+
         [Test]
         public void TestVersion() {
             string version = Dmtx.Version;
@@ -171,6 +591,178 @@ namespace Libdmtx {
             Assert.AreEqual(10, pxl[13]);
         }
 
+        /// <summary>
+        /// Decodes and encodes the shared benchmark corpus written by
+        /// "bench/dmtxbench corpus DIR" (see "make bench" in the top
+        /// directory) and prints the same columns as the other wrappers.
+        /// Set DMTX_BENCH_CORPUS to the corpus directory and optionally
+        /// DMTX_BENCH_ROUNDS; the overhead column compares against the
+        /// libdmtx-only timings in DIR/native.txt when present.
+        /// </summary>
+        [Test, Explicit]
+        public void BenchmarkCorpus() {
+            string corpus = Environment.GetEnvironmentVariable("DMTX_BENCH_CORPUS");
+            if (string.IsNullOrEmpty(corpus)) {
+                Assert.Ignore("DMTX_BENCH_CORPUS is not set");
+            }
+            string roundsValue = Environment.GetEnvironmentVariable("DMTX_BENCH_ROUNDS");
+            int rounds = string.IsNullOrEmpty(roundsValue) ? 20 : int.Parse(roundsValue);
+
+            Dictionary<string, double> native = new Dictionary<string, double>();
+            string nativePath = Path.Combine(corpus, "native.txt");
+            if (File.Exists(nativePath)) {
+                foreach (string line in File.ReadAllLines(nativePath)) {
+                    string[] fields = SplitFields(line);
+                    if (fields.Length > 3 && !fields[0].StartsWith("#")) {
+                        native[fields[0]] = double.Parse(fields[3], CultureInfo.InvariantCulture);
+                    }
+                }
+            }
+
+            Console.WriteLine("# net, {0} rounds per case", rounds);
+            Console.WriteLine(string.Format(CultureInfo.InvariantCulture, "# {0,-12} {1,7} {2,10} {3,9} {4,9} {5,12} {6,11}",
+                "case", "found", "per sec", "p50 ms", "p99 ms", "alloc/call", "overhead ms"));
+
+            foreach (string line in File.ReadAllLines(Path.Combine(corpus, "corpus.txt"))) {
+                string[] fields = SplitFields(line);
+                if (fields.Length == 0) {
+                    continue;
+                }
+                if (fields[0] == "decode") {
+                    int symbols = int.Parse(fields[6]);
+                    DecodeOptions options = new DecodeOptions();
+                    options.MaxCodes = (Int16)symbols;
+                    int width, height, channels;
+                    byte[] pixels = ReadPnm(Path.Combine(corpus, fields[2]), out width, out height, out channels);
+                    if (channels == 1) {
+                        ReportBenchmark(fields[1], symbols, rounds, native, delegate {
+                            return Dmtx.DecodeGray(pixels, width, height, width, options).Length;
+                        });
+                    } else {
+                        Bitmap bm = PnmToBitmap(pixels, width, height);
+                        ReportBenchmark(fields[1], symbols, rounds, native, delegate {
+                            return Dmtx.Decode(bm, options).Length;
+                        });
+                    }
+                } else if (fields[0] == "encode") {
+                    int length = int.Parse(fields[2]);
+                    StringBuilder payload = new StringBuilder();
+                    while (payload.Length < length) {
+                        payload.Append(BenchPayload);
+                    }
+                    byte[] data = Encoding.ASCII.GetBytes(payload.ToString(0, length));
+                    ReportBenchmark(fields[1], 1, rounds, native, delegate {
+                        return Dmtx.Encode(data, new EncodeOptions()) != null ? 1 : 0;
+                    });
+                }
+            }
+        }
+
+        private const string BenchPayload = "libdmtx benchmark payload 0123456789 ";
+
+        private delegate int BenchmarkWork();
+
+        private static void ReportBenchmark(string name, int expected, int rounds,
+            Dictionary<string, double> native, BenchmarkWork work) {
+            double[] times = new double[rounds];
+            int found = 0;
+
+            long allocBefore = AllocatedBytes();
+            for (int i = 0; i < rounds; i++) {
+                Stopwatch watch = Stopwatch.StartNew();
+                found = work();
+                times[i] = watch.Elapsed.TotalMilliseconds;
+            }
+            long allocAfter = AllocatedBytes();
+
+            double total = 0.0;
+            foreach (double t in times) {
+                total += t;
+            }
+            Array.Sort(times);
+            double p50 = times[rounds / 2];
+            double p99 = times[(rounds * 99) / 100];
+
+            string alloc = (allocBefore < 0 || allocAfter < 0) ? "-" :
+                string.Format(CultureInfo.InvariantCulture, "{0:F1} KB", (allocAfter - allocBefore) / 1024.0 / rounds);
+            string overhead = native.ContainsKey(name) ?
+                (p50 - native[name]).ToString("F3", CultureInfo.InvariantCulture) : "-";
+            Console.WriteLine(string.Format(CultureInfo.InvariantCulture, "  {0,-12} {1,7} {2,10:F1} {3,9:F3} {4,9:F3} {5,12} {6,11}",
+                name, found + "/" + expected, total > 0.0 ? rounds * 1000.0 / total : 0.0, p50, p99, alloc, overhead));
+        }
+
+        /// <summary>
+        /// Bytes allocated by this thread so far, or -1 on runtimes without
+        /// GC.GetAllocatedBytesForCurrentThread.
+        /// </summary>
+        private static long AllocatedBytes() {
+            MethodInfo method = typeof(GC).GetMethod("GetAllocatedBytesForCurrentThread", BindingFlags.Static | BindingFlags.Public);
+            return method == null ? -1 : (long)method.Invoke(null, null);
+        }
+
+        private static string[] SplitFields(string line) {
+            return line.Trim().Split(new char[] { ' ', '\t' }, StringSplitOptions.RemoveEmptyEntries);
+        }
+
+        /// <summary>
+        /// Reads a binary PGM or PPM as written by dmtxbench.
+        /// </summary>
+        private static byte[] ReadPnm(string path, out int width, out int height, out int channels) {
+            using (Stream stream = new BufferedStream(File.OpenRead(path))) {
+                string type = ReadPnmToken(stream);
+                width = int.Parse(ReadPnmToken(stream));
+                height = int.Parse(ReadPnmToken(stream));
+                ReadPnmToken(stream); // maxval, always 255
+                channels = type == "P5" ? 1 : 3;
+
+                byte[] pixels = new byte[width * height * channels];
+                int offset = 0;
+                while (offset < pixels.Length) {
+                    int read = stream.Read(pixels, offset, pixels.Length - offset);
+                    if (read <= 0) {
+                        throw new EndOfStreamException(path);
+                    }
+                    offset += read;
+                }
+                return pixels;
+            }
+        }
+
+        private static string ReadPnmToken(Stream stream) {
+            StringBuilder token = new StringBuilder();
+            int c;
+            while ((c = stream.ReadByte()) != -1) {
+                if (char.IsWhiteSpace((char)c)) {
+                    if (token.Length > 0) {
+                        break;
+                    }
+                } else {
+                    token.Append((char)c);
+                }
+            }
+            return token.ToString();
+        }
+
+        private static Bitmap PnmToBitmap(byte[] rgb, int width, int height) {
+            Bitmap result = new Bitmap(width, height, PixelFormat.Format24bppRgb);
+            BitmapData data = result.LockBits(new Rectangle(0, 0, width, height), ImageLockMode.WriteOnly, PixelFormat.Format24bppRgb);
+            try {
+                byte[] row = new byte[width * 3];
+                for (int y = 0; y < height; y++) {
+                    // PPM holds RGB, the bitmap BGR
+                    for (int x = 0; x < width * 3; x += 3) {
+                        row[x] = rgb[y * width * 3 + x + 2];
+                        row[x + 1] = rgb[y * width * 3 + x + 1];
+                        row[x + 2] = rgb[y * width * 3 + x];
+                    }
+                    Marshal.Copy(row, 0, new IntPtr(data.Scan0.ToInt64() + (long)y * data.Stride), row.Length);
+                }
+            } finally {
+                result.UnlockBits(data);
+            }
+            return result;
+        }
+
         private byte[] ExecuteBitmapToByteArray(Bitmap bm, out int stride) {
             Type[] paramTypes = new[] { typeof(Bitmap), typeof(int).MakeByRefType() };
             MethodInfo method = typeof(Dmtx).GetMethod("BitmapToByteArray", BindingFlags.Static | BindingFlags.NonPublic, null, paramTypes, null);
@@ -204,6 +796,48 @@ namespace Libdmtx {
             return bm;
         }
 
+        private static Bitmap ConvertBitmap(Image bm, PixelFormat format) {
+            Bitmap result = new Bitmap(bm.Width, bm.Height, format);
+            using (Graphics g = Graphics.FromImage(result)) {
+                g.DrawImage(bm, 0, 0, bm.Width, bm.Height);
+            }
+            return result;
+        }
+
+        private static byte[] GrayPixels(Bitmap bm) {
+            byte[] pixels = new byte[bm.Width * bm.Height];
+            for (int y = 0; y < bm.Height; y++) {
+                for (int x = 0; x < bm.Width; x++) {
+                    pixels[y * bm.Width + x] = (byte)(bm.GetPixel(x, y).GetBrightness() * 255);
+                }
+            }
+            return pixels;
+        }
+
+        private static Bitmap ToGrayscale8bpp(Bitmap bm) {
+            Bitmap result = new Bitmap(bm.Width, bm.Height, PixelFormat.Format8bppIndexed);
+            ColorPalette palette = result.Palette;
+            for (int i = 0; i < 256; i++) {
+                palette.Entries[i] = Color.FromArgb(i, i, i);
+            }
+            result.Palette = palette;
+
+            Rectangle rect = new Rectangle(0, 0, bm.Width, bm.Height);
+            BitmapData bd = result.LockBits(rect, ImageLockMode.WriteOnly, PixelFormat.Format8bppIndexed);
+            try {
+                byte[] row = new byte[bd.Stride];
+                for (int y = 0; y < bm.Height; y++) {
+                    for (int x = 0; x < bm.Width; x++) {
+                        row[x] = (byte)(bm.GetPixel(x, y).GetBrightness() * 255);
+                    }
+                    Marshal.Copy(row, 0, new IntPtr(bd.Scan0.ToInt64() + y * bd.Stride), bd.Stride);
+                }
+            } finally {
+                result.UnlockBits(bd);
+            }
+            return result;
+        }
+
         private Bitmap BitmapIncreaseCanvas(Image bm, int newWidth, int newHeight, Color fillColor) {
             Bitmap result = new Bitmap(newWidth, newHeight, bm.PixelFormat);
             using (Graphics g = Graphics.FromImage(result))
@@ -24,176 +24,1799 @@ Contact: libdmtx@fernsroth.com
 
 #include "libdmtx.h"
 #include "dmtx.h"
+#include "../convert/dmtxconvert.h"
+#include "../profile/dmtxprofile.h"
+#include "../core/dmtxcore.h"
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
 #include <stdio.h>
+#include <windows.h>
+#include <process.h>
+
+struct dmtx_decoder_t {
+	dmtx_decode_options_t options;
+	DmtxCoreDecoder core;
+	dmtx_decode_stats_t stats;  // of the last frame
+};
+
+static DmtxPassFail
+dmtx_apply_decode_options(DmtxDecode *decode, const dmtx_decode_options_t *options)
+{
+	DmtxPassFail err = DmtxPass;
+
+	while (1) {
+		if ((options->edgeMax != DmtxUndefined) &&
+			((err = dmtxDecodeSetProp(decode, DmtxPropEdgeMax, options->edgeMax)
+			) != DmtxPass)) break;
+		if ((options->edgeMin != DmtxUndefined) &&
+			((err = dmtxDecodeSetProp(decode, DmtxPropEdgeMin, options->edgeMin)
+			) != DmtxPass)) break;
+		if ((options->scanGap != DmtxUndefined) &&
+			((err = dmtxDecodeSetProp(decode, DmtxPropScanGap, options->scanGap)
+			) != DmtxPass)) break;
+		if ((options->squareDevn != DmtxUndefined) &&
+			((err = dmtxDecodeSetProp(decode, DmtxPropSquareDevn, options->squareDevn)
+			) != DmtxPass)) break;
+		if ((err = dmtxDecodeSetProp(decode, DmtxPropSymbolSize, options->sizeIdxExpected)
+			) != DmtxPass) break;
+		if ((options->edgeThresh != DmtxUndefined) &&
+			((err = dmtxDecodeSetProp(decode, DmtxPropEdgeThresh, options->edgeThresh)
+			) != DmtxPass)) break;
+		if ((options->xMax != DmtxUndefined) &&
+			((err = dmtxDecodeSetProp(decode, DmtxPropXmax, options->xMax)
+			) != DmtxPass)) break;
+		if ((options->xMin != DmtxUndefined) &&
+			((err = dmtxDecodeSetProp(decode, DmtxPropXmin, options->xMin)
+			) != DmtxPass)) break;
+		if ((options->yMax != DmtxUndefined) &&
+			((err = dmtxDecodeSetProp(decode, DmtxPropYmax, options->yMax)
+			) != DmtxPass)) break;
+		if ((options->yMin != DmtxUndefined) &&
+			((err = dmtxDecodeSetProp(decode, DmtxPropYmin, options->yMin)
+			) != DmtxPass)) break;
+		break;
+	}
+	return err;
+}
+
+// Structured diagnostics of a decode, see dmtx_decode_diagnose: a record
+// per candidate region and, if wanted, the combined scan caches
+typedef struct dmtx_diag_t {
+	DmtxCoreArena regions;
+	int wantOverlay;
+	unsigned char *overlay;
+	int overlayWidth;
+	int overlayHeight;
+	int failed;
+} dmtx_diag_t;
+
+// Corners of the core, (0,0) (1,0) (1,1) (0,1), in the order of
+// dmtx_corners_t: (0,0) (0,1) (1,0) (1,1)
+static void
+dmtx_corners_from_core(dmtx_corners_t *corners, const int *core)
+{
+	corners->corner0.x = (dmtx_uint16_t) core[0];
+	corners->corner0.y = (dmtx_uint16_t) core[1];
+	corners->corner1.x = (dmtx_uint16_t) core[6];
+	corners->corner1.y = (dmtx_uint16_t) core[7];
+	corners->corner2.x = (dmtx_uint16_t) core[2];
+	corners->corner2.y = (dmtx_uint16_t) core[3];
+	corners->corner3.x = (dmtx_uint16_t) core[4];
+	corners->corner3.y = (dmtx_uint16_t) core[5];
+}
+
+static void
+dmtx_corners_to_core(const dmtx_corners_t *corners, int *core)
+{
+	core[0] = corners->corner0.x;
+	core[1] = corners->corner0.y;
+	core[2] = corners->corner2.x;
+	core[3] = corners->corner2.y;
+	core[4] = corners->corner3.x;
+	core[5] = corners->corner3.y;
+	core[6] = corners->corner1.x;
+	core[7] = corners->corner1.y;
+}
+
+// Converts a location in decode's coordinates (shrunk, rows counted from
+// the bottom) to image pixels with rows counted from the top
+static void
+dmtx_diag_point(const int scale, const dmtx_uint32_t height,
+			double x, double y, dmtx_point_t *point)
+{
+	int row = (int) height - 1 - (int) (y * scale + 0.5);
+
+	point->x = (dmtx_uint16_t) (x * scale + 0.5);
+	point->y = (dmtx_uint16_t) ((row > 0) ? row : 0);
+}
+
+static void
+dmtx_diag_add_region(dmtx_diag_t *diag,
+			DmtxRegion *region,
+			const DmtxCoreResult *result,
+			const dmtx_uint32_t height)
+{
+	dmtx_region_record_t record;
+	int scale = result->scale;
+
+	dmtx_corners_from_core(&record.corners, result->corners);
+	dmtx_diag_point(scale, height, region->flowBegin.loc.X, region->flowBegin.loc.Y, &record.seed);
+	dmtx_diag_point(scale, height, region->leftLoc.X, region->leftLoc.Y, &record.edgeLeft);
+	dmtx_diag_point(scale, height, region->bottomLoc.X, region->bottomLoc.Y, &record.edgeBottom);
+	dmtx_diag_point(scale, height, region->topLoc.X, region->topLoc.Y, &record.edgeTop);
+	dmtx_diag_point(scale, height, region->rightLoc.X, region->rightLoc.Y, &record.edgeRight);
+	record.rows = (dmtx_uint16_t) region->symbolRows;
+	record.cols = (dmtx_uint16_t) region->symbolCols;
+	record.polarity = (dmtx_int16_t) region->polarity;
+	record.decodeUsec = (dmtx_uint32_t) (result->decodeUs + 0.5);
+
+	switch (result->status) {
+		case DmtxCoreDecoded:
+			record.status = DMTX_REGION_DECODED;
+			break;
+		case DmtxCoreDuplicate:
+			record.status = DMTX_REGION_DUPLICATE;
+			break;
+		case DmtxCoreCandidate:
+			record.status = DMTX_REGION_CANDIDATE;
+			break;
+		default:
+			record.status = DMTX_REGION_UNREADABLE;
+			break;
+	}
+
+	if (dmtxCoreArenaAppend(&diag->regions, &record, sizeof(record)) != DmtxPass)
+		diag->failed = 1;
+}
+
+// ORs the scan cache of decode into the overlay, flipping it to top-down
+// rows. Decodes of the same image at the same shrink share its size.
+static void
+dmtx_diag_capture_overlay(dmtx_diag_t *diag, DmtxDecode *decode)
+{
+	int width = dmtxDecodeGetProp(decode, DmtxPropWidth);
+	int height = dmtxDecodeGetProp(decode, DmtxPropHeight);
+	const unsigned char *src;
+	unsigned char *dst;
+	int x, y;
+
+	if (!diag->wantOverlay || diag->failed)
+		return;
+	if (diag->overlay == NULL) {
+		diag->overlay = calloc((size_t) width * height, 1);
+		if (diag->overlay == NULL) {
+			diag->failed = 1;
+			return;
+		}
+		diag->overlayWidth = width;
+		diag->overlayHeight = height;
+	}
+	if (width != diag->overlayWidth || height != diag->overlayHeight)
+		return;
+
+	for (y = 0; y < height; y++) {
+		src = decode->cache + (size_t) y * width;
+		dst = diag->overlay + (size_t) (height - 1 - y) * width;
+		for (x = 0; x < width; x++)
+			dst[x] |= src[x];
+	}
+}
+
+static void
+dmtx_diag_free(dmtx_diag_t *diag)
+{
+	dmtxCoreArenaFree(&diag->regions);
+	free(diag->overlay);
+}
+
+// Points core at a frame, only creating libdmtx's structures anew when the
+// frame geometry changes, and applies options to new ones
+static unsigned char
+dmtx_prepare_decode(DmtxCoreDecoder *core,
+			const void *pixels,
+			const dmtx_uint32_t width,
+			const dmtx_uint32_t height,
+			const dmtx_uint32_t bitmapStride,
+			const dmtx_uint32_t packing,
+			const dmtx_decode_options_t *options)
+{
+	dmtx_uint32_t bytesPerPixel = (dmtx_uint32_t) dmtxCoreBytesPerPixel((int) packing);
+
+	// Rows are padded up to the stride (4 byte aligned for GDI+ bitmaps)
+	if (bytesPerPixel == 0 || bitmapStride < width * bytesPerPixel)
+		return DMTX_RETURN_INVALID_ARGUMENT;
+
+	if (dmtxCoreDecoderPrepare(core, (unsigned char *) pixels, (int) width,
+		(int) height, (int) bitmapStride, (int) packing, options->shrink) != DmtxPass)
+		return DMTX_RETURN_NO_MEMORY;
+
+	if (core->fresh && dmtx_apply_decode_options(core->decode, options) != DmtxPass) {
+		dmtxCoreDecoderClear(core);
+		return DMTX_RETURN_INVALID_ARGUMENT;
+	}
+	return DMTX_RETURN_OK;
+}
+
+typedef int (*dmtx_callback_t)(dmtx_decoded_t *decode_result);
+
+// Receives each result of a scan; returning 0 stops the scan. The result's
+// data stays owned by the scanner and is freed once the sink returns.
+typedef int (*dmtx_sink_t)(void *context, dmtx_decoded_t *decode_result);
+
+// Sink forwarding to a dmtx_decode style callback; context points to it
+static int
+dmtx_callback_sink(void *context, dmtx_decoded_t *decode_result)
+{
+	return (*(dmtx_callback_t *) context)(decode_result);
+}
+
+// A scan of the decode core (see ../core/dmtxcore.h) and what its
+// callbacks pass the results on to
+typedef struct dmtx_scan_t {
+	DmtxCoreScan core;
+	dmtx_uint32_t height;
+	volatile LONG *cancel;
+	dmtx_diag_t *diag;
+	dmtx_sink_t sink;
+	void *context;
+	int decoded;
+} dmtx_scan_t;
+
+// Hands a region to the sink, whether its message decoded or not
+static int
+dmtx_scan_result(void *context, const DmtxCoreResult *result)
+{
+	dmtx_scan_t *scan = (dmtx_scan_t *) context;
+	dmtx_decoded_t decoded;
+	int sizeIdx = result->sizeIdx;
+
+	dmtx_corners_from_core(&decoded.corners, result->corners);
+	decoded.symbolInfo.angle = (dmtx_uint16_t) result->angle;
+	decoded.symbolInfo.cols = (dmtx_uint16_t) dmtxGetSymbolAttribute(DmtxSymAttribSymbolCols, sizeIdx);
+	decoded.symbolInfo.rows = (dmtx_uint16_t) dmtxGetSymbolAttribute(DmtxSymAttribSymbolRows, sizeIdx);
+	decoded.symbolInfo.horizDataRegions = (dmtx_uint16_t) dmtxGetSymbolAttribute(DmtxSymAttribHorizDataRegions, sizeIdx);
+	decoded.symbolInfo.vertDataRegions = (dmtx_uint16_t) dmtxGetSymbolAttribute(DmtxSymAttribVertDataRegions, sizeIdx);
+	decoded.symbolInfo.interleavedBlocks = (dmtx_uint16_t) dmtxGetSymbolAttribute(DmtxSymAttribInterleavedBlocks, sizeIdx);
+	decoded.symbolInfo.capacity = (dmtx_uint16_t) dmtxGetSymbolAttribute(DmtxSymAttribSymbolDataWords, sizeIdx);
+	decoded.symbolInfo.errorWords = (dmtx_uint16_t) dmtxGetSymbolAttribute(DmtxSymAttribSymbolErrorWords, sizeIdx);
+	decoded.symbolInfo.padWords = 0;
+	decoded.symbolInfo.dataWords = 0;
+	decoded.data = (char *) result->message;
+	decoded.dataSize = (dmtx_uint32_t) result->messageSize;
+
+	if (result->status == DmtxCoreDecoded) {
+		decoded.symbolInfo.padWords = (dmtx_uint16_t) result->padCount;
+		decoded.symbolInfo.dataWords = (dmtx_uint16_t) (
+			decoded.symbolInfo.capacity -
+			decoded.symbolInfo.padWords);
+		scan->decoded++;
+	}
+
+	return scan->sink(scan->context, &decoded);
+}
+
+static int
+dmtx_scan_cancelled(void *context)
+{
+	return *((dmtx_scan_t *) context)->cancel != 0;
+}
+
+// Records every region examined, called under the lock of tiled scans
+static void
+dmtx_scan_inspect(void *context, DmtxDecode *decode, DmtxRegion *region,
+			const DmtxCoreResult *result)
+{
+	dmtx_scan_t *scan = (dmtx_scan_t *) context;
+
+	dmtx_diag_add_region(scan->diag, region, result, scan->height);
+}
+
+// Adds the scan caches of the workers of a tiled scan to the overlay
+static void
+dmtx_scan_finish(void *context, DmtxDecode *decode)
+{
+	dmtx_diag_capture_overlay(((dmtx_scan_t *) context)->diag, decode);
+}
+
+// Sets up a scan of a frame as options ask. cancel and diag may be NULL.
+// Threads above 1 (or 0) scan in tiles and pyramidShrink coarse-to-fine,
+// as dmtxCoreScanRun() decides.
+static void
+dmtx_scan_init(dmtx_scan_t *scan,
+			const dmtx_uint32_t height,
+			const dmtx_decode_options_t *options,
+			volatile LONG *cancel,
+			dmtx_diag_t *diag,
+			dmtx_sink_t sink,
+			void *context)
+{
+	memset(scan, 0, sizeof(dmtx_scan_t));
+	dmtxCoreScanInit(&scan->core);
+	scan->height = height;
+	scan->cancel = cancel;
+	scan->diag = diag;
+	scan->sink = sink;
+	scan->context = context;
+
+	scan->core.maxCount = (options->maxCodes < 0) ? DmtxUndefined : options->maxCodes;
+	scan->core.timeoutMs = options->timeoutMS;
+	scan->core.corrections = options->correctionsMax;
+	scan->core.mosaic = options->mosaic;
+	scan->core.unreadable = 1;
+	scan->core.threads = options->threads;
+	scan->core.tileOverlap = options->tileOverlap;
+	if (options->pyramidShrink > 1)
+		scan->core.pyramid = options->pyramidShrink;
+
+	scan->core.result = dmtx_scan_result;
+	scan->core.resultContext = scan;
+	if (cancel != NULL) {
+		scan->core.cancel = dmtx_scan_cancelled;
+		scan->core.cancelContext = scan;
+	}
+	if (diag != NULL) {
+		scan->core.inspect = dmtx_scan_inspect;
+		scan->core.finish = dmtx_scan_finish;
+		scan->core.inspectContext = scan;
+	}
+}
+
+// Adds the times and counters of a scan to stats (may be NULL)
+static void
+dmtx_stats_add(dmtx_decode_stats_t *stats, const DmtxCoreStats *part)
+{
+	if (stats == NULL)
+		return;
+
+	stats->setupUsec += (dmtx_uint32_t) (part->setupUs + 0.5);
+	stats->searchUsec += (dmtx_uint32_t) (part->searchUs + 0.5);
+	stats->decodeUsec += (dmtx_uint32_t) (part->decodeUs + 0.5);
+	stats->marshalUsec += (dmtx_uint32_t) (part->marshalUs + 0.5);
+	stats->regionsExamined += (dmtx_uint32_t) part->regionsExamined;
+	stats->regionsRejected += (dmtx_uint32_t) part->regionsRejected;
+	stats->bytesCopied += (dmtx_uint32_t) part->bytesCopied;
+}
+
+// Scans the prepared frame of core, only around previous if it is not
+// NULL and a symbol decodes there (see dmtxCoreScanNear). Pixels already
+// tried there stay marked in the scan cache, so the full scan after a miss
+// does not repeat them.
+static unsigned char
+dmtx_scan_frame(dmtx_scan_t *scan,
+			DmtxCoreDecoder *core,
+			const dmtx_corners_t *previous,
+			const int padding,
+			dmtx_decode_stats_t *stats)
+{
+	unsigned char returncode;
+	int corners[8];
+
+	dmtxCoreScanStart(&scan->core);
+	if (previous != NULL) {
+		dmtx_corners_to_core(previous, corners);
+		dmtxCoreScanNear(&scan->core, core->decode, corners, padding);
+	}
+	if (scan->decoded == 0 && !scan->core.stopped)
+		dmtxCoreDecoderScan(core, &scan->core);
+
+	// Tiled scans have added the caches of their workers already
+	if (scan->diag != NULL)
+		dmtx_diag_capture_overlay(scan->diag, core->decode);
+
+	dmtx_stats_add(stats, &scan->core.stats);
+	returncode = scan->core.failed ? DMTX_RETURN_NO_MEMORY : DMTX_RETURN_OK;
+	dmtxCoreScanFree(&scan->core);
+	return returncode;
+}
+
+// Number of worker threads for a threads option: 0 means one per
+// processor, and WaitForMultipleObjects limits how many can be joined.
+static int
+dmtx_thread_count(int threads)
+{
+	if (threads == 0) {
+		SYSTEM_INFO info;
+		GetSystemInfo(&info);
+		threads = (int) info.dwNumberOfProcessors;
+	}
+	if (threads < 1)
+		threads = 1;
+	if (threads > MAXIMUM_WAIT_OBJECTS)
+		threads = MAXIMUM_WAIT_OBJECTS;
+	return threads;
+}
+
+// Results of one frame; record dataOffsets are relative to the frame's
+// payload until dmtx_layout_results lays out the final buffer.
+typedef struct dmtx_frame_results_t {
+	dmtx_uint32_t frameIndex;
+	DmtxCoreArena records;
+	DmtxCoreArena payload;
+	int failed;
+} dmtx_frame_results_t;
+
+static int
+dmtx_frame_results_sink(void *context, dmtx_decoded_t *decode_result)
+{
+	dmtx_frame_results_t *frame = (dmtx_frame_results_t *) context;
+	dmtx_result_record_t record;
+
+	record.frameIndex = frame->frameIndex;
+	record.symbolInfo = decode_result->symbolInfo;
+	record.corners = decode_result->corners;
+	record.dataOffset = (dmtx_uint32_t) frame->payload.size;
+	record.dataSize = decode_result->dataSize;
+
+	if (dmtxCoreArenaAppend(&frame->payload, decode_result->data, decode_result->dataSize) != DmtxPass ||
+		dmtxCoreArenaAppend(&frame->records, &record, sizeof(record)) != DmtxPass)
+		frame->failed = 1;
+
+	return !frame->failed;
+}
+
+// Copies the results of frameCount frames into one buffer, all records
+// first followed by every payload, to be freed with dmtx_free_results.
+static unsigned char
+dmtx_layout_results(const dmtx_frame_results_t *frameResults,
+			const dmtx_uint32_t frameCount,
+			unsigned char **results,
+			dmtx_uint32_t *resultsSize,
+			dmtx_uint32_t *recordCount)
+{
+	size_t recordBytes = 0, payloadBytes = 0;
+	unsigned char *buffer, *payload;
+	dmtx_result_record_t *record;
+	dmtx_uint32_t f, r;
+
+	*results = NULL;
+	*resultsSize = 0;
+	*recordCount = 0;
+
+	for (f = 0; f < frameCount; f++) {
+		recordBytes += frameResults[f].records.size;
+		payloadBytes += frameResults[f].payload.size;
+	}
+	if (recordBytes == 0)
+		return DMTX_RETURN_OK;
+
+	buffer = malloc(recordBytes + payloadBytes);
+	if (buffer == NULL)
+		return DMTX_RETURN_NO_MEMORY;
+
+	record = (dmtx_result_record_t *) buffer;
+	payload = buffer + recordBytes;
+	for (f = 0; f < frameCount; f++) {
+		const dmtx_frame_results_t *frame = &frameResults[f];
+		dmtx_uint32_t count = (dmtx_uint32_t) (frame->records.size / sizeof(dmtx_result_record_t));
+
+		memcpy(record, frame->records.data, frame->records.size);
+		for (r = 0; r < count; r++)
+			record[r].dataOffset += (dmtx_uint32_t) (payload - buffer);
+		if (frame->payload.size > 0)
+			memcpy(payload, frame->payload.data, frame->payload.size);
+		record += count;
+		payload += frame->payload.size;
+	}
+
+	*results = buffer;
+	*resultsSize = (dmtx_uint32_t) (recordBytes + payloadBytes);
+	*recordCount = (dmtx_uint32_t) (recordBytes / sizeof(dmtx_result_record_t));
+	return DMTX_RETURN_OK;
+}
+
+// Lays out the results of a single frame and releases its arenas. stats
+// may be NULL.
+static unsigned char
+dmtx_finish_results(dmtx_frame_results_t *frame,
+			unsigned char returncode,
+			dmtx_decode_stats_t *stats,
+			unsigned char **results,
+			dmtx_uint32_t *resultsSize,
+			dmtx_uint32_t *recordCount)
+{
+	double start = dmtxCoreClock();
+
+	if (returncode == DMTX_RETURN_OK && frame->failed)
+		returncode = DMTX_RETURN_NO_MEMORY;
+	if (returncode == DMTX_RETURN_OK)
+		returncode = dmtx_layout_results(frame, 1, results, resultsSize, recordCount);
+
+	// Every byte of the buffer was copied twice: into the frame's arenas
+	// by the sink and from there into the buffer
+	if (stats != NULL) {
+		stats->marshalUsec += (dmtx_uint32_t) (dmtxCoreClock() - start + 0.5);
+		stats->bytesCopied += 2 * *resultsSize;
+	}
+
+	dmtxCoreArenaFree(&frame->records);
+	dmtxCoreArenaFree(&frame->payload);
+	return returncode;
+}
+
+static unsigned char
+dmtx_decode_image(const void *pixels,
+			const dmtx_uint32_t width,
+			const dmtx_uint32_t height,
+			const dmtx_uint32_t bitmapStride,
+			const dmtx_uint32_t packing,
+			const dmtx_decode_options_t *options,
+			void(*diagnoseFunc)(unsigned char *data, dmtx_uint32_t totalBytes, dmtx_uint32_t headerBytes),
+			const dmtx_uint32_t diagnosticStyle,
+			volatile LONG *cancel,
+			dmtx_decode_stats_t *stats,
+			dmtx_diag_t *diag,
+			dmtx_sink_t sink,
+			void *context)
+{
+	DmtxCoreDecoder core;
+	dmtx_scan_t scan;
+	unsigned char returncode;
+	double start = dmtxCoreClock();
+
+	dmtxCoreDecoderInit(&core);
+	returncode = dmtx_prepare_decode(&core, pixels, width, height, bitmapStride,
+		packing, options);
+	if (stats != NULL)
+		stats->setupUsec += (dmtx_uint32_t) (dmtxCoreClock() - start + 0.5);
+	if (returncode != DMTX_RETURN_OK) {
+		dmtxCoreDecoderClear(&core);
+		return returncode;
+	}
+
+	if (diagnoseFunc) {
+		int totalBytes, headerBytes;
+		unsigned char *diagnosticData;
+		diagnosticData = dmtxDecodeCreateDiagnostic(
+			core.decode, &totalBytes, &headerBytes, diagnosticStyle);
+		diagnoseFunc(diagnosticData, totalBytes, headerBytes);
+		free(diagnosticData);
+	}
+
+	dmtx_scan_init(&scan, height, options, cancel, diag, sink, context);
+	returncode = dmtx_scan_frame(&scan, &core, NULL, 0, stats);
+
+	// Clean-up
+	dmtxCoreDecoderClear(&core);
+
+	return returncode;
+}
+
+DMTX_EXTERN unsigned char
+dmtx_decode_pixels(const void *pixels,
+			const dmtx_uint32_t width,
+			const dmtx_uint32_t height,
+			const dmtx_uint32_t bitmapStride,
+			const dmtx_uint32_t packing,
+			const dmtx_decode_options_t *options,
+			void(*diagnoseFunc)(unsigned char *data, dmtx_uint32_t totalBytes, dmtx_uint32_t headerBytes),
+			const dmtx_uint32_t diagnosticStyle,
+			int(*callbackFunc)(dmtx_decoded_t *decode_result))
+{
+	return dmtx_decode_image(pixels, width, height, bitmapStride, packing,
+		options, diagnoseFunc, diagnosticStyle, NULL, NULL, NULL, dmtx_callback_sink, &callbackFunc);
+}
+
+DMTX_EXTERN unsigned char
+dmtx_decode_results(const void *pixels,
+			const dmtx_uint32_t width,
+			const dmtx_uint32_t height,
+			const dmtx_uint32_t bitmapStride,
+			const dmtx_uint32_t packing,
+			const dmtx_decode_options_t *options,
+			void(*diagnoseFunc)(unsigned char *data, dmtx_uint32_t totalBytes, dmtx_uint32_t headerBytes),
+			const dmtx_uint32_t diagnosticStyle,
+			unsigned char **results,
+			dmtx_uint32_t *resultsSize,
+			dmtx_uint32_t *recordCount,
+			dmtx_decode_stats_t *stats)
+{
+	dmtx_frame_results_t frame;
+	unsigned char returncode;
+
+	*results = NULL;
+	*resultsSize = 0;
+	*recordCount = 0;
+	memset(&frame, 0, sizeof(frame));
+	if (stats != NULL)
+		memset(stats, 0, sizeof(*stats));
+
+	returncode = dmtx_decode_image(pixels, width, height, bitmapStride, packing,
+		options, diagnoseFunc, diagnosticStyle, NULL, stats, NULL, dmtx_frame_results_sink, &frame);
+
+	return dmtx_finish_results(&frame, returncode, stats, results, resultsSize, recordCount);
+}
+
+// Lays out diag as described for dmtx_decode_diagnose
+static unsigned char
+dmtx_layout_diagnostics(const dmtx_diag_t *diag,
+			unsigned char **diagnostics,
+			dmtx_uint32_t *diagnosticsSize)
+{
+	dmtx_diagnostics_t header;
+	size_t overlayBytes = (size_t) diag->overlayWidth * diag->overlayHeight;
+	unsigned char *buffer;
+
+	if (diag->failed)
+		return DMTX_RETURN_NO_MEMORY;
+
+	header.regionCount = (dmtx_uint32_t) (diag->regions.size / sizeof(dmtx_region_record_t));
+	header.regionOffset = sizeof(header);
+	header.overlayWidth = (dmtx_uint32_t) diag->overlayWidth;
+	header.overlayHeight = (dmtx_uint32_t) diag->overlayHeight;
+	header.overlayOffset = (dmtx_uint32_t) (sizeof(header) + diag->regions.size);
+
+	buffer = malloc(sizeof(header) + diag->regions.size + overlayBytes);
+	if (buffer == NULL)
+		return DMTX_RETURN_NO_MEMORY;
+
+	memcpy(buffer, &header, sizeof(header));
+	if (diag->regions.size > 0)
+		memcpy(buffer + header.regionOffset, diag->regions.data, diag->regions.size);
+	if (overlayBytes > 0)
+		memcpy(buffer + header.overlayOffset, diag->overlay, overlayBytes);
+
+	*diagnostics = buffer;
+	*diagnosticsSize = (dmtx_uint32_t) (sizeof(header) + diag->regions.size + overlayBytes);
+	return DMTX_RETURN_OK;
+}
+
+DMTX_EXTERN unsigned char
+dmtx_decode_diagnose(const void *pixels,
+			const dmtx_uint32_t width,
+			const dmtx_uint32_t height,
+			const dmtx_uint32_t bitmapStride,
+			const dmtx_uint32_t packing,
+			const dmtx_decode_options_t *options,
+			const dmtx_uint32_t flags,
+			unsigned char **results,
+			dmtx_uint32_t *resultsSize,
+			dmtx_uint32_t *recordCount,
+			unsigned char **diagnostics,
+			dmtx_uint32_t *diagnosticsSize)
+{
+	dmtx_frame_results_t frame;
+	dmtx_diag_t diag;
+	unsigned char returncode;
+
+	*results = NULL;
+	*resultsSize = 0;
+	*recordCount = 0;
+	*diagnostics = NULL;
+	*diagnosticsSize = 0;
+	memset(&frame, 0, sizeof(frame));
+	memset(&diag, 0, sizeof(diag));
+	diag.wantOverlay = (flags & DMTX_DIAGNOSE_OVERLAY) != 0;
+
+	returncode = dmtx_decode_image(pixels, width, height, bitmapStride, packing,
+		options, NULL, 0, NULL, NULL, &diag, dmtx_frame_results_sink, &frame);
+	if (returncode == DMTX_RETURN_OK)
+		returncode = dmtx_layout_diagnostics(&diag, diagnostics, diagnosticsSize);
+	dmtx_diag_free(&diag);
+
+	returncode = dmtx_finish_results(&frame, returncode, NULL, results, resultsSize, recordCount);
+	if (returncode != DMTX_RETURN_OK) {
+		free(*diagnostics);
+		*diagnostics = NULL;
+		*diagnosticsSize = 0;
+	}
+	return returncode;
+}
+
+struct dmtx_decode_job_t {
+	unsigned char *pixels;
+	dmtx_uint32_t width;
+	dmtx_uint32_t height;
+	dmtx_uint32_t bitmapStride;
+	dmtx_uint32_t packing;
+	dmtx_decode_options_t options;
+	void(*doneFunc)(void);
+	volatile LONG cancelled;
+	HANDLE done;
+	dmtx_frame_results_t frame;
+	unsigned char returncode;
+};
+
+// Runs a job queued by dmtx_decode_begin on a thread of the system pool.
+// The job belongs to dmtx_decode_end once done is set, so doneFunc is
+// read before.
+static DWORD WINAPI
+dmtx_decode_job_worker(void *arg)
+{
+	dmtx_decode_job_t *job = (dmtx_decode_job_t *) arg;
+	void(*doneFunc)(void) = job->doneFunc;
+
+	job->returncode = dmtx_decode_image(job->pixels, job->width, job->height,
+		job->bitmapStride, job->packing, &job->options, NULL, 0,
+		&job->cancelled, NULL, NULL, dmtx_frame_results_sink, &job->frame);
+	if (job->returncode == DMTX_RETURN_OK && job->cancelled)
+		job->returncode = DMTX_RETURN_CANCELLED;
+
+	SetEvent(job->done);
+	if (doneFunc != NULL)
+		doneFunc();
+	return 0;
+}
+
+DMTX_EXTERN unsigned char
+dmtx_decode_begin(const void *pixels,
+			const dmtx_uint32_t width,
+			const dmtx_uint32_t height,
+			const dmtx_uint32_t bitmapStride,
+			const dmtx_uint32_t packing,
+			const dmtx_decode_options_t *options,
+			void(*doneFunc)(void),
+			dmtx_decode_job_t **job)
+{
+	dmtx_decode_job_t *j;
+	size_t size = (size_t) bitmapStride * height;
+
+	*job = NULL;
+	j = calloc(1, sizeof(dmtx_decode_job_t));
+	if (j == NULL) return DMTX_RETURN_NO_MEMORY;
+
+	// The caller's pixels may go away before the job runs
+	j->pixels = malloc(size > 0 ? size : 1);
+	j->done = CreateEvent(NULL, TRUE, FALSE, NULL);
+	if (j->pixels == NULL || j->done == NULL) {
+		if (j->done != NULL) CloseHandle(j->done);
+		free(j->pixels);
+		free(j);
+		return DMTX_RETURN_NO_MEMORY;
+	}
+	memcpy(j->pixels, pixels, size);
+	j->width = width;
+	j->height = height;
+	j->bitmapStride = bitmapStride;
+	j->packing = packing;
+	j->options = *options;
+	j->doneFunc = doneFunc;
+
+	// Set before queueing, doneFunc may already run before this returns
+	*job = j;
+	if (!QueueUserWorkItem(dmtx_decode_job_worker, j, WT_EXECUTELONGFUNCTION)) {
+		*job = NULL;
+		CloseHandle(j->done);
+		free(j->pixels);
+		free(j);
+		return DMTX_RETURN_NO_MEMORY;
+	}
+
+	return DMTX_RETURN_OK;
+}
+
+DMTX_EXTERN void
+dmtx_decode_cancel(dmtx_decode_job_t *job)
+{
+	if (job != NULL)
+		InterlockedExchange(&job->cancelled, 1);
+}
+
+DMTX_EXTERN unsigned char
+dmtx_decode_end(dmtx_decode_job_t *job,
+			unsigned char **results,
+			dmtx_uint32_t *resultsSize,
+			dmtx_uint32_t *recordCount)
+{
+	unsigned char returncode;
+
+	*results = NULL;
+	*resultsSize = 0;
+	*recordCount = 0;
+	if (job == NULL) return DMTX_RETURN_INVALID_ARGUMENT;
+
+	WaitForSingleObject(job->done, INFINITE);
+	CloseHandle(job->done);
+
+	// Results of a cancelled job are dropped along with the job
+	returncode = dmtx_finish_results(&job->frame, job->returncode, NULL,
+		results, resultsSize, recordCount);
+
+	free(job->pixels);
+	free(job);
+	return returncode;
+}
+
+DMTX_EXTERN unsigned char
+dmtx_decode(const void *rgb_image,
+			const dmtx_uint32_t width,
+			const dmtx_uint32_t height,
+			const dmtx_uint32_t bitmapStride,
+			const dmtx_decode_options_t *options,
+			void(*diagnoseFunc)(unsigned char *data, dmtx_uint32_t totalBytes, dmtx_uint32_t headerBytes),
+			const dmtx_uint32_t diagnosticStyle,
+			int(*callbackFunc)(dmtx_decoded_t *decode_result))
+{
+	return dmtx_decode_pixels(rgb_image, width, height, bitmapStride,
+		DmtxPack24bppBGR, options, diagnoseFunc, diagnosticStyle, callbackFunc);
+}
+
+DMTX_EXTERN unsigned char
+dmtx_decoder_create(dmtx_decoder_t **decoder,
+			const dmtx_decode_options_t *options)
+{
+	dmtx_decoder_t *dec;
+	*decoder = NULL;
+
+	dec = calloc(1, sizeof(dmtx_decoder_t));
+	if (dec == NULL) return DMTX_RETURN_NO_MEMORY;
+
+	dec->options = *options;
+	dmtxCoreDecoderInit(&dec->core);
+	*decoder = dec;
+	return DMTX_RETURN_OK;
+}
+
+// Readies a decoder for a frame, reusing its structures when possible,
+// and starts its stats over
+static unsigned char
+dmtx_decoder_prepare(dmtx_decoder_t *decoder,
+			const void *rgb_image,
+			const dmtx_uint32_t width,
+			const dmtx_uint32_t height,
+			const dmtx_uint32_t bitmapStride,
+			const dmtx_uint32_t packing)
+{
+	unsigned char returncode;
+	double start = dmtxCoreClock();
+
+	memset(&decoder->stats, 0, sizeof(decoder->stats));
+
+	// Only rebuilds libdmtx's structures when the frame geometry changes
+	returncode = dmtx_prepare_decode(&decoder->core, rgb_image, width, height,
+		bitmapStride, packing, &decoder->options);
+	decoder->stats.setupUsec += (dmtx_uint32_t) (dmtxCoreClock() - start + 0.5);
+
+	return returncode;
+}
+
+DMTX_EXTERN unsigned char
+dmtx_decoder_decode(dmtx_decoder_t *decoder,
+			const void *rgb_image,
+			const dmtx_uint32_t width,
+			const dmtx_uint32_t height,
+			const dmtx_uint32_t bitmapStride,
+			const dmtx_uint32_t packing,
+			int(*callbackFunc)(dmtx_decoded_t *decode_result))
+{
+	dmtx_scan_t scan;
+	unsigned char returncode;
+
+	if (decoder == NULL) return DMTX_RETURN_INVALID_ARGUMENT;
+
+	returncode = dmtx_decoder_prepare(decoder, rgb_image, width, height,
+		bitmapStride, packing);
+	if (returncode != DMTX_RETURN_OK)
+		return returncode;
+
+	dmtx_scan_init(&scan, height, &decoder->options, NULL, NULL,
+		dmtx_callback_sink, &callbackFunc);
+	return dmtx_scan_frame(&scan, &decoder->core, NULL, 0, &decoder->stats);
+}
+
+DMTX_EXTERN unsigned char
+dmtx_decoder_decode_results(dmtx_decoder_t *decoder,
+			const void *rgb_image,
+			const dmtx_uint32_t width,
+			const dmtx_uint32_t height,
+			const dmtx_uint32_t bitmapStride,
+			const dmtx_uint32_t packing,
+			unsigned char **results,
+			dmtx_uint32_t *resultsSize,
+			dmtx_uint32_t *recordCount)
+{
+	return dmtx_decoder_track(decoder, rgb_image, width, height, bitmapStride,
+		packing, NULL, 0, results, resultsSize, recordCount);
+}
+
+DMTX_EXTERN unsigned char
+dmtx_decoder_track(dmtx_decoder_t *decoder,
+			const void *rgb_image,
+			const dmtx_uint32_t width,
+			const dmtx_uint32_t height,
+			const dmtx_uint32_t bitmapStride,
+			const dmtx_uint32_t packing,
+			const dmtx_corners_t *previous,
+			const dmtx_int16_t padding,
+			unsigned char **results,
+			dmtx_uint32_t *resultsSize,
+			dmtx_uint32_t *recordCount)
+{
+	dmtx_frame_results_t frame;
+	dmtx_scan_t scan;
+	unsigned char returncode;
+
+	*results = NULL;
+	*resultsSize = 0;
+	*recordCount = 0;
+	if (decoder == NULL) return DMTX_RETURN_INVALID_ARGUMENT;
+	memset(&frame, 0, sizeof(frame));
+
+	// Look around the previous position first, falling back to the whole
+	// frame on a miss
+	returncode = dmtx_decoder_prepare(decoder, rgb_image, width, height,
+		bitmapStride, packing);
+	if (returncode == DMTX_RETURN_OK) {
+		dmtx_scan_init(&scan, height, &decoder->options, NULL, NULL,
+			dmtx_frame_results_sink, &frame);
+		returncode = dmtx_scan_frame(&scan, &decoder->core, previous, padding,
+			&decoder->stats);
+	}
+
+	return dmtx_finish_results(&frame, returncode, &decoder->stats,
+		results, resultsSize, recordCount);
+}
+
+DMTX_EXTERN void
+dmtx_decoder_get_stats(const dmtx_decoder_t *decoder, dmtx_decode_stats_t *stats)
+{
+	if (decoder != NULL && stats != NULL)
+		*stats = decoder->stats;
+}
+
+DMTX_EXTERN void
+dmtx_decoder_destroy(dmtx_decoder_t *decoder)
+{
+	if (decoder == NULL) return;
+
+	dmtxCoreDecoderClear(&decoder->core);
+	free(decoder);
+}
+
+typedef struct dmtx_batch_job_t {
+	const dmtx_frame_t *frames;
+	dmtx_uint32_t frameCount;
+	const dmtx_decode_options_t *options;
+	dmtx_frame_results_t *frameResults;
+	volatile LONG nextFrame;
+	unsigned char returncode;
+} dmtx_batch_job_t;
+
+// Decodes frames until none are left, keeping one decoder for all of
+// them so that frames of equal size share their scan buffers.
+static unsigned __stdcall
+dmtx_batch_worker(void *arg)
+{
+	dmtx_batch_job_t *job = (dmtx_batch_job_t *) arg;
+	dmtx_decoder_t decoder;
+	dmtx_scan_t scan;
+	LONG index;
+
+	memset(&decoder, 0, sizeof(decoder));
+	decoder.options = *job->options;
+	dmtxCoreDecoderInit(&decoder.core);
+
+	while ((index = InterlockedIncrement(&job->nextFrame) - 1) < (LONG) job->frameCount) {
+		const dmtx_frame_t *frame = &job->frames[index];
+		dmtx_frame_results_t *results = &job->frameResults[index];
+		unsigned char returncode;
+
+		results->frameIndex = (dmtx_uint32_t) index;
+		returncode = dmtx_decoder_prepare(&decoder, frame->rgb_image,
+			frame->width, frame->height, frame->bitmapStride, frame->packing);
+		if (returncode == DMTX_RETURN_OK) {
+			// The frames are spread over the threads already
+			dmtx_scan_init(&scan, frame->height, &decoder.options, NULL, NULL,
+				dmtx_frame_results_sink, results);
+			scan.core.threads = 1;
+			returncode = dmtx_scan_frame(&scan, &decoder.core, NULL, 0, NULL);
+			if (returncode == DMTX_RETURN_OK && results->failed)
+				returncode = DMTX_RETURN_NO_MEMORY;
+		}
+		if (returncode != DMTX_RETURN_OK)
+			job->returncode = returncode;
+	}
+
+	dmtxCoreDecoderClear(&decoder.core);
+	return 0;
+}
+
+DMTX_EXTERN unsigned char
+dmtx_decode_batch(const dmtx_frame_t *frames,
+			const dmtx_uint32_t frameCount,
+			const dmtx_decode_options_t *options,
+			unsigned char **results,
+			dmtx_uint32_t *resultsSize,
+			dmtx_uint32_t *recordCount)
+{
+	HANDLE threads[MAXIMUM_WAIT_OBJECTS];
+	dmtx_batch_job_t job;
+	int threadCount = 1, started = 0, i;
+	dmtx_uint32_t f;
+
+	*results = NULL;
+	*resultsSize = 0;
+	*recordCount = 0;
+	if (frameCount == 0) return DMTX_RETURN_OK;
+	if (frames == NULL) return DMTX_RETURN_INVALID_ARGUMENT;
+
+	memset(&job, 0, sizeof(job));
+	job.frames = frames;
+	job.frameCount = frameCount;
+	job.options = options;
+	job.returncode = DMTX_RETURN_OK;
+	job.frameResults = calloc(frameCount, sizeof(dmtx_frame_results_t));
+	if (job.frameResults == NULL) return DMTX_RETURN_NO_MEMORY;
+
+	// Frames are spread over the threads, each frame scanned serially
+	if (options->threads == 0 || options->threads > 1)
+		threadCount = dmtx_thread_count(options->threads);
+	if ((dmtx_uint32_t) threadCount > frameCount)
+		threadCount = (int) frameCount;
+
+	for (started = 0; threadCount > 1 && started < threadCount; started++) {
+		threads[started] = (HANDLE) _beginthreadex(NULL, 0, dmtx_batch_worker, &job, 0, NULL);
+		if (threads[started] == 0)
+			break;
+	}
+	if (started > 0) {
+		WaitForMultipleObjects(started, threads, TRUE, INFINITE);
+		for (i = 0; i < started; i++)
+			CloseHandle(threads[i]);
+	}
+	// Also covers the serial case and any frames left by threads that
+	// could not be started
+	dmtx_batch_worker(&job);
+
+	if (job.returncode == DMTX_RETURN_OK)
+		job.returncode = dmtx_layout_results(job.frameResults, frameCount,
+			results, resultsSize, recordCount);
+
+	for (f = 0; f < frameCount; f++) {
+		dmtxCoreArenaFree(&job.frameResults[f].records);
+		dmtxCoreArenaFree(&job.frameResults[f].payload);
+	}
+	free(job.frameResults);
+
+	return job.returncode;
+}
+
+// Pages of a mapped image file. Pixels point into the mapping, except for
+// TIFF pages whose strips are scattered, which are gathered into copies.
+typedef struct dmtx_file_pages_t {
+	dmtx_frame_t *frames;
+	unsigned char **copies;
+	dmtx_uint32_t count;
+	dmtx_uint32_t alloc;
+} dmtx_file_pages_t;
+
+static unsigned char
+dmtx_file_add_page(dmtx_file_pages_t *pages, const unsigned char *pixels,
+			dmtx_uint32_t width, dmtx_uint32_t height, dmtx_uint32_t bitmapStride,
+			dmtx_uint32_t packing, unsigned char *copy)
+{
+	dmtx_frame_t *frame;
+
+	if (pages->count == pages->alloc) {
+		dmtx_uint32_t alloc = (pages->alloc == 0) ? 16 : pages->alloc * 2;
+		dmtx_frame_t *frames = realloc(pages->frames, alloc * sizeof(dmtx_frame_t));
+		unsigned char **copies;
+
+		if (frames == NULL) {
+			free(copy);
+			return DMTX_RETURN_NO_MEMORY;
+		}
+		pages->frames = frames;
+		copies = realloc(pages->copies, alloc * sizeof(unsigned char *));
+		if (copies == NULL) {
+			free(copy);
+			return DMTX_RETURN_NO_MEMORY;
+		}
+		pages->copies = copies;
+		pages->alloc = alloc;
+	}
+
+	frame = &pages->frames[pages->count];
+	frame->rgb_image = (copy != NULL) ? copy : pixels;
+	frame->width = width;
+	frame->height = height;
+	frame->bitmapStride = bitmapStride;
+	frame->packing = packing;
+	pages->copies[pages->count++] = copy;
+	return DMTX_RETURN_OK;
+}
+
+static void
+dmtx_file_free_pages(dmtx_file_pages_t *pages)
+{
+	dmtx_uint32_t i;
+
+	for (i = 0; i < pages->count; i++)
+		free(pages->copies[i]);
+	free(pages->copies);
+	free(pages->frames);
+}
+
+// Next number of a PNM header, skipping whitespace and comments; -1 if
+// there is none
+static int
+dmtx_pnm_number(const unsigned char *data, size_t size, size_t *pos)
+{
+	int value = 0, digits = 0;
+
+	while (*pos < size) {
+		if (data[*pos] == '#') {
+			while (*pos < size && data[*pos] != '\n')
+				(*pos)++;
+		}
+		else if (data[*pos] == ' ' || (data[*pos] >= '\t' && data[*pos] <= '\r'))
+			(*pos)++;
+		else
+			break;
+	}
+	while (*pos < size && data[*pos] >= '0' && data[*pos] <= '9' && value < 0x1000000) {
+		value = value * 10 + (data[*pos] - '0');
+		(*pos)++;
+		digits++;
+	}
+	return (digits > 0) ? value : -1;
+}
+
+// Binary PGM (P5) and PPM (P6) images with a maxval up to 255, any number
+// of them back to back
+static unsigned char
+dmtx_read_pnm_pages(const unsigned char *data, size_t size, dmtx_file_pages_t *pages)
+{
+	size_t pos = 0;
+	unsigned char returncode;
+
+	while (pos + 2 <= size && data[pos] == 'P') {
+		int bytesPerPixel, width, height, maxval;
+		size_t bytes;
+
+		if (data[pos + 1] == '5')
+			bytesPerPixel = 1;
+		else if (data[pos + 1] == '6')
+			bytesPerPixel = 3;
+		else
+			return DMTX_RETURN_INVALID_ARGUMENT;
+		pos += 2;
+		width = dmtx_pnm_number(data, size, &pos);
+		height = dmtx_pnm_number(data, size, &pos);
+		maxval = dmtx_pnm_number(data, size, &pos);
+		if (width <= 0 || height <= 0 || maxval <= 0 || maxval > 255 || pos >= size)
+			return DMTX_RETURN_INVALID_ARGUMENT;
+		pos++;  // the single whitespace ending the header
+
+		bytes = (size_t) width * height * bytesPerPixel;
+		if (bytes > size - pos)
+			return DMTX_RETURN_INVALID_ARGUMENT;
+		returncode = dmtx_file_add_page(pages, data + pos, width, height,
+			width * bytesPerPixel,
+			(bytesPerPixel == 1) ? DmtxPack8bppK : DmtxPack24bppRGB, NULL);
+		if (returncode != DMTX_RETURN_OK)
+			return returncode;
+
+		pos += bytes;
+		while (pos < size && (data[pos] == ' ' || (data[pos] >= '\t' && data[pos] <= '\r')))
+			pos++;
+	}
+	return (pages->count > 0 && pos == size) ? DMTX_RETURN_OK : DMTX_RETURN_INVALID_ARGUMENT;
+}
+
+typedef struct dmtx_tiff_t {
+	const unsigned char *data;
+	size_t size;
+	int bigEndian;
+} dmtx_tiff_t;
+
+static dmtx_uint32_t
+dmtx_tiff_u16(const dmtx_tiff_t *tiff, size_t offset)
+{
+	const unsigned char *p = tiff->data + offset;
+
+	if (offset > tiff->size || tiff->size - offset < 2)
+		return 0;
+	return tiff->bigEndian ? (p[0] << 8) | p[1] : (p[1] << 8) | p[0];
+}
+
+static dmtx_uint32_t
+dmtx_tiff_u32(const dmtx_tiff_t *tiff, size_t offset)
+{
+	const unsigned char *p = tiff->data + offset;
+
+	if (offset > tiff->size || tiff->size - offset < 4)
+		return 0;
+	if (tiff->bigEndian)
+		return ((dmtx_uint32_t) p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+	return ((dmtx_uint32_t) p[3] << 24) | (p[2] << 16) | (p[1] << 8) | p[0];
+}
+
+// Value number index of the SHORT or LONG directory entry at offset entry,
+// 0 if there is no such value
+static dmtx_uint32_t
+dmtx_tiff_value(const dmtx_tiff_t *tiff, size_t entry, dmtx_uint32_t index)
+{
+	dmtx_uint32_t type = dmtx_tiff_u16(tiff, entry + 2);
+	dmtx_uint32_t count = dmtx_tiff_u32(tiff, entry + 4);
+	size_t valueSize = (type == 3) ? 2 : 4, at;
+
+	if ((type != 3 && type != 4) || index >= count)
+		return 0;
+	at = (count * valueSize <= 4) ? entry + 8 : dmtx_tiff_u32(tiff, entry + 8);
+	at += index * valueSize;
+	return (type == 3) ? dmtx_tiff_u16(tiff, at) : dmtx_tiff_u32(tiff, at);
+}
+
+// Every directory of a baseline TIFF, each page being uncompressed, 8 bits
+// per sample, chunky and gray or RGB(X). Pages stored as one run of strips
+// are used in place.
+static unsigned char
+dmtx_read_tiff_pages(const unsigned char *data, size_t size, dmtx_file_pages_t *pages)
+{
+	dmtx_tiff_t tiff;
+	size_t ifd;
+	size_t directories = 0;
+	unsigned char returncode;
+
+	tiff.data = data;
+	tiff.size = size;
+	tiff.bigEndian = (data[0] == 'M');
+	ifd = dmtx_tiff_u32(&tiff, 4);
+
+	while (ifd != 0) {
+		dmtx_uint32_t entries = dmtx_tiff_u16(&tiff, ifd), e;
+		dmtx_uint32_t width = 0, height = 0, bits = 1, compression = 1;
+		dmtx_uint32_t samples = 1, planar = 1, strips, s;
+		size_t offsets = 0, counts = 0, stride, bytes, first, run;
+		unsigned char *copy = NULL;
+		int packing;
+
+		// Directories past the end or in a loop
+		if (++directories > size / 12 || ifd + 2 + entries * 12 + 4 > size)
+			return DMTX_RETURN_INVALID_ARGUMENT;
+
+		for (e = 0; e < entries; e++) {
+			size_t entry = ifd + 2 + e * 12;
+
+			switch (dmtx_tiff_u16(&tiff, entry)) {
+				case 256: width = dmtx_tiff_value(&tiff, entry, 0); break;
+				case 257: height = dmtx_tiff_value(&tiff, entry, 0); break;
+				case 258: bits = dmtx_tiff_value(&tiff, entry, 0); break;
+				case 259: compression = dmtx_tiff_value(&tiff, entry, 0); break;
+				case 273: offsets = entry; break;
+				case 277: samples = dmtx_tiff_value(&tiff, entry, 0); break;
+				case 279: counts = entry; break;
+				case 284: planar = dmtx_tiff_value(&tiff, entry, 0); break;
+			}
+		}
+
+		if (samples == 1)
+			packing = DmtxPack8bppK;
+		else if (samples == 3)
+			packing = DmtxPack24bppRGB;
+		else if (samples == 4)
+			packing = DmtxPack32bppRGBX;
+		else
+			return DMTX_RETURN_INVALID_ARGUMENT;
+		if (width == 0 || height == 0 || bits != 8 || compression != 1 ||
+				(planar != 1 && samples > 1) || offsets == 0 || counts == 0)
+			return DMTX_RETURN_INVALID_ARGUMENT;
+
+		stride = (size_t) width * samples;
+		bytes = stride * height;
+		strips = dmtx_tiff_u32(&tiff, offsets + 4);
+		first = dmtx_tiff_value(&tiff, offsets, 0);
+
+		// Usually the strips follow each other and the page is used as is
+		for (s = 0, run = first; s < strips && run == dmtx_tiff_value(&tiff, offsets, s); s++)
+			run += dmtx_tiff_value(&tiff, counts, s);
+		if (run - first < bytes) {
+			size_t filled = 0;
+
+			if ((copy = malloc(bytes)) == NULL)
+				return DMTX_RETURN_NO_MEMORY;
+			for (s = 0; s < strips && filled < bytes; s++) {
+				size_t at = dmtx_tiff_value(&tiff, offsets, s);
+				size_t length = dmtx_tiff_value(&tiff, counts, s);
+
+				if (length > bytes - filled)
+					length = bytes - filled;
+				if (at > size || length > size - at)
+					break;
+				memcpy(copy + filled, data + at, length);
+				filled += length;
+			}
+			if (filled < bytes) {
+				free(copy);
+				return DMTX_RETURN_INVALID_ARGUMENT;
+			}
+		}
+		else if (first > size || bytes > size - first)
+			return DMTX_RETURN_INVALID_ARGUMENT;
+
+		returncode = dmtx_file_add_page(pages, data + first, width, height,
+			(dmtx_uint32_t) stride, packing, copy);
+		if (returncode != DMTX_RETURN_OK)
+			return returncode;
+
+		ifd = dmtx_tiff_u32(&tiff, ifd + 2 + entries * 12);
+	}
+	return (pages->count > 0) ? DMTX_RETURN_OK : DMTX_RETURN_INVALID_ARGUMENT;
+}
+
+// Frames of the caller's geometry back to back; a partial frame at the end
+// is ignored
+static unsigned char
+dmtx_read_raw_pages(const unsigned char *data, size_t size,
+			const dmtx_file_layout_t *layout, dmtx_file_pages_t *pages)
+{
+	size_t frameBytes = (size_t) layout->bitmapStride * layout->height;
+	size_t pos = layout->headerBytes;
+	unsigned char returncode;
+
+	if (layout->width == 0 || layout->height == 0 || frameBytes == 0)
+		return DMTX_RETURN_INVALID_ARGUMENT;
+
+	while (pos <= size && size - pos >= frameBytes) {
+		returncode = dmtx_file_add_page(pages, data + pos, layout->width,
+			layout->height, layout->bitmapStride, layout->packing, NULL);
+		if (returncode != DMTX_RETURN_OK)
+			return returncode;
+		pos += frameBytes;
+	}
+	return DMTX_RETURN_OK;
+}
+
+DMTX_EXTERN unsigned char
+dmtx_decode_file(const wchar_t *path,
+			const dmtx_file_layout_t *layout,
+			const dmtx_decode_options_t *options,
+			unsigned char **results,
+			dmtx_uint32_t *resultsSize,
+			dmtx_uint32_t *recordCount,
+			dmtx_uint32_t *pageCount)
+{
+	HANDLE file, mapping = NULL;
+	LARGE_INTEGER fileSize;
+	const unsigned char *data = NULL;
+	size_t size;
+	dmtx_file_pages_t pages;
+	dmtx_uint32_t format;
+	unsigned char returncode;
+
+	*results = NULL;
+	*resultsSize = 0;
+	*recordCount = 0;
+	*pageCount = 0;
+	if (path == NULL || layout == NULL) return DMTX_RETURN_INVALID_ARGUMENT;
+
+	file = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+		FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return DMTX_RETURN_FILE_ERROR;
+	if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+		CloseHandle(file);
+		return DMTX_RETURN_FILE_ERROR;
+	}
+	if ((ULONGLONG) fileSize.QuadPart > (size_t) -1) {
+		CloseHandle(file);
+		return DMTX_RETURN_NO_MEMORY;
+	}
+	size = (size_t) fileSize.QuadPart;
+
+	// The whole file is mapped once; the pages are decoded in place
+	mapping = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mapping != NULL)
+		data = (const unsigned char *) MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (data == NULL) {
+		if (mapping != NULL)
+			CloseHandle(mapping);
+		CloseHandle(file);
+		return DMTX_RETURN_FILE_ERROR;
+	}
+
+	format = layout->format;
+	if (format == DMTX_FILE_AUTO) {
+		if (size >= 8 && ((data[0] == 'I' && data[1] == 'I' && data[2] == 42 && data[3] == 0) ||
+				(data[0] == 'M' && data[1] == 'M' && data[2] == 0 && data[3] == 42)))
+			format = DMTX_FILE_TIFF;
+		else if (size >= 2 && data[0] == 'P')
+			format = DMTX_FILE_PNM;
+	}
+
+	memset(&pages, 0, sizeof(pages));
+	switch (format) {
+		case DMTX_FILE_PNM:
+			returncode = dmtx_read_pnm_pages(data, size, &pages);
+			break;
+		case DMTX_FILE_TIFF:
+			returncode = (size >= 8) ? dmtx_read_tiff_pages(data, size, &pages) :
+				DMTX_RETURN_INVALID_ARGUMENT;
+			break;
+		case DMTX_FILE_RAW:
+			returncode = dmtx_read_raw_pages(data, size, layout, &pages);
+			break;
+		default:
+			returncode = DMTX_RETURN_INVALID_ARGUMENT;
+			break;
+	}
+
+	if (returncode == DMTX_RETURN_OK) {
+		*pageCount = pages.count;
+		returncode = dmtx_decode_batch(pages.frames, pages.count, options,
+			results, resultsSize, recordCount);
+	}
+
+	dmtx_file_free_pages(&pages);
+	UnmapViewOfFile(data);
+	CloseHandle(mapping);
+	CloseHandle(file);
+	return returncode;
+}
+
+// Copies the search options of a profile into options
+static void
+dmtx_options_from_profile(dmtx_decode_options_t *options, const DmtxProfile *profile)
+{
+	options->sizeIdxExpected = (dmtx_int16_t) profile->sizeIdxExpected;
+	options->edgeMin = (dmtx_int16_t) profile->edgeMin;
+	options->edgeMax = (dmtx_int16_t) profile->edgeMax;
+	options->scanGap = (dmtx_int16_t) profile->scanGap;
+	options->squareDevn = (dmtx_int16_t) profile->squareDevn;
+	options->edgeThresh = (dmtx_int16_t) profile->edgeThresh;
+	options->shrink = (dmtx_int16_t) dmtxProfileGetShrink(profile);
+}
 
 DMTX_EXTERN unsigned char
-dmtx_decode(const unsigned char *rgb_image,
-			const dmtx_uint32_t width,
-			const dmtx_uint32_t height,
-			const dmtx_uint32_t bitmapStride,
-			const dmtx_decode_options_t *options,
-			void(*diagnoseFunc)(unsigned char *data, int totalBytes, int headerBytes),
-			const dmtx_uint32_t diagnosticStyle,
-			int(*callbackFunc)(dmtx_decoded_t *decode_result))
+dmtx_decode_profile(const dmtx_int32_t profile,
+			dmtx_decode_options_t *options)
+{
+	DmtxProfile p;
+
+	if (options == NULL || dmtxProfileInit(&p, (int) profile) != DmtxPass)
+		return DMTX_RETURN_INVALID_ARGUMENT;
+
+	dmtx_options_from_profile(options, &p);
+	return DMTX_RETURN_OK;
+}
+
+DMTX_EXTERN unsigned char
+dmtx_decode_calibrate(const dmtx_frame_t *frames,
+			const dmtx_uint32_t frameCount,
+			dmtx_decode_options_t *options,
+			dmtx_uint32_t *symbolCount,
+			double *defaultMS,
+			double *profileMS)
 {
-	DmtxImage *img = NULL;
-	DmtxDecode *decode = NULL;
-	DmtxRegion *region = NULL;
-	DmtxMessage *msg = NULL;
+	DmtxImage **images;
+	DmtxProfile start;
+	DmtxCalibration calib;
 	unsigned char returncode = DMTX_RETURN_OK;
-	dmtx_uint16_t max_results = options->maxCodes;
-	DmtxPassFail err = DmtxPass;
-	DmtxTime msec, *timeout = NULL;
-	DmtxVector2 p00, p10, p11, p01;
-	double rotate;
-	int result_count;
-
-	// Create libdmtx's image structure
-	img = dmtxImageCreate((unsigned char *)rgb_image, (int) width, (int) height, DmtxPack24bppBGR);
-	if (img == NULL) return DMTX_RETURN_NO_MEMORY;
-
-	dmtxImageSetProp(img, DmtxPropRowPadBytes, bitmapStride % 3);
-
-	// Apply options
-	decode = dmtxDecodeCreate(img, options->shrink);
-	timeout = (options->timeoutMS != DmtxUndefined) ? &msec : NULL;
-	if (timeout != NULL)
-		msec = dmtxTimeAdd(dmtxTimeNow(), options->timeoutMS);
-	while (1) {
-		if ((options->edgeMax != DmtxUndefined) &&
-			((err = dmtxDecodeSetProp(decode, DmtxPropEdgeMax, options->edgeMax)
-			) != DmtxPass)) break;
-		if ((options->edgeMin != DmtxUndefined) &&
-			((err = dmtxDecodeSetProp(decode, DmtxPropEdgeMin, options->edgeMin)
-			) != DmtxPass)) break;
-		if ((options->scanGap != DmtxUndefined) &&
-			((err = dmtxDecodeSetProp(decode, DmtxPropScanGap, options->scanGap)
-			) != DmtxPass)) break;
-		if ((options->squareDevn != DmtxUndefined) &&
-			((err = dmtxDecodeSetProp(decode, DmtxPropSquareDevn, options->squareDevn)
-			) != DmtxPass)) break;
-		if ((err = dmtxDecodeSetProp(decode, DmtxPropSymbolSize, options->sizeIdxExpected)
-			) != DmtxPass) break;
-		if ((options->edgeThresh != DmtxUndefined) &&
-			((err = dmtxDecodeSetProp(decode, DmtxPropEdgeThresh, options->edgeThresh)
-			) != DmtxPass)) break;
-		if ((options->xMax != DmtxUndefined) &&
-			((err = dmtxDecodeSetProp(decode, DmtxPropXmax, options->xMax)
-			) != DmtxPass)) break;
-		if ((options->xMin != DmtxUndefined) &&
-			((err = dmtxDecodeSetProp(decode, DmtxPropXmin, options->xMin)
-			) != DmtxPass)) break;
-		if ((options->yMax != DmtxUndefined) &&
-			((err = dmtxDecodeSetProp(decode, DmtxPropYmax, options->yMax)
-			) != DmtxPass)) break;
-		if ((options->yMin != DmtxUndefined) &&
-			((err = dmtxDecodeSetProp(decode, DmtxPropYmin, options->yMin)
-			) != DmtxPass)) break;
-		break;
-	}
-	if (err != DmtxPass) {
-		dmtxDecodeDestroy(&decode);
-		dmtxImageDestroy(&img);
+	dmtx_uint32_t f, rowBytes;
+
+	*symbolCount = 0;
+	*defaultMS = *profileMS = 0.0;
+	if (frames == NULL || frameCount == 0 || options == NULL)
 		return DMTX_RETURN_INVALID_ARGUMENT;
+
+	images = calloc(frameCount, sizeof(DmtxImage *));
+	if (images == NULL) return DMTX_RETURN_NO_MEMORY;
+
+	for (f = 0; f < frameCount && returncode == DMTX_RETURN_OK; f++) {
+		images[f] = dmtxImageCreate((unsigned char *) frames[f].rgb_image,
+			(int) frames[f].width, (int) frames[f].height, (int) frames[f].packing);
+		if (images[f] == NULL) {
+			returncode = DMTX_RETURN_NO_MEMORY;
+			break;
+		}
+		rowBytes = frames[f].width * dmtxImageGetProp(images[f], DmtxPropBytesPerPixel);
+		if (frames[f].bitmapStride < rowBytes)
+			returncode = DMTX_RETURN_INVALID_ARGUMENT;
+		else
+			dmtxImageSetProp(images[f], DmtxPropRowPadBytes, frames[f].bitmapStride - rowBytes);
 	}
 
-	if (diagnoseFunc) {
-		int totalBytes, headerBytes;
-		unsigned char *diagnosticData;
-		diagnosticData = dmtxDecodeCreateDiagnostic(
-			decode, &totalBytes, &headerBytes, diagnosticStyle);
-		diagnoseFunc(diagnosticData, totalBytes, headerBytes);
-		free(diagnosticData);
+	// Settings given in options are tried first; a shrink of 1 leaves the
+	// calibration free to pick one
+	start.sizeIdxExpected = options->sizeIdxExpected;
+	start.edgeMin = options->edgeMin;
+	start.edgeMax = options->edgeMax;
+	start.scanGap = options->scanGap;
+	start.squareDevn = options->squareDevn;
+	start.edgeThresh = options->edgeThresh;
+	start.shrink = (options->shrink > 1) ? options->shrink : DmtxUndefined;
+
+	if (returncode == DMTX_RETURN_OK) {
+		if (dmtxProfileCalibrate(&calib, images, (int) frameCount, &start,
+				(int) options->timeoutMS) == DmtxPass) {
+			dmtx_options_from_profile(options, &calib.profile);
+			*symbolCount = (dmtx_uint32_t) calib.symbolCount;
+			*defaultMS = calib.defaultMs;
+			*profileMS = calib.profileMs;
+		} else {
+			// No symbol in the samples to calibrate against
+			returncode = DMTX_RETURN_INVALID_ARGUMENT;
+		}
 	}
 
-	// Find and decode matrices in the image
-	region = dmtxRegionFindNext(decode, timeout);
-	result_count = 0;
-	while ((region != NULL) && (result_count < max_results)) {
-		dmtx_decoded_t result;
-
-		p00.X = p00.Y = p10.Y = p01.X = 0.0;
-		p10.X = p01.Y = p11.X = p11.Y = 1.0;
-		dmtxMatrix3VMultiplyBy(&p00, region->fit2raw);
-		dmtxMatrix3VMultiplyBy(&p10, region->fit2raw);
-		dmtxMatrix3VMultiplyBy(&p11, region->fit2raw);
-		dmtxMatrix3VMultiplyBy(&p01, region->fit2raw);
-		result.corners.corner0.x = (dmtx_uint16_t)(p00.X + 0.5);
-		result.corners.corner0.y = (dmtx_uint16_t)(height - 1 - (int)(p00.Y + 0.5));
-		result.corners.corner1.x = (dmtx_uint16_t)(p01.X + 0.5);
-		result.corners.corner1.y = (dmtx_uint16_t)(height - 1 - (int)(p01.Y + 0.5));
-		result.corners.corner2.x = (dmtx_uint16_t)(p10.X + 0.5);
-		result.corners.corner2.y = (dmtx_uint16_t)(height - 1 - (int)(p10.Y + 0.5));
-		result.corners.corner3.x = (dmtx_uint16_t)(p11.X + 0.5);
-		result.corners.corner3.y = (dmtx_uint16_t)(height - 1 - (int)(p11.Y + 0.5));
-
-		rotate = (2 * M_PI) + (atan2(region->fit2raw[0][1], region->fit2raw[1][1]) -
-			atan2(region->fit2raw[1][0], region->fit2raw[0][0])) / 2.0;
-		rotate = (rotate * 180/M_PI);  // degrees
-		if (rotate >= 360) rotate -= 360;
-		result.symbolInfo.angle = (dmtx_uint16_t) (rotate + 0.5);
-		result.symbolInfo.cols = (dmtx_uint16_t) dmtxGetSymbolAttribute(DmtxSymAttribSymbolCols, region->sizeIdx);
-		result.symbolInfo.rows = (dmtx_uint16_t) dmtxGetSymbolAttribute(DmtxSymAttribSymbolRows, region->sizeIdx);
-		result.symbolInfo.horizDataRegions = (dmtx_uint16_t) dmtxGetSymbolAttribute(DmtxSymAttribHorizDataRegions, region->sizeIdx);
-		result.symbolInfo.vertDataRegions = (dmtx_uint16_t) dmtxGetSymbolAttribute(DmtxSymAttribVertDataRegions, region->sizeIdx);
-		result.symbolInfo.interleavedBlocks = (dmtx_uint16_t) dmtxGetSymbolAttribute(DmtxSymAttribInterleavedBlocks, region->sizeIdx);
-		result.symbolInfo.capacity = (dmtx_uint16_t) dmtxGetSymbolAttribute(DmtxSymAttribSymbolDataWords, region->sizeIdx);
-		result.symbolInfo.errorWords = (dmtx_uint16_t) dmtxGetSymbolAttribute(DmtxSymAttribSymbolErrorWords, region->sizeIdx);
-
-		if (options->mosaic)
-			msg = dmtxDecodeMosaicRegion(decode, region, options->correctionsMax);
-		else
-			msg = dmtxDecodeMatrixRegion(decode, region, options->correctionsMax);
-		if (msg != NULL) {
-			result.data = malloc(msg->outputSize);
-			if (result.data != NULL) {
-				memcpy(result.data, msg->output, msg->outputSize);
-				result.dataSize = msg->outputSize;
-			}
-			result.symbolInfo.padWords = (dmtx_uint16_t) msg->padCount;
-			result.symbolInfo.dataWords = (dmtx_uint16_t) (
-				result.symbolInfo.capacity -
-				result.symbolInfo.padWords);
-			dmtxMessageDestroy(&msg);
+	for (f = 0; f < frameCount; f++) {
+		if (images[f] != NULL)
+			dmtxImageDestroy(&images[f]);
+	}
+	free(images);
+	return returncode;
+}
+
+DMTX_EXTERN void
+dmtx_free_results(unsigned char *results)
+{
+	free(results);
+}
+
+// Optional LRU cache of finished encodes, shared by all threads. Entries
+// are keyed on the encode options and the payload; every byte an entry
+// holds counts against the budget. A budget of 0 (the default) disables
+// the cache.
+#define DMTX_CACHE_BUCKETS  1024
+#define DMTX_CACHE_RASTER   1
+#define DMTX_CACHE_MODULES  2
+
+typedef struct dmtx_cache_key_t {
+	dmtx_uint16_t kind;
+	dmtx_encode_options_t options;
+} dmtx_cache_key_t;
+
+typedef struct dmtx_cache_entry_t {
+	struct dmtx_cache_entry_t *prev;   // LRU list, most recently used first
+	struct dmtx_cache_entry_t *next;
+	struct dmtx_cache_entry_t *chain;  // next entry in the same bucket
+	dmtx_uint32_t hash;
+	dmtx_uint32_t textSize;
+	dmtx_uint32_t valueSize;
+	dmtx_cache_key_t key;
+	dmtx_symbolinfo_t symbolInfo;
+	dmtx_uint32_t width;
+	dmtx_uint32_t height;
+	unsigned char bytes[1];            // payload followed by value
+} dmtx_cache_entry_t;
+
+static struct {
+	CRITICAL_SECTION mutex;
+	volatile LONG state;               // 0 = new, 1 = initialising, 2 = ready
+	dmtx_cache_entry_t *buckets[DMTX_CACHE_BUCKETS];
+	dmtx_cache_entry_t *head;
+	dmtx_cache_entry_t *tail;
+	dmtx_cache_stats_t stats;
+} dmtx_cache;
+
+static void
+dmtx_cache_lock(void)
+{
+	// No DllMain to set up the mutex in, so the first caller does it
+	if (dmtx_cache.state != 2) {
+		if (InterlockedCompareExchange(&dmtx_cache.state, 1, 0) == 0) {
+			InitializeCriticalSection(&dmtx_cache.mutex);
+			InterlockedExchange(&dmtx_cache.state, 2);
+		} else {
+			while (dmtx_cache.state != 2)
+				Sleep(0);
 		}
+	}
+	EnterCriticalSection(&dmtx_cache.mutex);
+}
+
+static void
+dmtx_cache_unlock(void)
+{
+	LeaveCriticalSection(&dmtx_cache.mutex);
+}
 
-		if(callbackFunc(&result)==0) {
+static void
+dmtx_cache_make_key(dmtx_cache_key_t *key, dmtx_uint16_t kind,
+			const dmtx_encode_options_t *options)
+{
+	memset(key, 0, sizeof(*key));
+	key->kind = kind;
+	key->options = *options;
+	// Module matrices do not depend on how they would be rendered
+	if (kind == DMTX_CACHE_MODULES)
+		key->options.moduleSize = key->options.marginSize = 0;
+}
+
+static dmtx_uint32_t
+dmtx_cache_hash(const dmtx_cache_key_t *key, const void *text, dmtx_uint32_t textSize)
+{
+	const unsigned char *p = (const unsigned char *) key;
+	dmtx_uint32_t hash = 2166136261U;  // FNV-1a
+	dmtx_uint32_t i;
+
+	for (i = 0; i < sizeof(*key); i++)
+		hash = (hash ^ p[i]) * 16777619U;
+	p = (const unsigned char *) text;
+	for (i = 0; i < textSize; i++)
+		hash = (hash ^ p[i]) * 16777619U;
+	return hash;
+}
+
+static dmtx_uint32_t
+dmtx_cache_entry_bytes(const dmtx_cache_entry_t *entry)
+{
+	return (dmtx_uint32_t) sizeof(*entry) + entry->textSize + entry->valueSize;
+}
+
+// Caller holds the lock
+static void
+dmtx_cache_remove(dmtx_cache_entry_t *entry)
+{
+	dmtx_cache_entry_t **link = &dmtx_cache.buckets[entry->hash % DMTX_CACHE_BUCKETS];
+
+	while (*link != entry)
+		link = &(*link)->chain;
+	*link = entry->chain;
+
+	if (entry->prev != NULL) entry->prev->next = entry->next;
+	else dmtx_cache.head = entry->next;
+	if (entry->next != NULL) entry->next->prev = entry->prev;
+	else dmtx_cache.tail = entry->prev;
+
+	dmtx_cache.stats.entries--;
+	dmtx_cache.stats.bytes -= dmtx_cache_entry_bytes(entry);
+	free(entry);
+}
+
+// Caller holds the lock
+static void
+dmtx_cache_trim(dmtx_uint32_t maxBytes)
+{
+	while (dmtx_cache.tail != NULL && dmtx_cache.stats.bytes > maxBytes)
+		dmtx_cache_remove(dmtx_cache.tail);
+}
+
+// Returns a malloc'd copy of the cached value, or NULL on a miss
+static unsigned char *
+dmtx_cache_get(const dmtx_cache_key_t *key,
+			const void *text,
+			const dmtx_uint32_t textSize,
+			dmtx_symbolinfo_t *symbolInfo,
+			dmtx_uint32_t *width,
+			dmtx_uint32_t *height,
+			dmtx_uint32_t *valueSize)
+{
+	dmtx_uint32_t hash = dmtx_cache_hash(key, text, textSize);
+	dmtx_cache_entry_t *entry;
+	unsigned char *value = NULL;
+
+	dmtx_cache_lock();
+	if (dmtx_cache.stats.maxBytes == 0) {
+		dmtx_cache_unlock();
+		return NULL;
+	}
+	for (entry = dmtx_cache.buckets[hash % DMTX_CACHE_BUCKETS]; entry != NULL; entry = entry->chain) {
+		if (entry->hash == hash && entry->textSize == textSize &&
+			memcmp(&entry->key, key, sizeof(*key)) == 0 &&
+			memcmp(entry->bytes, text, textSize) == 0)
 			break;
+	}
+	if (entry != NULL)
+		value = malloc(entry->valueSize > 0 ? entry->valueSize : 1);
+	if (value != NULL) {
+		memcpy(value, entry->bytes + entry->textSize, entry->valueSize);
+		*symbolInfo = entry->symbolInfo;
+		*width = entry->width;
+		*height = entry->height;
+		*valueSize = entry->valueSize;
+
+		// Move to the front of the LRU list
+		if (entry != dmtx_cache.head) {
+			entry->prev->next = entry->next;
+			if (entry->next != NULL) entry->next->prev = entry->prev;
+			else dmtx_cache.tail = entry->prev;
+			entry->prev = NULL;
+			entry->next = dmtx_cache.head;
+			dmtx_cache.head->prev = entry;
+			dmtx_cache.head = entry;
 		}
+		dmtx_cache.stats.hits++;
+	} else {
+		dmtx_cache.stats.misses++;
+	}
+	dmtx_cache_unlock();
+	return value;
+}
+
+// Stores a copy of value, evicting the least recently used entries to
+// stay within budget. A failed insert only costs the next lookup a miss.
+static void
+dmtx_cache_put(const dmtx_cache_key_t *key,
+			const void *text,
+			const dmtx_uint32_t textSize,
+			const dmtx_symbolinfo_t *symbolInfo,
+			const dmtx_uint32_t width,
+			const dmtx_uint32_t height,
+			const unsigned char *value,
+			const dmtx_uint32_t valueSize)
+{
+	dmtx_uint32_t hash = dmtx_cache_hash(key, text, textSize);
+	dmtx_cache_entry_t *entry, *old;
 
-		result_count++;
-		region = dmtxRegionFindNext(decode, timeout);
+	entry = malloc(sizeof(*entry) + textSize + valueSize);
+	if (entry == NULL) return;
+	memset(entry, 0, sizeof(*entry));
+	entry->hash = hash;
+	entry->textSize = textSize;
+	entry->valueSize = valueSize;
+	entry->key = *key;
+	entry->symbolInfo = *symbolInfo;
+	entry->width = width;
+	entry->height = height;
+	memcpy(entry->bytes, text, textSize);
+	memcpy(entry->bytes + textSize, value, valueSize);
+
+	dmtx_cache_lock();
+	if (dmtx_cache_entry_bytes(entry) > dmtx_cache.stats.maxBytes) {
+		dmtx_cache_unlock();
+		free(entry);
+		return;
+	}
+	// Another thread may have encoded the same payload meanwhile
+	for (old = dmtx_cache.buckets[hash % DMTX_CACHE_BUCKETS]; old != NULL; old = old->chain) {
+		if (old->hash == hash && old->textSize == textSize &&
+			memcmp(&old->key, key, sizeof(*key)) == 0 &&
+			memcmp(old->bytes, text, textSize) == 0) {
+			dmtx_cache_remove(old);
+			break;
+		}
 	}
+	dmtx_cache_trim(dmtx_cache.stats.maxBytes - dmtx_cache_entry_bytes(entry));
 
-	// Clean-up
-	dmtxRegionDestroy(&region);
-	dmtxDecodeDestroy(&decode);
-	dmtxImageDestroy(&img);
+	entry->chain = dmtx_cache.buckets[hash % DMTX_CACHE_BUCKETS];
+	dmtx_cache.buckets[hash % DMTX_CACHE_BUCKETS] = entry;
+	entry->next = dmtx_cache.head;
+	if (dmtx_cache.head != NULL) dmtx_cache.head->prev = entry;
+	else dmtx_cache.tail = entry;
+	dmtx_cache.head = entry;
+	dmtx_cache.stats.entries++;
+	dmtx_cache.stats.bytes += dmtx_cache_entry_bytes(entry);
+	dmtx_cache_unlock();
+}
 
-	return returncode;
+DMTX_EXTERN void
+dmtx_encode_cache_set_limit(const dmtx_uint32_t maxBytes)
+{
+	dmtx_cache_lock();
+	dmtx_cache.stats.maxBytes = maxBytes;
+	dmtx_cache_trim(maxBytes);
+	dmtx_cache_unlock();
 }
 
-DMTX_EXTERN unsigned char
-dmtx_encode(const void *plain_text,
+DMTX_EXTERN void
+dmtx_encode_cache_clear(void)
+{
+	dmtx_cache_lock();
+	dmtx_cache_trim(0);
+	dmtx_cache.stats.hits = 0;
+	dmtx_cache.stats.misses = 0;
+	dmtx_cache_unlock();
+}
+
+DMTX_EXTERN void
+dmtx_encode_cache_stats(dmtx_cache_stats_t *stats)
+{
+	dmtx_cache_lock();
+	*stats = dmtx_cache.stats;
+	dmtx_cache_unlock();
+}
+
+// Creates a DmtxEncode with the given options and encodes plain_text
+static unsigned char
+dmtx_create_encode(const void *plain_text,
 			const dmtx_uint16_t text_size,
-			dmtx_encoded_t **result,
-			const dmtx_encode_options_t *options)
+			const dmtx_encode_options_t *options,
+			const int moduleSize,
+			const int marginSize,
+			DmtxEncode **encode)
 {
 	DmtxEncode *enc;
 	DmtxPassFail err = DmtxPass;
-	DmtxRegion *region = NULL;
-	dmtx_encoded_t *res = NULL;
-	*result = NULL;
+	*encode = NULL;
 
 	enc = dmtxEncodeCreate();
 	if (enc == NULL) return DMTX_RETURN_NO_MEMORY;
 	while (1) {
-		if ((err = dmtxEncodeSetProp(enc, DmtxPropMarginSize, options->marginSize))
+		if ((err = dmtxEncodeSetProp(enc, DmtxPropMarginSize, marginSize))
 			!= DmtxPass) break;
-		if ((err = dmtxEncodeSetProp(enc, DmtxPropModuleSize, options->moduleSize))
+		if ((err = dmtxEncodeSetProp(enc, DmtxPropModuleSize, moduleSize))
 			!= DmtxPass) break;
 		if ((err = dmtxEncodeSetProp(enc, DmtxPropSizeRequest, options->sizeIdx))
 			!= DmtxPass) break;
@@ -217,51 +1840,397 @@ dmtx_encode(const void *plain_text,
 		return DMTX_RETURN_ENCODE_ERROR;
 	}
 
-	res = *result = malloc(sizeof(dmtx_encoded_t));
-	if (res == NULL) {
-		dmtxEncodeDestroy(&enc);
-		return DMTX_RETURN_NO_MEMORY;
-	}
+	*encode = enc;
+	return DMTX_RETURN_OK;
+}
 
-	res->symbolInfo.angle = options->rotate;
-	region = &enc->region;
-	res->symbolInfo.cols = (dmtx_uint16_t)
+static void
+dmtx_encode_symbolinfo(const DmtxEncode *enc,
+			const dmtx_encode_options_t *options,
+			dmtx_symbolinfo_t *symbolInfo)
+{
+	const DmtxRegion *region = &enc->region;
+
+	symbolInfo->angle = options->rotate;
+	symbolInfo->cols = (dmtx_uint16_t)
 		dmtxGetSymbolAttribute(DmtxSymAttribSymbolCols, region->sizeIdx);
-	res->symbolInfo.rows = (dmtx_uint16_t)
+	symbolInfo->rows = (dmtx_uint16_t)
 		dmtxGetSymbolAttribute(DmtxSymAttribSymbolRows, region->sizeIdx);
-	res->symbolInfo.horizDataRegions = (dmtx_uint16_t)
+	symbolInfo->horizDataRegions = (dmtx_uint16_t)
 		dmtxGetSymbolAttribute(DmtxSymAttribHorizDataRegions, region->sizeIdx);
-	res->symbolInfo.vertDataRegions = (dmtx_uint16_t)
+	symbolInfo->vertDataRegions = (dmtx_uint16_t)
 		dmtxGetSymbolAttribute(DmtxSymAttribVertDataRegions, region->sizeIdx);
-	res->symbolInfo.interleavedBlocks = (dmtx_uint16_t)
+	symbolInfo->interleavedBlocks = (dmtx_uint16_t)
 		dmtxGetSymbolAttribute(DmtxSymAttribInterleavedBlocks, region->sizeIdx);
-	res->symbolInfo.capacity = (dmtx_uint16_t)
+	symbolInfo->capacity = (dmtx_uint16_t)
 		dmtxGetSymbolAttribute(DmtxSymAttribSymbolDataWords, region->sizeIdx);
-	res->symbolInfo.errorWords = (dmtx_uint16_t)
+	symbolInfo->errorWords = (dmtx_uint16_t)
 		dmtxGetSymbolAttribute(DmtxSymAttribSymbolErrorWords, region->sizeIdx);
-	res->symbolInfo.padWords = (dmtx_uint16_t) enc->message->padCount;
-	res->symbolInfo.dataWords = (dmtx_uint16_t) (
-		res->symbolInfo.capacity -
-		res->symbolInfo.padWords);
+	symbolInfo->padWords = (dmtx_uint16_t) enc->message->padCount;
+	symbolInfo->dataWords = (dmtx_uint16_t) (
+		symbolInfo->capacity -
+		symbolInfo->padWords);
+}
+
+DMTX_EXTERN unsigned char
+dmtx_encode(const void *plain_text,
+			const dmtx_uint16_t text_size,
+			dmtx_encoded_t **result,
+			const dmtx_encode_options_t *options)
+{
+	DmtxEncode *enc;
+	dmtx_encoded_t *res = NULL;
+	dmtx_cache_key_t key;
+	unsigned char *pxl;
+	dmtx_uint32_t pxlSize;
+	unsigned char returncode;
+	*result = NULL;
+
+	res = malloc(sizeof(dmtx_encoded_t));
+	if (res == NULL)
+		return DMTX_RETURN_NO_MEMORY;
+
+	dmtx_cache_make_key(&key, DMTX_CACHE_RASTER, options);
+	pxl = dmtx_cache_get(&key, plain_text, text_size, &res->symbolInfo,
+		&res->width, &res->height, &pxlSize);
+	if (pxl != NULL) {
+		// Wrap the cached raster in a DmtxEncode so that it is copied and
+		// freed like a fresh one; dmtxEncodeDestroy frees pxl
+		enc = dmtxEncodeCreate();
+		if (enc != NULL)
+			enc->image = dmtxImageCreate(pxl, (int) res->width, (int) res->height,
+				DmtxPack24bppRGB);
+		if (enc == NULL || enc->image == NULL) {
+			dmtxEncodeDestroy(&enc);
+			free(pxl);
+			free(res);
+			return DMTX_RETURN_NO_MEMORY;
+		}
+		dmtxImageSetProp(enc->image, DmtxPropImageFlip, DmtxFlipY);
+		res->data = enc;
+		*result = res;
+		return DMTX_RETURN_OK;
+	}
+
+	returncode = dmtx_create_encode(plain_text, text_size, options,
+		options->moduleSize, options->marginSize, &enc);
+	if (returncode != DMTX_RETURN_OK) {
+		free(res);
+		return returncode;
+	}
+
+	dmtx_encode_symbolinfo(enc, options, &res->symbolInfo);
 	res->width = (dmtx_uint16_t) dmtxImageGetProp(enc->image, DmtxPropWidth);
 	res->height = (dmtx_uint16_t) dmtxImageGetProp(enc->image, DmtxPropHeight);
 	res->data = enc;
+	*result = res;
+
+	pxlSize = (dmtx_uint32_t) (dmtxImageGetProp(enc->image, DmtxPropRowSizeBytes) * res->height);
+	dmtx_cache_put(&key, plain_text, text_size, &res->symbolInfo,
+		res->width, res->height, enc->image->pxl, pxlSize);
+	return DMTX_RETURN_OK;
+}
+
+DMTX_EXTERN unsigned char
+dmtx_encode_modules(const void *plain_text,
+			const dmtx_uint16_t text_size,
+			const dmtx_encode_options_t *options,
+			dmtx_symbolinfo_t *symbolInfo,
+			unsigned char **modules,
+			dmtx_uint32_t *modulesSize)
+{
+	DmtxEncode *enc;
+	dmtx_cache_key_t key;
+	dmtx_uint32_t width, height;
+	unsigned char returncode;
+	int rows, cols, rowBytes, row, col;
+
+	*modules = NULL;
+	*modulesSize = 0;
+
+	// Mosaic modules are coloured, they do not fit in one bit
+	if (options->mosaic)
+		return DMTX_RETURN_INVALID_ARGUMENT;
+
+	dmtx_cache_make_key(&key, DMTX_CACHE_MODULES, options);
+	*modules = dmtx_cache_get(&key, plain_text, text_size, symbolInfo,
+		&width, &height, modulesSize);
+	if (*modules != NULL)
+		return DMTX_RETURN_OK;
+
+	// libdmtx always rasterises, so keep that raster as small as possible
+	returncode = dmtx_create_encode(plain_text, text_size, options, 1, 0, &enc);
+	if (returncode != DMTX_RETURN_OK)
+		return returncode;
+
+	dmtx_encode_symbolinfo(enc, options, symbolInfo);
+	rows = symbolInfo->rows;
+	cols = symbolInfo->cols;
+	rowBytes = (cols + 7) / 8;
+
+	*modules = calloc(rows, rowBytes);
+	if (*modules == NULL) {
+		dmtxEncodeDestroy(&enc);
+		return DMTX_RETURN_NO_MEMORY;
+	}
+
+	// Top row first; libdmtx counts symbol rows from the bottom
+	for (row = 0; row < rows; row++) {
+		unsigned char *out = *modules + (rows - 1 - row) * rowBytes;
+		for (col = 0; col < cols; col++) {
+			if (dmtxSymbolModuleStatus(enc->message, enc->region.sizeIdx, row, col) & DmtxModuleOnRGB)
+				out[col >> 3] |= 0x80 >> (col & 7);
+		}
+	}
+	*modulesSize = (dmtx_uint32_t) (rows * rowBytes);
+
+	dmtxEncodeDestroy(&enc);
+	dmtx_cache_put(&key, plain_text, text_size, symbolInfo,
+		(dmtx_uint32_t) cols, (dmtx_uint32_t) rows, *modules, *modulesSize);
+	return DMTX_RETURN_OK;
+}
+
+// One payload of dmtx_encode_batch, encoded by whichever worker got it
+typedef struct dmtx_encode_item_t {
+	dmtx_symbolinfo_t symbolInfo;
+	dmtx_uint32_t width;
+	dmtx_uint32_t height;
+	unsigned char *modules;
+	dmtx_uint32_t modulesSize;
+	DmtxEncode *enc;
+	unsigned char returncode;
+} dmtx_encode_item_t;
+
+typedef struct dmtx_encode_job_t {
+	const unsigned char *texts;
+	const dmtx_uint16_t *textSizes;
+	const dmtx_uint32_t *textOffsets;
+	dmtx_uint32_t count;
+	const dmtx_encode_options_t *options;
+	dmtx_uint32_t format;
+	dmtx_encode_item_t *items;
+	volatile LONG nextItem;
+	volatile LONG stop;
+} dmtx_encode_job_t;
+
+// Encodes payloads until none are left or one of them failed
+static unsigned __stdcall
+dmtx_encode_worker(void *arg)
+{
+	dmtx_encode_job_t *job = (dmtx_encode_job_t *) arg;
+	LONG index;
+
+	while (!job->stop && (index = InterlockedIncrement(&job->nextItem) - 1) < (LONG) job->count) {
+		dmtx_encode_item_t *item = &job->items[index];
+		const unsigned char *text = job->texts + job->textOffsets[index];
+		dmtx_uint16_t textSize = job->textSizes[index];
+
+		if (job->format == DMTX_BATCH_MODULES) {
+			item->returncode = dmtx_encode_modules(text, textSize, job->options,
+				&item->symbolInfo, &item->modules, &item->modulesSize);
+			item->width = item->symbolInfo.cols;
+			item->height = item->symbolInfo.rows;
+		} else {
+			dmtx_encoded_t *encoded;
+
+			item->returncode = dmtx_encode(text, textSize, &encoded, job->options);
+			if (item->returncode == DMTX_RETURN_OK) {
+				item->symbolInfo = encoded->symbolInfo;
+				item->width = encoded->width;
+				item->height = encoded->height;
+				item->enc = encoded->data;
+				free(encoded);
+			}
+		}
+		if (item->returncode != DMTX_RETURN_OK)
+			InterlockedExchange(&job->stop, 1);
+	}
+	return 0;
+}
+
+// Lays out the finished items: all records first, then either every
+// module matrix or one sheet with the bitmaps stacked top to bottom
+static unsigned char
+dmtx_layout_encodes(const dmtx_encode_job_t *job,
+			unsigned char **results,
+			dmtx_uint32_t *resultsSize,
+			dmtx_uint32_t *sheetWidth,
+			dmtx_uint32_t *sheetHeight,
+			dmtx_uint32_t *sheetStride)
+{
+	dmtx_encode_record_t *records;
+	unsigned __int64 size, dataSize = 0;
+	dmtx_uint32_t i, width = 0, height = 0, stride = 0, offset, y = 0;
+	unsigned char *buffer;
+
+	if (job->format == DMTX_BATCH_MODULES) {
+		for (i = 0; i < job->count; i++)
+			dataSize += job->items[i].modulesSize;
+	} else {
+		for (i = 0; i < job->count; i++) {
+			if (job->items[i].width > width)
+				width = job->items[i].width;
+			height += job->items[i].height;
+		}
+		// Rows padded to 4 bytes, as GDI+ expects of a 24bpp scan0
+		stride = (width * 3 + 3) & ~3U;
+		dataSize = (unsigned __int64) stride * height;
+	}
+
+	offset = (dmtx_uint32_t) (job->count * sizeof(dmtx_encode_record_t));
+	size = offset + dataSize;
+	if (size > 0xFFFFFFFFU)
+		return DMTX_RETURN_NO_MEMORY;
+	buffer = malloc((size_t) size);
+	if (buffer == NULL)
+		return DMTX_RETURN_NO_MEMORY;
+
+	records = (dmtx_encode_record_t *) buffer;
+	if (job->format != DMTX_BATCH_MODULES)
+		memset(buffer + offset, 0xFF, (size_t) dataSize);
+
+	for (i = 0; i < job->count; i++) {
+		const dmtx_encode_item_t *item = &job->items[i];
+		dmtx_encode_record_t *record = &records[i];
+
+		record->symbolInfo = item->symbolInfo;
+		record->x = 0;
+		record->width = item->width;
+		record->height = item->height;
+		if (job->format == DMTX_BATCH_MODULES) {
+			record->y = 0;
+			record->dataOffset = offset;
+			record->dataSize = item->modulesSize;
+			memcpy(buffer + offset, item->modules, item->modulesSize);
+			offset += item->modulesSize;
+		} else {
+			dmtx_uint32_t row, rowBytes = item->width * 3;
+
+			record->y = y;
+			record->dataOffset = offset + y * stride;
+			record->dataSize = item->height * stride;
+			// The encoded raster is bottom-up, the sheet top-down
+			for (row = 0; row < item->height; row++)
+				memcpy(buffer + record->dataOffset + (item->height - row - 1) * stride,
+					item->enc->image->pxl + row * rowBytes, rowBytes);
+			y += item->height;
+		}
+	}
+
+	*results = buffer;
+	*resultsSize = (dmtx_uint32_t) size;
+	*sheetWidth = width;
+	*sheetHeight = height;
+	*sheetStride = stride;
 	return DMTX_RETURN_OK;
 }
 
+DMTX_EXTERN unsigned char
+dmtx_encode_batch(const unsigned char *texts,
+			const dmtx_uint16_t *textSizes,
+			const dmtx_uint32_t count,
+			const dmtx_encode_options_t *options,
+			const dmtx_uint32_t format,
+			const dmtx_int16_t threads,
+			unsigned char **results,
+			dmtx_uint32_t *resultsSize,
+			dmtx_uint32_t *sheetWidth,
+			dmtx_uint32_t *sheetHeight,
+			dmtx_uint32_t *sheetStride,
+			dmtx_uint32_t *failedIndex)
+{
+	HANDLE workers[MAXIMUM_WAIT_OBJECTS];
+	dmtx_encode_job_t job;
+	dmtx_uint32_t *textOffsets;
+	dmtx_uint32_t i, offset = 0;
+	int threadCount = 1, started = 0, t;
+	unsigned char returncode = DMTX_RETURN_OK;
+
+	*results = NULL;
+	*resultsSize = 0;
+	*sheetWidth = *sheetHeight = *sheetStride = 0;
+	*failedIndex = 0;
+	if (count == 0) return DMTX_RETURN_OK;
+	if (texts == NULL || textSizes == NULL) return DMTX_RETURN_INVALID_ARGUMENT;
+	if (format != DMTX_BATCH_MODULES && format != DMTX_BATCH_SHEET)
+		return DMTX_RETURN_INVALID_ARGUMENT;
+	if (format == DMTX_BATCH_MODULES && options->mosaic)
+		return DMTX_RETURN_INVALID_ARGUMENT;
+
+	textOffsets = malloc(count * sizeof(dmtx_uint32_t));
+	if (textOffsets == NULL) return DMTX_RETURN_NO_MEMORY;
+	for (i = 0; i < count; i++) {
+		textOffsets[i] = offset;
+		offset += textSizes[i];
+	}
+
+	memset(&job, 0, sizeof(job));
+	job.texts = texts;
+	job.textSizes = textSizes;
+	job.textOffsets = textOffsets;
+	job.count = count;
+	job.options = options;
+	job.format = format;
+	job.items = calloc(count, sizeof(dmtx_encode_item_t));
+	if (job.items == NULL) {
+		free(textOffsets);
+		return DMTX_RETURN_NO_MEMORY;
+	}
+
+	if (threads == 0 || threads > 1)
+		threadCount = dmtx_thread_count(threads);
+	if ((dmtx_uint32_t) threadCount > count)
+		threadCount = (int) count;
+
+	for (started = 0; threadCount > 1 && started < threadCount; started++) {
+		workers[started] = (HANDLE) _beginthreadex(NULL, 0, dmtx_encode_worker, &job, 0, NULL);
+		if (workers[started] == 0)
+			break;
+	}
+	if (started > 0) {
+		WaitForMultipleObjects(started, workers, TRUE, INFINITE);
+		for (t = 0; t < started; t++)
+			CloseHandle(workers[t]);
+	}
+	// Also covers the serial case and any payloads left by threads that
+	// could not be started
+	dmtx_encode_worker(&job);
+
+	// Workers stop at the first failure, report the failed payload
+	for (i = 0; job.stop && i < count; i++) {
+		if (job.items[i].returncode != DMTX_RETURN_OK) {
+			returncode = job.items[i].returncode;
+			*failedIndex = i;
+			break;
+		}
+	}
+	if (returncode == DMTX_RETURN_OK)
+		returncode = dmtx_layout_encodes(&job, results, resultsSize,
+			sheetWidth, sheetHeight, sheetStride);
+
+	for (i = 0; i < count; i++) {
+		free(job.items[i].modules);
+		if (job.items[i].enc != NULL)
+			dmtxEncodeDestroy(&job.items[i].enc);
+	}
+	free(job.items);
+	free(textOffsets);
+
+	return returncode;
+}
+
 DMTX_EXTERN void
 dmtx_copy_encode_result(const DmtxEncode *enc,
 						const dmtx_uint32_t stride,
 						const unsigned char *bitmap)
 {
-	dmtx_uint32_t i;
 	dmtx_uint32_t width = dmtxImageGetProp(enc->image, DmtxPropWidth);
 	dmtx_uint32_t height = dmtxImageGetProp(enc->image, DmtxPropHeight);
 
-	for (i = 0; i < height; i++)
-		memcpy((void *) (bitmap + (height-i-1) * stride),
-		enc->image->pxl + i * 3 * width,
-		3 * width);
+	// Encoded rows are bottom-up (DmtxFlipY), bitmaps top-down
+	dmtxConvertRows((unsigned char *) bitmap, (int) stride, enc->image->pxl,
+		dmtxImageGetProp(enc->image, DmtxPropRowSizeBytes), (int) (3 * width),
+		(int) height, 1);
 }
 
 DMTX_EXTERN void
@@ -29,8 +29,31 @@ Contact: libdmtx@fernsroth.com
 #define DMTX_RETURN_NO_MEMORY         1
 #define DMTX_RETURN_INVALID_ARGUMENT  2
 #define DMTX_RETURN_ENCODE_ERROR      3
+#define DMTX_RETURN_CANCELLED         4
+#define DMTX_RETURN_FILE_ERROR        5
+
+#define DMTX_BATCH_MODULES            1
+#define DMTX_BATCH_SHEET              2
+
+#define DMTX_DIAGNOSE_OVERLAY         1
+
+#define DMTX_REGION_DECODED           0
+#define DMTX_REGION_UNREADABLE        1
+#define DMTX_REGION_DUPLICATE         2
+#define DMTX_REGION_CANDIDATE         3
+
+#define DMTX_FILE_AUTO                0
+#define DMTX_FILE_PNM                 1
+#define DMTX_FILE_TIFF                2
+#define DMTX_FILE_RAW                 3
+
+#define DMTX_PROFILE_DEFAULT          0
+#define DMTX_PROFILE_FIXED_SIZE_LABEL 1
+#define DMTX_PROFILE_DENSE_DOCUMENT   2
+#define DMTX_PROFILE_FAR_FIELD_CAMERA 3
 
 #include "dmtx.h"
+#include <wchar.h>
 
 #ifdef _MSC_VER
 typedef signed   __int32 dmtx_int32_t;
@@ -64,6 +87,9 @@ typedef struct dmtx_decode_options_t {
 	dmtx_int16_t correctionsMax;
 	dmtx_uint16_t mosaic;
 	dmtx_int16_t shrink;
+	dmtx_int16_t threads;      // > 1 (or 0 = one per CPU) decodes in tiles
+	dmtx_int16_t tileOverlap;  // pixels shared by neighbouring tiles
+	dmtx_int16_t pyramidShrink; // > 1 locates at this shrink, then decodes at shrink
 } dmtx_decode_options_t;
 
 typedef struct dmtx_encode_options_t {
@@ -111,6 +137,123 @@ typedef struct dmtx_decoded_t
 	dmtx_uint32_t dataSize;
 } dmtx_decoded_t;
 
+typedef struct dmtx_decoder_t dmtx_decoder_t;
+typedef struct dmtx_decode_job_t dmtx_decode_job_t;
+
+typedef struct dmtx_frame_t
+{
+	const void *rgb_image;
+	dmtx_uint32_t width;
+	dmtx_uint32_t height;
+	dmtx_uint32_t bitmapStride;
+	dmtx_uint32_t packing;
+} dmtx_frame_t;
+
+// Where dmtx_decode_file finds the pages of a file. PNM and TIFF files
+// describe their pages themselves and only need the format (or
+// DMTX_FILE_AUTO). Raw files hold frames of width by height pixels,
+// bitmapStride bytes per row, back to back after headerBytes of header.
+typedef struct dmtx_file_layout_t
+{
+	dmtx_uint32_t format;
+	dmtx_uint32_t width;
+	dmtx_uint32_t height;
+	dmtx_uint32_t bitmapStride;
+	dmtx_uint32_t packing;
+	dmtx_uint32_t headerBytes;
+} dmtx_file_layout_t;
+
+// Fixed size record of a decoded symbol in a flat result buffer. All
+// records come first; dataOffset is counted from the start of the buffer.
+typedef struct dmtx_result_record_t
+{
+	dmtx_uint32_t frameIndex;
+	dmtx_symbolinfo_t symbolInfo;
+	dmtx_corners_t corners;
+	dmtx_uint32_t dataOffset;
+	dmtx_uint32_t dataSize;
+} dmtx_result_record_t;
+
+// Fixed size record of one payload in a dmtx_encode_batch buffer. All
+// records come first; dataOffset is counted from the start of the buffer.
+// Module matrices are width (cols) by height (rows) modules packed as by
+// dmtx_encode_modules. Bitmaps are width by height pixels at (x, y) in
+// the sheet, dataOffset pointing at their top row.
+typedef struct dmtx_encode_record_t
+{
+	dmtx_symbolinfo_t symbolInfo;
+	dmtx_uint32_t x;
+	dmtx_uint32_t y;
+	dmtx_uint32_t width;
+	dmtx_uint32_t height;
+	dmtx_uint32_t dataOffset;
+	dmtx_uint32_t dataSize;
+} dmtx_encode_record_t;
+
+typedef struct dmtx_cache_stats_t
+{
+	dmtx_uint32_t hits;
+	dmtx_uint32_t misses;
+	dmtx_uint32_t entries;
+	dmtx_uint32_t bytes;
+	dmtx_uint32_t maxBytes;
+} dmtx_cache_stats_t;
+
+// Where the time of a decode went. Times are in microseconds and, for a
+// tiled decode, summed over the worker threads. A region is examined when
+// libdmtx finds a candidate symbol there and rejected when its message
+// then fails to decode. bytesCopied counts result bytes copied between
+// libdmtx's messages and the buffer handed back.
+typedef struct dmtx_decode_stats_t
+{
+	dmtx_uint32_t setupUsec;
+	dmtx_uint32_t searchUsec;
+	dmtx_uint32_t decodeUsec;
+	dmtx_uint32_t marshalUsec;
+	dmtx_uint32_t regionsExamined;
+	dmtx_uint32_t regionsRejected;
+	dmtx_uint32_t bytesCopied;
+} dmtx_decode_stats_t;
+
+// What the scan made of one candidate region, as collected by
+// dmtx_decode_diagnose. Points are image pixels with rows counted from the
+// top, like the corners of results. seed is the scan grid location the
+// region was grown from; edgeLeft and edgeBottom lie on the solid finder
+// edges, edgeTop and edgeRight on the alternating ones. status is
+// DMTX_REGION_DECODED, DMTX_REGION_UNREADABLE (the message failed to
+// decode), DMTX_REGION_DUPLICATE (already found from a neighbouring tile)
+// or DMTX_REGION_CANDIDATE (located on the shrunk image of a pyramid
+// scan, and decoded at full size by the records that follow it).
+typedef struct dmtx_region_record_t
+{
+	dmtx_corners_t corners;
+	dmtx_point_t seed;
+	dmtx_point_t edgeLeft;
+	dmtx_point_t edgeBottom;
+	dmtx_point_t edgeTop;
+	dmtx_point_t edgeRight;
+	dmtx_uint16_t rows;
+	dmtx_uint16_t cols;
+	dmtx_uint16_t status;
+	dmtx_int16_t polarity;  // +1 dark symbol on light, -1 the reverse
+	dmtx_uint32_t decodeUsec;
+} dmtx_region_record_t;
+
+// Start of a dmtx_decode_diagnose buffer. Offsets are counted from the
+// start of the buffer. The overlay, if asked for, is libdmtx's scan cache:
+// one byte per pixel of the image shrunk by the shrink option, top row
+// first. Bit 0x80 marks pixels the scan has visited (edge traces and the
+// area of decoded symbols), 0x40 edge pixels assigned to a region and the
+// low bits the directions of the trace.
+typedef struct dmtx_diagnostics_t
+{
+	dmtx_uint32_t regionCount;
+	dmtx_uint32_t regionOffset;
+	dmtx_uint32_t overlayWidth;
+	dmtx_uint32_t overlayHeight;
+	dmtx_uint32_t overlayOffset;
+} dmtx_diagnostics_t;
+
 typedef struct dmtx_encoded_t
 {
 	dmtx_symbolinfo_t symbolInfo;
@@ -129,12 +272,229 @@ dmtx_decode(const void *rgb_image,
 			const dmtx_uint32_t diagnosticStyle,
 			int(*callbackFunc)(dmtx_decoded_t *decode_result));
 
+// Same as dmtx_decode for pixels in any DmtxPackOrder layout, e.g.
+// DmtxPack8bppK or DmtxPack32bppBGRX, with rows bitmapStride bytes apart
+DMTX_EXTERN unsigned char
+dmtx_decode_pixels(const void *pixels,
+			const dmtx_uint32_t width,
+			const dmtx_uint32_t height,
+			const dmtx_uint32_t bitmapStride,
+			const dmtx_uint32_t packing,
+			const dmtx_decode_options_t *options,
+			void(*diagnoseFunc)(unsigned char *data, dmtx_uint32_t totalBytes, dmtx_uint32_t headerBytes),
+			const dmtx_uint32_t diagnosticStyle,
+			int(*callbackFunc)(dmtx_decoded_t *decode_result));
+
+// Same as dmtx_decode_pixels, but instead of calling back for every symbol
+// all results are written to one flat buffer of dmtx_result_record_t
+// records followed by their payloads. Free it with dmtx_free_results.
+// stats (may be NULL) receives the timings and counters of the decode.
+DMTX_EXTERN unsigned char
+dmtx_decode_results(const void *pixels,
+			const dmtx_uint32_t width,
+			const dmtx_uint32_t height,
+			const dmtx_uint32_t bitmapStride,
+			const dmtx_uint32_t packing,
+			const dmtx_decode_options_t *options,
+			void(*diagnoseFunc)(unsigned char *data, dmtx_uint32_t totalBytes, dmtx_uint32_t headerBytes),
+			const dmtx_uint32_t diagnosticStyle,
+			unsigned char **results,
+			dmtx_uint32_t *resultsSize,
+			dmtx_uint32_t *recordCount,
+			dmtx_decode_stats_t *stats);
+
+// Same as dmtx_decode_results, also returning a dmtx_diagnostics_t buffer
+// with a record for every candidate region the scan found and, with
+// DMTX_DIAGNOSE_OVERLAY in flags, the overlay. The records are collected
+// while scanning, so this costs little more than the decode itself. Free
+// both buffers with dmtx_free_results.
+DMTX_EXTERN unsigned char
+dmtx_decode_diagnose(const void *pixels,
+			const dmtx_uint32_t width,
+			const dmtx_uint32_t height,
+			const dmtx_uint32_t bitmapStride,
+			const dmtx_uint32_t packing,
+			const dmtx_decode_options_t *options,
+			const dmtx_uint32_t flags,
+			unsigned char **results,
+			dmtx_uint32_t *resultsSize,
+			dmtx_uint32_t *recordCount,
+			unsigned char **diagnostics,
+			dmtx_uint32_t *diagnosticsSize);
+
+// Starts decoding a copy of pixels on the system thread pool and returns
+// at once. doneFunc (may be NULL) is called from the pool thread when the
+// job has finished; dmtx_decode_end then waits for it if needed, returns
+// its results like dmtx_decode_results and frees the job. Every job must
+// be ended exactly once.
+DMTX_EXTERN unsigned char
+dmtx_decode_begin(const void *pixels,
+			const dmtx_uint32_t width,
+			const dmtx_uint32_t height,
+			const dmtx_uint32_t bitmapStride,
+			const dmtx_uint32_t packing,
+			const dmtx_decode_options_t *options,
+			void(*doneFunc)(void),
+			dmtx_decode_job_t **job);
+
+// Asks a running job to stop; the scan notices within a few milliseconds
+// and dmtx_decode_end returns DMTX_RETURN_CANCELLED without results.
+DMTX_EXTERN void
+dmtx_decode_cancel(dmtx_decode_job_t *job);
+
+DMTX_EXTERN unsigned char
+dmtx_decode_end(dmtx_decode_job_t *job,
+			unsigned char **results,
+			dmtx_uint32_t *resultsSize,
+			dmtx_uint32_t *recordCount);
+
+DMTX_EXTERN unsigned char
+dmtx_decoder_create(dmtx_decoder_t **decoder,
+			const dmtx_decode_options_t *options);
+
+DMTX_EXTERN unsigned char
+dmtx_decoder_decode(dmtx_decoder_t *decoder,
+			const void *rgb_image,
+			const dmtx_uint32_t width,
+			const dmtx_uint32_t height,
+			const dmtx_uint32_t bitmapStride,
+			const dmtx_uint32_t packing,
+			int(*callbackFunc)(dmtx_decoded_t *decode_result));
+
+DMTX_EXTERN unsigned char
+dmtx_decoder_decode_results(dmtx_decoder_t *decoder,
+			const void *rgb_image,
+			const dmtx_uint32_t width,
+			const dmtx_uint32_t height,
+			const dmtx_uint32_t bitmapStride,
+			const dmtx_uint32_t packing,
+			unsigned char **results,
+			dmtx_uint32_t *resultsSize,
+			dmtx_uint32_t *recordCount);
+
+// Like dmtx_decoder_decode_results, but scans the box around previous
+// (grown by padding pixels, or by half the symbol size if padding is
+// negative) first and only scans the whole frame if nothing decodes there.
+DMTX_EXTERN unsigned char
+dmtx_decoder_track(dmtx_decoder_t *decoder,
+			const void *rgb_image,
+			const dmtx_uint32_t width,
+			const dmtx_uint32_t height,
+			const dmtx_uint32_t bitmapStride,
+			const dmtx_uint32_t packing,
+			const dmtx_corners_t *previous,
+			const dmtx_int16_t padding,
+			unsigned char **results,
+			dmtx_uint32_t *resultsSize,
+			dmtx_uint32_t *recordCount);
+
+// Timings and counters of the decoder's last frame
+DMTX_EXTERN void
+dmtx_decoder_get_stats(const dmtx_decoder_t *decoder,
+			dmtx_decode_stats_t *stats);
+
+DMTX_EXTERN void
+dmtx_decoder_destroy(dmtx_decoder_t *decoder);
+
+DMTX_EXTERN unsigned char
+dmtx_decode_batch(const dmtx_frame_t *frames,
+			const dmtx_uint32_t frameCount,
+			const dmtx_decode_options_t *options,
+			unsigned char **results,
+			dmtx_uint32_t *resultsSize,
+			dmtx_uint32_t *recordCount);
+
+// Decodes every page of an uncompressed image file straight from a
+// read-only mapping of it: binary PGM/PPM (several images may follow each
+// other), baseline TIFF with uncompressed 8-bit strips, or raw frames.
+// Records carry the page index in frameIndex; pageCount is the number of
+// pages found, including those without symbols.
+DMTX_EXTERN unsigned char
+dmtx_decode_file(const wchar_t *path,
+			const dmtx_file_layout_t *layout,
+			const dmtx_decode_options_t *options,
+			unsigned char **results,
+			dmtx_uint32_t *resultsSize,
+			dmtx_uint32_t *recordCount,
+			dmtx_uint32_t *pageCount);
+
+// Sets the search options of a named profile (DMTX_PROFILE_*) in
+// options: sizeIdxExpected, edgeMin, edgeMax, scanGap, squareDevn,
+// edgeThresh and shrink. The other options are left as they are.
+DMTX_EXTERN unsigned char
+dmtx_decode_profile(const dmtx_int32_t profile,
+			dmtx_decode_options_t *options);
+
+// Narrows the search options of options to the tightest ones that still
+// decode every symbol found in the frames with libdmtx's defaults (see
+// dmtxProfileCalibrate), and times both over the frames. Search options
+// already set in options are tried first. Returns
+// DMTX_RETURN_INVALID_ARGUMENT if the frames hold no symbol.
+DMTX_EXTERN unsigned char
+dmtx_decode_calibrate(const dmtx_frame_t *frames,
+			const dmtx_uint32_t frameCount,
+			dmtx_decode_options_t *options,
+			dmtx_uint32_t *symbolCount,
+			double *defaultMS,
+			double *profileMS);
+
+DMTX_EXTERN void
+dmtx_free_results(unsigned char *results);
+
 DMTX_EXTERN unsigned char
 dmtx_encode(const void *plain_text,
 			const dmtx_uint16_t text_size,
 			dmtx_encoded_t **result,
 			const dmtx_encode_options_t *options);
 
+// Encodes plain_text and returns only its module matrix: symbolInfo.rows
+// rows of symbolInfo.cols bits (1 = dark), most significant bit first,
+// top row first, each row padded to a whole byte. Free the modules with
+// dmtx_free_results.
+DMTX_EXTERN unsigned char
+dmtx_encode_modules(const void *plain_text,
+			const dmtx_uint16_t text_size,
+			const dmtx_encode_options_t *options,
+			dmtx_symbolinfo_t *symbolInfo,
+			unsigned char **modules,
+			dmtx_uint32_t *modulesSize);
+
+// Encodes count payloads, stored back to back in texts, with the same
+// options on threads worker threads (0 = one per processor). format
+// DMTX_BATCH_MODULES returns one module matrix per payload,
+// DMTX_BATCH_SHEET one 24bpp RGB sheet (white background, rows
+// sheetStride bytes apart, top row first) with the bitmaps stacked from
+// top to bottom. Either way results holds count dmtx_encode_record_t
+// records followed by the data; free it with dmtx_free_results. If a
+// payload fails to encode, failedIndex tells which one and no results
+// are returned.
+DMTX_EXTERN unsigned char
+dmtx_encode_batch(const unsigned char *texts,
+			const dmtx_uint16_t *textSizes,
+			const dmtx_uint32_t count,
+			const dmtx_encode_options_t *options,
+			const dmtx_uint32_t format,
+			const dmtx_int16_t threads,
+			unsigned char **results,
+			dmtx_uint32_t *resultsSize,
+			dmtx_uint32_t *sheetWidth,
+			dmtx_uint32_t *sheetHeight,
+			dmtx_uint32_t *sheetStride,
+			dmtx_uint32_t *failedIndex);
+
+// Bounds the cache of finished encodes used by dmtx_encode and
+// dmtx_encode_modules to maxBytes, evicting the least recently used
+// entries. 0 (the default) disables the cache and frees its entries.
+DMTX_EXTERN void
+dmtx_encode_cache_set_limit(const dmtx_uint32_t maxBytes);
+
+// Frees all cached encodes and resets the hit and miss counters
+DMTX_EXTERN void
+dmtx_encode_cache_clear(void);
+
+DMTX_EXTERN void
+dmtx_encode_cache_stats(dmtx_cache_stats_t *stats);
+
 DMTX_EXTERN void
 dmtx_copy_encode_result(const DmtxEncode *enc,
 						const dmtx_uint32_t stride,
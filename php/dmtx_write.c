@@ -32,12 +32,23 @@
 #define PHP_DMTX_IMAGE_RES_NAME "Datamatrix Image"
 int le_dmtx_image;
 
-ZEND_DECLARE_MODULE_GLOBALS(dmtx)
+/* Formats of dmtx_getBitmap() */
+#define PHP_DMTX_FORMAT_RGB     0
+#define PHP_DMTX_FORMAT_MODULES 1
+#define PHP_DMTX_FORMAT_PNG     2
+
+/* Resource behind each dmtx_write() result; every image keeps its own
+   dmtx_getRow() cursor so several can be streamed at once */
+typedef struct {
+   DmtxEncode *enc;
+   long row_index;
+} php_dmtx_image;
 
 static function_entry dmtx_functions[] = {
    PHP_FE(dmtx_write, NULL)
    PHP_FE(dmtx_getRow, NULL)
    PHP_FE(dmtx_getSize, NULL)
+   PHP_FE(dmtx_getBitmap, NULL)
    {NULL, NULL, NULL}
 };
 
@@ -49,7 +60,7 @@ zend_module_entry dmtx_module_entry = {
    dmtx_functions,
    PHP_MINIT(dmtx),
    PHP_MSHUTDOWN(dmtx),
-   PHP_RINIT(dmtx),
+   NULL,
    NULL,
    NULL,
 #if ZEND_MODULE_API_NO >= 20010901
@@ -62,23 +73,16 @@ zend_module_entry dmtx_module_entry = {
 ZEND_GET_MODULE(dmtx)
 #endif
 
-static void php_dmtx_init_globals(zend_dmtx_globals *dmtx_globals)
-{
-}
-
-PHP_RINIT_FUNCTION(dmtx)
-{
-   DMTX_G(row_index) = 0;
-
-   return SUCCESS;
-}
-
 static void php_dmtx_image_dtor(zend_rsrc_list_entry *rsrc TSRMLS_DC)
 {
-   DmtxEncode *enc = (DmtxEncode *)rsrc->ptr;
+   php_dmtx_image *image = (php_dmtx_image *)rsrc->ptr;
 
-   if(enc != NULL)
-      dmtxEncodeDestroy(&enc);
+   if(image == NULL)
+      return;
+
+   if(image->enc != NULL)
+      dmtxEncodeDestroy(&image->enc);
+   efree(image);
 }
 
 PHP_MINIT_FUNCTION(dmtx)
@@ -86,7 +90,12 @@ PHP_MINIT_FUNCTION(dmtx)
    le_dmtx_image = zend_register_list_destructors_ex(php_dmtx_image_dtor, NULL,
          PHP_DMTX_IMAGE_RES_NAME, module_number);
 
-   ZEND_INIT_MODULE_GLOBALS(dmtx, php_dmtx_init_globals, NULL);
+   REGISTER_LONG_CONSTANT("DMTX_FORMAT_RGB", PHP_DMTX_FORMAT_RGB,
+         CONST_CS | CONST_PERSISTENT);
+   REGISTER_LONG_CONSTANT("DMTX_FORMAT_MODULES", PHP_DMTX_FORMAT_MODULES,
+         CONST_CS | CONST_PERSISTENT);
+   REGISTER_LONG_CONSTANT("DMTX_FORMAT_PNG", PHP_DMTX_FORMAT_PNG,
+         CONST_CS | CONST_PERSISTENT);
 
    return SUCCESS;
 }
@@ -100,8 +109,8 @@ PHP_FUNCTION(dmtx_write)
 {
    unsigned char *data;
    int data_len;
-   int i;
    DmtxEncode *enc;
+   php_dmtx_image *image;
 
    if(zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "s",
          &data, &data_len) == FAILURE)
@@ -113,48 +122,55 @@ PHP_FUNCTION(dmtx_write)
 
    dmtxEncodeDataMatrix(enc, data_len, data);
 
-   printf("ddd");
-   fflush(stdout);
+   image = emalloc(sizeof(php_dmtx_image));
+   image->enc = enc;
+   image->row_index = 0;
 
-   ZEND_REGISTER_RESOURCE(return_value, enc, le_dmtx_image);
+   ZEND_REGISTER_RESOURCE(return_value, image, le_dmtx_image);
 }
 
 PHP_FUNCTION(dmtx_getSize)
 {
+   php_dmtx_image *image;
    DmtxEncode *enc;
    zval *zImage;
 
    if(zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "r", &zImage) == FAILURE)
       RETURN_NULL();
 
-   ZEND_FETCH_RESOURCE(enc, DmtxEncode *, &zImage, -1, PHP_DMTX_IMAGE_RES_NAME, le_dmtx_image);
+   ZEND_FETCH_RESOURCE(image, php_dmtx_image *, &zImage, -1, PHP_DMTX_IMAGE_RES_NAME, le_dmtx_image);
+   enc = image->enc;
 
    array_init(return_value);
    add_assoc_long(return_value, "width", enc->image->width);
    add_assoc_long(return_value, "height", enc->image->height);
+   add_assoc_long(return_value, "rows", dmtxGetSymbolAttribute(
+         DmtxSymAttribSymbolRows, enc->region.sizeIdx));
+   add_assoc_long(return_value, "cols", dmtxGetSymbolAttribute(
+         DmtxSymAttribSymbolCols, enc->region.sizeIdx));
 }
 
 PHP_FUNCTION(dmtx_getRow)
 {
    int i;
    zval *zImage;
-   DmtxEncode *enc;
+   php_dmtx_image *image;
    DmtxImage *img;
 
    if(zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "r", &zImage) == FAILURE)
       RETURN_NULL();
 
-   ZEND_FETCH_RESOURCE(enc, DmtxEncode *, &zImage, -1, PHP_DMTX_IMAGE_RES_NAME, le_dmtx_image);
-   img = enc->image;
+   ZEND_FETCH_RESOURCE(image, php_dmtx_image *, &zImage, -1, PHP_DMTX_IMAGE_RES_NAME, le_dmtx_image);
+   img = image->enc->image;
 
-   if(DMTX_G(row_index) >= img->height)
+   if(image->row_index >= img->height)
       RETURN_NULL();
 
    array_init(return_value);
 
    for(i = 0; i < img->width; i++) {
 
-      int pos = (DMTX_G(row_index) * img->width) + i;
+      int pos = (image->row_index * img->width) + i;
       zval *arr;
 
       ALLOC_INIT_ZVAL(arr);
@@ -167,5 +183,201 @@ PHP_FUNCTION(dmtx_getRow)
       add_next_index_zval(return_value, arr);
    }
 
-   DMTX_G(row_index)++;
+   image->row_index++;
+}
+
+/* Copy the rendered image as packed 24 bit RGB rows, top row first */
+static char *php_dmtx_copy_rgb(DmtxImage *img, int *len)
+{
+   int y, row_bytes = img->width * 3;
+   char *buf;
+
+   *len = row_bytes * img->height;
+   buf = emalloc(*len + 1);
+
+   for(y = 0; y < img->height; y++)
+      memcpy(buf + y * row_bytes, img->pxl + y * img->rowSizeBytes, row_bytes);
+   buf[*len] = '\0';
+
+   return buf;
+}
+
+/* Pack the symbol's modules one bit each (1 = dark), most significant bit
+   first. Rows start on a byte boundary, top row first. */
+static char *php_dmtx_pack_modules(DmtxEncode *enc, int *len)
+{
+   int rows, cols, row_bytes, row, col;
+   unsigned char *buf;
+
+   rows = dmtxGetSymbolAttribute(DmtxSymAttribSymbolRows, enc->region.sizeIdx);
+   cols = dmtxGetSymbolAttribute(DmtxSymAttribSymbolCols, enc->region.sizeIdx);
+   row_bytes = (cols + 7) / 8;
+
+   *len = row_bytes * rows;
+   buf = ecalloc(*len + 1, 1);
+
+   /* libdmtx counts symbol rows from the bottom */
+   for(row = 0; row < rows; row++) {
+      unsigned char *out = buf + (rows - 1 - row) * row_bytes;
+
+      for(col = 0; col < cols; col++) {
+         if(dmtxSymbolModuleStatus(enc->message, enc->region.sizeIdx, row, col) & DmtxModuleOnRGB)
+            out[col >> 3] |= 0x80 >> (col & 7);
+      }
+   }
+
+   return (char *)buf;
+}
+
+static unsigned long php_dmtx_crc32(unsigned long crc, const unsigned char *buf, int len)
+{
+   int i, k;
+
+   crc = ~crc & 0xffffffffUL;
+   for(i = 0; i < len; i++) {
+      crc ^= buf[i];
+      for(k = 0; k < 8; k++)
+         crc = (crc >> 1) ^ (0xedb88320UL & (0UL - (crc & 1)));
+   }
+
+   return ~crc & 0xffffffffUL;
+}
+
+static unsigned char *php_dmtx_put32(unsigned char *p, unsigned long v)
+{
+   p[0] = (unsigned char)(v >> 24);
+   p[1] = (unsigned char)(v >> 16);
+   p[2] = (unsigned char)(v >> 8);
+   p[3] = (unsigned char)v;
+
+   return p + 4;
+}
+
+/* Write a PNG chunk whose data is already in place after its length and
+   type; returns the end of the chunk */
+static unsigned char *php_dmtx_end_chunk(unsigned char *chunk, int data_len)
+{
+   unsigned char *crc = chunk + 8 + data_len;
+
+   php_dmtx_put32(chunk, data_len);
+
+   return php_dmtx_put32(crc, php_dmtx_crc32(0, chunk + 4, data_len + 4));
+}
+
+/* Render the image as a 1 bit grayscale PNG. The encoder only draws black
+   and white, so nothing is lost, and the pixel data is stored in
+   uncompressed deflate blocks so no zlib is needed. */
+static char *php_dmtx_write_png(DmtxImage *img, int *len)
+{
+   static const unsigned char signature[8] = { 137, 'P', 'N', 'G', '\r', '\n', 26, '\n' };
+   int line_bytes, raw_len, blocks, idat_len, done, x, y;
+   unsigned long s1 = 1, s2 = 0;
+   unsigned char *buf, *raw, *p, *chunk;
+
+   line_bytes = 1 + (img->width + 7) / 8;
+   raw_len = line_bytes * img->height;
+   blocks = (raw_len + 65534) / 65535;
+   if(blocks == 0)
+      blocks = 1;
+   idat_len = 2 + raw_len + 5 * blocks + 4;
+
+   *len = 8 + (12 + 13) + (12 + idat_len) + 12;
+   buf = emalloc(*len + 1);
+   p = buf;
+
+   memcpy(p, signature, 8);
+   p += 8;
+
+   /* IHDR: bit depth 1, grayscale, default compression/filter/interlace */
+   chunk = p;
+   memcpy(chunk + 4, "IHDR", 4);
+   p = php_dmtx_put32(chunk + 8, img->width);
+   p = php_dmtx_put32(p, img->height);
+   p[0] = 1; p[1] = 0; p[2] = 0; p[3] = 0; p[4] = 0;
+   p = php_dmtx_end_chunk(chunk, 13);
+
+   /* IDAT: zlib stream of stored blocks, each scanline with filter 0 */
+   chunk = p;
+   memcpy(chunk + 4, "IDAT", 4);
+   p = chunk + 8;
+   *p++ = 0x78;
+   *p++ = 0x01;
+
+   /* The scanlines are generated first, then cut into stored blocks */
+   raw = emalloc(raw_len + 1);
+   for(y = 0; y < img->height; y++) {
+      unsigned char *line = raw + y * line_bytes;
+      const unsigned char *pxl = img->pxl + y * img->rowSizeBytes;
+
+      memset(line, 0, line_bytes);
+      for(x = 0; x < img->width; x++) {
+         /* 1 = white in a grayscale PNG */
+         if(pxl[x * img->bytesPerPixel] >= 128)
+            line[1 + (x >> 3)] |= 0x80 >> (x & 7);
+      }
+   }
+
+   done = 0;
+   do {
+      int size = (raw_len - done > 65535) ? 65535 : raw_len - done;
+
+      *p++ = (done + size == raw_len) ? 1 : 0;
+      *p++ = (unsigned char)size;
+      *p++ = (unsigned char)(size >> 8);
+      *p++ = (unsigned char)~size;
+      *p++ = (unsigned char)(~size >> 8);
+      memcpy(p, raw + done, size);
+      p += size;
+      done += size;
+   } while(done < raw_len);
+
+   for(x = 0; x < raw_len; x++) {
+      s1 = (s1 + raw[x]) % 65521;
+      s2 = (s2 + s1) % 65521;
+   }
+   efree(raw);
+
+   p = php_dmtx_put32(p, (s2 << 16) | s1);
+   p = php_dmtx_end_chunk(chunk, idat_len);
+
+   chunk = p;
+   memcpy(chunk + 4, "IEND", 4);
+   php_dmtx_end_chunk(chunk, 0);
+
+   buf[*len] = '\0';
+   return (char *)buf;
+}
+
+/* dmtx_getBitmap($image [, $format = DMTX_FORMAT_RGB]) returns the whole
+   image as one binary string: packed RGB rows, the 1 bit module matrix
+   (see dmtx_getSize() for rows/cols) or a PNG file */
+PHP_FUNCTION(dmtx_getBitmap)
+{
+   zval *zImage;
+   long format = PHP_DMTX_FORMAT_RGB;
+   php_dmtx_image *image;
+   char *buf;
+   int len;
+
+   if(zend_parse_parameters(ZEND_NUM_ARGS() TSRMLS_CC, "r|l", &zImage, &format) == FAILURE)
+      RETURN_NULL();
+
+   ZEND_FETCH_RESOURCE(image, php_dmtx_image *, &zImage, -1, PHP_DMTX_IMAGE_RES_NAME, le_dmtx_image);
+
+   switch(format) {
+      case PHP_DMTX_FORMAT_RGB:
+         buf = php_dmtx_copy_rgb(image->enc->image, &len);
+         break;
+      case PHP_DMTX_FORMAT_MODULES:
+         buf = php_dmtx_pack_modules(image->enc, &len);
+         break;
+      case PHP_DMTX_FORMAT_PNG:
+         buf = php_dmtx_write_png(image->enc->image, &len);
+         break;
+      default:
+         php_error_docref(NULL TSRMLS_CC, E_WARNING, "Unknown bitmap format %ld", format);
+         RETURN_FALSE;
+   }
+
+   RETURN_STRINGL(buf, len, 0);
 }
@@ -0,0 +1,603 @@
+/*
+libdmtx wrappers - decode profiles shared by the wrappers
+
+Copyright (C) 2009 Mike Laughton
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+Contact: mike@dragonflylogic.com
+*/
+
+/* $Id$ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/time.h>
+#endif
+#include <dmtx.h>
+#include "dmtxprofile.h"
+
+/* Each sample is decoded this often when timing a profile; the fastest
+   round counts, which keeps other work on the machine out of the result */
+#define DMTX_PROFILE_ROUNDS     3
+
+/* Room left around the edge lengths and angles seen in the samples */
+#define DMTX_PROFILE_EDGE_BELOW 0.8
+#define DMTX_PROFILE_EDGE_ABOVE 1.25
+#define DMTX_PROFILE_DEVN_ROOM  5
+
+/* libdmtx accepts corners up to 50 degrees off square by default */
+#define DMTX_PROFILE_DEVN_MAX   50
+
+/* Shrunk images keep at least this many pixels per module */
+#define DMTX_PROFILE_MODULE_MIN 3
+#define DMTX_PROFILE_SHRINK_MAX 4
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/* Message of a symbol found in a sample */
+typedef struct {
+   int sample;
+   int length;
+   unsigned char *output;
+} ProfileSymbol;
+
+/* Symbols found in the samples and what they looked like, in pixels of
+   the full size image */
+typedef struct {
+   ProfileSymbol *symbols;
+   int count;
+   int capacity;
+   int sizeIdx;           /* shared by all symbols, DmtxUndefined if not */
+   int squareCount;
+   int rectCount;
+   double edgeMin;
+   double edgeMax;
+   double moduleMin;
+   double devnMax;
+} ProfileFound;
+
+static const char *profileNames[] = {
+   "default",
+   "fixed_size_label",
+   "dense_document",
+   "far_field_camera"
+};
+
+static double ProfileClock(void);
+static int ProfileDecode(DmtxImage *img, const DmtxProfile *profile,
+      int timeoutMs, int sample, ProfileFound *found);
+static DmtxPassFail ProfileRecord(ProfileFound *found, int sample,
+      DmtxMessage *msg, DmtxRegion *reg, int scale);
+static void ProfileFoundFree(ProfileFound *found);
+static int ProfileVerify(DmtxImage **samples, int sampleCount,
+      const DmtxProfile *profile, int timeoutMs, const ProfileFound *reference);
+static double ProfileTime(DmtxImage **samples, int sampleCount,
+      const DmtxProfile *profile, int timeoutMs);
+static void ProfileTighten(DmtxProfile *profile, const DmtxProfile *start,
+      const ProfileFound *found);
+static DmtxPassFail ProfileRelax(DmtxProfile *profile);
+
+/**
+ * Fill profile with the settings of a named profile. Fixed size labels
+ * still need their sizeIdxExpected set by the caller.
+ */
+extern DmtxPassFail
+dmtxProfileInit(DmtxProfile *profile, int name)
+{
+   if(profile == NULL)
+      return DmtxFail;
+
+   profile->sizeIdxExpected = DmtxSymbolShapeAuto;
+   profile->edgeMin = DmtxUndefined;
+   profile->edgeMax = DmtxUndefined;
+   profile->scanGap = DmtxUndefined;
+   profile->squareDevn = DmtxUndefined;
+   profile->edgeThresh = DmtxUndefined;
+   profile->shrink = DmtxUndefined;
+
+   switch(name) {
+      case DmtxProfileDefault:
+         break;
+      case DmtxProfileFixedSizeLabel:
+         /* Printed labels passing a fixed camera: crisp, seen head-on */
+         profile->scanGap = 2;
+         profile->squareDevn = 15;
+         profile->edgeThresh = 20;
+         break;
+      case DmtxProfileDenseDocument:
+         /* Many small symbols on a flat scan */
+         profile->squareDevn = 10;
+         profile->edgeThresh = 20;
+         break;
+      case DmtxProfileFarFieldCamera:
+         /* Small, soft symbols at an angle in a large frame */
+         profile->edgeMax = 100;
+         profile->edgeThresh = 5;
+         break;
+      default:
+         return DmtxFail;
+   }
+
+   return DmtxPass;
+}
+
+/**
+ * Identifier of a named profile ("fixed_size_label" ...), or NULL
+ */
+extern const char *
+dmtxProfileName(int name)
+{
+   if(name < DmtxProfileDefault || name > DmtxProfileFarFieldCamera)
+      return NULL;
+
+   return profileNames[name];
+}
+
+/**
+ * Named profile of an identifier returned by dmtxProfileName(), or
+ * DmtxUndefined
+ */
+extern int
+dmtxProfileLookup(const char *name)
+{
+   int i;
+
+   for(i = DmtxProfileDefault; name != NULL && i <= DmtxProfileFarFieldCamera; i++) {
+      if(strcmp(name, profileNames[i]) == 0)
+         return i;
+   }
+
+   return DmtxUndefined;
+}
+
+/**
+ * Shrink to pass to dmtxDecodeCreate() for profile
+ */
+extern int
+dmtxProfileGetShrink(const DmtxProfile *profile)
+{
+   return (profile != NULL && profile->shrink > 1) ? profile->shrink : 1;
+}
+
+/**
+ * Set the search properties of profile on dec, which should have been
+ * created with dmtxProfileGetShrink(profile)
+ */
+extern DmtxPassFail
+dmtxProfileApply(DmtxDecode *dec, const DmtxProfile *profile)
+{
+   if(dec == NULL || profile == NULL)
+      return DmtxFail;
+
+   if(profile->edgeMin != DmtxUndefined &&
+         dmtxDecodeSetProp(dec, DmtxPropEdgeMin, profile->edgeMin) != DmtxPass)
+      return DmtxFail;
+   if(profile->edgeMax != DmtxUndefined &&
+         dmtxDecodeSetProp(dec, DmtxPropEdgeMax, profile->edgeMax) != DmtxPass)
+      return DmtxFail;
+   if(profile->scanGap != DmtxUndefined &&
+         dmtxDecodeSetProp(dec, DmtxPropScanGap, profile->scanGap) != DmtxPass)
+      return DmtxFail;
+   if(profile->squareDevn != DmtxUndefined &&
+         dmtxDecodeSetProp(dec, DmtxPropSquareDevn, profile->squareDevn) != DmtxPass)
+      return DmtxFail;
+   if(profile->sizeIdxExpected != DmtxSymbolShapeAuto &&
+         dmtxDecodeSetProp(dec, DmtxPropSymbolSize, profile->sizeIdxExpected) != DmtxPass)
+      return DmtxFail;
+   if(profile->edgeThresh != DmtxUndefined &&
+         dmtxDecodeSetProp(dec, DmtxPropEdgeThresh, profile->edgeThresh) != DmtxPass)
+      return DmtxFail;
+
+   return DmtxPass;
+}
+
+/**
+ * Find the tightest profile that still decodes every symbol the defaults
+ * find in the samples, and time both. Settings of start other than
+ * DmtxUndefined (e.g. a known symbol size, or the shrink of a wrapper that
+ * cannot shrink) are tried as they are; the others are derived from the
+ * symbols found. Settings are then loosened one at a time, shrink first,
+ * until all symbols decode again. start may be NULL. Fails if no symbol is
+ * found or memory runs out.
+ */
+extern DmtxPassFail
+dmtxProfileCalibrate(DmtxCalibration *calib, DmtxImage **samples,
+      int sampleCount, const DmtxProfile *start, int timeoutMs)
+{
+   int i, passed;
+   DmtxProfile defaults, candidate;
+   ProfileFound reference;
+
+   if(calib == NULL || samples == NULL || sampleCount < 1)
+      return DmtxFail;
+
+   memset(calib, 0x00, sizeof(DmtxCalibration));
+   memset(&reference, 0x00, sizeof(ProfileFound));
+   reference.sizeIdx = DmtxUndefined;
+   dmtxProfileInit(&defaults, DmtxProfileDefault);
+
+   for(i = 0; i < sampleCount; i++) {
+      if(ProfileDecode(samples[i], &defaults, timeoutMs, i, &reference) < 0) {
+         ProfileFoundFree(&reference);
+         return DmtxFail;
+      }
+   }
+
+   if(reference.count == 0) {
+      ProfileFoundFree(&reference);
+      return DmtxFail;
+   }
+
+   ProfileTighten(&candidate, start, &reference);
+   for(;;) {
+      passed = ProfileVerify(samples, sampleCount, &candidate, timeoutMs, &reference);
+      if(passed < 0) {
+         ProfileFoundFree(&reference);
+         return DmtxFail;
+      }
+
+      /* The defaults are what the reference was found with, so the loop
+         ends there at the latest */
+      if(passed == 1 || ProfileRelax(&candidate) == DmtxFail)
+         break;
+   }
+
+   calib->profile = candidate;
+   calib->symbolCount = reference.count;
+   calib->defaultMs = ProfileTime(samples, sampleCount, &defaults, timeoutMs);
+   calib->profileMs = ProfileTime(samples, sampleCount, &candidate, timeoutMs);
+   calib->speedup = (calib->profileMs > 0.0) ? calib->defaultMs / calib->profileMs : 1.0;
+
+   ProfileFoundFree(&reference);
+
+   return DmtxPass;
+}
+
+/**
+ * Milliseconds from an arbitrary start, finer than dmtxTimeNow() on Windows
+ */
+static double
+ProfileClock(void)
+{
+#ifdef _WIN32
+   LARGE_INTEGER now, frequency;
+
+   QueryPerformanceCounter(&now);
+   QueryPerformanceFrequency(&frequency);
+   return (double)now.QuadPart * 1000.0 / (double)frequency.QuadPart;
+#else
+   struct timeval now;
+
+   gettimeofday(&now, NULL);
+   return (double)now.tv_sec * 1000.0 + (double)now.tv_usec / 1000.0;
+#endif
+}
+
+/**
+ * Decode every symbol of img with profile, adding them to found if not
+ * NULL. Returns the number of symbols decoded, or -1 if memory ran out.
+ */
+static int
+ProfileDecode(DmtxImage *img, const DmtxProfile *profile, int timeoutMs,
+      int sample, ProfileFound *found)
+{
+   int count = 0;
+   DmtxDecode *dec;
+   DmtxRegion *reg;
+   DmtxMessage *msg;
+   DmtxTime timeout;
+
+   dec = dmtxDecodeCreate(img, dmtxProfileGetShrink(profile));
+   if(dec == NULL)
+      return -1;
+
+   /* Settings libdmtx refuses make a profile that decodes nothing */
+   if(dmtxProfileApply(dec, profile) != DmtxPass) {
+      dmtxDecodeDestroy(&dec);
+      return 0;
+   }
+
+   if(timeoutMs != DmtxUndefined)
+      timeout = dmtxTimeAdd(dmtxTimeNow(), timeoutMs);
+
+   while((reg = dmtxRegionFindNext(dec, (timeoutMs != DmtxUndefined) ?
+         &timeout : NULL)) != NULL) {
+      msg = dmtxDecodeMatrixRegion(dec, reg, DmtxUndefined);
+      if(msg != NULL) {
+         if(found != NULL && ProfileRecord(found, sample, msg, reg,
+               dmtxProfileGetShrink(profile)) != DmtxPass)
+            count = -1;
+         else
+            count++;
+         dmtxMessageDestroy(&msg);
+      }
+      dmtxRegionDestroy(&reg);
+      if(count < 0)
+         break;
+   }
+
+   dmtxDecodeDestroy(&dec);
+
+   return count;
+}
+
+/**
+ * Keep the message of a decoded region and add its geometry to found
+ */
+static DmtxPassFail
+ProfileRecord(ProfileFound *found, int sample, DmtxMessage *msg,
+      DmtxRegion *reg, int scale)
+{
+   int i, rows, cols;
+   double len, cosine, devn;
+   DmtxVector2 p[4], side[4];
+   ProfileSymbol *symbol, *symbols;
+
+   if(found->count == found->capacity) {
+      symbols = (ProfileSymbol *)realloc(found->symbols,
+            (found->capacity + 16) * sizeof(ProfileSymbol));
+      if(symbols == NULL)
+         return DmtxFail;
+      found->symbols = symbols;
+      found->capacity += 16;
+   }
+
+   symbol = &found->symbols[found->count];
+   symbol->output = (unsigned char *)malloc(msg->outputIdx + 1);
+   if(symbol->output == NULL)
+      return DmtxFail;
+   memcpy(symbol->output, msg->output, msg->outputIdx);
+   symbol->length = msg->outputIdx;
+   symbol->sample = sample;
+
+   if(found->count == 0)
+      found->sizeIdx = reg->sizeIdx;
+   else if(found->sizeIdx != reg->sizeIdx)
+      found->sizeIdx = DmtxUndefined;
+   if(reg->sizeIdx < DmtxSymbolSquareCount)
+      found->squareCount++;
+   else
+      found->rectCount++;
+
+   /* Corners in full size pixels, anti-clockwise from the origin */
+   p[0].X = p[0].Y = p[1].Y = p[3].X = 0.0;
+   p[1].X = p[3].Y = p[2].X = p[2].Y = 1.0;
+   for(i = 0; i < 4; i++) {
+      dmtxMatrix3VMultiplyBy(&p[i], reg->fit2raw);
+      p[i].X *= scale;
+      p[i].Y *= scale;
+   }
+
+   /* Sides 0 and 2 run along the columns, 1 and 3 along the rows */
+   rows = dmtxGetSymbolAttribute(DmtxSymAttribSymbolRows, reg->sizeIdx);
+   cols = dmtxGetSymbolAttribute(DmtxSymAttribSymbolCols, reg->sizeIdx);
+   for(i = 0; i < 4; i++) {
+      side[i].X = p[(i + 1) % 4].X - p[i].X;
+      side[i].Y = p[(i + 1) % 4].Y - p[i].Y;
+      len = sqrt(side[i].X * side[i].X + side[i].Y * side[i].Y);
+
+      if(found->count == 0 && i == 0)
+         found->edgeMin = found->edgeMax = len;
+      if(len < found->edgeMin)
+         found->edgeMin = len;
+      if(len > found->edgeMax)
+         found->edgeMax = len;
+
+      len /= (i % 2 == 0) ? cols : rows;
+      if((found->count == 0 && i == 0) || len < found->moduleMin)
+         found->moduleMin = len;
+   }
+
+   /* How far each corner is from a right angle */
+   for(i = 0; i < 4; i++) {
+      len = sqrt((side[i].X * side[i].X + side[i].Y * side[i].Y) *
+            (side[(i + 3) % 4].X * side[(i + 3) % 4].X +
+            side[(i + 3) % 4].Y * side[(i + 3) % 4].Y));
+      if(len <= 0.0)
+         continue;
+      cosine = (side[i].X * side[(i + 3) % 4].X + side[i].Y * side[(i + 3) % 4].Y) / len;
+      devn = fabs(asin(cosine > 1.0 ? 1.0 : (cosine < -1.0 ? -1.0 : cosine))) * 180.0 / M_PI;
+      if(devn > found->devnMax)
+         found->devnMax = devn;
+   }
+
+   found->count++;
+
+   return DmtxPass;
+}
+
+static void
+ProfileFoundFree(ProfileFound *found)
+{
+   int i;
+
+   for(i = 0; i < found->count; i++)
+      free(found->symbols[i].output);
+   free(found->symbols);
+   memset(found, 0x00, sizeof(ProfileFound));
+}
+
+/**
+ * Returns 1 if profile decodes every symbol of reference in its sample, 0
+ * if not and -1 if memory ran out
+ */
+static int
+ProfileVerify(DmtxImage **samples, int sampleCount,
+      const DmtxProfile *profile, int timeoutMs, const ProfileFound *reference)
+{
+   int i, j, k, passed = 1;
+   char *used;
+   ProfileFound found;
+   const ProfileSymbol *want, *have;
+
+   for(i = 0; i < sampleCount && passed == 1; i++) {
+      memset(&found, 0x00, sizeof(ProfileFound));
+      if(ProfileDecode(samples[i], profile, timeoutMs, i, &found) < 0) {
+         ProfileFoundFree(&found);
+         return -1;
+      }
+
+      used = (char *)calloc(found.count + 1, 1);
+      if(used == NULL) {
+         ProfileFoundFree(&found);
+         return -1;
+      }
+
+      /* Each symbol of the reference needs a symbol of its own */
+      for(j = 0; j < reference->count && passed == 1; j++) {
+         want = &reference->symbols[j];
+         if(want->sample != i)
+            continue;
+         for(k = 0; k < found.count; k++) {
+            have = &found.symbols[k];
+            if(!used[k] && have->length == want->length &&
+                  memcmp(have->output, want->output, want->length) == 0)
+               break;
+         }
+         if(k == found.count)
+            passed = 0;
+         else
+            used[k] = 1;
+      }
+
+      free(used);
+      ProfileFoundFree(&found);
+   }
+
+   return passed;
+}
+
+/**
+ * Milliseconds profile takes to decode all samples
+ */
+static double
+ProfileTime(DmtxImage **samples, int sampleCount, const DmtxProfile *profile,
+      int timeoutMs)
+{
+   int i, round;
+   double start, elapsed, best, total = 0.0;
+
+   for(i = 0; i < sampleCount; i++) {
+      best = -1.0;
+      for(round = 0; round < DMTX_PROFILE_ROUNDS; round++) {
+         start = ProfileClock();
+         ProfileDecode(samples[i], profile, timeoutMs, i, NULL);
+         elapsed = ProfileClock() - start;
+         if(best < 0.0 || elapsed < best)
+            best = elapsed;
+      }
+      total += best;
+   }
+
+   return total;
+}
+
+/**
+ * First candidate of a calibration: the settings of start where given,
+ * otherwise the tightest ones the symbols found allow
+ */
+static void
+ProfileTighten(DmtxProfile *profile, const DmtxProfile *start,
+      const ProfileFound *found)
+{
+   int shrink, devn;
+
+   dmtxProfileInit(profile, DmtxProfileDefault);
+   if(start != NULL)
+      *profile = *start;
+
+   if(profile->sizeIdxExpected == DmtxSymbolShapeAuto) {
+      if(found->sizeIdx != DmtxUndefined)
+         profile->sizeIdxExpected = found->sizeIdx;
+      else if(found->rectCount == 0)
+         profile->sizeIdxExpected = DmtxSymbolSquareAuto;
+      else if(found->squareCount == 0)
+         profile->sizeIdxExpected = DmtxSymbolRectAuto;
+   }
+
+   if(profile->shrink == DmtxUndefined) {
+      shrink = (int)(found->moduleMin / DMTX_PROFILE_MODULE_MIN);
+      if(shrink > DMTX_PROFILE_SHRINK_MAX)
+         shrink = DMTX_PROFILE_SHRINK_MAX;
+      profile->shrink = (shrink > 1) ? shrink : DmtxUndefined;
+   }
+   shrink = dmtxProfileGetShrink(profile);
+
+   if(profile->edgeMin == DmtxUndefined)
+      profile->edgeMin = (int)(found->edgeMin * DMTX_PROFILE_EDGE_BELOW / shrink);
+   if(profile->edgeMax == DmtxUndefined)
+      profile->edgeMax = (int)ceil(found->edgeMax * DMTX_PROFILE_EDGE_ABOVE / shrink);
+
+   /* A scan line every quarter of the smallest symbol still crosses it */
+   if(profile->scanGap == DmtxUndefined && found->edgeMin >= 8.0)
+      profile->scanGap = (int)(found->edgeMin / 4.0);
+
+   if(profile->squareDevn == DmtxUndefined) {
+      devn = (int)ceil(found->devnMax) + DMTX_PROFILE_DEVN_ROOM;
+      if(devn < DMTX_PROFILE_DEVN_MAX)
+         profile->squareDevn = devn;
+   }
+}
+
+/**
+ * Loosen the setting of profile most likely to lose symbols. Fails once
+ * profile is back at the defaults.
+ */
+static DmtxPassFail
+ProfileRelax(DmtxProfile *profile)
+{
+   int shrink;
+
+   if(profile->shrink > 1) {
+      /* Edge lengths are counted in pixels of the shrunk image */
+      shrink = profile->shrink / 2;
+      if(profile->edgeMin != DmtxUndefined)
+         profile->edgeMin = profile->edgeMin * profile->shrink / shrink;
+      if(profile->edgeMax != DmtxUndefined)
+         profile->edgeMax = profile->edgeMax * profile->shrink / shrink;
+      profile->shrink = (shrink > 1) ? shrink : DmtxUndefined;
+   }
+   else if(profile->scanGap > 1) {
+      profile->scanGap /= 2;
+   }
+   else if(profile->scanGap != DmtxUndefined) {
+      profile->scanGap = DmtxUndefined;
+   }
+   else if(profile->edgeThresh != DmtxUndefined) {
+      profile->edgeThresh = DmtxUndefined;
+   }
+   else if(profile->squareDevn != DmtxUndefined) {
+      profile->squareDevn = DmtxUndefined;
+   }
+   else if(profile->edgeMin != DmtxUndefined || profile->edgeMax != DmtxUndefined) {
+      profile->edgeMin = DmtxUndefined;
+      profile->edgeMax = DmtxUndefined;
+   }
+   else if(profile->sizeIdxExpected != DmtxSymbolShapeAuto) {
+      profile->sizeIdxExpected = DmtxSymbolShapeAuto;
+   }
+   else {
+      return DmtxFail;
+   }
+
+   return DmtxPass;
+}
@@ -0,0 +1,85 @@
+/*
+libdmtx wrappers - decode profiles shared by the wrappers
+
+Copyright (C) 2009 Mike Laughton
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+Contact: mike@dragonflylogic.com
+*/
+
+/* $Id$ */
+
+/**
+ * A profile bundles the search properties of a decode: the expected symbol
+ * size, the edge length range, the scan gap, the allowed deviation from
+ * square, the edge threshold and the shrink. Fields left at DmtxUndefined
+ * keep libdmtx's defaults.
+ *
+ * The named profiles are starting points for typical setups. A profile
+ * can also be calibrated against sample images: the tightest settings
+ * that still decode every symbol found in them with the defaults are kept,
+ * and the time of both is measured.
+ */
+
+#ifndef __DMTXPROFILE_H__
+#define __DMTXPROFILE_H__
+
+#include <dmtx.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+   DmtxProfileDefault,
+   DmtxProfileFixedSizeLabel,
+   DmtxProfileDenseDocument,
+   DmtxProfileFarFieldCamera
+} DmtxProfileName;
+
+typedef struct DmtxProfile_struct {
+   int sizeIdxExpected;  /* one symbol size, or DmtxSymbol[Shape|Square|Rect]Auto */
+   int edgeMin;          /* in pixels of the shrunk image */
+   int edgeMax;
+   int scanGap;          /* in pixels of the image */
+   int squareDevn;       /* in degrees */
+   int edgeThresh;
+   int shrink;           /* DmtxUndefined decodes at full size */
+} DmtxProfile;
+
+typedef struct DmtxCalibration_struct {
+   DmtxProfile profile;  /* the tightest profile decoding all samples */
+   int symbolCount;      /* symbols found in the samples with the defaults */
+   double defaultMs;     /* to decode all samples with the defaults */
+   double profileMs;     /* to decode them with profile */
+   double speedup;       /* defaultMs / profileMs */
+} DmtxCalibration;
+
+extern DmtxPassFail dmtxProfileInit(DmtxProfile *profile, int name);
+extern const char *dmtxProfileName(int name);
+extern int dmtxProfileLookup(const char *name);
+extern int dmtxProfileGetShrink(const DmtxProfile *profile);
+extern DmtxPassFail dmtxProfileApply(DmtxDecode *dec, const DmtxProfile *profile);
+
+extern DmtxPassFail dmtxProfileCalibrate(DmtxCalibration *calib,
+      DmtxImage **samples, int sampleCount, const DmtxProfile *start,
+      int timeoutMs);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,146 @@
+# pydmtx - corpus benchmark
+#
+# Decodes and encodes the shared benchmark corpus written by
+# "bench/dmtxbench corpus DIR" (see "make bench" in the top directory) and
+# prints the same columns as the other wrappers. When DIR/native.txt holds
+# the timings of libdmtx alone, the overhead column is the median time
+# pydmtx adds on top of it.
+#
+# Usage: python bench_decode.py corpus_dir [rounds]
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2.1 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+# $Id$
+
+import os
+import sys
+import time
+
+from pydmtx import DataMatrix
+from PIL import Image
+
+try:
+    import tracemalloc
+except ImportError:
+    tracemalloc = None
+
+PAYLOAD = "libdmtx benchmark payload 0123456789 "
+
+def read_cases(corpus):
+    cases = []
+    for line in open(os.path.join(corpus, "corpus.txt")):
+        fields = line.split()
+        if fields and fields[0] in ("decode", "encode"):
+            cases.append(fields)
+    return cases
+
+def read_native(corpus):
+    # Median times of libdmtx alone, by case name
+    native = {}
+    path = os.path.join(corpus, "native.txt")
+    if os.path.exists(path):
+        for line in open(path):
+            fields = line.split()
+            if fields and not fields[0].startswith("#"):
+                native[fields[0]] = float(fields[3])
+    return native
+
+def pixels_of(image):
+    if hasattr(image, "tobytes"):
+        return image.tobytes()
+    return image.tostring()
+
+def measure(rounds, work):
+    # Returns the sorted per-call times in ms and the result of the last call
+    times = []
+    result = None
+    for i in range(rounds):
+        start = time.time()
+        result = work()
+        times.append((time.time() - start) * 1000.0)
+    times.sort()
+    return times, result
+
+def allocated(work):
+    # Peak Python heap used by one call, where tracemalloc is available
+    if tracemalloc is None or not hasattr(tracemalloc, "reset_peak"):
+        return "-"
+    tracemalloc.start()
+    try:
+        base = tracemalloc.get_traced_memory()[0]
+        tracemalloc.reset_peak()
+        work()
+        peak = tracemalloc.get_traced_memory()[1]
+    finally:
+        tracemalloc.stop()
+    return "%.1f KB" % ((peak - base) / 1024.0)
+
+def report(name, found, expected, times, alloc, native):
+    total = sum(times)
+    p50 = times[len(times) // 2]
+    p99 = times[(len(times) * 99) // 100]
+    if name in native:
+        overhead = "%.3f" % (p50 - native[name])
+    else:
+        overhead = "-"
+    print("  %-12s %7s %10.1f %9.3f %9.3f %12s %11s" % (name,
+        "%d/%d" % (found, expected), len(times) * 1000.0 / total if total else 0.0,
+        p50, p99, alloc, overhead))
+
+def main():
+    if len(sys.argv) < 2:
+        print("Usage: python bench_decode.py corpus_dir [rounds]")
+        sys.exit(2)
+    corpus = sys.argv[1]
+    rounds = int(sys.argv[2]) if len(sys.argv) > 2 else 20
+    native = read_native(corpus)
+
+    print("# python, %d rounds per case" % rounds)
+    print("# %-12s %7s %10s %9s %9s %12s %11s" % ("case", "found",
+        "per sec", "p50 ms", "p99 ms", "alloc/call", "overhead ms"))
+
+    for fields in read_cases(corpus):
+        if fields[0] == "decode":
+            name, path = fields[1], os.path.join(corpus, fields[2])
+            symbols = int(fields[6])
+            image = Image.open(path)
+            width, height = image.size
+            data = pixels_of(image)
+            if fields[5] == "1":
+                packing = DataMatrix.DmtxPack8bppK
+            else:
+                packing = DataMatrix.DmtxPack24bppRGB
+
+            def work():
+                dm = DataMatrix(max_count=symbols)
+                dm.decode(width, height, data, packing=packing)
+                return dm.count()
+
+            times, found = measure(rounds, work)
+            report(name, found, symbols, times, allocated(work), native)
+        else:
+            name, length = fields[1], int(fields[2])
+            payload = (PAYLOAD * (length // len(PAYLOAD) + 1))[:length]
+
+            def work():
+                dm = DataMatrix()
+                dm.encode(payload)
+                return dm.image is not None
+
+            times, ok = measure(rounds, work)
+            report(name, int(ok), 1, times, allocated(work), native)
+
+if __name__ == '__main__':
+    main()
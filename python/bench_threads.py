@@ -0,0 +1,95 @@
+# pydmtx - thread scaling benchmark
+#
+# Decodes (and encodes) the same work on 1, 2, 4, ... Python threads and
+# reports the throughput of each run. Since pydmtx releases the GIL while
+# libdmtx is working, throughput should grow with the number of cores.
+#
+# Usage: python bench_threads.py [max_threads] [jobs]
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2.1 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+# $Id$
+
+import sys
+import threading
+import time
+
+from pydmtx import DataMatrix
+from PIL import Image
+
+def make_page(count):
+    # A page holding several different symbols side by side
+    symbols = []
+    for i in range(count):
+        dm = DataMatrix()
+        dm.encode("Benchmark page symbol %d" % i)
+        symbols.append(dm.image)
+
+    cell = max([max(s.size) for s in symbols]) + 20
+    page = Image.new('RGB', (count * cell, cell), (255, 255, 255))
+    for i in range(count):
+        page.paste(symbols[i], (i * cell + 10, 10))
+    return page
+
+def run(threads, jobs, work):
+    # Split jobs over the threads and time until all of them are done
+    def worker(n):
+        for i in range(n):
+            work()
+
+    share = [jobs // threads] * threads
+    for i in range(jobs % threads):
+        share[i] += 1
+
+    workers = [threading.Thread(target=worker, args=(n,)) for n in share]
+    start = time.time()
+    for t in workers:
+        t.start()
+    for t in workers:
+        t.join()
+    return time.time() - start
+
+def report(name, max_threads, jobs, work):
+    print(name)
+    base = None
+    threads = 1
+    while threads <= max_threads:
+        elapsed = run(threads, jobs, work)
+        if base is None:
+            base = elapsed
+        print("  %2d threads: %7.3f s  %8.1f jobs/s  speedup %.2fx" % (
+            threads, elapsed, jobs / elapsed, base / elapsed))
+        threads *= 2
+
+def main():
+    max_threads = int(sys.argv[1]) if len(sys.argv) > 1 else 8
+    jobs = int(sys.argv[2]) if len(sys.argv) > 2 else 64
+
+    page = make_page(4)
+    width, height = page.size
+    pixels = page.tostring()
+
+    def decode():
+        DataMatrix().decode(width, height, pixels)
+
+    def encode():
+        DataMatrix().encode("Benchmark encode payload 0123456789" * 4)
+
+    report("decode (%dx%d, 4 symbols)" % (width, height), max_threads,
+           jobs, decode)
+    report("encode", max_threads, jobs * 8, encode)
+
+if __name__ == '__main__':
+    main()
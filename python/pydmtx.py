@@ -21,14 +21,143 @@
 
 # $Id$
 
+import mmap
+import struct
+import sys
+import threading
+try:
+	import Queue
+except ImportError:
+	import queue as Queue
+
 import _pydmtx
 try:
-	from PIL import Image, ImageDraw
+	from PIL import Image
 	_hasPIL = True
 except ImportError:
 	_hasPIL = False
 
 
+# Worker threads of decode_async(), shared by all DataMatrix objects and
+# created on first use. They are daemon threads so that an idle pool never
+# keeps the interpreter alive.
+_pool_lock = threading.Lock()
+_pool_queue = None
+_pool_workers = []
+_pool_size = None
+
+def _pool_default_size():
+	try:
+		import multiprocessing
+		return multiprocessing.cpu_count()
+	except (ImportError, NotImplementedError):
+		return 1
+
+def _pool_worker():
+	while True:
+		future = _pool_queue.get()
+		if future is None:
+			return
+		future._run()
+
+def _pool_resize( size ):
+	# Called with _pool_lock held. Surplus workers leave once they reach
+	# the stop marker, after the decodes queued before it.
+	while len(_pool_workers) > size:
+		_pool_workers.pop()
+		_pool_queue.put( None )
+	while len(_pool_workers) < size:
+		thread = threading.Thread( target=_pool_worker,
+			name="pydmtx decode" )
+		thread.daemon = True
+		thread.start()
+		_pool_workers.append( thread )
+
+def _pool_submit( future ):
+	global _pool_queue
+	_pool_lock.acquire()
+	try:
+		if _pool_queue is None:
+			_pool_queue = Queue.Queue()
+			_pool_resize( _pool_size or _pool_default_size() )
+		_pool_queue.put( future )
+	finally:
+		_pool_lock.release()
+
+
+class DecodeFuture (object):
+	# Pending result of DataMatrix.decode_async(), used in the manner of a
+	# concurrent.futures.Future, but needing nothing beyond threading.
+	def __init__( self, func, cancel ):
+		self._func = func
+		self._cancel = cancel
+		self._done = threading.Event()
+		self._lock = threading.Lock()
+		self._callbacks = []
+		self._result = None
+		self._error = None
+
+	def _run( self ):
+		# A decode cancelled while still queued never starts scanning
+		try:
+			if self._cancel.isSet():
+				self._result = []
+			else:
+				self._result = self._func()
+		except Exception:
+			self._error = sys.exc_info()[1]
+
+		self._lock.acquire()
+		try:
+			self._done.set()
+			callbacks, self._callbacks = self._callbacks, []
+		finally:
+			self._lock.release()
+
+		for callback in callbacks:
+			callback( self )
+
+	def cancel( self ):
+		# Stop the scan; False if it had already finished
+		if self._done.isSet():
+			return False
+		self._cancel.set()
+		return True
+
+	def cancelled( self ):
+		return self._cancel.isSet()
+
+	def done( self ):
+		return self._done.isSet()
+
+	def result( self, timeout=None ):
+		self._done.wait( timeout )
+		if not self._done.isSet():
+			raise RuntimeError( "decode still running" )
+		if self._error is not None:
+			raise self._error
+		return self._result
+
+	def exception( self, timeout=None ):
+		self._done.wait( timeout )
+		if not self._done.isSet():
+			raise RuntimeError( "decode still running" )
+		return self._error
+
+	def add_done_callback( self, callback ):
+		# Called with this future once the decode is done, right away if it
+		# already is
+		self._lock.acquire()
+		try:
+			if not self._done.isSet():
+				self._callbacks.append( callback )
+				return
+		finally:
+			self._lock.release()
+
+		callback( self )
+
+
 class DataMatrix (object):
 	DmtxUndefined = -1
 
@@ -77,14 +206,27 @@ class DataMatrix (object):
 	DmtxSymbol16x36      =  28
 	DmtxSymbol16x48      =  29
 
+	# Packing: pixel layouts accepted by decode()
+	DmtxPack8bppK     = _pydmtx.DmtxPack8bppK
+	DmtxPack24bppRGB  = _pydmtx.DmtxPack24bppRGB
+	DmtxPack24bppBGR  = _pydmtx.DmtxPack24bppBGR
+	DmtxPack32bppRGBX = _pydmtx.DmtxPack32bppRGBX
+	DmtxPack32bppBGRX = _pydmtx.DmtxPack32bppBGRX
+
+	# Profile: names accepted by use_profile()
+	DmtxProfileDefault        = 'default'
+	DmtxProfileFixedSizeLabel = 'fixed_size_label'
+	DmtxProfileDenseDocument  = 'dense_document'
+	DmtxProfileFarFieldCamera = 'far_field_camera'
+
 	def __init__( self, **kwargs ):
 		self._data = None
 		self._image = None
-		self._draw = None
 
 		self.width, self.height = 0, 0
 
 		self.results = ""
+		self.last_stats = None
 
 		# defaults (only set mandatory values)
 		self.options = {
@@ -107,34 +249,187 @@ class DataMatrix (object):
 		all_kwargs.update(kwargs)
 
 		self._data = str(data)
-		_pydmtx.encode( self._data, plotter=self._plot,
-			start=self._start, finish=self._finish, **all_kwargs );
+		self.width, self.height, stride, pixels = _pydmtx.encode( self._data,
+			**all_kwargs )
 
-	def save( self, path, fmt ):
-		if self._image is not None:
-			self._image.save( path, fmt )
+		# libdmtx hands back rows top-down (no image flip requested)
+		self._image = Image.frombuffer( 'RGB', (self.width,self.height),
+			pixels, 'raw', 'RGB', stride, 1 )
+
+	def encode_modules( self, data, **kwargs ):
+		# Module matrix only, no image: returns (rows, cols, modules) with
+		# one bit per module (1 = dark), MSB first, top row first and rows
+		# padded to whole bytes
+		all_kwargs = dict(self.options)
+		all_kwargs.update(kwargs)
+
+		self._data = str(data)
+		return _pydmtx.encode_modules( self._data, **all_kwargs )
+
+	def encode_many( self, data_list, **kwargs ):
+		# Encodes every payload with the same options on threads=N native
+		# threads (0 = one per processor). With modules=True this returns
+		# a list of (rows, cols, modules) as from encode_modules().
+		# Otherwise it returns (sheet, boxes): one image with the symbols
+		# stacked from top to bottom, and the (x, y, width, height) box of
+		# each payload's symbol in it.
+		all_kwargs = dict(self.options)
+		all_kwargs.update(kwargs)
+		if 'modules' in all_kwargs:
+			all_kwargs['modules'] = int(bool(all_kwargs['modules']))
+
+		payloads = [str(data) for data in data_list]
+		result = _pydmtx.encode_many( payloads, **all_kwargs )
+		if all_kwargs.get('modules'):
+			return result
+
+		width, height, stride, pixels, boxes = result
+		sheet = Image.frombuffer( 'RGB', (width,height), pixels, 'raw', 'RGB',
+			stride, 1 )
+		return sheet, boxes
 
-	def _start( self, width, height, context ):
-		self.width, self.height = width, height
-		self._image = Image.new( 'RGB', (width,height), (255,255,255) )
-		self._draw = ImageDraw.Draw( self._image )
+	# encode cache, shared by all DataMatrix objects of the process
+	def set_encode_cache( max_bytes ):
+		# Repeated payloads encoded with the same options are copied from a
+		# cache of up to max_bytes instead of being encoded again (0, the
+		# default, disables it)
+		_pydmtx.encode_cache( max_bytes )
+	set_encode_cache = staticmethod( set_encode_cache )
 
-	def _plot( self, x, y, color, context ):
-		self._draw.point( (x,self.height-y-1), fill=color )
+	def clear_encode_cache():
+		_pydmtx.encode_cache_clear()
+	clear_encode_cache = staticmethod( clear_encode_cache )
 
-	def _finish( self, context ):
-		del self._draw
-		self._draw = None
+	def encode_cache_stats():
+		# dict of hits, misses, entries, bytes and max_bytes
+		return _pydmtx.encode_cache_stats()
+	encode_cache_stats = staticmethod( encode_cache_stats )
+
+	def save( self, path, fmt ):
+		if self._image is not None:
+			self._image.save( path, fmt )
 
 	def decode( self, width, height, data, **kwargs):
-		all_kwargs = self.options
+		all_kwargs = dict(self.options)
 		all_kwargs.update(kwargs)
 
-		self.results =  _pydmtx.decode( width, height, data, **all_kwargs)
+		# Timings and counters of this decode; cheap enough to always keep
+		self.last_stats = kwargs.get('stats', {})
+		self.results =  _pydmtx.decode( width, height, data,
+			**dict(all_kwargs, stats=self.last_stats) )
 
 		# return only the first message
 		return self.message(1)
 
+	def scan( self, width, height, data, **kwargs ):
+		# Iterator over the (message, corners) of the symbols in an image,
+		# each returned as soon as it decodes. Stopping the iteration stops
+		# the scan, so the first symbol costs no more than finding it.
+		all_kwargs = dict(self.options)
+		all_kwargs.update(kwargs)
+
+		return _pydmtx.scan( width, height, data, **all_kwargs )
+
+	def decode_async( self, width, height, data, **kwargs ):
+		# Decode on the shared worker pool (see set_async_workers) without
+		# blocking the caller. Returns a DecodeFuture of the (message,
+		# corners) list; cancel() on it stops the native scan within a few
+		# milliseconds, and result() then returns the symbols found so far,
+		# none if it had not started yet. Only the thread that started
+		# the scan polls for cancellation; in a tiled decode (threads=N)
+		# the other workers stop at the end of their current 50 ms search
+		# slice once it has noticed. data must not change until it is done.
+		all_kwargs = dict(self.options)
+		all_kwargs.update(kwargs)
+		cancel = threading.Event()
+		all_kwargs['cancel'] = cancel
+
+		future = DecodeFuture( lambda: _pydmtx.decode( width, height, data,
+			**all_kwargs ), cancel )
+		_pool_submit( future )
+		return future
+
+	def set_async_workers( count ):
+		# Number of worker threads shared by every decode_async() call (by
+		# default one per processor); further decodes wait in a queue
+		global _pool_size
+		count = int(count)
+		if count < 1:
+			raise ValueError( "at least one worker is needed" )
+		_pool_lock.acquire()
+		try:
+			_pool_size = count
+			if _pool_queue is not None:
+				_pool_resize( count )
+		finally:
+			_pool_lock.release()
+	set_async_workers = staticmethod( set_async_workers )
+
+	def decode_file( self, path, width=None, height=None, stride=None,
+			packing=DmtxPack8bppK, header=0, **kwargs ):
+		# Decode every page of an uncompressed image file straight from a
+		# memory mapping of it, returning one (message, corners) list per
+		# page. Reads binary PGM/PPM files (several images may follow each
+		# other) and TIFF files with uncompressed 8-bit gray, palette or RGB
+		# pages (white-is-zero and palette pages are converted in a copy);
+		# with width and height the file holds raw frames of that size
+		# after header bytes. All pages go through one Decoder.
+		decoder = self.decoder( **kwargs )
+		f = open( path, 'rb' )
+		try:
+			mm = mmap.mmap( f.fileno(), 0, access=mmap.ACCESS_READ )
+		finally:
+			f.close()
+
+		try:
+			if width is not None:
+				pages = _raw_pages( mm, width, height, stride or width *
+					_bytes_per_pixel(packing), packing, header )
+			elif mm[:2] in (b'II', b'MM'):
+				pages = _tiff_pages( mm )
+			else:
+				pages = _pnm_pages( mm )
+
+			results = []
+			for pixels, page_width, page_height, page_stride, page_packing in pages:
+				results.append( decoder.decode( page_width, page_height,
+					pixels, stride=page_stride, packing=page_packing ) )
+				del pixels
+			return results
+		finally:
+			try:
+				mm.close()
+			except BufferError:
+				# A caller still holds a page; the mapping goes with it
+				pass
+
+	def use_profile( self, name ):
+		# Take the search settings of a named profile into the options.
+		# Fixed size labels still need shape set to the printed size.
+		self.options.update( _pydmtx.profile( name ) )
+
+	def calibrate( self, samples, **kwargs ):
+		# Fit the search settings to samples, a list of (width, height,
+		# data[, stride[, packing]]) images typical of what is decoded: the
+		# tightest ones that still find every symbol the defaults find there
+		# are taken into the options. Search settings already in the options
+		# are tried first. Returns a dict of the options found, the symbols
+		# found and the milliseconds all samples take with the defaults and
+		# with the options, and their ratio (speedup).
+		all_kwargs = dict(self.options)
+		all_kwargs.update(kwargs)
+
+		result = _pydmtx.calibrate( samples, **all_kwargs )
+		self.options.update( result['options'] )
+		return result
+
+	def decoder( self, **kwargs ):
+		# Reusable decoder for repeated frames, built from the current options
+		all_kwargs = dict(self.options)
+		all_kwargs.update(kwargs)
+
+		return _pydmtx.Decoder( **all_kwargs )
+
 	def count( self ):
 		return len(self.results)
 
@@ -150,3 +445,168 @@ class DataMatrix (object):
 			return self.results[ref-1]
 		else:
 			return
+
+
+# Page readers used by DataMatrix.decode_file. Each yields the pixels of a
+# page (a zero-copy view of the mapping where the page is stored in one
+# piece) with its width, height, stride and packing.
+
+def _bytes_per_pixel( packing ):
+	if packing == DataMatrix.DmtxPack8bppK:
+		return 1
+	if packing in (DataMatrix.DmtxPack24bppRGB, DataMatrix.DmtxPack24bppBGR):
+		return 3
+	return 4
+
+def _view( mm, offset, length ):
+	try:
+		return memoryview( mm )[offset:offset + length]
+	except TypeError:
+		# Python 2 mmaps only have the old buffer interface
+		return buffer( mm, offset, length )
+
+def _raw_pages( mm, width, height, stride, packing, header ):
+	# Frames back to back after the header; a partial last frame is ignored
+	frame_bytes = stride * height
+	if width <= 0 or height <= 0 or frame_bytes <= 0:
+		raise ValueError( "invalid frame geometry" )
+	offset = header
+	while len(mm) - offset >= frame_bytes:
+		yield _view( mm, offset, frame_bytes ), width, height, stride, packing
+		offset += frame_bytes
+
+def _pnm_pages( mm ):
+	# Binary PGM (P5) and PPM (P6) images with a maxval up to 255
+	size = len(mm)
+	pos = [0]
+
+	def number():
+		while pos[0] < size:
+			c = mm[pos[0]:pos[0] + 1]
+			if c == b'#':
+				end = mm.find( b'\n', pos[0] )
+				pos[0] = size if end < 0 else end
+			elif c.isspace():
+				pos[0] += 1
+			else:
+				break
+		start = pos[0]
+		while pos[0] < size and mm[pos[0]:pos[0] + 1].isdigit():
+			pos[0] += 1
+		if start == pos[0]:
+			raise ValueError( "invalid PNM header" )
+		return int( mm[start:pos[0]] )
+
+	while pos[0] < size:
+		magic = mm[pos[0]:pos[0] + 2]
+		if magic not in (b'P5', b'P6'):
+			raise ValueError( "not a binary PGM or PPM file" )
+		pos[0] += 2
+		width, height, maxval = number(), number(), number()
+		if width <= 0 or height <= 0 or maxval <= 0 or maxval > 255:
+			raise ValueError( "unsupported PNM image" )
+		pos[0] += 1
+
+		if magic == b'P5':
+			stride, packing = width, DataMatrix.DmtxPack8bppK
+		else:
+			stride, packing = width * 3, DataMatrix.DmtxPack24bppRGB
+		if pos[0] + stride * height > size:
+			raise ValueError( "PNM image truncated" )
+		yield _view( mm, pos[0], stride * height ), width, height, stride, packing
+
+		pos[0] += stride * height
+		while pos[0] < size and mm[pos[0]:pos[0] + 1].isspace():
+			pos[0] += 1
+
+_tiff_inverted = bytes( bytearray( range(255, -1, -1) ) )
+
+def _bytes( pixels ):
+	# Copy of a page view (or the gathered page itself) as a byte string
+	if isinstance( pixels, bytes ):
+		return pixels
+	try:
+		return pixels.tobytes()
+	except AttributeError:
+		return bytes( pixels )
+
+def _tiff_pages( mm ):
+	# Baseline TIFF pages, uncompressed, 8 bits per sample, chunky
+	order = '>' if mm[:2] == b'MM' else '<'
+	size = len(mm)
+	packings = { 1: DataMatrix.DmtxPack8bppK, 3: DataMatrix.DmtxPack24bppRGB,
+		4: DataMatrix.DmtxPack32bppRGBX }
+
+	def values( entry ):
+		kind, count = struct.unpack_from( order + 'HI', mm, entry + 2 )
+		if kind not in (3, 4):
+			return []
+		fmt = order + ('H' if kind == 3 else 'I') * count
+		at = entry + 8
+		if struct.calcsize( fmt ) > 4:
+			at = struct.unpack_from( order + 'I', mm, at )[0]
+		return list( struct.unpack_from( fmt, mm, at ) )
+
+	if struct.unpack_from( order + 'H', mm, 2 )[0] != 42:
+		raise ValueError( "not a TIFF file" )
+	ifd = struct.unpack_from( order + 'I', mm, 4 )[0]
+	seen = set()
+	while ifd:
+		if ifd in seen or ifd + 2 > size:
+			raise ValueError( "corrupt TIFF directory" )
+		seen.add( ifd )
+		count = struct.unpack_from( order + 'H', mm, ifd )[0]
+		tags = {}
+		for e in range(count):
+			entry = ifd + 2 + e * 12
+			tags[struct.unpack_from( order + 'H', mm, entry )[0]] = values( entry )
+
+		first = lambda tag, default: (tags.get(tag) or [default])[0]
+		width, height = first(256, 0), first(257, 0)
+		samples = first(277, 1)
+		if (not width or not height or first(258, 1) != 8 or
+				first(259, 1) != 1 or samples not in packings or
+				(samples > 1 and first(284, 1) != 1)):
+			raise ValueError( "unsupported TIFF page" )
+
+		# Gray pages are read black is zero (1), white is zero (0) or
+		# through a palette (3); pages with more samples must be RGB (2)
+		photometric = first(262, 1 if samples == 1 else 2)
+		colormap = tags.get(320, [])
+		if samples == 1 and photometric == 3:
+			if len(colormap) != 3 * 256:
+				raise ValueError( "TIFF palette page without a colormap" )
+		elif photometric not in ((0, 1) if samples == 1 else (2,)):
+			raise ValueError( "unsupported TIFF photometric interpretation %d"
+				% photometric )
+
+		stride = width * samples
+		length = stride * height
+		offsets, counts = tags.get(273, []), tags.get(279, [])
+		run = offsets[0] if offsets else 0
+		for offset, strip in zip(offsets, counts):
+			if offset != run:
+				break
+			run += strip
+		if offsets and run - offsets[0] >= length and offsets[0] + length <= size:
+			pixels = _view( mm, offsets[0], length )
+		else:
+			# Scattered strips are gathered into one copy of the page
+			pixels = b''.join( [mm[o:o + c] for o, c in zip(offsets, counts)] )[:length]
+			if len(pixels) < length:
+				raise ValueError( "TIFF strips shorter than the page" )
+
+		packing = packings[samples]
+		if photometric == 0:
+			pixels = _bytes( pixels ).translate( _tiff_inverted )
+		elif photometric == 3:
+			pixels, stride = _bytes( pixels ), width * 3
+			rgb = bytearray( stride * height )
+			for channel in range(3):
+				table = bytes( bytearray( [value >> 8 for value in
+					colormap[channel * 256:(channel + 1) * 256]] ) )
+				rgb[channel::3] = pixels.translate( table )
+			pixels, packing = bytes( rgb ), DataMatrix.DmtxPack24bppRGB
+		yield pixels, width, height, stride, packing
+
+		ifd = struct.unpack_from( order + 'I', mm, ifd + 2 + count * 12 )[0]
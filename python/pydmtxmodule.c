@@ -28,8 +28,14 @@ Contact: mike@dragonflylogic.com
 /* $Id$ */
 
 #include <string.h>
+#include <stdlib.h>
+#include <math.h>
 #include <Python.h>
+#include <pythread.h>
 #include <dmtx.h>
+#include "../convert/dmtxconvert.h"
+#include "../profile/dmtxprofile.h"
+#include "../core/dmtxcore.h"
 
 /* Define Py_ssize_t for earlier Python versions */
 #if PY_VERSION_HEX < 0x02050000 && !defined(PY_SSIZE_T_MIN)
@@ -38,24 +44,300 @@ typedef int Py_ssize_t;
 #define PY_SSIZE_T_MIN INT_MIN
 #endif
 
+/* Decode options shared by decode() and Decoder objects */
+typedef struct {
+   int gap_size;
+   int max_count;
+   int timeout;
+   int shape;
+   int deviation;
+   int threshold;
+   int shrink;
+   int corrections;
+   int min_edge;
+   int max_edge;
+   int threads;
+   int tile_overlap;
+   int x_min;           /* scan bounds in image pixels, rows counted */
+   int x_max;           /* from the top as in the returned corners */
+   int y_min;
+   int y_max;
+   int pyramid;         /* shrink used to locate symbols before decoding */
+   PyObject *cancel;    /* borrowed; stops the scan once cancel.is_set() */
+} DecodeOptions;
+
+/* Symbol found by run_scan(), kept in C until the GIL is back. The
+   message is at offset in the text arena. */
+typedef struct {
+   int corners[8];
+   size_t offset;
+   int message_size;
+} ScanFound;
+
+/* State of run_scan() shared with its callbacks */
+typedef struct {
+   DmtxCoreScan scan;
+   DmtxCoreArena found;   /* ScanFound records */
+   DmtxCoreArena text;
+   PyObject *cancel;
+   int error;             /* cancel.is_set() raised */
+   int failed;            /* out of memory */
+} ScanRun;
+
+/* One payload of encode_many(), encoded by whichever worker got it.
+   Rasters are top-down rows of stride bytes; module matrices are height
+   rows of width modules packed as by encode_modules(). */
+typedef struct {
+   int width;
+   int height;
+   int stride;
+   unsigned char *bytes;
+   int failed;
+} EncodeItem;
+
+/* Work shared by the threads of encode_many() */
+typedef struct {
+   const char **data;
+   int *data_size;
+   int count;
+   int module_size;
+   int margin_size;
+   int scheme;
+   int shape;
+   int modules;
+   EncodeItem *items;
+   int next_item;
+   int stop;
+   int running;
+   PyThread_type_lock lock;
+   PyThread_type_lock done;
+} EncodeJob;
+
+/* Decoder keeps its DmtxImage and DmtxDecode between frames */
+typedef struct {
+   PyObject_HEAD
+   DecodeOptions options;
+   DmtxCoreDecoder decoder;
+   int busy;
+} DecoderObject;
+
+/* Iterator returned by scan(): the scan state lives between next() calls,
+   so each symbol is handed out as soon as it decodes */
+typedef struct {
+   PyObject_HEAD
+   DecodeOptions options;
+   Py_buffer view;
+   int has_view;
+   DmtxCoreDecoder decoder;
+   DmtxCoreScan scan;
+   int found;
+   int busy;
+} ScanObject;
+
+/* Optional LRU cache of finished encodes. It is only touched with the GIL
+   held, which is all the locking it needs. Entries are keyed on the kind
+   of output, the encode options and the payload. */
+#define CACHE_BUCKETS  1024
+#define CACHE_KEY_INTS 5
+#define CACHE_RASTER   1
+#define CACHE_MODULES  2
+
+typedef struct CacheEntry {
+   struct CacheEntry *prev;   /* LRU list, most recently used first */
+   struct CacheEntry *next;
+   struct CacheEntry *chain;  /* next entry in the same bucket */
+   unsigned long hash;
+   int key[CACHE_KEY_INTS];
+   int info[3];               /* width, height, stride or rows, cols */
+   int data_size;
+   int value_size;
+   unsigned char bytes[1];    /* payload followed by value */
+} CacheEntry;
+
+static struct {
+   CacheEntry *buckets[CACHE_BUCKETS];
+   CacheEntry *head;
+   CacheEntry *tail;
+   long hits;
+   long misses;
+   long entries;
+   long bytes;
+   long max_bytes;
+} encode_cache;
+
 static PyObject *dmtx_encode(PyObject *self, PyObject *args, PyObject *kwargs);
+static PyObject *dmtx_encode_modules(PyObject *self, PyObject *args, PyObject *kwargs);
+static PyObject *dmtx_encode_many(PyObject *self, PyObject *args, PyObject *kwargs);
 static PyObject *dmtx_decode(PyObject *self, PyObject *args, PyObject *kwargs);
+static PyObject *dmtx_encode_cache(PyObject *self, PyObject *args);
+static PyObject *dmtx_encode_cache_clear(PyObject *self, PyObject *args);
+static PyObject *dmtx_encode_cache_stats(PyObject *self, PyObject *args);
+static int Decoder_init(DecoderObject *self, PyObject *args, PyObject *kwargs);
+static void Decoder_dealloc(DecoderObject *self);
+static PyObject *Decoder_decode(DecoderObject *self, PyObject *args, PyObject *kwargs);
+static PyObject *dmtx_scan(PyObject *self, PyObject *args, PyObject *kwargs);
+static void scan_release(ScanObject *self);
+static void Scan_dealloc(ScanObject *self);
+static PyObject *Scan_next(ScanObject *self);
+static PyObject *dmtx_profile(PyObject *self, PyObject *args);
+static PyObject *dmtx_calibrate(PyObject *self, PyObject *args, PyObject *kwargs);
+static PyObject *profile_options(const DmtxProfile *profile);
+static void init_decode_options(DecodeOptions *opts);
+static void apply_decode_options(DmtxDecode *dec, DecodeOptions *opts);
+static int prepare_decoder(DmtxCoreDecoder *decoder, Py_buffer *view,
+      int width, int height, int packing, int stride, DecodeOptions *opts);
+static DmtxImage *create_image(Py_buffer *view, int width, int height,
+      int packing, int stride, int *row_stride);
+static PyObject *run_scan(DmtxCoreDecoder *decoder, DecodeOptions *opts,
+      const int *near, int padding, DmtxCoreStats *stats);
+static int scan_result(void *context, const DmtxCoreResult *result);
+static int scan_cancelled(void *context);
+static int is_cancelled(PyObject *cancel);
+static int stats_export(const DmtxCoreStats *stats, PyObject *dict);
+static PyObject *result_item(const unsigned char *message, int message_size,
+      const int *corners);
+static int get_corners(PyObject *obj, int *corners);
+static int encode_symbol(const char *data, int data_size, int module_size,
+      int margin_size, int scheme, int shape, int modules, EncodeItem *item);
+static void encode_worker(void *arg);
+static int call_callback(PyObject *callback, PyObject *args);
+static PyObject *filter_kwargs(PyObject *kwargs, char **kwlist, int first);
+static int get_pixel_buffer(PyObject *obj, Py_buffer *view);
+static int get_row_stride(Py_buffer *view, int width, int height,
+      int bytes_per_pixel, int stride);
+static const unsigned char *cache_get(const int *key,
+      const unsigned char *data, int data_size, int *info, int *value_size);
+static void cache_put(const int *key, const unsigned char *data,
+      int data_size, const int *info, const unsigned char *value,
+      int value_size);
 
 static PyMethodDef dmtxMethods[] = {
    { "encode",
      (PyCFunction)dmtx_encode,
      METH_VARARGS | METH_KEYWORDS,
-     "Encodes data into a matrix and calls back to plot." },
+     "Encodes data into a matrix and either calls back to plot or returns the raster." },
+   { "encode_modules",
+     (PyCFunction)dmtx_encode_modules,
+     METH_VARARGS | METH_KEYWORDS,
+     "Encodes data and returns (rows, cols, modules) with the module matrix packed one bit per module." },
+   { "encode_many",
+     (PyCFunction)dmtx_encode_many,
+     METH_VARARGS | METH_KEYWORDS,
+     "Encodes a sequence of payloads on several threads into module matrices or one raster sheet." },
    { "decode",
      (PyCFunction)dmtx_decode,
      METH_VARARGS | METH_KEYWORDS,
      "Decodes data from a bitmap stored in a buffer and returns the encoded data." },
+   { "scan",
+     (PyCFunction)dmtx_scan,
+     METH_VARARGS | METH_KEYWORDS,
+     "Returns an iterator that decodes the symbols of a bitmap one at a time, as they are found." },
+   { "profile",
+     (PyCFunction)dmtx_profile,
+     METH_VARARGS,
+     "Returns the decode keywords of a named profile (e.g., 'fixed_size_label')." },
+   { "calibrate",
+     (PyCFunction)dmtx_calibrate,
+     METH_VARARGS | METH_KEYWORDS,
+     "Finds the fastest decode keywords that still find every symbol of sample images, and times them." },
+   { "encode_cache",
+     (PyCFunction)dmtx_encode_cache,
+     METH_VARARGS,
+     "Sets the byte budget of the cache of finished encodes (0 disables it)." },
+   { "encode_cache_clear",
+     (PyCFunction)dmtx_encode_cache_clear,
+     METH_NOARGS,
+     "Drops all cached encodes and resets the hit and miss counters." },
+   { "encode_cache_stats",
+     (PyCFunction)dmtx_encode_cache_stats,
+     METH_NOARGS,
+     "Returns the hits, misses, entries, bytes and max_bytes of the encode cache." },
    { NULL,
      NULL,
      0,
      NULL }
 };
 
+static PyMethodDef DecoderMethods[] = {
+   { "decode",
+     (PyCFunction)Decoder_decode,
+     METH_VARARGS | METH_KEYWORDS,
+     "Decodes a frame, reusing the scan buffers of the previous frame when its size and packing match." },
+   { NULL,
+     NULL,
+     0,
+     NULL }
+};
+
+static PyTypeObject DecoderType = {
+   PyVarObject_HEAD_INIT(NULL, 0)
+   "_pydmtx.Decoder",                /* tp_name */
+   sizeof(DecoderObject),            /* tp_basicsize */
+   0,                                /* tp_itemsize */
+   (destructor)Decoder_dealloc,      /* tp_dealloc */
+   0,                                /* tp_print */
+   0,                                /* tp_getattr */
+   0,                                /* tp_setattr */
+   0,                                /* tp_compare */
+   0,                                /* tp_repr */
+   0,                                /* tp_as_number */
+   0,                                /* tp_as_sequence */
+   0,                                /* tp_as_mapping */
+   0,                                /* tp_hash */
+   0,                                /* tp_call */
+   0,                                /* tp_str */
+   0,                                /* tp_getattro */
+   0,                                /* tp_setattro */
+   0,                                /* tp_as_buffer */
+   Py_TPFLAGS_DEFAULT,               /* tp_flags */
+   "Reusable decoder configured once with the decode() options.", /* tp_doc */
+   0,                                /* tp_traverse */
+   0,                                /* tp_clear */
+   0,                                /* tp_richcompare */
+   0,                                /* tp_weaklistoffset */
+   0,                                /* tp_iter */
+   0,                                /* tp_iternext */
+   DecoderMethods,                   /* tp_methods */
+   0,                                /* tp_members */
+   0,                                /* tp_getset */
+   0,                                /* tp_base */
+   0,                                /* tp_dict */
+   0,                                /* tp_descr_get */
+   0,                                /* tp_descr_set */
+   0,                                /* tp_dictoffset */
+   (initproc)Decoder_init,           /* tp_init */
+};
+
+static PyTypeObject ScanType = {
+   PyVarObject_HEAD_INIT(NULL, 0)
+   "_pydmtx.Scan",                   /* tp_name */
+   sizeof(ScanObject),               /* tp_basicsize */
+   0,                                /* tp_itemsize */
+   (destructor)Scan_dealloc,         /* tp_dealloc */
+   0,                                /* tp_print */
+   0,                                /* tp_getattr */
+   0,                                /* tp_setattr */
+   0,                                /* tp_compare */
+   0,                                /* tp_repr */
+   0,                                /* tp_as_number */
+   0,                                /* tp_as_sequence */
+   0,                                /* tp_as_mapping */
+   0,                                /* tp_hash */
+   0,                                /* tp_call */
+   0,                                /* tp_str */
+   0,                                /* tp_getattro */
+   0,                                /* tp_setattro */
+   0,                                /* tp_as_buffer */
+   Py_TPFLAGS_DEFAULT,               /* tp_flags */
+   "Iterator over the symbols of one bitmap, created by scan().", /* tp_doc */
+   0,                                /* tp_traverse */
+   0,                                /* tp_clear */
+   0,                                /* tp_richcompare */
+   0,                                /* tp_weaklistoffset */
+   PyObject_SelfIter,                /* tp_iter */
+   (iternextfunc)Scan_next,          /* tp_iternext */
+};
+
 static PyObject *
 dmtx_encode(PyObject *self, PyObject *arglist, PyObject *kwargs)
 {
@@ -71,43 +353,254 @@ dmtx_encode(PyObject *self, PyObject *arglist, PyObject *kwargs)
    PyObject *start_cb = NULL;
    PyObject *finish_cb = NULL;
    PyObject *context = Py_None;
-   PyObject *args;
+   PyObject *output;
 
    DmtxEncode *enc;
+   DmtxPassFail encoded = DmtxFail;
    int row, col;
+   int stride;
    int rgb[3];
+   int failed = 0;
+   int key[CACHE_KEY_INTS];
+   int info[3];
+   const unsigned char *cached;
    static char *kwlist[] = { "data", "module_size", "margin_size",
                              "scheme", "shape", "plotter", "start",
                              "finish", "context", NULL };
 
-   /* Parse out the options which are applicable */
+   /* Parse out the options which are applicable, skipping the first
+      keyword as it is sent in arglist */
    PyObject *filtered_kwargs;
-   filtered_kwargs = PyDict_New();
-   count = 1; /* Skip the first keyword as it is sent in arglist */
-   while(kwlist[count]){
-      if(PyDict_GetItemString(kwargs, kwlist[count])) {
-         PyDict_SetItemString(filtered_kwargs, kwlist[count],
-               PyDict_GetItemString(kwargs, kwlist[count]));
-      }
-      count++;
-   }
+   filtered_kwargs = filter_kwargs(kwargs, kwlist, 1);
+   if(filtered_kwargs == NULL)
+      return NULL;
 
-   if(!PyArg_ParseTupleAndKeywords(arglist, filtered_kwargs, "s#iiii|OOOO",
+   count = PyArg_ParseTupleAndKeywords(arglist, filtered_kwargs, "s#iiii|OOOO",
          kwlist, &data, &data_size, &module_size, &margin_size, &scheme,
-         &shape, &plotter, &start_cb, &finish_cb, &context))
+         &shape, &plotter, &start_cb, &finish_cb, &context);
+   Py_DECREF(filtered_kwargs);
+   if(!count)
       return NULL;
 
-   Py_INCREF(context);
+   /* Plotter is optional, but must be callable if provided */
+   if(plotter == Py_None)
+      plotter = NULL;
 
-   /* Plotter is required, and must be callable */
-   if(plotter == NULL || !PyCallable_Check(plotter)) {
+   if(plotter != NULL && !PyCallable_Check(plotter)) {
       PyErr_SetString(PyExc_TypeError, "plotter must be callable");
       return NULL;
    }
 
+   /* Only finished rasters are cached, plotters still see every pixel */
+   key[0] = CACHE_RASTER;
+   key[1] = module_size;
+   key[2] = margin_size;
+   key[3] = scheme;
+   key[4] = shape;
+   if(plotter == NULL) {
+      cached = cache_get(key, data, data_size, info, &stride);
+      if(cached != NULL)
+         return Py_BuildValue("(iiis#)", info[0], info[1], info[2], cached,
+               stride);
+   }
+
+   /* Encoding touches no Python objects, so let other threads run */
+   Py_BEGIN_ALLOW_THREADS
    enc = dmtxEncodeCreate();
+   if(enc != NULL) {
+      dmtxEncodeSetProp(enc, DmtxPropPixelPacking, DmtxPack24bppRGB);
+      dmtxEncodeSetProp(enc, DmtxPropImageFlip, DmtxFlipNone);
+
+      if(scheme != DmtxUndefined)
+         dmtxEncodeSetProp(enc, DmtxPropScheme, scheme);
+
+      if(shape != DmtxUndefined)
+         dmtxEncodeSetProp(enc, DmtxPropSizeRequest, shape);
+
+      if(margin_size != DmtxUndefined)
+         dmtxEncodeSetProp(enc, DmtxPropMarginSize, margin_size);
+
+      if(module_size != DmtxUndefined)
+         dmtxEncodeSetProp(enc, DmtxPropModuleSize, module_size);
+
+      encoded = dmtxEncodeDataMatrix(enc, data_size, (unsigned char *)data);
+   }
+   Py_END_ALLOW_THREADS
+
    if(enc == NULL)
+      return PyErr_NoMemory();
+
+   Py_INCREF(context);
+
+   if(encoded == DmtxFail) {
+      dmtxEncodeDestroy(&enc);
+      Py_DECREF(context);
+      PyErr_SetString(PyExc_ValueError, "Unable to encode message (possibly too large for requested size)");
+      return NULL;
+   }
+
+   /* Without a plotter, return the finished raster in one object. Rows
+      are stored top-down since no image flip was requested. */
+   if(plotter == NULL) {
+      stride = dmtxImageGetProp(enc->image, DmtxPropRowSizeBytes);
+      output = Py_BuildValue("(iiis#)", enc->image->width, enc->image->height,
+            stride, enc->image->pxl, stride * enc->image->height);
+      info[0] = enc->image->width;
+      info[1] = enc->image->height;
+      info[2] = stride;
+      cache_put(key, data, data_size, info, enc->image->pxl,
+            stride * enc->image->height);
+      dmtxEncodeDestroy(&enc);
+      Py_DECREF(context);
+      return output;
+   }
+
+   if((start_cb != NULL) && PyCallable_Check(start_cb))
+      failed = call_callback(start_cb, Py_BuildValue("(iiO)",
+            enc->image->width, enc->image->height, context));
+
+   /* Stop at the first callback that raises and pass its exception on */
+   for(row = 0; row < enc->image->height && !failed; row++) {
+      for(col = 0; col < enc->image->width && !failed; col++) {
+         dmtxImageGetPixelValue(enc->image, col, row, 0, &rgb[0]);
+         dmtxImageGetPixelValue(enc->image, col, row, 1, &rgb[1]);
+         dmtxImageGetPixelValue(enc->image, col, row, 2, &rgb[2]);
+         failed = call_callback(plotter, Py_BuildValue("(ii(iii)O)", col,
+               row, rgb[0], rgb[1], rgb[2], context));
+      }
+   }
+
+   if(!failed && (finish_cb != NULL) && PyCallable_Check(finish_cb))
+      failed = call_callback(finish_cb, Py_BuildValue("(O)", context));
+
+   dmtxEncodeDestroy(&enc);
+   Py_DECREF(context);
+
+   if(failed)
+      return NULL;
+
+   Py_INCREF(Py_None);
+   return Py_None;
+}
+
+/* Returns (rows, cols, modules) where modules packs the symbol one bit per
+   module (1 = dark), most significant bit first, top row first and each
+   row padded to a whole byte */
+static PyObject *
+dmtx_encode_modules(PyObject *self, PyObject *arglist, PyObject *kwargs)
+{
+   const unsigned char *data;
+   int data_size = 0;
+   int scheme = DmtxUndefined;
+   int shape = DmtxUndefined;
+   int count, rows = 0, cols = 0, row_bytes = 0, row, col;
+   unsigned char *modules = NULL;
+   DmtxEncode *enc;
+   DmtxPassFail encoded = DmtxFail;
+   PyObject *output;
+   int key[CACHE_KEY_INTS];
+   int info[3];
+   const unsigned char *cached;
+   static char *kwlist[] = { "data", "scheme", "shape", NULL };
+
+   PyObject *filtered_kwargs;
+   filtered_kwargs = filter_kwargs(kwargs, kwlist, 1);
+   if(filtered_kwargs == NULL)
+      return NULL;
+
+   count = PyArg_ParseTupleAndKeywords(arglist, filtered_kwargs, "s#|ii",
+         kwlist, &data, &data_size, &scheme, &shape);
+   Py_DECREF(filtered_kwargs);
+   if(!count)
+      return NULL;
+
+   key[0] = CACHE_MODULES;
+   key[1] = 0;
+   key[2] = 0;
+   key[3] = scheme;
+   key[4] = shape;
+   cached = cache_get(key, data, data_size, info, &count);
+   if(cached != NULL)
+      return Py_BuildValue("(iis#)", info[0], info[1], cached, count);
+
+   Py_BEGIN_ALLOW_THREADS
+   enc = dmtxEncodeCreate();
+   if(enc != NULL) {
+      /* libdmtx always renders, so keep that raster as small as possible */
+      dmtxEncodeSetProp(enc, DmtxPropModuleSize, 1);
+      dmtxEncodeSetProp(enc, DmtxPropMarginSize, 0);
+
+      if(scheme != DmtxUndefined)
+         dmtxEncodeSetProp(enc, DmtxPropScheme, scheme);
+
+      if(shape != DmtxUndefined)
+         dmtxEncodeSetProp(enc, DmtxPropSizeRequest, shape);
+
+      encoded = dmtxEncodeDataMatrix(enc, data_size, (unsigned char *)data);
+   }
+
+   if(encoded == DmtxPass) {
+      rows = dmtxGetSymbolAttribute(DmtxSymAttribSymbolRows, enc->region.sizeIdx);
+      cols = dmtxGetSymbolAttribute(DmtxSymAttribSymbolCols, enc->region.sizeIdx);
+      row_bytes = (cols + 7) / 8;
+      modules = (unsigned char *)calloc(rows, row_bytes);
+   }
+
+   /* libdmtx counts symbol rows from the bottom */
+   for(row = 0; modules != NULL && row < rows; row++) {
+      unsigned char *out = modules + (rows - 1 - row) * row_bytes;
+
+      for(col = 0; col < cols; col++) {
+         if(dmtxSymbolModuleStatus(enc->message, enc->region.sizeIdx, row, col) & DmtxModuleOnRGB)
+            out[col >> 3] |= 0x80 >> (col & 7);
+      }
+   }
+
+   count = (enc != NULL);
+   if(enc != NULL)
+      dmtxEncodeDestroy(&enc);
+   Py_END_ALLOW_THREADS
+
+   if(encoded == DmtxFail) {
+      if(!count)
+         return PyErr_NoMemory();
+      PyErr_SetString(PyExc_ValueError, "Unable to encode message (possibly too large for requested size)");
       return NULL;
+   }
+
+   if(modules == NULL)
+      return PyErr_NoMemory();
+
+   output = Py_BuildValue("(iis#)", rows, cols, modules, rows * row_bytes);
+   info[0] = rows;
+   info[1] = cols;
+   info[2] = row_bytes;
+   cache_put(key, data, data_size, info, modules, rows * row_bytes);
+   free(modules);
+
+   return output;
+}
+
+/* Encodes one payload into item without touching any Python object.
+   Returns 0 if libdmtx could not encode it or memory ran out. */
+static int
+encode_symbol(const char *data, int data_size, int module_size,
+      int margin_size, int scheme, int shape, int modules, EncodeItem *item)
+{
+   DmtxEncode *enc;
+   int row, col, row_bytes;
+
+   item->bytes = NULL;
+
+   enc = dmtxEncodeCreate();
+   if(enc == NULL)
+      return 0;
+
+   if(modules) {
+      /* libdmtx always renders, so keep that raster as small as possible */
+      module_size = 1;
+      margin_size = 0;
+   }
 
    dmtxEncodeSetProp(enc, DmtxPropPixelPacking, DmtxPack24bppRGB);
    dmtxEncodeSetProp(enc, DmtxPropImageFlip, DmtxFlipNone);
@@ -124,189 +617,1405 @@ dmtx_encode(PyObject *self, PyObject *arglist, PyObject *kwargs)
    if(module_size != DmtxUndefined)
       dmtxEncodeSetProp(enc, DmtxPropModuleSize, module_size);
 
-   dmtxEncodeDataMatrix(enc, data_size, (unsigned char *)data);
+   if(dmtxEncodeDataMatrix(enc, data_size, (unsigned char *)data) == DmtxFail) {
+      dmtxEncodeDestroy(&enc);
+      return 0;
+   }
+
+   if(modules) {
+      item->height = dmtxGetSymbolAttribute(DmtxSymAttribSymbolRows, enc->region.sizeIdx);
+      item->width = dmtxGetSymbolAttribute(DmtxSymAttribSymbolCols, enc->region.sizeIdx);
+      row_bytes = (item->width + 7) / 8;
+      item->stride = row_bytes;
+      item->bytes = (unsigned char *)calloc(item->height, row_bytes);
+
+      /* libdmtx counts symbol rows from the bottom */
+      for(row = 0; item->bytes != NULL && row < item->height; row++) {
+         unsigned char *out = item->bytes + (item->height - 1 - row) * row_bytes;
+
+         for(col = 0; col < item->width; col++) {
+            if(dmtxSymbolModuleStatus(enc->message, enc->region.sizeIdx, row, col) & DmtxModuleOnRGB)
+               out[col >> 3] |= 0x80 >> (col & 7);
+         }
+      }
+   }
+   else {
+      /* Rows are stored top-down since no image flip was requested */
+      item->width = enc->image->width;
+      item->height = enc->image->height;
+      item->stride = dmtxImageGetProp(enc->image, DmtxPropRowSizeBytes);
+      item->bytes = (unsigned char *)malloc(item->stride * item->height);
+      if(item->bytes != NULL)
+         memcpy(item->bytes, enc->image->pxl, item->stride * item->height);
+   }
+
+   dmtxEncodeDestroy(&enc);
+
+   return item->bytes != NULL;
+}
+
+/* Worker body for dmtx_encode_many(). Must not touch any Python object. */
+static void
+encode_worker(void *arg)
+{
+   EncodeJob *job = (EncodeJob *)arg;
+   EncodeItem *item;
+   int index;
+
+   for(;;) {
+      PyThread_acquire_lock(job->lock, WAIT_LOCK);
+      index = job->stop ? job->count : job->next_item++;
+      PyThread_release_lock(job->lock);
+      if(index >= job->count)
+         break;
 
-   if((start_cb != NULL) && PyCallable_Check(start_cb)) {
-      args = Py_BuildValue("(iiO)", enc->image->width, enc->image->height, context);
-      (void)PyEval_CallObject(start_cb, args);
-      Py_DECREF(args);
+      item = &job->items[index];
+      if(!encode_symbol(job->data[index], job->data_size[index],
+            job->module_size, job->margin_size, job->scheme, job->shape,
+            job->modules, item)) {
+         item->failed = 1;
+         PyThread_acquire_lock(job->lock, WAIT_LOCK);
+         job->stop = 1;
+         PyThread_release_lock(job->lock);
+      }
    }
 
-   for(row = 0; row < enc->image->height; row++) {
-      for(col = 0; col < enc->image->width; col++) {
-         dmtxImageGetPixelValue(enc->image, col, row, 0, &rgb[0]);
-         dmtxImageGetPixelValue(enc->image, col, row, 1, &rgb[1]);
-         dmtxImageGetPixelValue(enc->image, col, row, 2, &rgb[2]);
-         args = Py_BuildValue("(ii(iii)O)", col, row, rgb[0], rgb[1], rgb[2], context);
-         (void)PyEval_CallObject(plotter, args);
-         Py_DECREF(args);
+   PyThread_acquire_lock(job->lock, WAIT_LOCK);
+   if(--job->running == 0)
+      PyThread_release_lock(job->done);
+   PyThread_release_lock(job->lock);
+}
+
+/* Builds the single result of encode_many(): a list of (rows, cols,
+   modules), or (width, height, stride, pixels, boxes) for one white sheet
+   with the rasters stacked from top to bottom and boxes holding the
+   (x, y, width, height) of each */
+static PyObject *
+encode_many_result(EncodeJob *job)
+{
+   PyObject *output, *boxes, *item;
+   unsigned char *sheet;
+   int width = 0, height = 0, stride, y = 0, i, row;
+
+   if(job->modules) {
+      output = PyList_New(job->count);
+      for(i = 0; output != NULL && i < job->count; i++) {
+         item = Py_BuildValue("(iis#)", job->items[i].height,
+               job->items[i].width, job->items[i].bytes,
+               job->items[i].height * job->items[i].stride);
+         if(item == NULL) {
+            Py_DECREF(output);
+            return NULL;
+         }
+         PyList_SET_ITEM(output, i, item);
       }
+      return output;
    }
 
-   if((finish_cb != NULL) && PyCallable_Check(finish_cb)) {
-      args = Py_BuildValue("(O)", context);
-      (void)PyEval_CallObject(finish_cb, args);
-      Py_DECREF(args);
+   for(i = 0; i < job->count; i++) {
+      if(job->items[i].width > width)
+         width = job->items[i].width;
+      height += job->items[i].height;
    }
+   stride = width * 3;
 
-   dmtxEncodeDestroy(&enc);
-   Py_DECREF(context);
+   output = PyString_FromStringAndSize(NULL, (Py_ssize_t)stride * height);
+   boxes = PyList_New(job->count);
+   if(output == NULL || boxes == NULL) {
+      Py_XDECREF(output);
+      Py_XDECREF(boxes);
+      return NULL;
+   }
 
-   return Py_None;
+   sheet = (unsigned char *)PyString_AS_STRING(output);
+   memset(sheet, 0xff, stride * height);
+   for(i = 0; i < job->count; i++) {
+      EncodeItem *e = &job->items[i];
+
+      for(row = 0; row < e->height; row++)
+         memcpy(sheet + (y + row) * stride, e->bytes + row * e->stride, e->width * 3);
+      PyList_SET_ITEM(boxes, i, Py_BuildValue("(iiii)", 0, y, e->width, e->height));
+      y += e->height;
+   }
+
+   item = Py_BuildValue("(iiiNN)", width, height, stride, output, boxes);
+   return item;
+}
+
+/* Frees everything dmtx_encode_many() allocated for a job */
+static void
+free_encode_job(EncodeJob *job)
+{
+   int i;
+
+   if(job->items != NULL) {
+      for(i = 0; i < job->count; i++)
+         free(job->items[i].bytes);
+   }
+   free(job->items);
+   free(job->data);
+   free(job->data_size);
+   if(job->lock != NULL)
+      PyThread_free_lock(job->lock);
+   if(job->done != NULL)
+      PyThread_free_lock(job->done);
+}
+
+/* Encodes every payload of a sequence with the same options on a pool of
+   threads, see encode_many_result() for what comes back */
+static PyObject *
+dmtx_encode_many(PyObject *self, PyObject *arglist, PyObject *kwargs)
+{
+   PyObject *data;
+   PyObject *payloads;
+   PyObject *payload;
+   PyObject *output;
+   EncodeJob job;
+   int module_size = DmtxUndefined;
+   int margin_size = DmtxUndefined;
+   int scheme = DmtxUndefined;
+   int shape = DmtxUndefined;
+   int modules = 0;
+   int thread_count = 0;
+   int started, count, i;
+   static char *kwlist[] = { "data", "module_size", "margin_size",
+                             "scheme", "shape", "modules", "threads", NULL };
+
+   PyObject *filtered_kwargs;
+   filtered_kwargs = filter_kwargs(kwargs, kwlist, 1);
+   if(filtered_kwargs == NULL)
+      return NULL;
+
+   count = PyArg_ParseTupleAndKeywords(arglist, filtered_kwargs, "O|iiiiii",
+         kwlist, &data, &module_size, &margin_size, &scheme, &shape,
+         &modules, &thread_count);
+   Py_DECREF(filtered_kwargs);
+   if(!count)
+      return NULL;
+
+   /* Own the payloads, the caller's list may change while we run */
+   payloads = PySequence_Tuple(data);
+   if(payloads == NULL)
+      return NULL;
+
+   memset(&job, 0x00, sizeof(job));
+   job.count = (int)PyTuple_GET_SIZE(payloads);
+   job.module_size = module_size;
+   job.margin_size = margin_size;
+   job.scheme = scheme;
+   job.shape = shape;
+   job.modules = modules;
+   job.data = (const char **)malloc((job.count + 1) * sizeof(char *));
+   job.data_size = (int *)malloc((job.count + 1) * sizeof(int));
+   job.items = (EncodeItem *)calloc(job.count + 1, sizeof(EncodeItem));
+   job.lock = PyThread_allocate_lock();
+   job.done = PyThread_allocate_lock();
+   if(job.data == NULL || job.data_size == NULL || job.items == NULL ||
+         job.lock == NULL || job.done == NULL) {
+      free_encode_job(&job);
+      Py_DECREF(payloads);
+      return PyErr_NoMemory();
+   }
+
+   for(i = 0; i < job.count; i++) {
+      payload = PyTuple_GET_ITEM(payloads, i);
+      if(!PyString_Check(payload)) {
+         free_encode_job(&job);
+         Py_DECREF(payloads);
+         PyErr_SetString(PyExc_TypeError, "encode_many expects a sequence of strings");
+         return NULL;
+      }
+      job.data[i] = PyString_AS_STRING(payload);
+      job.data_size[i] = (int)PyString_GET_SIZE(payload);
+   }
+
+   thread_count = dmtxCoreThreadCount(thread_count);
+   if(thread_count > job.count)
+      thread_count = job.count;
+
+   Py_BEGIN_ALLOW_THREADS
+   PyThread_acquire_lock(job.done, WAIT_LOCK);
+
+   /* The calling thread works too, so start one thread fewer */
+   job.running = 1;
+   for(started = 1; started < thread_count; started++) {
+      PyThread_acquire_lock(job.lock, WAIT_LOCK);
+      job.running++;
+      PyThread_release_lock(job.lock);
+      if(PyThread_start_new_thread(encode_worker, &job) == (long)-1) {
+         PyThread_acquire_lock(job.lock, WAIT_LOCK);
+         job.running--;
+         PyThread_release_lock(job.lock);
+         break;
+      }
+   }
+
+   encode_worker(&job);
+
+   /* Released by whichever worker finishes last */
+   PyThread_acquire_lock(job.done, WAIT_LOCK);
+   PyThread_release_lock(job.done);
+   Py_END_ALLOW_THREADS
+
+   output = NULL;
+   for(i = 0; i < job.count && !job.items[i].failed; i++)
+      ;
+   if(i < job.count)
+      PyErr_Format(PyExc_ValueError, "Unable to encode message %d (possibly too large for requested size)", i);
+   else
+      output = encode_many_result(&job);
+
+   free_encode_job(&job);
+   Py_DECREF(payloads);
+
+   return output;
 }
 
 static PyObject *
 dmtx_decode(PyObject *self, PyObject *arglist, PyObject *kwargs)
 {
-   int count=0;
-   int found=0;
    int width;
    int height;
-   int gap_size = DmtxUndefined;
-   int max_count = DmtxUndefined;
-   int timeout = DmtxUndefined;
-   int shape = DmtxUndefined;
-   int deviation = DmtxUndefined;
-   int threshold = DmtxUndefined;
-   int shrink = 1;
-   int corrections = DmtxUndefined;
-   int min_edge = DmtxUndefined;
-   int max_edge = DmtxUndefined;
+   int stride = DmtxUndefined;
+   int packing = DmtxPack24bppRGB;
+   DecodeOptions opts;
+
+   int near[8];
+   int padding = DmtxUndefined;
 
    PyObject *dataBuf = NULL;
-   Py_ssize_t dataLen;
-   PyObject *context = Py_None;
-   PyObject *output = PyList_New(0);
+   PyObject *context = Py_None; /* Accepted for compatibility, unused */
+   PyObject *nearObj = Py_None;
+   PyObject *statsObj = Py_None;
+   PyObject *filtered_kwargs;
+   PyObject *output;
 
-   DmtxTime dmtx_timeout;
-   DmtxImage *img;
-   DmtxDecode *dec;
-   DmtxRegion *reg;
-   DmtxMessage *msg;
-   DmtxVector2 p00, p10, p11, p01;
-   const char *pxl; /* Input image buffer */
+   DmtxCoreDecoder decoder;
+   DmtxCoreStats stats;
+   double start;
+   Py_buffer view; /* Input image buffer, referenced without copying */
 
    static char *kwlist[] = { "width", "height", "data", "gap_size",
                              "max_count", "context", "timeout", "shape",
                              "deviation", "threshold", "shrink", "corrections",
-                             "min_edge", "max_edge", NULL };
+                             "min_edge", "max_edge", "stride", "packing",
+                             "threads", "tile_overlap", "x_min", "x_max",
+                             "y_min", "y_max", "near", "padding", "pyramid",
+                             "cancel", "stats", NULL };
 
-   /* Parse out the options which are applicable */
-   PyObject *filtered_kwargs;
-   filtered_kwargs = PyDict_New();
-   count = 3; /* Skip the first 3 keywords as they are sent in arglist */
-   while(kwlist[count]){
-      if(PyDict_GetItemString(kwargs, kwlist[count])) {
-         PyDict_SetItemString(filtered_kwargs, kwlist[count],
-               PyDict_GetItemString(kwargs, kwlist[count]));
-      }
-      count++;
-   }
+   init_decode_options(&opts);
+
+   /* Parse out the options which are applicable, skipping the first 3
+      keywords as they are sent in arglist */
+   filtered_kwargs = filter_kwargs(kwargs, kwlist, 3);
+   if(filtered_kwargs == NULL)
+      return NULL;
 
    /* Get parameters from Python for libdmtx */
-   if(!PyArg_ParseTupleAndKeywords(arglist, filtered_kwargs, "iiOi|iOiiiiiiii",
-         kwlist, &width, &height, &dataBuf, &gap_size, &max_count, &context,
-         &timeout, &shape, &deviation, &threshold, &shrink, &corrections,
-         &min_edge, &max_edge)) {
+   if(!PyArg_ParseTupleAndKeywords(arglist, filtered_kwargs, "iiOi|iOiiiiiiiiiiiiiiiOiiOO",
+         kwlist, &width, &height, &dataBuf, &opts.gap_size, &opts.max_count,
+         &context, &opts.timeout, &opts.shape, &opts.deviation,
+         &opts.threshold, &opts.shrink, &opts.corrections, &opts.min_edge,
+         &opts.max_edge, &stride, &packing, &opts.threads,
+         &opts.tile_overlap, &opts.x_min, &opts.x_max, &opts.y_min,
+         &opts.y_max, &nearObj, &padding, &opts.pyramid, &opts.cancel,
+         &statsObj)) {
+      Py_DECREF(filtered_kwargs);
       PyErr_SetString(PyExc_TypeError, "decode takes at least 3 arguments");
       return NULL;
    }
+   Py_DECREF(filtered_kwargs);
 
-   Py_INCREF(context);
-
-   /* Reset timeout for each new page */
-   if(timeout != DmtxUndefined)
-      dmtx_timeout = dmtxTimeAdd(dmtxTimeNow(), timeout);
+   /* Borrowed from kwargs, which outlives the call */
+   if(opts.cancel == Py_None)
+      opts.cancel = NULL;
 
    if(dataBuf == NULL) {
       PyErr_SetString(PyExc_TypeError, "Interleaved bitmapped data in buffer missing");
       return NULL;
    }
 
-   PyObject_AsCharBuffer(dataBuf, &pxl, &dataLen);
+   if(nearObj != Py_None && get_corners(nearObj, near) != 0)
+      return NULL;
 
-   img = dmtxImageCreate((unsigned char *)pxl, width, height, DmtxPack24bppRGB);
-   if(img == NULL)
+   if(statsObj != Py_None && !PyDict_Check(statsObj)) {
+      PyErr_SetString(PyExc_TypeError, "stats must be a dict");
       return NULL;
+   }
+   memset(&stats, 0x00, sizeof(stats));
 
-   dec = dmtxDecodeCreate(img, shrink);
-   if(dec == NULL) {
-      dmtxImageDestroy(&img);
+   if(get_pixel_buffer(dataBuf, &view) != 0)
+      return NULL;
+
+   start = dmtxCoreClock();
+   dmtxCoreDecoderInit(&decoder);
+   if(prepare_decoder(&decoder, &view, width, height, packing, stride, &opts) != 0) {
+      dmtxCoreDecoderClear(&decoder);
+      PyBuffer_Release(&view);
       return NULL;
    }
+   stats.setupUs += dmtxCoreClock() - start;
 
-   if(gap_size != DmtxUndefined)
-      dmtxDecodeSetProp(dec, DmtxPropScanGap, gap_size);
+   output = run_scan(&decoder, &opts, (nearObj != Py_None) ? near : NULL,
+         padding, &stats);
 
-   if(shape != DmtxUndefined)
-      dmtxDecodeSetProp(dec, DmtxPropSymbolSize, shape);
+   dmtxCoreDecoderClear(&decoder);
+   PyBuffer_Release(&view);
+   if(output != NULL && statsObj != Py_None && stats_export(&stats, statsObj) != 0)
+      Py_CLEAR(output);
 
-   if(deviation != DmtxUndefined)
-      dmtxDecodeSetProp(dec, DmtxPropSquareDevn, deviation);
+   return output;
+}
 
-   if(threshold != DmtxUndefined)
-      dmtxDecodeSetProp(dec, DmtxPropEdgeThresh, threshold);
+static int
+Decoder_init(DecoderObject *self, PyObject *arglist, PyObject *kwargs)
+{
+   PyObject *filtered_kwargs;
+   int result;
 
-   if(min_edge != DmtxUndefined)
-      dmtxDecodeSetProp(dec, DmtxPropEdgeMin, min_edge);
+   static char *kwlist[] = { "gap_size", "max_count", "timeout", "shape",
+                             "deviation", "threshold", "shrink", "corrections",
+                             "min_edge", "max_edge", "x_min", "x_max",
+                             "y_min", "y_max", "pyramid", NULL };
 
-   if(max_edge != DmtxUndefined)
-      dmtxDecodeSetProp(dec, DmtxPropEdgeMax, max_edge);
+   init_decode_options(&self->options);
 
-   for(count=1; ;count++) {
-      Py_BEGIN_ALLOW_THREADS
-      if(timeout == DmtxUndefined)
-         reg = dmtxRegionFindNext(dec, NULL);
-      else
-         reg = dmtxRegionFindNext(dec, &dmtx_timeout);
-      Py_END_ALLOW_THREADS
+   filtered_kwargs = filter_kwargs(kwargs, kwlist, 0);
+   if(filtered_kwargs == NULL)
+      return -1;
 
-      /* Finished file or ran out of time before finding another region */
-      if(reg == NULL)
-         break;
+   result = PyArg_ParseTupleAndKeywords(arglist, filtered_kwargs, "|iiiiiiiiiiiiiii",
+         kwlist, &self->options.gap_size, &self->options.max_count,
+         &self->options.timeout, &self->options.shape, &self->options.deviation,
+         &self->options.threshold, &self->options.shrink,
+         &self->options.corrections, &self->options.min_edge,
+         &self->options.max_edge, &self->options.x_min, &self->options.x_max,
+         &self->options.y_min, &self->options.y_max, &self->options.pyramid);
+   Py_DECREF(filtered_kwargs);
 
-      msg = dmtxDecodeMatrixRegion(dec, reg, corrections);
-      if(msg != NULL) {
-         p00.X = p00.Y = p10.Y = p01.X = 0.0;
-         p10.X = p01.Y = p11.X = p11.Y = 1.0;
-         dmtxMatrix3VMultiplyBy(&p00, reg->fit2raw);
-         dmtxMatrix3VMultiplyBy(&p10, reg->fit2raw);
-         dmtxMatrix3VMultiplyBy(&p11, reg->fit2raw);
-         dmtxMatrix3VMultiplyBy(&p01, reg->fit2raw);
-
-         PyList_Append(output, Py_BuildValue("s#((ii)(ii)(ii)(ii))", msg->output, msg->outputIdx,
-               (int)((shrink * p00.X) + 0.5), height - 1 - (int)((shrink * p00.Y) + 0.5),
-               (int)((shrink * p10.X) + 0.5), height - 1 - (int)((shrink * p10.Y) + 0.5),
-               (int)((shrink * p11.X) + 0.5), height - 1 - (int)((shrink * p11.Y) + 0.5),
-               (int)((shrink * p01.X) + 0.5), height - 1 - (int)((shrink * p01.Y) + 0.5)));
-
-         Py_INCREF(output);
-         dmtxMessageDestroy(&msg);
-         found++;
-      }
+   return result ? 0 : -1;
+}
 
-      dmtxRegionDestroy(&reg);
+static void
+Decoder_dealloc(DecoderObject *self)
+{
+   dmtxCoreDecoderClear(&self->decoder);
+
+   Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static PyObject *
+Decoder_decode(DecoderObject *self, PyObject *arglist, PyObject *kwargs)
+{
+   int width;
+   int height;
+   int stride = DmtxUndefined;
+   int packing = DmtxPack24bppRGB;
+   int near[8];
+   int padding = DmtxUndefined;
 
-      /* Stop if we've reached maximium count */
-      if(max_count != DmtxUndefined)
-         if(found >= max_count) break;
+   PyObject *dataBuf;
+   PyObject *nearObj = Py_None;
+   PyObject *cancel = Py_None;
+   PyObject *statsObj = Py_None;
+   PyObject *output;
+   DmtxCoreStats stats;
+   double start;
+   Py_buffer view;
+
+   static char *kwlist[] = { "width", "height", "data", "stride", "packing",
+                             "near", "padding", "cancel", "stats", NULL };
+
+   if(!PyArg_ParseTupleAndKeywords(arglist, kwargs, "iiO|iiOiOO", kwlist, &width,
+         &height, &dataBuf, &stride, &packing, &nearObj, &padding, &cancel,
+         &statsObj))
+      return NULL;
+
+   if(nearObj != Py_None && get_corners(nearObj, near) != 0)
+      return NULL;
+
+   if(statsObj != Py_None && !PyDict_Check(statsObj)) {
+      PyErr_SetString(PyExc_TypeError, "stats must be a dict");
+      return NULL;
    }
+   memset(&stats, 0x00, sizeof(stats));
 
-   dmtxDecodeDestroy(&dec);
-   dmtxImageDestroy(&img);
-   Py_DECREF(context);
-   if(output == NULL) {
-      Py_INCREF(Py_None);
-      return Py_None;
+   /* The GIL is released while scanning, so another thread could otherwise
+      enter with the same decoder */
+   if(self->busy) {
+      PyErr_SetString(PyExc_RuntimeError, "Decoder is in use by another thread");
+      return NULL;
+   }
+
+   if(get_pixel_buffer(dataBuf, &view) != 0)
+      return NULL;
+
+   self->busy = 1;
+
+   /* Same geometry as the previous frame keeps the scan buffers */
+   start = dmtxCoreClock();
+   if(prepare_decoder(&self->decoder, &view, width, height, packing, stride,
+         &self->options) != 0) {
+      self->busy = 0;
+      PyBuffer_Release(&view);
+      return NULL;
    }
+   stats.setupUs += dmtxCoreClock() - start;
+
+   /* Only for this call; cancel is kept alive by arglist or kwargs */
+   self->options.cancel = (cancel != Py_None) ? cancel : NULL;
+
+   output = run_scan(&self->decoder, &self->options,
+         (nearObj != Py_None) ? near : NULL, padding, &stats);
+
+   /* The frame belongs to the caller, so never keep pointing at it */
+   self->options.cancel = NULL;
+   self->decoder.image->pxl = NULL;
+   self->busy = 0;
+   PyBuffer_Release(&view);
+
+   if(output != NULL && statsObj != Py_None && stats_export(&stats, statsObj) != 0)
+      Py_CLEAR(output);
 
    return output;
 }
 
-PyMODINIT_FUNC
-init_pydmtx(void)
+static PyObject *
+dmtx_scan(PyObject *self, PyObject *arglist, PyObject *kwargs)
 {
-   (void)Py_InitModule("_pydmtx", dmtxMethods);
+   int width;
+   int height;
+   int stride = DmtxUndefined;
+   int packing = DmtxPack24bppRGB;
+   PyObject *dataBuf = NULL;
+   PyObject *filtered_kwargs;
+   ScanObject *scan;
+
+   static char *kwlist[] = { "width", "height", "data", "gap_size",
+                             "max_count", "timeout", "shape", "deviation",
+                             "threshold", "shrink", "corrections",
+                             "min_edge", "max_edge", "stride", "packing",
+                             "x_min", "x_max", "y_min", "y_max", NULL };
+
+   scan = PyObject_New(ScanObject, &ScanType);
+   if(scan == NULL)
+      return NULL;
+
+   init_decode_options(&scan->options);
+   dmtxCoreDecoderInit(&scan->decoder);
+   dmtxCoreScanInit(&scan->scan);
+   scan->found = 0;
+   scan->busy = 0;
+   scan->has_view = 0;
+
+   filtered_kwargs = filter_kwargs(kwargs, kwlist, 3);
+   if(filtered_kwargs == NULL) {
+      Py_DECREF(scan);
+      return NULL;
+   }
+
+   if(!PyArg_ParseTupleAndKeywords(arglist, filtered_kwargs, "iiO|iiiiiiiiiiiiiiii",
+         kwlist, &width, &height, &dataBuf, &scan->options.gap_size,
+         &scan->options.max_count, &scan->options.timeout,
+         &scan->options.shape, &scan->options.deviation,
+         &scan->options.threshold, &scan->options.shrink,
+         &scan->options.corrections, &scan->options.min_edge,
+         &scan->options.max_edge, &stride, &packing, &scan->options.x_min,
+         &scan->options.x_max, &scan->options.y_min, &scan->options.y_max)) {
+      Py_DECREF(filtered_kwargs);
+      Py_DECREF(scan);
+      return NULL;
+   }
+   Py_DECREF(filtered_kwargs);
+
+   /* The buffer is held until the scan is exhausted or dropped */
+   if(get_pixel_buffer(dataBuf, &scan->view) != 0) {
+      Py_DECREF(scan);
+      return NULL;
+   }
+   scan->has_view = 1;
+
+   if(prepare_decoder(&scan->decoder, &scan->view, width, height, packing,
+         stride, &scan->options) != 0) {
+      Py_DECREF(scan);
+      return NULL;
+   }
+
+   /* One timeout covers the whole scan, however slowly it is consumed */
+   scan->scan.timeoutMs = scan->options.timeout;
+   scan->scan.corrections = scan->options.corrections;
+   dmtxCoreScanStart(&scan->scan);
+
+   return (PyObject *)scan;
+}
+
+/* Free the libdmtx structures and let go of the caller's buffer */
+static void
+scan_release(ScanObject *self)
+{
+   dmtxCoreScanFree(&self->scan);
+   dmtxCoreDecoderClear(&self->decoder);
+
+   if(self->has_view) {
+      PyBuffer_Release(&self->view);
+      self->has_view = 0;
+   }
+}
+
+static void
+Scan_dealloc(ScanObject *self)
+{
+   scan_release(self);
+   PyObject_Del(self);
+}
+
+/* Scan on until the next symbol decodes and return it as (message,
+   corners). The scan state is released as soon as it is exhausted. */
+static PyObject *
+Scan_next(ScanObject *self)
+{
+   DmtxCoreResult result;
+   DmtxPassFail err;
+   PyObject *item;
+
+   if(self->busy) {
+      PyErr_SetString(PyExc_RuntimeError, "Scan is in use by another thread");
+      return NULL;
+   }
+
+   self->busy = 1;
+
+   if(self->decoder.decode != NULL && (self->options.max_count == DmtxUndefined ||
+         self->found < self->options.max_count)) {
+      /* Regions which do not decode are skipped without coming back */
+      Py_BEGIN_ALLOW_THREADS
+      do {
+         err = dmtxCoreScanNext(&self->scan, self->decoder.decode, &result);
+      } while(err == DmtxPass && result.status != DmtxCoreDecoded);
+      Py_END_ALLOW_THREADS
+
+      if(err == DmtxPass) {
+         item = result_item(result.message, result.messageSize, result.corners);
+         self->found++;
+         self->busy = 0;
+         return item;
+      }
+
+      if(self->scan.failed) {
+         scan_release(self);
+         self->busy = 0;
+         return PyErr_NoMemory();
+      }
+   }
+
+   scan_release(self);
+   self->busy = 0;
+
+   return NULL;
+}
+
+static PyObject *
+dmtx_profile(PyObject *self, PyObject *arglist)
+{
+   const char *name;
+   DmtxProfile profile;
+
+   if(!PyArg_ParseTuple(arglist, "s", &name))
+      return NULL;
+
+   if(dmtxProfileInit(&profile, dmtxProfileLookup(name)) != DmtxPass) {
+      PyErr_Format(PyExc_ValueError, "Unknown profile '%s'", name);
+      return NULL;
+   }
+
+   return profile_options(&profile);
+}
+
+/* Calibrate a profile on a sequence of (width, height, data[, stride[,
+   packing]]) samples. The search keywords given are kept as they are; the
+   others are derived from the symbols found with the defaults. */
+static PyObject *
+dmtx_calibrate(PyObject *self, PyObject *arglist, PyObject *kwargs)
+{
+   int i;
+   int count;
+   int width, height, stride, packing, row_stride;
+   int timeout = DmtxUndefined;
+   int failed = 0;
+   DmtxPassFail status;
+   DmtxProfile start;
+   DmtxCalibration calib;
+   DmtxImage **images;
+   Py_buffer *views;
+   PyObject *samplesObj;
+   PyObject *samples;
+   PyObject *dataBuf;
+   PyObject *filtered_kwargs;
+   PyObject *options;
+   PyObject *output;
+
+   static char *kwlist[] = { "samples", "timeout", "shape", "min_edge",
+                             "max_edge", "gap_size", "deviation", "threshold",
+                             "shrink", NULL };
+
+   dmtxProfileInit(&start, DmtxProfileDefault);
+
+   filtered_kwargs = filter_kwargs(kwargs, kwlist, 1);
+   if(filtered_kwargs == NULL)
+      return NULL;
+
+   if(!PyArg_ParseTupleAndKeywords(arglist, filtered_kwargs, "O|iiiiiiii",
+         kwlist, &samplesObj, &timeout, &start.sizeIdxExpected, &start.edgeMin,
+         &start.edgeMax, &start.scanGap, &start.squareDevn, &start.edgeThresh,
+         &start.shrink)) {
+      Py_DECREF(filtered_kwargs);
+      return NULL;
+   }
+   Py_DECREF(filtered_kwargs);
+
+   /* A shrink of 1 is what decode() uses when none is given, so it is left
+      for the calibration to pick */
+   if(start.shrink <= 1)
+      start.shrink = DmtxUndefined;
+
+   samples = PySequence_Fast(samplesObj, "samples must be a sequence of (width, height, data) tuples");
+   if(samples == NULL)
+      return NULL;
+
+   count = (int)PySequence_Fast_GET_SIZE(samples);
+   if(count == 0) {
+      Py_DECREF(samples);
+      PyErr_SetString(PyExc_ValueError, "No samples given");
+      return NULL;
+   }
+
+   images = (DmtxImage **)calloc(count, sizeof(DmtxImage *));
+   views = (Py_buffer *)calloc(count, sizeof(Py_buffer));
+   if(images == NULL || views == NULL) {
+      free(images);
+      free(views);
+      Py_DECREF(samples);
+      return PyErr_NoMemory();
+   }
+
+   for(i = 0; i < count; i++) {
+      stride = DmtxUndefined;
+      packing = DmtxPack24bppRGB;
+      if(!PyArg_ParseTuple(PySequence_Fast_GET_ITEM(samples, i), "iiO|ii",
+            &width, &height, &dataBuf, &stride, &packing) ||
+            get_pixel_buffer(dataBuf, &views[i]) != 0) {
+         failed = 1;
+         break;
+      }
+
+      images[i] = create_image(&views[i], width, height, packing, stride, &row_stride);
+      if(images[i] == NULL) {
+         PyBuffer_Release(&views[i]);
+         failed = 1;
+         break;
+      }
+   }
+
+   /* The samples are decoded many times over */
+   output = NULL;
+   if(!failed) {
+      Py_BEGIN_ALLOW_THREADS
+      status = dmtxProfileCalibrate(&calib, images, count, &start, timeout);
+      Py_END_ALLOW_THREADS
+
+      if(status != DmtxPass) {
+         PyErr_SetString(PyExc_ValueError, "No symbol found in the samples");
+      }
+      else {
+         options = profile_options(&calib.profile);
+         if(options != NULL) {
+            output = Py_BuildValue("{s:N,s:i,s:d,s:d,s:d}",
+                  "options", options,
+                  "symbols", calib.symbolCount,
+                  "default_ms", calib.defaultMs,
+                  "profile_ms", calib.profileMs,
+                  "speedup", calib.speedup);
+         }
+      }
+   }
+
+   for(i = 0; i < count && images[i] != NULL; i++) {
+      dmtxImageDestroy(&images[i]);
+      PyBuffer_Release(&views[i]);
+   }
+   free(images);
+   free(views);
+   Py_DECREF(samples);
+
+   return output;
+}
+
+/* Decode keywords of a profile, ready to be passed to decode() */
+static PyObject *
+profile_options(const DmtxProfile *profile)
+{
+   return Py_BuildValue("{s:i,s:i,s:i,s:i,s:i,s:i,s:i}",
+         "shape", profile->sizeIdxExpected,
+         "min_edge", profile->edgeMin,
+         "max_edge", profile->edgeMax,
+         "gap_size", profile->scanGap,
+         "deviation", profile->squareDevn,
+         "threshold", profile->edgeThresh,
+         "shrink", dmtxProfileGetShrink(profile));
+}
+
+static void
+init_decode_options(DecodeOptions *opts)
+{
+   opts->gap_size = DmtxUndefined;
+   opts->max_count = DmtxUndefined;
+   opts->timeout = DmtxUndefined;
+   opts->shape = DmtxUndefined;
+   opts->deviation = DmtxUndefined;
+   opts->threshold = DmtxUndefined;
+   opts->shrink = 1;
+   opts->corrections = DmtxUndefined;
+   opts->min_edge = DmtxUndefined;
+   opts->max_edge = DmtxUndefined;
+   opts->threads = 1;
+   opts->tile_overlap = DmtxUndefined;
+   opts->x_min = DmtxUndefined;
+   opts->x_max = DmtxUndefined;
+   opts->y_min = DmtxUndefined;
+   opts->y_max = DmtxUndefined;
+   opts->pyramid = DmtxUndefined;
+   opts->cancel = NULL;
+}
+
+static void
+apply_decode_options(DmtxDecode *dec, DecodeOptions *opts)
+{
+   int width, height;
+
+   if(opts->gap_size != DmtxUndefined)
+      dmtxDecodeSetProp(dec, DmtxPropScanGap, opts->gap_size);
+
+   if(opts->shape != DmtxUndefined)
+      dmtxDecodeSetProp(dec, DmtxPropSymbolSize, opts->shape);
+
+   if(opts->deviation != DmtxUndefined)
+      dmtxDecodeSetProp(dec, DmtxPropSquareDevn, opts->deviation);
+
+   if(opts->threshold != DmtxUndefined)
+      dmtxDecodeSetProp(dec, DmtxPropEdgeThresh, opts->threshold);
+
+   if(opts->min_edge != DmtxUndefined)
+      dmtxDecodeSetProp(dec, DmtxPropEdgeMin, opts->min_edge);
+
+   if(opts->max_edge != DmtxUndefined)
+      dmtxDecodeSetProp(dec, DmtxPropEdgeMax, opts->max_edge);
+
+   /* Bounds left out reach the edge of the image; bounds outside of it
+      are ignored as libdmtx would */
+   if(opts->x_min != DmtxUndefined || opts->x_max != DmtxUndefined ||
+         opts->y_min != DmtxUndefined || opts->y_max != DmtxUndefined) {
+      width = dmtxImageGetProp(dec->image, DmtxPropWidth);
+      height = dmtxImageGetProp(dec->image, DmtxPropHeight);
+      dmtxCoreSetImageBounds(dec,
+            (opts->x_min != DmtxUndefined) ? opts->x_min : 0,
+            (opts->x_max != DmtxUndefined) ? opts->x_max : width - 1,
+            (opts->y_min != DmtxUndefined) ? opts->y_min : 0,
+            (opts->y_max != DmtxUndefined) ? opts->y_max : height - 1);
+   }
+}
+
+/* Point decoder at the caller's pixels, honoring row padding, and apply
+   opts when its DmtxDecode had to be created anew. Returns -1 with an
+   exception set on failure. */
+static int
+prepare_decoder(DmtxCoreDecoder *decoder, Py_buffer *view, int width,
+      int height, int packing, int stride, DecodeOptions *opts)
+{
+   int bytes_per_pixel;
+   int row_stride;
+   DmtxPassFail err;
+
+   bytes_per_pixel = dmtxCoreBytesPerPixel(packing);
+   if(bytes_per_pixel == 0 || width <= 0 || height <= 0) {
+      PyErr_SetString(PyExc_ValueError, "Unsupported image size or pixel packing");
+      return -1;
+   }
+
+   /* Rows may be padded, either by the exporter's strides or explicitly */
+   row_stride = get_row_stride(view, width, height, bytes_per_pixel, stride);
+   if(row_stride < 0)
+      return -1;
+
+   /* Allocating and clearing the scan cache can take a while */
+   Py_BEGIN_ALLOW_THREADS
+   err = dmtxCoreDecoderPrepare(decoder, (unsigned char *)view->buf, width,
+         height, row_stride, packing, opts->shrink);
+   if(err == DmtxPass && decoder->fresh)
+      apply_decode_options(decoder->decode, opts);
+   Py_END_ALLOW_THREADS
+
+   if(err != DmtxPass) {
+      PyErr_NoMemory();
+      return -1;
+   }
+
+   return 0;
+}
+
+/* Wrap the caller's pixels in a DmtxImage, honoring row padding */
+static DmtxImage *
+create_image(Py_buffer *view, int width, int height, int packing, int stride,
+      int *row_stride)
+{
+   DmtxImage *img;
+   int bytes_per_pixel;
+
+   img = dmtxImageCreate((unsigned char *)view->buf, width, height, packing);
+   if(img == NULL) {
+      PyErr_SetString(PyExc_ValueError, "Unsupported image size or pixel packing");
+      return NULL;
+   }
+
+   /* Rows may be padded, either by the exporter's strides or explicitly */
+   bytes_per_pixel = dmtxImageGetProp(img, DmtxPropBytesPerPixel);
+   *row_stride = get_row_stride(view, width, height, bytes_per_pixel, stride);
+   if(*row_stride < 0) {
+      dmtxImageDestroy(&img);
+      return NULL;
+   }
+
+   dmtxImageSetProp(img, DmtxPropRowPadBytes, *row_stride - width * bytes_per_pixel);
+
+   return img;
+}
+
+/* Scan the prepared decoder as opts ask, around near first if it is not
+   NULL, and return a list of (message, corners). The GIL is released
+   while scanning; the scan only takes it back to call cancel.is_set().
+   Time and counters are added to stats. */
+static PyObject *
+run_scan(DmtxCoreDecoder *decoder, DecodeOptions *opts, const int *near,
+      int padding, DmtxCoreStats *stats)
+{
+   ScanRun run;
+   const ScanFound *found;
+   size_t i, count;
+   double start;
+   PyObject *output;
+   PyObject *item;
+
+   memset(&run, 0x00, sizeof(run));
+   dmtxCoreScanInit(&run.scan);
+   run.scan.maxCount = opts->max_count;
+   run.scan.timeoutMs = opts->timeout;
+   run.scan.corrections = opts->corrections;
+   run.scan.threads = opts->threads;
+   run.scan.tileOverlap = opts->tile_overlap;
+   if(opts->pyramid != DmtxUndefined)
+      run.scan.pyramid = opts->pyramid;
+   run.scan.result = scan_result;
+   run.scan.resultContext = &run;
+   if(opts->cancel != NULL) {
+      run.cancel = opts->cancel;
+      run.scan.cancel = scan_cancelled;
+      run.scan.cancelContext = &run;
+   }
+
+   /* Full scan unless tracking found the symbol again */
+   Py_BEGIN_ALLOW_THREADS
+   dmtxCoreScanStart(&run.scan);
+   if(near != NULL)
+      dmtxCoreScanNear(&run.scan, decoder->decode, near, padding);
+   if(run.scan.found == 0 && !run.scan.stopped)
+      dmtxCoreDecoderScan(decoder, &run.scan);
+   Py_END_ALLOW_THREADS
+
+   output = NULL;
+   if(run.error)
+      ; /* is_set() raised, its exception is pending */
+   else if(run.failed || run.scan.failed)
+      PyErr_NoMemory();
+   else
+      output = PyList_New(0);
+
+   start = dmtxCoreClock();
+   found = (const ScanFound *)run.found.data;
+   count = run.found.size / sizeof(ScanFound);
+   for(i = 0; output != NULL && i < count; i++) {
+      item = result_item(run.text.data + found[i].offset,
+            found[i].message_size, found[i].corners);
+      if(item == NULL || PyList_Append(output, item) != 0)
+         Py_CLEAR(output);
+      Py_XDECREF(item);
+   }
+   run.scan.stats.marshalUs += dmtxCoreClock() - start;
+
+   dmtxCoreStatsAdd(stats, &run.scan.stats);
+   dmtxCoreArenaFree(&run.found);
+   dmtxCoreArenaFree(&run.text);
+   dmtxCoreScanFree(&run.scan);
+
+   return output;
+}
+
+/* Result callback of run_scan(), keeping the symbol in C until the GIL is
+   back */
+static int
+scan_result(void *context, const DmtxCoreResult *result)
+{
+   ScanRun *run = (ScanRun *)context;
+   ScanFound found;
+
+   memcpy(found.corners, result->corners, sizeof(found.corners));
+   found.offset = run->text.size;
+   found.message_size = result->messageSize;
+
+   if(dmtxCoreArenaAppend(&run->text, result->message, result->messageSize) != DmtxPass ||
+         dmtxCoreArenaAppend(&run->found, &found, sizeof(found)) != DmtxPass) {
+      run->failed = 1;
+      return 0;
+   }
+
+   return 1;
+}
+
+/* Cancel callback of run_scan(), called every DMTX_CORE_POLL_MS without
+   the GIL. A failing is_set() stops the scan with its exception left set. */
+static int
+scan_cancelled(void *context)
+{
+   ScanRun *run = (ScanRun *)context;
+   PyGILState_STATE state;
+   int cancelled;
+
+   if(run->error)
+      return 1;
+
+   state = PyGILState_Ensure();
+   cancelled = is_cancelled(run->cancel);
+   PyGILState_Release(state);
+
+   if(cancelled < 0)
+      run->error = 1;
+
+   return cancelled != 0;
+}
+
+/* Whether the decode was asked to stop through its cancel option, e.g. a
+   threading.Event. Returns -1 with an exception set if is_set() failed.
+   Needs the GIL. */
+static int
+is_cancelled(PyObject *cancel)
+{
+   PyObject *result;
+   int cancelled;
+
+   result = PyObject_CallMethod(cancel, "is_set", NULL);
+   if(result == NULL)
+      return -1;
+
+   cancelled = PyObject_IsTrue(result);
+   Py_DECREF(result);
+
+   return cancelled;
+}
+
+/* Store stats in dict as setup_us, search_us, decode_us, marshal_us,
+   regions_examined, regions_rejected and bytes_copied. Returns -1 with an
+   exception set on failure. Needs the GIL. */
+static int
+stats_export(const DmtxCoreStats *stats, PyObject *dict)
+{
+   PyObject *values;
+   int result;
+
+   values = Py_BuildValue("{s:l,s:l,s:l,s:l,s:l,s:l,s:l}",
+         "setup_us", (long)(stats->setupUs + 0.5),
+         "search_us", (long)(stats->searchUs + 0.5),
+         "decode_us", (long)(stats->decodeUs + 0.5),
+         "marshal_us", (long)(stats->marshalUs + 0.5),
+         "regions_examined", stats->regionsExamined,
+         "regions_rejected", stats->regionsRejected,
+         "bytes_copied", stats->bytesCopied);
+   if(values == NULL)
+      return -1;
+
+   result = PyDict_Update(dict, values);
+   Py_DECREF(values);
+
+   return result;
+}
+
+/* The (message, corners) tuple of a decoded symbol. Needs the GIL. */
+static PyObject *
+result_item(const unsigned char *message, int message_size,
+      const int *corners)
+{
+   return Py_BuildValue("s#((ii)(ii)(ii)(ii))", message, message_size,
+         corners[0], corners[1], corners[2], corners[3],
+         corners[4], corners[5], corners[6], corners[7]);
+}
+
+static PyObject *
+filter_kwargs(PyObject *kwargs, char **kwlist, int first)
+{
+   PyObject *filtered_kwargs;
+   PyObject *value;
+   int count;
+
+   filtered_kwargs = PyDict_New();
+   if(filtered_kwargs == NULL || kwargs == NULL)
+      return filtered_kwargs;
+
+   for(count = first; kwlist[count]; count++) {
+      value = PyDict_GetItemString(kwargs, kwlist[count]);
+      if(value != NULL)
+         PyDict_SetItemString(filtered_kwargs, kwlist[count], value);
+   }
+
+   return filtered_kwargs;
+}
+
+/* Call a Python callback, dropping its result; steals args, which may be
+   NULL if building them failed. Returns -1 with the exception set if the
+   call raised. */
+static int
+call_callback(PyObject *callback, PyObject *args)
+{
+   PyObject *result;
+
+   if(args == NULL)
+      return -1;
+
+   result = PyObject_CallObject(callback, args);
+   Py_DECREF(args);
+   if(result == NULL)
+      return -1;
+
+   Py_DECREF(result);
+   return 0;
+}
+
+/* Read corners given as four (x, y) pairs, as returned by decode() */
+static int
+get_corners(PyObject *obj, int *corners)
+{
+   PyObject *seq;
+   int i;
+
+   seq = PySequence_Fast(obj, "near must be a sequence of four (x, y) pairs");
+   if(seq == NULL)
+      return -1;
+
+   if(PySequence_Fast_GET_SIZE(seq) != 4) {
+      Py_DECREF(seq);
+      PyErr_SetString(PyExc_TypeError, "near must be a sequence of four (x, y) pairs");
+      return -1;
+   }
+
+   for(i = 0; i < 4; i++) {
+      if(!PyArg_Parse(PySequence_Fast_GET_ITEM(seq, i), "(ii)",
+            &corners[2 * i], &corners[2 * i + 1])) {
+         Py_DECREF(seq);
+         return -1;
+      }
+   }
+
+   Py_DECREF(seq);
+   return 0;
+}
+
+/* Borrow a read-only view of an object's pixels without copying them */
+static int
+get_pixel_buffer(PyObject *obj, Py_buffer *view)
+{
+#if PY_MAJOR_VERSION < 3
+   const void *buf;
+   Py_ssize_t len;
+
+   /* Old-style buffer objects (e.g., buffer()) lack the new protocol */
+   if(!PyObject_CheckBuffer(obj)) {
+      if(PyObject_AsReadBuffer(obj, &buf, &len) != 0)
+         return -1;
+      return PyBuffer_FillInfo(view, obj, (void *)buf, len, 1, PyBUF_SIMPLE);
+   }
+#endif
+
+   return PyObject_GetBuffer(obj, view, PyBUF_STRIDED_RO);
+}
+
+/* Determine the distance in bytes between rows and validate the buffer
+   size. Multi-dimensional exporters (e.g., numpy) describe the row stride
+   themselves; flat buffers use the explicit stride or are tightly packed. */
+static int
+get_row_stride(Py_buffer *view, int width, int height, int bytes_per_pixel,
+      int stride)
+{
+   int i;
+   Py_ssize_t row_bytes = (Py_ssize_t)width * bytes_per_pixel;
+   Py_ssize_t contiguous;
+
+   if(view->ndim > 1 && view->strides != NULL) {
+      /* Pixels within a row must be contiguous */
+      contiguous = view->itemsize;
+      for(i = view->ndim - 1; i > 0; i--) {
+         if(view->strides[i] != contiguous) {
+            PyErr_SetString(PyExc_ValueError, "Rows must be contiguous in memory");
+            return -1;
+         }
+         contiguous *= view->shape[i];
+      }
+
+      if(contiguous != row_bytes) {
+         PyErr_SetString(PyExc_ValueError, "Buffer shape does not match width and packing");
+         return -1;
+      }
+
+      stride = (int)view->strides[0];
+   }
+   else if(view->ndim == 1 && view->strides != NULL &&
+         view->strides[0] != view->itemsize) {
+      PyErr_SetString(PyExc_ValueError, "Buffer must be contiguous");
+      return -1;
+   }
+   else if(stride == DmtxUndefined) {
+      stride = (int)row_bytes;
+   }
+
+   if(stride < row_bytes) {
+      PyErr_SetString(PyExc_ValueError, "Stride is smaller than a row of pixels");
+      return -1;
+   }
+
+   if(height > 0 && (Py_ssize_t)(height - 1) * stride + row_bytes > view->len) {
+      PyErr_SetString(PyExc_ValueError, "Buffer is too small for the given dimensions");
+      return -1;
+   }
+
+   return stride;
+}
+
+static unsigned long
+cache_hash(const int *key, const unsigned char *data, int data_size)
+{
+   const unsigned char *p = (const unsigned char *)key;
+   unsigned long hash = 2166136261UL; /* FNV-1a */
+   int i;
+
+   for(i = 0; i < (int)(CACHE_KEY_INTS * sizeof(int)); i++)
+      hash = ((hash ^ p[i]) * 16777619UL) & 0xffffffffUL;
+   for(i = 0; i < data_size; i++)
+      hash = ((hash ^ data[i]) * 16777619UL) & 0xffffffffUL;
+
+   return hash;
+}
+
+static CacheEntry *
+cache_find(const int *key, const unsigned char *data, int data_size,
+      unsigned long hash)
+{
+   CacheEntry *entry;
+
+   for(entry = encode_cache.buckets[hash % CACHE_BUCKETS]; entry != NULL;
+         entry = entry->chain) {
+      if(entry->hash == hash && entry->data_size == data_size &&
+            memcmp(entry->key, key, sizeof(entry->key)) == 0 &&
+            memcmp(entry->bytes, data, data_size) == 0)
+         return entry;
+   }
+
+   return NULL;
+}
+
+static long
+cache_entry_bytes(CacheEntry *entry)
+{
+   return (long)sizeof(CacheEntry) + entry->data_size + entry->value_size;
+}
+
+static void
+cache_unlink(CacheEntry *entry)
+{
+   if(entry->prev != NULL)
+      entry->prev->next = entry->next;
+   else
+      encode_cache.head = entry->next;
+
+   if(entry->next != NULL)
+      entry->next->prev = entry->prev;
+   else
+      encode_cache.tail = entry->prev;
+}
+
+static void
+cache_remove(CacheEntry *entry)
+{
+   CacheEntry **link = &encode_cache.buckets[entry->hash % CACHE_BUCKETS];
+
+   while(*link != entry)
+      link = &(*link)->chain;
+   *link = entry->chain;
+
+   cache_unlink(entry);
+   encode_cache.entries--;
+   encode_cache.bytes -= cache_entry_bytes(entry);
+   free(entry);
+}
+
+static void
+cache_trim(long max_bytes)
+{
+   while(encode_cache.tail != NULL && encode_cache.bytes > max_bytes)
+      cache_remove(encode_cache.tail);
+}
+
+/* Returns the cached value, valid until the GIL is next released, or NULL
+   on a miss */
+static const unsigned char *
+cache_get(const int *key, const unsigned char *data, int data_size,
+      int *info, int *value_size)
+{
+   CacheEntry *entry;
+
+   if(encode_cache.max_bytes == 0)
+      return NULL;
+
+   entry = cache_find(key, data, data_size, cache_hash(key, data, data_size));
+   if(entry == NULL) {
+      encode_cache.misses++;
+      return NULL;
+   }
+
+   /* Move to the front of the LRU list */
+   cache_unlink(entry);
+   entry->prev = NULL;
+   entry->next = encode_cache.head;
+   if(encode_cache.head != NULL)
+      encode_cache.head->prev = entry;
+   else
+      encode_cache.tail = entry;
+   encode_cache.head = entry;
+
+   encode_cache.hits++;
+   memcpy(info, entry->info, sizeof(entry->info));
+   *value_size = entry->value_size;
+
+   return entry->bytes + entry->data_size;
+}
+
+/* Stores a copy of value, evicting the least recently used entries to stay
+   within budget. A failed insert only costs the next lookup a miss. */
+static void
+cache_put(const int *key, const unsigned char *data, int data_size,
+      const int *info, const unsigned char *value, int value_size)
+{
+   unsigned long hash;
+   CacheEntry *entry;
+   long size = (long)sizeof(CacheEntry) + data_size + value_size;
+
+   if(size > encode_cache.max_bytes)
+      return;
+
+   /* Another thread may have encoded the same payload meanwhile */
+   hash = cache_hash(key, data, data_size);
+   entry = cache_find(key, data, data_size, hash);
+   if(entry != NULL)
+      cache_remove(entry);
+
+   cache_trim(encode_cache.max_bytes - size);
+
+   entry = (CacheEntry *)malloc(size);
+   if(entry == NULL)
+      return;
+
+   memset(entry, 0, sizeof(CacheEntry));
+   entry->hash = hash;
+   memcpy(entry->key, key, sizeof(entry->key));
+   memcpy(entry->info, info, sizeof(entry->info));
+   entry->data_size = data_size;
+   entry->value_size = value_size;
+   memcpy(entry->bytes, data, data_size);
+   memcpy(entry->bytes + data_size, value, value_size);
+
+   entry->chain = encode_cache.buckets[hash % CACHE_BUCKETS];
+   encode_cache.buckets[hash % CACHE_BUCKETS] = entry;
+   entry->next = encode_cache.head;
+   if(encode_cache.head != NULL)
+      encode_cache.head->prev = entry;
+   else
+      encode_cache.tail = entry;
+   encode_cache.head = entry;
+
+   encode_cache.entries++;
+   encode_cache.bytes += size;
+}
+
+static PyObject *
+dmtx_encode_cache(PyObject *self, PyObject *arglist)
+{
+   long max_bytes;
+
+   if(!PyArg_ParseTuple(arglist, "l", &max_bytes))
+      return NULL;
+
+   if(max_bytes < 0) {
+      PyErr_SetString(PyExc_ValueError, "max_bytes must not be negative");
+      return NULL;
+   }
+
+   encode_cache.max_bytes = max_bytes;
+   cache_trim(max_bytes);
+
+   Py_INCREF(Py_None);
+   return Py_None;
+}
+
+static PyObject *
+dmtx_encode_cache_clear(PyObject *self, PyObject *arglist)
+{
+   cache_trim(0);
+   encode_cache.hits = 0;
+   encode_cache.misses = 0;
+
+   Py_INCREF(Py_None);
+   return Py_None;
+}
+
+static PyObject *
+dmtx_encode_cache_stats(PyObject *self, PyObject *arglist)
+{
+   return Py_BuildValue("{s:l,s:l,s:l,s:l,s:l}",
+         "hits", encode_cache.hits, "misses", encode_cache.misses,
+         "entries", encode_cache.entries, "bytes", encode_cache.bytes,
+         "max_bytes", encode_cache.max_bytes);
+}
+
+
+PyMODINIT_FUNC
+init_pydmtx(void)
+{
+   PyObject *module;
+
+   module = Py_InitModule("_pydmtx", dmtxMethods);
+   if(module == NULL)
+      return;
+
+   DecoderType.tp_new = PyType_GenericNew;
+   if(PyType_Ready(&DecoderType) < 0)
+      return;
+
+   Py_INCREF(&DecoderType);
+   PyModule_AddObject(module, "Decoder", (PyObject *)&DecoderType);
+
+   if(PyType_Ready(&ScanType) < 0)
+      return;
+
+   /* Pixel packings accepted by decode() */
+   PyModule_AddIntConstant(module, "DmtxPack8bppK", DmtxPack8bppK);
+   PyModule_AddIntConstant(module, "DmtxPack24bppRGB", DmtxPack24bppRGB);
+   PyModule_AddIntConstant(module, "DmtxPack24bppBGR", DmtxPack24bppBGR);
+   PyModule_AddIntConstant(module, "DmtxPack32bppRGBX", DmtxPack32bppRGBX);
+   PyModule_AddIntConstant(module, "DmtxPack32bppBGRX", DmtxPack32bppBGRX);
 }
 
 int
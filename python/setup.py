@@ -25,6 +25,9 @@ mod = Extension( '_pydmtx',
                  include_dirs = ['/usr/local/include'],
                  library_dirs = ['/usr/local/lib'],
                  libraries = ['dmtx'],
+                 # The decode loop, conversion kernels and profiles shared
+                 # with the other wrappers ("make libdmtxcore.la" in ..)
+                 extra_objects = ['../.libs/libdmtxcore.a'],
                  sources = ['pydmtxmodule.c'] )
 
 setup( name = 'pydmtx',
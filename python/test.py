@@ -1,3 +1,5 @@
+import threading
+
 from pydmtx import DataMatrix
 from PIL import Image
 
@@ -14,3 +16,59 @@ print dm_read.decode(img.size[0], img.size[1], buffer(img.tostring()))
 print dm_read.count()
 print dm_read.message(1)
 print dm_read.stats(1)
+
+# Any object with the buffer protocol is read in place, str included
+print dm_read.decode(img.size[0], img.size[1], img.tostring())
+print dm_read.last_stats
+
+# Other pixel packings are read without converting them first
+print dm_read.decode(img.size[0], img.size[1], img.tostring('raw', 'BGR'),
+      packing=DataMatrix.DmtxPack24bppBGR)
+
+# Read the same image as 8-bit grayscale straight from the buffer
+gray = img.convert('L')
+print dm_read.decode(gray.size[0], gray.size[1], gray.tostring(),
+      packing=DataMatrix.DmtxPack8bppK)
+
+# Per-call options apply to that call only: RGB data decodes again
+# without repeating the default packing
+assert dm_read.decode(img.size[0], img.size[1], img.tostring()) is not None
+assert 'packing' not in dm_read.options
+
+# Reuse one decoder for several frames of the same size
+decoder = dm_read.decoder()
+for frame in (img, img):
+    print decoder.decode(frame.size[0], frame.size[1], frame.tostring())
+
+# Look for the symbol where it was found in the previous frame first
+results = decoder.decode(img.size[0], img.size[1], img.tostring())
+print decoder.decode(img.size[0], img.size[1], img.tostring(),
+      near=results[0][1])
+
+# Queue more background decodes than there are pool workers
+DataMatrix.set_async_workers(2)
+futures = [dm_read.decode_async(img.size[0], img.size[1], img.tostring())
+      for i in range(5)]
+assert [f.result() for f in futures] == [results] * 5
+assert len([t for t in threading.enumerate()
+      if t.name == "pydmtx decode"]) == 2
+
+# Stop scanning as soon as the first symbol decodes
+for message, corners in dm_read.scan(img.size[0], img.size[1], img.tostring()):
+    print message
+    break
+
+# Decode every page of a multi-image PGM file from a mapping of it
+pgm = open("hello.pgm", "wb")
+for page in range(2):
+    pgm.write("P5\n%d %d\n255\n" % gray.size)
+    pgm.write(gray.tostring())
+pgm.close()
+print dm_read.decode_file("hello.pgm")
+
+# Fit the search settings to the images this decoder will see
+dm_fast = DataMatrix()
+dm_fast.use_profile(DataMatrix.DmtxProfileFixedSizeLabel)
+calib = dm_fast.calibrate([(img.size[0], img.size[1], img.tostring())])
+print calib['options'], calib['speedup']
+print dm_fast.decode(img.size[0], img.size[1], img.tostring())
@@ -23,106 +23,1526 @@ Contact: r.goyet@gmail.com
 /* $Id:$ */
 
 #include <ruby.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef HAVE_RUBY_THREAD_H
+#include <ruby/thread.h>
+#endif
+#ifdef HAVE_RB_IO_BUFFER_GET_BYTES_FOR_READING
+#include <ruby/io/buffer.h>
+#endif
 #include <dmtx.h>
+#include "../convert/dmtxconvert.h"
+#include "../profile/dmtxprofile.h"
+#include "../core/dmtxcore.h"
+
+#ifndef RSTRING_PTR
+#define RSTRING_PTR(s) (RSTRING(s)->ptr)
+#endif
+#ifndef RSTRING_LEN
+#define RSTRING_LEN(s) (RSTRING(s)->len)
+#endif
+#ifndef RARRAY_LEN
+#define RARRAY_LEN(a) (RARRAY(a)->len)
+#endif
+#ifndef RB_GC_GUARD
+#define RB_GC_GUARD(v) (*(volatile VALUE *)&(v))
+#endif
+
+/* State kept by Rdmtx::Decoder between images */
+typedef struct {
+    DmtxCoreDecoder core;
+    int hasRegion;
+    int region[4]; /* x, y, width, height with rows counted from the top */
+    int pyramid;   /* shrink used to locate symbols before decoding */
+    DmtxProfile profile;
+    int busy;      /* scanning, with the GVL released */
+} RdmtxDecoder;
+
+/* One call of an Rdmtx::Decoder method, run by rdmtx_decoder_run */
+typedef struct RdmtxCall {
+    RdmtxDecoder * decoder;
+    VALUE (*body)(struct RdmtxCall * call);
+    VALUE * args;
+    VALUE pinned;  /* String or IO::Buffer of pixels locked by the body */
+} RdmtxCall;
+
+/* One payload of Rdmtx#encode_many, packed as by encode_modules */
+typedef struct {
+    int rows;
+    int cols;
+    unsigned char * bits;
+    int failed;
+} RdmtxEncodeItem;
+
+/* Work shared by the threads of Rdmtx#encode_many. Workers never touch a
+   Ruby object, the payloads were copied out before they started. */
+typedef struct {
+    const char * data;
+    const long * offsets;
+    const long * sizes;
+    long count;
+    long next;
+    int stop;
+    RdmtxEncodeItem * items;
+    pthread_mutex_t lock;
+} RdmtxEncodeJob;
+
+VALUE cRdmtx;
+VALUE cRdmtxDecoder;
 
 static VALUE rdmtx_init(VALUE self) {
     return self;
 }
 
-static VALUE rdmtx_decode(VALUE self, VALUE image /* Image from RMagick (Magick::Image) */, VALUE timeout /* Timeout in msec */) {
+/* What a scan found, collected without the GVL and turned into Ruby
+   objects once it is done */
+typedef struct {
+    int corners[8];
+    size_t offset; /* of the message in RdmtxScan.text */
+    int size;
+} RdmtxFound;
 
-    VALUE rawImageString = rb_funcall(image, rb_intern("export_pixels_to_str"), 0);
+/* One scan of a decoder, run without the GVL by rdmtx_scan */
+typedef struct {
+    DmtxCoreScan scan;
+    DmtxCoreDecoder * decoder;
+    const int * near;  /* corners to scan around first, or NULL */
+    int padding;
+    DmtxCoreArena found;
+    DmtxCoreArena text;
+    int failed;
+    volatile int interrupted;
+} RdmtxScan;
 
-    VALUE safeImageString = StringValue(rawImageString);
+/* Scan of one image by Rdmtx#each_decoded, freed by rdmtx_each_release
+   however the block leaves */
+typedef struct {
+    DmtxCoreScan scan;
+    DmtxCoreDecoder decoder;
+    DmtxCoreResult result;
+    DmtxPassFail status;
+    VALUE pixels;
+    volatile int interrupted;
+} RdmtxEach;
 
-    char * imageBuffer = RSTRING(safeImageString)->ptr;
+/* Ruby interrupts a thread scanning without the GVL (e.g. Thread#raise)
+   by setting the flag, which the scan polls through its cancel callback */
+static void rdmtx_interrupt(void * flag) {
+    *(volatile int *)flag = 1;
+}
 
-    int width = NUM2INT(rb_funcall(image, rb_intern("columns"), 0));
-    int height = NUM2INT(rb_funcall(image, rb_intern("rows"), 0));
+static int rdmtx_interrupted(void * flag) {
+    return *(volatile int *)flag;
+}
+
+static int rdmtx_scan_result(void * context, const DmtxCoreResult * result) {
+
+    RdmtxScan * run = (RdmtxScan *)context;
+    RdmtxFound found;
+
+    memcpy(found.corners, result->corners, sizeof(found.corners));
+    found.offset = run->text.size;
+    found.size = result->messageSize;
+
+    if (dmtxCoreArenaAppend(&run->text, result->message, result->messageSize) != DmtxPass ||
+          dmtxCoreArenaAppend(&run->found, &found, sizeof(found)) != DmtxPass) {
+        run->failed = 1;
+        return 0;
+    }
+
+    return 1;
+}
+
+static void * rdmtx_scan_without_gvl(void * arg) {
+
+    RdmtxScan * run = (RdmtxScan *)arg;
+
+    /* Pixels tried around the previous position stay marked in the scan
+       cache, so the full scan after a miss does not repeat them */
+    dmtxCoreScanStart(&run->scan);
+    if (run->near != NULL)
+        dmtxCoreScanNear(&run->scan, run->decoder->decode, run->near, run->padding);
+    if (run->scan.found == 0 && !run->scan.stopped)
+        dmtxCoreDecoderScan(run->decoder, &run->scan);
+
+    return NULL;
+}
+
+/* Scan a prepared decoder, coarse-to-fine if pyramid is above 1 and around
+   near first if it is not NULL, and return the messages or, with
+   withCorners, [message, corners] pairs with the corners in image pixels
+   (rows counted from the top). Other Ruby threads run meanwhile. */
+static VALUE rdmtx_scan(DmtxCoreDecoder * decoder, int pyramid, int intTimeout,
+      const int * near, int padding, int withCorners) {
 
-    DmtxImage *dmtxImage = dmtxImageCreate((unsigned char *)imageBuffer, width,
-          height, DmtxPack24bppRGB);
+    RdmtxScan run;
+    memset(&run, 0, sizeof(run));
+    dmtxCoreScanInit(&run.scan);
+    run.scan.timeoutMs = (intTimeout == 0) ? DmtxUndefined : intTimeout;
+    run.scan.pyramid = (pyramid > 1) ? pyramid : 1;
+    run.scan.cancel = rdmtx_interrupted;
+    run.scan.cancelContext = (void *)&run.interrupted;
+    run.scan.result = rdmtx_scan_result;
+    run.scan.resultContext = &run;
+    run.decoder = decoder;
+    run.near = near;
+    run.padding = padding;
+
+#ifdef HAVE_RB_THREAD_CALL_WITHOUT_GVL2
+    rb_thread_call_without_gvl2(rdmtx_scan_without_gvl, &run, rdmtx_interrupt,
+          (void *)&run.interrupted);
+#else
+    rdmtx_scan_without_gvl(&run);
+#endif
 
     VALUE results = rb_ary_new();
+    const RdmtxFound * found = (const RdmtxFound *)run.found.data;
+    long count = (long)(run.found.size / sizeof(RdmtxFound));
+    long i;
+    int j;
 
-    /* Initialize decode struct for newly loaded image */
-    DmtxDecode * decode = dmtxDecodeCreate(dmtxImage, 1);
+    for (i = 0; i < count; i++) {
+        VALUE message = rb_str_new((char *)run.text.data + found[i].offset, found[i].size);
+        if (withCorners) {
+            VALUE corners = rb_ary_new();
+            for (j = 0; j < 4; j++)
+                rb_ary_push(corners, rb_ary_new3(2, INT2NUM(found[i].corners[2 * j]),
+                      INT2NUM(found[i].corners[2 * j + 1])));
+            rb_ary_push(results, rb_ary_new3(2, message, corners));
+        } else {
+            rb_ary_push(results, message);
+        }
+    }
 
-    DmtxRegion * region;
+    int failed = run.failed || run.scan.failed;
+    dmtxCoreArenaFree(&run.found);
+    dmtxCoreArenaFree(&run.text);
+    dmtxCoreScanFree(&run.scan);
+    if (failed)
+        rb_raise(rb_eNoMemError, "Unable to allocate the scan results");
+
+    return results;
+}
+
+/* Export the pixels of an RMagick image for libdmtx into *pixels and
+   return their packing. Grayscale images (Image#gray?) are exported as one
+   intensity byte per pixel instead of three RGB bytes, which is all that
+   libdmtx looks at in them. */
+static int rdmtx_export_pixels(VALUE image, int width, int height, VALUE * pixels) {
+
+    int gray = RTEST(rb_funcall(image, rb_intern("gray?"), 0));
+
+    VALUE rawImageString = rb_funcall(image, rb_intern("export_pixels_to_str"), 5,
+          INT2FIX(0), INT2FIX(0), INT2NUM(width), INT2NUM(height),
+          rb_str_new2(gray ? "I" : "RGB"));
+
+    *pixels = StringValue(rawImageString);
+
+    return gray ? DmtxPack8bppK : DmtxPack24bppRGB;
+}
 
-    int intTimeout = NUM2INT(timeout);
-    DmtxTime dmtxTimeout = dmtxTimeAdd(dmtxTimeNow(), intTimeout);
+/* Find the next region that decodes */
+static void * rdmtx_each_next(void * arg) {
+
+    RdmtxEach * each = (RdmtxEach *)arg;
+
+    do {
+        each->status = dmtxCoreScanNext(&each->scan, each->decoder.decode, &each->result);
+    } while (each->status == DmtxPass && each->result.status != DmtxCoreDecoded);
+
+    return NULL;
+}
+
+/* Yield each message as soon as it decodes. Nothing is held between two
+   regions, so nothing leaks if the block breaks out of the scan. */
+static VALUE rdmtx_each_scan(VALUE arg) {
+
+    RdmtxEach * each = (RdmtxEach *)arg;
+
+    dmtxCoreScanStart(&each->scan);
 
     for(;;) {
-        if (intTimeout == 0) {
-            region = dmtxRegionFindNext(decode, NULL);
+        /* Not called at all if an interrupt is pending */
+        each->status = DmtxFail;
+#ifdef HAVE_RB_THREAD_CALL_WITHOUT_GVL2
+        rb_thread_call_without_gvl2(rdmtx_each_next, each, rdmtx_interrupt,
+              (void *)&each->interrupted);
+#else
+        rdmtx_each_next(each);
+#endif
+        if (each->status != DmtxPass)
+            break;
+
+        rb_yield(rb_str_new((char *)each->result.message, each->result.messageSize));
+    }
+
+    return Qnil;
+}
+
+static VALUE rdmtx_each_release(VALUE arg) {
+
+    RdmtxEach * each = (RdmtxEach *)arg;
+
+    dmtxCoreScanFree(&each->scan);
+    dmtxCoreDecoderClear(&each->decoder);
+
+    return Qnil;
+}
+
+/* Like decode, but yields every message as soon as it is found, so that
+   the block can stop the scan (e.g. with break) after the first one.
+   Returns an Enumerator without a block. */
+static VALUE rdmtx_each_decoded(int argc, VALUE * argv, VALUE self) {
+
+    VALUE image, timeout;
+
+    RETURN_ENUMERATOR(self, argc, argv);
+    rb_scan_args(argc, argv, "11", &image, &timeout);
+
+    RdmtxEach each;
+    memset(&each, 0, sizeof(each));
+    dmtxCoreScanInit(&each.scan);
+    dmtxCoreDecoderInit(&each.decoder);
+    if (!NIL_P(timeout) && NUM2INT(timeout) != 0)
+        each.scan.timeoutMs = NUM2INT(timeout);
+    each.scan.cancel = rdmtx_interrupted;
+    each.scan.cancelContext = (void *)&each.interrupted;
+
+    int height = NUM2INT(rb_funcall(image, rb_intern("rows"), 0));
+    int width = NUM2INT(rb_funcall(image, rb_intern("columns"), 0));
+    int packing = rdmtx_export_pixels(image, width, height, &each.pixels);
+
+    if (dmtxCoreDecoderPrepare(&each.decoder, (unsigned char *)RSTRING_PTR(each.pixels),
+          width, height, 0, packing, 1) != DmtxPass) {
+        dmtxCoreScanFree(&each.scan);
+        dmtxCoreDecoderClear(&each.decoder);
+        rb_raise(rb_eNoMemError, "Unable to allocate the libdmtx decoder");
+    }
+
+    rb_ensure(rdmtx_each_scan, (VALUE)&each, rdmtx_each_release, (VALUE)&each);
+
+    return self;
+}
+
+static void rdmtx_decoder_free(RdmtxDecoder * decoder) {
+    dmtxCoreDecoderClear(&decoder->core);
+    free(decoder);
+}
+
+static VALUE rdmtx_decoder_alloc(VALUE klass) {
+    RdmtxDecoder * decoder = ALLOC(RdmtxDecoder);
+    MEMZERO(decoder, RdmtxDecoder, 1);
+    dmtxCoreDecoderInit(&decoder->core);
+    dmtxProfileInit(&decoder->profile, DmtxProfileDefault);
+    return Data_Wrap_Struct(klass, 0, rdmtx_decoder_free, decoder);
+}
+
+/* Full scan of a prepared decoder, around near first if it is not NULL */
+static VALUE rdmtx_decoder_scan(RdmtxDecoder * decoder, int intTimeout, const int * near,
+      int padding, int withCorners) {
+    return rdmtx_scan(&decoder->core, decoder->pyramid, intTimeout, near, padding,
+          withCorners);
+}
+
+/* Point the decoder at pixels of the given layout, only rebuilding the
+   libdmtx decode state when the dimensions, row stride or packing change,
+   and restrict the scan to the decoder's scan region */
+static void rdmtx_decoder_prepare_pixels(RdmtxDecoder * decoder,
+      unsigned char * imageBuffer, int width, int height, int stride, int packing) {
+
+    int bytesPerPixel = dmtxCoreBytesPerPixel(packing);
+
+    if (bytesPerPixel == 0)
+        rb_raise(rb_eArgError, "Unsupported pixel packing %d", packing);
+    if (stride > 0 && stride < width * bytesPerPixel)
+        rb_raise(rb_eArgError, "Row stride %d is too small for %d pixels", stride, width);
+
+    if (dmtxCoreDecoderPrepare(&decoder->core, imageBuffer, width, height, stride,
+          packing, 1) != DmtxPass)
+        rb_raise(rb_eArgError, "Unable to create image of %dx%d", width, height);
+    if (decoder->core.fresh)
+        dmtxProfileApply(decoder->core.decode, &decoder->profile);
+
+    const int * r = decoder->region;
+    if (decoder->hasRegion) {
+        if (dmtxCoreSetImageBounds(decoder->core.decode, r[0], r[0] + r[2] - 1, r[1],
+              r[1] + r[3] - 1) != DmtxPass)
+            rb_raise(rb_eArgError, "Scan region is outside the image");
+    } else {
+        dmtxCoreSetBounds(decoder->core.decode, 0, width - 1, 0, height - 1);
+    }
+}
+
+/* Point the decoder at the pixels of an RMagick image (see
+   rdmtx_decoder_prepare_pixels). The pixel string is stored in *pixels so
+   that the caller keeps it alive while scanning. */
+static void rdmtx_decoder_prepare(RdmtxDecoder * decoder, VALUE image, VALUE * pixels) {
+
+    int width = NUM2INT(rb_funcall(image, rb_intern("columns"), 0));
+    int height = NUM2INT(rb_funcall(image, rb_intern("rows"), 0));
+
+    int packing = rdmtx_export_pixels(image, width, height, pixels);
+
+    rdmtx_decoder_prepare_pixels(decoder, (unsigned char *)RSTRING_PTR(*pixels),
+          width, height, 0, packing);
+}
+
+static VALUE rdmtx_decoder_call(VALUE arg) {
+    RdmtxCall * call = (RdmtxCall *)arg;
+    return call->body(call);
+}
+
+static VALUE rdmtx_decoder_release(VALUE arg) {
+
+    RdmtxCall * call = (RdmtxCall *)arg;
+
+    /* The pixels are only guaranteed to live for this call */
+    if (call->decoder->core.image != NULL)
+        call->decoder->core.image->pxl = NULL;
+
+    if (!NIL_P(call->pinned)) {
+#ifdef HAVE_RB_IO_BUFFER_GET_BYTES_FOR_READING
+        if (rb_obj_is_kind_of(call->pinned, rb_cIOBuffer))
+            rb_io_buffer_unlock(call->pinned);
+        else
+#endif
+            rb_str_unlocktmp(call->pinned);
+    }
+    call->decoder->busy = 0;
+
+    return Qnil;
+}
+
+/* Run body with the decoder of self and args. Scans release the GVL, so
+   a decoder used by another thread at the same time raises instead. */
+static VALUE rdmtx_decoder_run(VALUE self, VALUE (*body)(RdmtxCall * call), VALUE * args) {
+
+    RdmtxCall call;
+    Data_Get_Struct(self, RdmtxDecoder, call.decoder);
+
+    if (call.decoder->busy)
+        rb_raise(rb_eRuntimeError, "Decoder is in use by another thread");
+    call.decoder->busy = 1;
+    call.body = body;
+    call.args = args;
+    call.pinned = Qnil;
+
+    return rb_ensure(rdmtx_decoder_call, (VALUE)&call, rdmtx_decoder_release, (VALUE)&call);
+}
+
+static VALUE rdmtx_decoder_decode_body(RdmtxCall * call) {
+
+    VALUE pixels;
+    rdmtx_decoder_prepare(call->decoder, call->args[0], &pixels);
+
+    VALUE results = rdmtx_decoder_scan(call->decoder, NUM2INT(call->args[1]), NULL, 0, 0);
+
+    RB_GC_GUARD(pixels);
+    return results;
+}
+
+/* Same as Rdmtx#decode, but keeps the libdmtx decode state between calls
+   and only rebuilds it when the image dimensions change */
+static VALUE rdmtx_decoder_decode(VALUE self, VALUE image /* Image from RMagick (Magick::Image) */, VALUE timeout /* Timeout in msec */) {
+    VALUE args[2] = { image, timeout };
+    return rdmtx_decoder_run(self, rdmtx_decoder_decode_body, args);
+}
+
+/* Same as Rdmtx::Decoder#decode with a decoder of its own */
+static VALUE rdmtx_decode(VALUE self, VALUE image /* Image from RMagick (Magick::Image) */, VALUE timeout /* Timeout in msec */) {
+    VALUE decoder = rb_class_new_instance(0, NULL, cRdmtxDecoder);
+    return rdmtx_decoder_decode(decoder, image, timeout);
+}
+
+/* Pixels of a raw decode: an IO::Buffer (Ruby 3.1 and later) or a String.
+   Both are locked against changes until the call returns, as the scan
+   reads them without the GVL; frozen Strings cannot change anyway. */
+static void rdmtx_pin_pixels(RdmtxCall * call, VALUE data, const unsigned char ** pixels,
+      size_t * size) {
+
+#ifdef HAVE_RB_IO_BUFFER_GET_BYTES_FOR_READING
+    if (rb_obj_is_kind_of(data, rb_cIOBuffer)) {
+        const void * base;
+        rb_io_buffer_get_bytes_for_reading(data, &base, size);
+        rb_io_buffer_lock(data);
+        call->pinned = data;
+        *pixels = (const unsigned char *)base;
+        return;
+    }
+#endif
+
+    StringValue(data);
+    if (!OBJ_FROZEN(data)) {
+        rb_str_locktmp(data);
+        call->pinned = data;
+    }
+    call->args[0] = data;
+    *pixels = (const unsigned char *)RSTRING_PTR(data);
+    *size = RSTRING_LEN(data);
+}
+
+static VALUE rdmtx_decoder_decode_raw_body(RdmtxCall * call) {
+
+    VALUE * args = call->args;
+    const unsigned char * pixels;
+    size_t size;
+    int width = NUM2INT(args[1]);
+    int height = NUM2INT(args[2]);
+    int stride = NIL_P(args[5]) ? 0 : NUM2INT(args[5]);
+    int packing;
+
+    rdmtx_pin_pixels(call, args[0], &pixels, &size);
+    if (width <= 0 || height <= 0)
+        rb_raise(rb_eArgError, "Invalid image size %dx%d", width, height);
+
+    /* Without a packing, tell gray, RGB and RGBX apart by the size */
+    if (!NIL_P(args[3]))
+        packing = NUM2INT(args[3]);
+    else if (stride == 0 && size == (size_t)width * height)
+        packing = DmtxPack8bppK;
+    else if (stride == 0 && size == (size_t)width * height * 3)
+        packing = DmtxPack24bppRGB;
+    else if (stride == 0 && size == (size_t)width * height * 4)
+        packing = DmtxPack32bppRGBX;
+    else
+        rb_raise(rb_eArgError, "Cannot tell the packing of %ld bytes of %dx%d pixels",
+              (long)size, width, height);
+
+    if (dmtxCoreBytesPerPixel(packing) == 0)
+        rb_raise(rb_eArgError, "Unsupported pixel packing %d", packing);
+
+    size_t rowBytes = (size_t)width * dmtxCoreBytesPerPixel(packing);
+    if ((stride != 0 && (size_t)stride < rowBytes) ||
+          size < (size_t)(stride != 0 ? stride : rowBytes) * (height - 1) + rowBytes)
+        rb_raise(rb_eArgError, "%ld bytes are too few for %dx%d pixels", (long)size,
+              width, height);
+
+    rdmtx_decoder_prepare_pixels(call->decoder, (unsigned char *)pixels, width, height,
+          stride, packing);
+
+    return rdmtx_decoder_scan(call->decoder, NIL_P(args[4]) ? 0 : NUM2INT(args[4]), NULL, 0,
+          0);
+}
+
+/* Decode pixels that are already in memory, without going through
+   RMagick: Rdmtx::Decoder#decode_raw(data, width, height, packing = nil,
+   timeout = 0, stride = nil). data is a String or IO::Buffer of rows top
+   first, packing one of the Rdmtx::PACK_ constants (guessed from the size
+   of data if nil) and stride the bytes from one row to the next. Mono
+   exports (export_pixels_to_str(..., "I")) are PACK_8BPP_K. */
+static VALUE rdmtx_decoder_decode_raw(int argc, VALUE * argv, VALUE self) {
+    VALUE args[6];
+    rb_scan_args(argc, argv, "33", &args[0], &args[1], &args[2], &args[3], &args[4],
+          &args[5]);
+    return rdmtx_decoder_run(self, rdmtx_decoder_decode_raw_body, args);
+}
+
+/* Same as Rdmtx::Decoder#decode_raw with a decoder of its own */
+static VALUE rdmtx_decode_raw(int argc, VALUE * argv, VALUE self) {
+    VALUE decoder = rb_class_new_instance(0, NULL, cRdmtxDecoder);
+    return rdmtx_decoder_decode_raw(argc, argv, decoder);
+}
+
+/* Decode an image in which a symbol is expected close to where it was
+   found before: Rdmtx::Decoder#track(image, timeout, previous = nil,
+   padding = nil) only scans the box around the previous corners at first,
+   and the whole image only if nothing decodes there. Returns [message,
+   corners] pairs, corners being four [x, y] pairs that can be passed back
+   as previous for the next image. */
+static VALUE rdmtx_decoder_track_body(RdmtxCall * call) {
+
+    VALUE image = call->args[0], timeout = call->args[1];
+    VALUE previous = call->args[2], padding = call->args[3];
+    RdmtxDecoder * decoder = call->decoder;
+
+    int near[8];
+    int i;
+    if (!NIL_P(previous)) {
+        Check_Type(previous, T_ARRAY);
+        if (RARRAY_LEN(previous) != 4)
+            rb_raise(rb_eArgError, "previous must hold four [x, y] corners");
+        for (i = 0; i < 4; i++) {
+            VALUE corner = rb_ary_entry(previous, i);
+            Check_Type(corner, T_ARRAY);
+            near[2 * i] = NUM2INT(rb_ary_entry(corner, 0));
+            near[2 * i + 1] = NUM2INT(rb_ary_entry(corner, 1));
+        }
+    }
+
+    VALUE pixels;
+    rdmtx_decoder_prepare(decoder, image, &pixels);
+
+    VALUE results = rdmtx_decoder_scan(decoder, NUM2INT(timeout), NIL_P(previous) ? NULL : near,
+          NIL_P(padding) ? -1 : NUM2INT(padding), 1);
+
+    RB_GC_GUARD(pixels);
+    return results;
+}
+
+static VALUE rdmtx_decoder_track(int argc, VALUE * argv, VALUE self) {
+    VALUE args[4];
+    rb_scan_args(argc, argv, "22", &args[0], &args[1], &args[2], &args[3]);
+    return rdmtx_decoder_run(self, rdmtx_decoder_track_body, args);
+}
+
+/* One page of a file decoded by Rdmtx::Decoder#decode_file. The pixels
+   point into the mapping, or into copy for TIFF pages whose strips are
+   scattered over the file. */
+typedef struct {
+    const unsigned char * pixels;
+    unsigned char * copy;
+    int width;
+    int height;
+    int stride;
+    int packing;
+} RdmtxPage;
+
+/* A mapped file and its pages, released by rdmtx_file_release however the
+   decode leaves */
+typedef struct {
+    RdmtxDecoder * decoder;
+    VALUE raw;
+    int timeout;
+    unsigned char * data;
+    size_t size;
+    RdmtxPage * pages;
+    long count;
+    long alloc;
+} RdmtxFile;
+
+static void rdmtx_file_add_page(RdmtxFile * file, const unsigned char * pixels,
+      int width, int height, int stride, int packing, unsigned char * copy) {
+
+    RdmtxPage * page;
+
+    if (file->count == file->alloc) {
+        long alloc = (file->alloc == 0) ? 16 : file->alloc * 2;
+        RdmtxPage * pages = realloc(file->pages, alloc * sizeof(RdmtxPage));
+        if (pages == NULL) {
+            free(copy);
+            rb_raise(rb_eNoMemError, "Unable to allocate pages");
+        }
+        file->pages = pages;
+        file->alloc = alloc;
+    }
+
+    page = &file->pages[file->count++];
+    page->pixels = (copy != NULL) ? copy : pixels;
+    page->copy = copy;
+    page->width = width;
+    page->height = height;
+    page->stride = stride;
+    page->packing = packing;
+}
+
+static int rdmtx_is_space(int c) {
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+/* Next number of a PNM header, skipping whitespace and comments; -1 if
+   there is none */
+static int rdmtx_pnm_number(const RdmtxFile * file, size_t * pos) {
+
+    int value = 0, digits = 0;
+
+    while (*pos < file->size) {
+        if (file->data[*pos] == '#') {
+            while (*pos < file->size && file->data[*pos] != '\n')
+                (*pos)++;
+        } else if (rdmtx_is_space(file->data[*pos])) {
+            (*pos)++;
         } else {
-            region = dmtxRegionFindNext(decode, &dmtxTimeout);
+            break;
         }
+    }
+    while (*pos < file->size && file->data[*pos] >= '0' && file->data[*pos] <= '9' &&
+          value < 0x1000000) {
+        value = value * 10 + (file->data[*pos] - '0');
+        (*pos)++;
+        digits++;
+    }
+    return (digits > 0) ? value : -1;
+}
+
+/* Binary PGM (P5) and PPM (P6) images with a maxval up to 255, any number
+   of them back to back */
+static void rdmtx_read_pnm_pages(RdmtxFile * file) {
 
-        if (region == NULL )
+    size_t pos = 0;
+
+    while (pos + 2 <= file->size && file->data[pos] == 'P') {
+        int bytesPerPixel, width, height, maxval;
+        size_t bytes;
+
+        if (file->data[pos + 1] == '5')
+            bytesPerPixel = 1;
+        else if (file->data[pos + 1] == '6')
+            bytesPerPixel = 3;
+        else
             break;
+        pos += 2;
+        width = rdmtx_pnm_number(file, &pos);
+        height = rdmtx_pnm_number(file, &pos);
+        maxval = rdmtx_pnm_number(file, &pos);
+        if (width <= 0 || height <= 0 || maxval <= 0 || maxval > 255 || pos >= file->size)
+            rb_raise(rb_eArgError, "Unsupported PNM header");
+        pos++; /* the single whitespace ending the header */
+
+        bytes = (size_t)width * height * bytesPerPixel;
+        if (bytes > file->size - pos)
+            rb_raise(rb_eArgError, "PNM image truncated");
+        rdmtx_file_add_page(file, file->data + pos, width, height, width * bytesPerPixel,
+              (bytesPerPixel == 1) ? DmtxPack8bppK : DmtxPack24bppRGB, NULL);
+
+        pos += bytes;
+        while (pos < file->size && rdmtx_is_space(file->data[pos]))
+            pos++;
+    }
+    if (file->count == 0 || pos != file->size)
+        rb_raise(rb_eArgError, "Not a binary PGM or PPM file");
+}
+
+static unsigned long rdmtx_tiff_u16(const RdmtxFile * file, int bigEndian, size_t offset) {
+    const unsigned char * p = file->data + offset;
+    if (offset > file->size || file->size - offset < 2)
+        return 0;
+    return bigEndian ? (p[0] << 8) | p[1] : (p[1] << 8) | p[0];
+}
+
+static unsigned long rdmtx_tiff_u32(const RdmtxFile * file, int bigEndian, size_t offset) {
+    return bigEndian ?
+          (rdmtx_tiff_u16(file, 1, offset) << 16) | rdmtx_tiff_u16(file, 1, offset + 2) :
+          (rdmtx_tiff_u16(file, 0, offset + 2) << 16) | rdmtx_tiff_u16(file, 0, offset);
+}
+
+/* Value number index of the SHORT or LONG directory entry at entry, 0 if
+   there is no such value */
+static unsigned long rdmtx_tiff_value(const RdmtxFile * file, int bigEndian,
+      size_t entry, unsigned long index) {
+
+    unsigned long type = rdmtx_tiff_u16(file, bigEndian, entry + 2);
+    unsigned long count = rdmtx_tiff_u32(file, bigEndian, entry + 4);
+    size_t valueSize = (type == 3) ? 2 : 4, at;
 
-        DmtxMessage * message = dmtxDecodeMatrixRegion(decode, region, DmtxUndefined);
-        if (message != NULL) {
-            VALUE outputString = rb_str_new2((char *)message->output);
-            rb_ary_push(results, outputString);
-            dmtxMessageDestroy(&message);
+    if ((type != 3 && type != 4) || index >= count)
+        return 0;
+    at = (count * valueSize <= 4) ? entry + 8 : rdmtx_tiff_u32(file, bigEndian, entry + 8);
+    at += index * valueSize;
+    return (type == 3) ? rdmtx_tiff_u16(file, bigEndian, at) : rdmtx_tiff_u32(file, bigEndian, at);
+}
+
+/* Every directory of a baseline TIFF, each page being uncompressed, 8 bits
+   per sample, chunky and gray or RGB(X). Pages stored as one run of strips
+   are used in place. */
+static void rdmtx_read_tiff_pages(RdmtxFile * file) {
+
+    int big = (file->data[0] == 'M');
+    size_t ifd = rdmtx_tiff_u32(file, big, 4);
+    size_t directories = 0;
+
+    if (rdmtx_tiff_u16(file, big, 2) != 42)
+        rb_raise(rb_eArgError, "Not a TIFF file");
+
+    while (ifd != 0) {
+        unsigned long entries = rdmtx_tiff_u16(file, big, ifd), e;
+        unsigned long width = 0, height = 0, bits = 1, compression = 1;
+        unsigned long samples = 1, planar = 1, strips, s;
+        size_t offsets = 0, counts = 0, stride, bytes, first, run;
+        unsigned char * copy = NULL;
+        int packing;
+
+        /* Directories past the end or in a loop */
+        if (++directories > file->size / 12 || ifd + 2 + entries * 12 + 4 > file->size)
+            rb_raise(rb_eArgError, "Corrupt TIFF directory");
+
+        for (e = 0; e < entries; e++) {
+            size_t entry = ifd + 2 + e * 12;
+            switch (rdmtx_tiff_u16(file, big, entry)) {
+                case 256: width = rdmtx_tiff_value(file, big, entry, 0); break;
+                case 257: height = rdmtx_tiff_value(file, big, entry, 0); break;
+                case 258: bits = rdmtx_tiff_value(file, big, entry, 0); break;
+                case 259: compression = rdmtx_tiff_value(file, big, entry, 0); break;
+                case 273: offsets = entry; break;
+                case 277: samples = rdmtx_tiff_value(file, big, entry, 0); break;
+                case 279: counts = entry; break;
+                case 284: planar = rdmtx_tiff_value(file, big, entry, 0); break;
+            }
+        }
+
+        if (samples == 1)
+            packing = DmtxPack8bppK;
+        else if (samples == 3)
+            packing = DmtxPack24bppRGB;
+        else if (samples == 4)
+            packing = DmtxPack32bppRGBX;
+        else
+            rb_raise(rb_eArgError, "Unsupported TIFF samples per pixel");
+        if (width == 0 || height == 0 || width > 0xffff || height > 0xffff || bits != 8 ||
+              compression != 1 || (planar != 1 && samples > 1) || offsets == 0 || counts == 0)
+            rb_raise(rb_eArgError, "Unsupported TIFF page");
+
+        stride = width * samples;
+        bytes = stride * height;
+        strips = rdmtx_tiff_u32(file, big, offsets + 4);
+        first = rdmtx_tiff_value(file, big, offsets, 0);
+
+        /* Usually the strips follow each other and the page is used as is */
+        for (s = 0, run = first; s < strips && run == rdmtx_tiff_value(file, big, offsets, s); s++)
+            run += rdmtx_tiff_value(file, big, counts, s);
+        if (run - first < bytes) {
+            size_t filled = 0;
+
+            copy = malloc(bytes);
+            if (copy == NULL)
+                rb_raise(rb_eNoMemError, "Unable to gather TIFF strips");
+            for (s = 0; s < strips && filled < bytes; s++) {
+                size_t at = rdmtx_tiff_value(file, big, offsets, s);
+                size_t length = rdmtx_tiff_value(file, big, counts, s);
+
+                if (length > bytes - filled)
+                    length = bytes - filled;
+                if (at > file->size || length > file->size - at)
+                    break;
+                memcpy(copy + filled, file->data + at, length);
+                filled += length;
+            }
+            if (filled < bytes) {
+                free(copy);
+                rb_raise(rb_eArgError, "TIFF strips shorter than the page");
+            }
+        } else if (first > file->size || bytes > file->size - first) {
+            rb_raise(rb_eArgError, "TIFF page past the end of the file");
         }
 
-        dmtxRegionDestroy(&region);
+        rdmtx_file_add_page(file, file->data + first, (int)width, (int)height, (int)stride,
+              packing, copy);
+        ifd = rdmtx_tiff_u32(file, big, ifd + 2 + entries * 12);
+    }
+    if (file->count == 0)
+        rb_raise(rb_eArgError, "TIFF file without pages");
+}
+
+static int rdmtx_raw_option(VALUE raw, const char * name, int fallback) {
+    VALUE value = rb_hash_aref(raw, ID2SYM(rb_intern(name)));
+    return NIL_P(value) ? fallback : NUM2INT(value);
+}
+
+/* Frames of the geometry given in the raw Hash back to back; a partial
+   frame at the end is ignored */
+static void rdmtx_read_raw_pages(RdmtxFile * file) {
+
+    int width = rdmtx_raw_option(file->raw, "width", 0);
+    int height = rdmtx_raw_option(file->raw, "height", 0);
+    int packing = rdmtx_raw_option(file->raw, "packing", DmtxPack8bppK);
+    int stride = rdmtx_raw_option(file->raw, "stride", width * dmtxCoreBytesPerPixel(packing));
+    size_t pos = rdmtx_raw_option(file->raw, "header", 0);
+    size_t frameBytes = (size_t)stride * height;
+
+    if (width <= 0 || height <= 0 || stride <= 0)
+        rb_raise(rb_eArgError, "raw needs a positive :width, :height and :stride");
+
+    while (pos <= file->size && file->size - pos >= frameBytes) {
+        rdmtx_file_add_page(file, file->data + pos, width, height, stride, packing, NULL);
+        pos += frameBytes;
+    }
+}
+
+static VALUE rdmtx_file_decode(VALUE arg) {
+
+    RdmtxFile * file = (RdmtxFile *)arg;
+    RdmtxDecoder * decoder = file->decoder;
+    VALUE results = rb_ary_new();
+    long i;
+
+    if (!NIL_P(file->raw)) {
+        Check_Type(file->raw, T_HASH);
+        rdmtx_read_raw_pages(file);
+    } else if (file->size >= 8 && (file->data[0] == 'I' || file->data[0] == 'M') &&
+          file->data[1] == file->data[0]) {
+        rdmtx_read_tiff_pages(file);
+    } else {
+        rdmtx_read_pnm_pages(file);
     }
 
-    dmtxDecodeDestroy(&decode);
-    dmtxImageDestroy(&dmtxImage);
+    for (i = 0; i < file->count; i++) {
+        const RdmtxPage * page = &file->pages[i];
+
+        rdmtx_decoder_prepare_pixels(decoder, (unsigned char *)page->pixels, page->width,
+              page->height, page->stride, page->packing);
+        rb_ary_push(results, rdmtx_decoder_scan(decoder, file->timeout, NULL, 0, 0));
+        decoder->core.image->pxl = NULL;
+    }
 
     return results;
 }
 
-static VALUE rdmtx_encode(VALUE self, VALUE string) {
+static VALUE rdmtx_file_release(VALUE arg) {
 
-    /* Create and initialize libdmtx structures */
-    DmtxEncode * enc = dmtxEncodeCreate();
+    RdmtxFile * file = (RdmtxFile *)arg;
+    long i;
 
-    VALUE safeString = StringValue(string);
+    /* The mapping is about to go */
+    if (file->decoder->core.image != NULL)
+        file->decoder->core.image->pxl = NULL;
+
+    for (i = 0; i < file->count; i++)
+        free(file->pages[i].copy);
+    free(file->pages);
+    munmap(file->data, file->size);
+
+    return Qnil;
+}
+
+/* Decode every page of an uncompressed image file straight from a
+   read-only mapping of it, without going through RMagick:
+   Rdmtx::Decoder#decode_file(path, timeout, raw = nil) returns one Array of
+   messages per page. Reads binary PGM/PPM files (several images may follow
+   each other) and TIFF files with uncompressed 8-bit pages. With raw, a
+   Hash of :width, :height and optionally :stride, :packing (one of the
+   Rdmtx::PACK_ constants) and :header bytes, the file holds raw frames. */
+static VALUE rdmtx_decoder_decode_file_body(RdmtxCall * call) {
+
+    VALUE path = call->args[0];
+    RdmtxFile file;
+    struct stat st;
+    int fd;
+
+    memset(&file, 0x00, sizeof(file));
+    file.decoder = call->decoder;
+    file.raw = call->args[2];
+    file.timeout = NUM2INT(call->args[1]);
+
+    fd = open(StringValueCStr(path), O_RDONLY);
+    if (fd < 0)
+        rb_sys_fail(StringValueCStr(path));
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        rb_raise(rb_eArgError, "Empty or unreadable file %s", StringValueCStr(path));
+    }
+    file.size = (size_t)st.st_size;
+    file.data = mmap(NULL, file.size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (file.data == MAP_FAILED)
+        rb_sys_fail(StringValueCStr(path));
+    madvise(file.data, file.size, MADV_SEQUENTIAL);
+
+    return rb_ensure(rdmtx_file_decode, (VALUE)&file, rdmtx_file_release, (VALUE)&file);
+}
+
+static VALUE rdmtx_decoder_decode_file(int argc, VALUE * argv, VALUE self) {
+    VALUE args[3];
+    rb_scan_args(argc, argv, "21", &args[0], &args[1], &args[2]);
+    return rdmtx_decoder_run(self, rdmtx_decoder_decode_file_body, args);
+}
+
+/* Same as Rdmtx::Decoder#decode_file with a decoder of its own */
+static VALUE rdmtx_decode_file(int argc, VALUE * argv, VALUE self) {
+    VALUE decoder = rb_class_new_instance(0, NULL, cRdmtxDecoder);
+    return rdmtx_decoder_decode_file(argc, argv, decoder);
+}
+
+/* Rdmtx::Decoder#scan_region = [x, y, width, height] only scans that part
+   of the images (rows counted from the top); nil scans whole images */
+static VALUE rdmtx_decoder_set_scan_region(VALUE self, VALUE region) {
+
+    RdmtxDecoder * decoder;
+    Data_Get_Struct(self, RdmtxDecoder, decoder);
+
+    if (NIL_P(region)) {
+        decoder->hasRegion = 0;
+        return region;
+    }
+
+    Check_Type(region, T_ARRAY);
+    if (RARRAY_LEN(region) != 4)
+        rb_raise(rb_eArgError, "scan_region must be [x, y, width, height]");
+
+    int r[4];
+    int i;
+    for (i = 0; i < 4; i++)
+        r[i] = NUM2INT(rb_ary_entry(region, i));
+    if (r[2] <= 0 || r[3] <= 0)
+        rb_raise(rb_eArgError, "Empty scan region");
+
+    memcpy(decoder->region, r, sizeof(r));
+    decoder->hasRegion = 1;
+
+    return region;
+}
+
+static VALUE rdmtx_decoder_scan_region(VALUE self) {
+
+    RdmtxDecoder * decoder;
+    Data_Get_Struct(self, RdmtxDecoder, decoder);
+
+    if (!decoder->hasRegion)
+        return Qnil;
+
+    return rb_ary_new3(4, INT2NUM(decoder->region[0]), INT2NUM(decoder->region[1]),
+          INT2NUM(decoder->region[2]), INT2NUM(decoder->region[3]));
+}
+
+/* Rdmtx::Decoder#pyramid_shrink = n locates symbols on images shrunk by n
+   first and only decodes around them at full size; 1 (the default) scans
+   at full size only */
+static VALUE rdmtx_decoder_set_pyramid_shrink(VALUE self, VALUE shrink) {
+
+    RdmtxDecoder * decoder;
+    Data_Get_Struct(self, RdmtxDecoder, decoder);
+
+    int value = NUM2INT(shrink);
+    if (value < 1)
+        rb_raise(rb_eArgError, "Shrink must be at least 1");
+    decoder->pyramid = value;
+
+    return shrink;
+}
+
+static VALUE rdmtx_decoder_pyramid_shrink(VALUE self) {
+
+    RdmtxDecoder * decoder;
+    Data_Get_Struct(self, RdmtxDecoder, decoder);
+
+    return INT2NUM(decoder->pyramid > 1 ? decoder->pyramid : 1);
+}
+
+/* Settings of a profile Hash, in the field order of DmtxProfile */
+static const char * rdmtxProfileKeys[] = {
+    "size_idx", "edge_min", "edge_max", "scan_gap", "square_devn", "edge_thresh"
+};
+
+static VALUE rdmtx_profile_value(const DmtxProfile * profile) {
+
+    const int values[6] = { profile->sizeIdxExpected, profile->edgeMin,
+          profile->edgeMax, profile->scanGap, profile->squareDevn, profile->edgeThresh };
+    VALUE hash = rb_hash_new();
+    int i;
+
+    /* Settings left to libdmtx are nil */
+    for (i = 0; i < 6; i++)
+        rb_hash_aset(hash, ID2SYM(rb_intern(rdmtxProfileKeys[i])),
+              values[i] == DmtxUndefined ? Qnil : INT2NUM(values[i]));
+
+    return hash;
+}
+
+/* Rdmtx::Decoder#profile = :fixed_size_label (or another named profile), a
+   Hash as returned by #profile, or nil for libdmtx's defaults. Pure Ruby
+   decoders never shrink images, so neither do their profiles. */
+static VALUE rdmtx_decoder_set_profile(VALUE self, VALUE value) {
+
+    RdmtxDecoder * decoder;
+    Data_Get_Struct(self, RdmtxDecoder, decoder);
+
+    if (decoder->busy)
+        rb_raise(rb_eRuntimeError, "Decoder is in use by another thread");
+
+    DmtxProfile profile;
+    if (NIL_P(value)) {
+        dmtxProfileInit(&profile, DmtxProfileDefault);
+    } else if (SYMBOL_P(value) || TYPE(value) == T_STRING) {
+        VALUE name = rb_obj_as_string(value);
+        if (dmtxProfileInit(&profile, dmtxProfileLookup(StringValueCStr(name))) != DmtxPass)
+            rb_raise(rb_eArgError, "Unknown profile %s", StringValueCStr(name));
+    } else {
+        Check_Type(value, T_HASH);
+        int * fields[6] = { &profile.sizeIdxExpected, &profile.edgeMin, &profile.edgeMax,
+              &profile.scanGap, &profile.squareDevn, &profile.edgeThresh };
+        int i;
+        for (i = 0; i < 6; i++) {
+            VALUE v = rb_hash_aref(value, ID2SYM(rb_intern(rdmtxProfileKeys[i])));
+            *fields[i] = NIL_P(v) ? DmtxUndefined : NUM2INT(v);
+        }
+    }
+    profile.shrink = DmtxUndefined;
+    decoder->profile = profile;
+
+    /* Rebuilt by the next decode, without any setting of the old profile */
+    dmtxCoreDecoderClear(&decoder->core);
+
+    return value;
+}
+
+static VALUE rdmtx_decoder_profile(VALUE self) {
+
+    RdmtxDecoder * decoder;
+    Data_Get_Struct(self, RdmtxDecoder, decoder);
+
+    return rdmtx_profile_value(&decoder->profile);
+}
+
+/* Calibration of Rdmtx::Decoder#calibrate, run without the GVL */
+typedef struct {
+    DmtxCalibration calib;
+    DmtxImage ** images;
+    int count;
+    DmtxProfile start;
+    int timeout;
+    DmtxPassFail status;
+} RdmtxCalibrate;
+
+static void * rdmtx_calibrate_without_gvl(void * arg) {
+
+    RdmtxCalibrate * work = (RdmtxCalibrate *)arg;
+
+    work->status = dmtxProfileCalibrate(&work->calib, work->images, work->count,
+          &work->start, work->timeout);
+
+    return NULL;
+}
+
+static VALUE rdmtx_decoder_calibrate_body(RdmtxCall * call) {
+
+    VALUE images = call->args[0];
+    Check_Type(images, T_ARRAY);
+    int count = (int)RARRAY_LEN(images);
+    if (count == 0)
+        rb_raise(rb_eArgError, "No sample images given");
+
+    /* Export every image before allocating anything that could leak */
+    VALUE strings = rb_ary_new2(count);
+    int * widths = ALLOCA_N(int, count);
+    int * heights = ALLOCA_N(int, count);
+    int * packings = ALLOCA_N(int, count);
+    int i;
+    for (i = 0; i < count; i++) {
+        VALUE image = rb_ary_entry(images, i);
+        VALUE pixels;
+        widths[i] = NUM2INT(rb_funcall(image, rb_intern("columns"), 0));
+        heights[i] = NUM2INT(rb_funcall(image, rb_intern("rows"), 0));
+        packings[i] = rdmtx_export_pixels(image, widths[i], heights[i], &pixels);
+        rb_ary_push(strings, pixels);
+    }
+
+    RdmtxCalibrate work;
+    work.images = ALLOCA_N(DmtxImage *, count);
+    work.count = count;
+    work.start = call->decoder->profile;
+    work.start.shrink = 1;
+    work.timeout = NUM2INT(call->args[1]);
+    work.status = DmtxFail;
+
+    for (i = 0; i < count; i++) {
+        work.images[i] = dmtxImageCreate((unsigned char *)RSTRING_PTR(RARRAY_PTR(strings)[i]),
+              widths[i], heights[i], packings[i]);
+        if (work.images[i] == NULL)
+            break;
+    }
+
+    /* The exported strings are only referenced here, so nothing changes
+       them while the GVL is released. Calibration has no cancel hook, so
+       an interrupt is handled once it returns (each decode is bounded by
+       the timeout) */
+    if (i == count) {
+#ifdef HAVE_RB_THREAD_CALL_WITHOUT_GVL2
+        rb_thread_call_without_gvl2(rdmtx_calibrate_without_gvl, &work,
+              RUBY_UBF_IO, NULL);
+#else
+        rdmtx_calibrate_without_gvl(&work);
+#endif
+    }
+
+    while (--i >= 0)
+        dmtxImageDestroy(&work.images[i]);
+    RB_GC_GUARD(strings);
+
+    if (work.status != DmtxPass)
+        return Qnil;
+
+    work.calib.profile.shrink = DmtxUndefined;
+    call->decoder->profile = work.calib.profile;
+    dmtxCoreDecoderClear(&call->decoder->core);
+
+    VALUE result = rb_hash_new();
+    rb_hash_aset(result, ID2SYM(rb_intern("profile")), rdmtx_profile_value(&work.calib.profile));
+    rb_hash_aset(result, ID2SYM(rb_intern("symbols")), INT2NUM(work.calib.symbolCount));
+    rb_hash_aset(result, ID2SYM(rb_intern("default_ms")), rb_float_new(work.calib.defaultMs));
+    rb_hash_aset(result, ID2SYM(rb_intern("profile_ms")), rb_float_new(work.calib.profileMs));
+    rb_hash_aset(result, ID2SYM(rb_intern("speedup")), rb_float_new(work.calib.speedup));
+    return result;
+}
+
+/* Rdmtx::Decoder#calibrate(images, timeout) fits the decoder's profile to
+   sample images (Magick::Image): the tightest settings that still find
+   every symbol the defaults find in them. Settings of the current profile
+   are tried first. Returns a Hash of the new :profile, the :symbols found
+   and the milliseconds all images take with the defaults (:default_ms)
+   and with the profile (:profile_ms), and their ratio (:speedup); nil,
+   keeping the profile, if no symbol is found. */
+static VALUE rdmtx_decoder_calibrate(VALUE self, VALUE images, VALUE timeout) {
+    VALUE args[2] = { images, timeout };
+    return rdmtx_decoder_run(self, rdmtx_decoder_calibrate_body, args);
+}
+
+/* RMagick class and constants used by Rdmtx#encode, looked up once: by
+   Init_Rdmtx if RMagick is already loaded, otherwise by the first encode */
+static VALUE cMagickImage = Qnil;
+static VALUE vMagickCharPixel = Qnil;
+static VALUE vRgbMap = Qnil;
+static ID idNew;
+static ID idImportPixels;
+
+static void rdmtx_lookup_magick(void) {
+    if (!NIL_P(cMagickImage))
+        return;
+
+    VALUE mMagick = rb_const_get(rb_cObject, rb_intern("Magick"));
+    vMagickCharPixel = rb_const_get(mMagick, rb_intern("CharPixel"));
+    cMagickImage = rb_const_get(mMagick, rb_intern("Image"));
+}
+
+/* Render string as a square symbol of 24-bit RGB pixels, rows top first.
+   A moduleSize or marginSize of DmtxUndefined keeps libdmtx's default.
+   Returns NULL if the string cannot be encoded. */
+static DmtxEncode * rdmtx_render(VALUE string, int moduleSize, int marginSize) {
+
+    DmtxEncode * enc = dmtxEncodeCreate();
+    if (enc == NULL)
+        rb_raise(rb_eNoMemError, "unable to allocate encoder");
 
     dmtxEncodeSetProp(enc, DmtxPropPixelPacking, DmtxPack24bppRGB);
     dmtxEncodeSetProp(enc, DmtxPropSizeRequest, DmtxSymbolSquareAuto);
+    if (moduleSize != DmtxUndefined)
+        dmtxEncodeSetProp(enc, DmtxPropModuleSize, moduleSize);
+    if (marginSize != DmtxUndefined)
+        dmtxEncodeSetProp(enc, DmtxPropMarginSize, marginSize);
 
-    /* Create barcode image */
-    if (dmtxEncodeDataMatrix(enc, RSTRING(safeString)->len,
-            (unsigned char *)RSTRING(safeString)->ptr) == DmtxFail) {
-//        printf("Fatal error !\n");
+    if (dmtxEncodeDataMatrix(enc, RSTRING_LEN(string),
+            (unsigned char *)RSTRING_PTR(string)) == DmtxFail) {
         dmtxEncodeDestroy(&enc);
-        return Qnil;
+        return NULL;
     }
 
+    return enc;
+}
+
+static VALUE rdmtx_encode(VALUE self, VALUE string) {
+
+    VALUE safeString = StringValue(string);
+
+    rdmtx_lookup_magick();
+
+    /* Create barcode image */
+    DmtxEncode * enc = rdmtx_render(safeString, DmtxUndefined, DmtxUndefined);
+    if (enc == NULL)
+        return Qnil;
+
     int width = dmtxImageGetProp(enc->image, DmtxPropWidth);
     int height = dmtxImageGetProp(enc->image, DmtxPropHeight);
 
-    VALUE magickImageClass = rb_path2class("Magick::Image");
-    VALUE outputImage = rb_funcall(magickImageClass, rb_intern("new"), 2, INT2NUM(width), INT2NUM(height));
+    VALUE pixels = rb_str_new((char *)enc->image->pxl, 3*width*height);
+
+    /* Clean up before calling into RMagick, which may raise */
+    dmtxEncodeDestroy(&enc);
+
+    VALUE outputImage = rb_funcall(cMagickImage, idNew, 2, INT2NUM(width), INT2NUM(height));
 
-    rb_funcall(outputImage, rb_intern("import_pixels"), 7,
+    rb_funcall(outputImage, idImportPixels, 7,
                INT2NUM(0),
                INT2NUM(0),
                INT2NUM(width),
                INT2NUM(height),
-               rb_str_new("RGB", 3),
-               rb_str_new((char *)enc->image->pxl, 3*width*height),
-//               rb_const_get("Magick" ,rb_intern("CharPixel"))
-               rb_eval_string("Magick::CharPixel"));
+               vRgbMap,
+               pixels,
+               vMagickCharPixel);
+
+    return outputImage;
+}
+
+/* Returns [width, height, pixels] of the rendered symbol without going
+   through RMagick: Rdmtx#encode_raw(string, packing = PACK_24BPP_RGB,
+   module_size = nil, margin_size = nil). pixels holds the rows top first
+   with nothing between them, 3 bytes (RGB) per pixel for PACK_24BPP_RGB
+   or 1 byte for PACK_8BPP_K. Returns nil if string cannot be encoded. */
+static VALUE rdmtx_encode_raw(int argc, VALUE * argv, VALUE self) {
+
+    VALUE string, packingArg, moduleSizeArg, marginSizeArg;
+    rb_scan_args(argc, argv, "13", &string, &packingArg, &moduleSizeArg, &marginSizeArg);
+
+    VALUE safeString = StringValue(string);
+    int packing = NIL_P(packingArg) ? DmtxPack24bppRGB : NUM2INT(packingArg);
+    int moduleSize = NIL_P(moduleSizeArg) ? DmtxUndefined : NUM2INT(moduleSizeArg);
+    int marginSize = NIL_P(marginSizeArg) ? DmtxUndefined : NUM2INT(marginSizeArg);
+
+    if (packing != DmtxPack24bppRGB && packing != DmtxPack8bppK)
+        rb_raise(rb_eArgError, "encode_raw renders PACK_24BPP_RGB or PACK_8BPP_K");
+
+    DmtxEncode * enc = rdmtx_render(safeString, moduleSize, marginSize);
+    if (enc == NULL)
+        return Qnil;
+
+    int width = dmtxImageGetProp(enc->image, DmtxPropWidth);
+    int height = dmtxImageGetProp(enc->image, DmtxPropHeight);
+    int rowSize = dmtxImageGetProp(enc->image, DmtxPropRowSizeBytes);
+    int bytesPerPixel = (packing == DmtxPack8bppK) ? 1 : 3;
+
+    VALUE pixels = rb_str_new(NULL, (long)width * height * bytesPerPixel);
+    unsigned char * out = (unsigned char *)RSTRING_PTR(pixels);
+    int row, col;
+
+    for (row = 0; row < height; row++) {
+        const unsigned char * in = enc->image->pxl + row * rowSize;
+        if (bytesPerPixel == 3) {
+            memcpy(out, in, width * 3);
+            out += width * 3;
+        } else {
+            /* Symbols are black and white, any channel will do */
+            for (col = 0; col < width; col++)
+                *out++ = in[col * 3];
+        }
+    }
 
-    /* Clean up */
     dmtxEncodeDestroy(&enc);
 
-    return outputImage;
+    return rb_ary_new3(3, INT2NUM(width), INT2NUM(height), pixels);
+}
+
+/* Returns [rows, cols, modules] where modules packs the symbol one bit per
+   module (1 = dark), most significant bit first, top row first and each
+   row padded to a whole byte */
+static VALUE rdmtx_encode_modules(VALUE self, VALUE string) {
+
+    VALUE safeString = StringValue(string);
+
+    DmtxEncode * enc = dmtxEncodeCreate();
+    if (enc == NULL)
+        rb_raise(rb_eNoMemError, "unable to allocate encoder");
+
+    /* libdmtx always renders, so keep that raster as small as possible */
+    dmtxEncodeSetProp(enc, DmtxPropModuleSize, 1);
+    dmtxEncodeSetProp(enc, DmtxPropMarginSize, 0);
+    dmtxEncodeSetProp(enc, DmtxPropSizeRequest, DmtxSymbolSquareAuto);
+
+    if (dmtxEncodeDataMatrix(enc, RSTRING_LEN(safeString),
+            (unsigned char *)RSTRING_PTR(safeString)) == DmtxFail) {
+        dmtxEncodeDestroy(&enc);
+        return Qnil;
+    }
+
+    int rows = dmtxGetSymbolAttribute(DmtxSymAttribSymbolRows, enc->region.sizeIdx);
+    int cols = dmtxGetSymbolAttribute(DmtxSymAttribSymbolCols, enc->region.sizeIdx);
+    int rowBytes = (cols + 7) / 8;
+
+    VALUE modules = rb_str_new(NULL, rows * rowBytes);
+    unsigned char * bits = (unsigned char *)RSTRING_PTR(modules);
+    memset(bits, 0, rows * rowBytes);
+
+    /* libdmtx counts symbol rows from the bottom */
+    for (int row = 0; row < rows; row++) {
+        unsigned char * out = bits + (rows - 1 - row) * rowBytes;
+        for (int col = 0; col < cols; col++) {
+            if (dmtxSymbolModuleStatus(enc->message, enc->region.sizeIdx, row, col) & DmtxModuleOnRGB)
+                out[col >> 3] |= 0x80 >> (col & 7);
+        }
+    }
+
+    dmtxEncodeDestroy(&enc);
+
+    return rb_ary_new3(3, INT2NUM(rows), INT2NUM(cols), modules);
+}
+
+/* Packs the module matrix of one payload into item, returning 0 if it
+   could not be encoded */
+static int rdmtx_encode_item(const char * data, long size, RdmtxEncodeItem * item) {
+    DmtxEncode * enc = dmtxEncodeCreate();
+    if (enc == NULL)
+        return 0;
+
+    /* libdmtx always renders, so keep that raster as small as possible */
+    dmtxEncodeSetProp(enc, DmtxPropModuleSize, 1);
+    dmtxEncodeSetProp(enc, DmtxPropMarginSize, 0);
+    dmtxEncodeSetProp(enc, DmtxPropSizeRequest, DmtxSymbolSquareAuto);
+
+    if (dmtxEncodeDataMatrix(enc, (int)size, (unsigned char *)data) == DmtxFail) {
+        dmtxEncodeDestroy(&enc);
+        return 0;
+    }
+
+    item->rows = dmtxGetSymbolAttribute(DmtxSymAttribSymbolRows, enc->region.sizeIdx);
+    item->cols = dmtxGetSymbolAttribute(DmtxSymAttribSymbolCols, enc->region.sizeIdx);
+    int rowBytes = (item->cols + 7) / 8;
+
+    item->bits = calloc(item->rows, rowBytes);
+    if (item->bits == NULL) {
+        dmtxEncodeDestroy(&enc);
+        return 0;
+    }
+
+    /* libdmtx counts symbol rows from the bottom */
+    for (int row = 0; row < item->rows; row++) {
+        unsigned char * out = item->bits + (item->rows - 1 - row) * rowBytes;
+        for (int col = 0; col < item->cols; col++) {
+            if (dmtxSymbolModuleStatus(enc->message, enc->region.sizeIdx, row, col) & DmtxModuleOnRGB)
+                out[col >> 3] |= 0x80 >> (col & 7);
+        }
+    }
+
+    dmtxEncodeDestroy(&enc);
+    return 1;
+}
+
+/* Encodes payloads until none are left or one of them failed */
+static void * rdmtx_encode_worker(void * arg) {
+    RdmtxEncodeJob * job = (RdmtxEncodeJob *)arg;
+
+    for (;;) {
+        pthread_mutex_lock(&job->lock);
+        long index = job->stop ? job->count : job->next++;
+        pthread_mutex_unlock(&job->lock);
+        if (index >= job->count)
+            break;
+
+        RdmtxEncodeItem * item = &job->items[index];
+        if (!rdmtx_encode_item(job->data + job->offsets[index], job->sizes[index], item)) {
+            item->failed = 1;
+            pthread_mutex_lock(&job->lock);
+            job->stop = 1;
+            pthread_mutex_unlock(&job->lock);
+        }
+    }
+
+    return NULL;
+}
+
+/* Encodes an Array of Strings on threads native threads (0 or none = one
+   per processor) and returns one [rows, cols, modules] per payload, as
+   from encode_modules */
+static VALUE rdmtx_encode_many(int argc, VALUE * argv, VALUE self) {
+    VALUE strings, threadsArg;
+    rb_scan_args(argc, argv, "11", &strings, &threadsArg);
+
+    /* Copy the payloads out so that no Ruby object is shared with workers */
+    VALUE payloads = rb_ary_dup(rb_Array(strings));
+    long count = RARRAY_LEN(payloads);
+    long total = 0;
+    for (long i = 0; i < count; i++) {
+        VALUE payload = rb_ary_entry(payloads, i);
+        total += RSTRING_LEN(StringValue(payload));
+        rb_ary_store(payloads, i, payload);
+    }
+
+    char * data = malloc(total + 1);
+    long * offsets = malloc((count + 1) * sizeof(long));
+    long * sizes = malloc((count + 1) * sizeof(long));
+    RdmtxEncodeItem * items = calloc(count + 1, sizeof(RdmtxEncodeItem));
+    if (data == NULL || offsets == NULL || sizes == NULL || items == NULL) {
+        free(data);
+        free(offsets);
+        free(sizes);
+        free(items);
+        rb_raise(rb_eNoMemError, "unable to allocate encode job");
+    }
+
+    total = 0;
+    for (long i = 0; i < count; i++) {
+        VALUE payload = rb_ary_entry(payloads, i);
+        offsets[i] = total;
+        sizes[i] = RSTRING_LEN(payload);
+        memcpy(data + total, RSTRING_PTR(payload), sizes[i]);
+        total += sizes[i];
+    }
+
+    int threads = NIL_P(threadsArg) ? 0 : NUM2INT(threadsArg);
+    threads = dmtxCoreThreadCount(threads < 0 ? 0 : threads);
+    if (threads > count)
+        threads = (int)count;
+
+    RdmtxEncodeJob job;
+    memset(&job, 0, sizeof(job));
+    job.data = data;
+    job.offsets = offsets;
+    job.sizes = sizes;
+    job.count = count;
+    job.items = items;
+    pthread_mutex_init(&job.lock, NULL);
+
+    /* The calling thread works too, so start one thread fewer */
+    pthread_t * workers = calloc(threads > 1 ? threads : 1, sizeof(pthread_t));
+    int started = 0;
+    while (workers != NULL && started < threads - 1 &&
+            pthread_create(&workers[started], NULL, rdmtx_encode_worker, &job) == 0)
+        started++;
+    rdmtx_encode_worker(&job);
+    for (int t = 0; t < started; t++)
+        pthread_join(workers[t], NULL);
+    free(workers);
+    pthread_mutex_destroy(&job.lock);
+
+    long failed = -1;
+    for (long i = 0; i < count && failed < 0; i++) {
+        if (items[i].failed)
+            failed = i;
+    }
+
+    VALUE results = Qnil;
+    if (failed < 0) {
+        results = rb_ary_new2(count);
+        for (long i = 0; i < count; i++) {
+            int size = items[i].rows * ((items[i].cols + 7) / 8);
+            rb_ary_push(results, rb_ary_new3(3, INT2NUM(items[i].rows),
+                INT2NUM(items[i].cols), rb_str_new((char *)items[i].bits, size)));
+        }
+    }
+
+    for (long i = 0; i < count; i++)
+        free(items[i].bits);
+    free(items);
+    free(sizes);
+    free(offsets);
+    free(data);
+
+    if (failed >= 0)
+        rb_raise(rb_eArgError, "unable to encode payload %ld", failed);
+
+    return results;
 }
 
-VALUE cRdmtx;
 void Init_Rdmtx() {
     cRdmtx = rb_define_class("Rdmtx", rb_cObject);
     rb_define_method(cRdmtx, "initialize", rdmtx_init, 0);
     rb_define_method(cRdmtx, "decode", rdmtx_decode, 2);
+    rb_define_method(cRdmtx, "each_decoded", rdmtx_each_decoded, -1);
+    rb_define_method(cRdmtx, "decode_raw", rdmtx_decode_raw, -1);
+    rb_define_method(cRdmtx, "decode_file", rdmtx_decode_file, -1);
     rb_define_method(cRdmtx, "encode", rdmtx_encode, 1);
+    rb_define_method(cRdmtx, "encode_raw", rdmtx_encode_raw, -1);
+    rb_define_method(cRdmtx, "encode_modules", rdmtx_encode_modules, 1);
+    rb_define_method(cRdmtx, "encode_many", rdmtx_encode_many, -1);
+
+    /* Pixel packings of raw frames */
+    rb_define_const(cRdmtx, "PACK_8BPP_K", INT2FIX(DmtxPack8bppK));
+    rb_define_const(cRdmtx, "PACK_24BPP_RGB", INT2FIX(DmtxPack24bppRGB));
+    rb_define_const(cRdmtx, "PACK_24BPP_BGR", INT2FIX(DmtxPack24bppBGR));
+    rb_define_const(cRdmtx, "PACK_32BPP_RGBX", INT2FIX(DmtxPack32bppRGBX));
+    rb_define_const(cRdmtx, "PACK_32BPP_BGRX", INT2FIX(DmtxPack32bppBGRX));
+
+    idNew = rb_intern("new");
+    idImportPixels = rb_intern("import_pixels");
+    rb_global_variable(&cMagickImage);
+    rb_global_variable(&vMagickCharPixel);
+    rb_global_variable(&vRgbMap);
+    vRgbMap = rb_obj_freeze(rb_str_new2("RGB"));
+    if (rb_const_defined(rb_cObject, rb_intern("Magick")) &&
+          rb_const_defined(rb_const_get(rb_cObject, rb_intern("Magick")), rb_intern("CharPixel")))
+        rdmtx_lookup_magick();
+
+    cRdmtxDecoder = rb_define_class_under(cRdmtx, "Decoder", rb_cObject);
+    rb_define_alloc_func(cRdmtxDecoder, rdmtx_decoder_alloc);
+    rb_define_method(cRdmtxDecoder, "decode", rdmtx_decoder_decode, 2);
+    rb_define_method(cRdmtxDecoder, "track", rdmtx_decoder_track, -1);
+    rb_define_method(cRdmtxDecoder, "decode_raw", rdmtx_decoder_decode_raw, -1);
+    rb_define_method(cRdmtxDecoder, "decode_file", rdmtx_decoder_decode_file, -1);
+    rb_define_method(cRdmtxDecoder, "scan_region", rdmtx_decoder_scan_region, 0);
+    rb_define_method(cRdmtxDecoder, "scan_region=", rdmtx_decoder_set_scan_region, 1);
+    rb_define_method(cRdmtxDecoder, "pyramid_shrink", rdmtx_decoder_pyramid_shrink, 0);
+    rb_define_method(cRdmtxDecoder, "pyramid_shrink=", rdmtx_decoder_set_pyramid_shrink, 1);
+    rb_define_method(cRdmtxDecoder, "profile", rdmtx_decoder_profile, 0);
+    rb_define_method(cRdmtxDecoder, "profile=", rdmtx_decoder_set_profile, 1);
+    rb_define_method(cRdmtxDecoder, "calibrate", rdmtx_decoder_calibrate, 2);
 }
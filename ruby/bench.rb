@@ -0,0 +1,90 @@
+#!/usr/bin/env ruby
+# Rdmtx - corpus benchmark
+#
+# Decodes and encodes the shared benchmark corpus written by
+# "bench/dmtxbench corpus DIR" (see "make bench" in the top directory) and
+# prints the same columns as the other wrappers. When DIR/native.txt holds
+# the timings of libdmtx alone, the overhead column is the median time
+# Rdmtx (including the RMagick pixel export) adds on top of it.
+#
+# Usage: ruby bench.rb corpus_dir [rounds]
+
+require 'rubygems'
+require 'RMagick'
+
+require 'Rdmtx'
+
+PAYLOAD = "libdmtx benchmark payload 0123456789 "
+
+def now_ms
+  if defined?(Process::CLOCK_MONOTONIC)
+    Process.clock_gettime(Process::CLOCK_MONOTONIC) * 1000.0
+  else
+    Time.now.to_f * 1000.0
+  end
+end
+
+def allocated_objects
+  GC.stat[:total_allocated_objects] if GC.respond_to?(:stat)
+end
+
+# Per-call times in ms (sorted), Ruby objects allocated per call and the
+# result of the last call
+def measure(rounds)
+  times = []
+  result = nil
+  before = allocated_objects
+  rounds.times do
+    start = now_ms
+    result = yield
+    times << now_ms - start
+  end
+  after = allocated_objects
+  alloc = (before && after) ? "#{(after - before) / rounds} obj" : "-"
+  [times.sort, alloc, result]
+end
+
+def report(name, found, expected, times, alloc, native)
+  total = times.inject(0.0) { |sum, t| sum + t }
+  p50 = times[times.size / 2]
+  p99 = times[(times.size * 99) / 100]
+  overhead = native[name] ? format("%.3f", p50 - native[name]) : "-"
+  puts format("  %-12s %7s %10.1f %9.3f %9.3f %12s %11s", name,
+              "#{found}/#{expected}", total > 0 ? times.size * 1000.0 / total : 0.0,
+              p50, p99, alloc, overhead)
+end
+
+corpus = ARGV[0] or abort "Usage: ruby bench.rb corpus_dir [rounds]"
+rounds = (ARGV[1] || 20).to_i
+
+# Median times of libdmtx alone, by case name
+native = {}
+native_path = File.join(corpus, "native.txt")
+if File.exist?(native_path)
+  File.readlines(native_path).each do |line|
+    fields = line.split
+    native[fields[0]] = fields[3].to_f unless fields.empty? || fields[0].start_with?("#")
+  end
+end
+
+rdmtx = Rdmtx.new
+
+puts "# ruby, #{rounds} rounds per case"
+puts format("# %-12s %7s %10s %9s %9s %12s %11s", "case", "found",
+            "per sec", "p50 ms", "p99 ms", "alloc/call", "overhead ms")
+
+File.readlines(File.join(corpus, "corpus.txt")).each do |line|
+  fields = line.split
+  case fields[0]
+  when "decode"
+    name, file, symbols = fields[1], fields[2], fields[6].to_i
+    image = Magick::Image.read(File.join(corpus, file)).first
+    times, alloc, found = measure(rounds) { rdmtx.decode(image, 0).size }
+    report(name, found, symbols, times, alloc, native)
+  when "encode"
+    name, length = fields[1], fields[2].to_i
+    payload = (PAYLOAD * (length / PAYLOAD.size + 1))[0, length]
+    times, alloc, ok = measure(rounds) { !rdmtx.encode(payload).nil? }
+    report(name, ok ? 1 : 0, 1, times, alloc, native)
+  end
+end
@@ -1,4 +1,12 @@
 require 'mkmf'
 dir_config('dmtx')
 have_library('dmtx')
+have_library('pthread')
+have_header('ruby/thread.h')
+have_func('rb_thread_call_without_gvl2', 'ruby/thread.h')
+have_func('rb_io_buffer_get_bytes_for_reading', 'ruby/io/buffer.h')
+# The pixel conversion kernels, decode profiles and decode loop are shared
+# with the other wrappers and built once as ../.libs/libdmtxcore.a
+# ("make libdmtxcore.la" in ..)
+$LOCAL_LIBS << ' $(srcdir)/../.libs/libdmtxcore.a'
 create_makefile('Rdmtx')
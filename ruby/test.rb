@@ -6,11 +6,56 @@ require 'Rdmtx'
 
 rdmtx = Rdmtx.new
 
-if ARGV[0]
+if ARGV[0] =~ /\.(pgm|ppm|pnm|tiff?)$/i
+  # Multi-page files are decoded from a mapping, one Array per page
+  rdmtx.decode_file(ARGV[0], 0).each_with_index do |messages, page|
+    puts "Page #{page}: #{messages.inspect}"
+  end
+elsif ARGV[0]
   image = Magick::Image.read(ARGV[0]).first
   puts "The image contains : "
   puts rdmtx.decode(image, 0)
+
+  # A decoder keeps its state across images of the same size
+  decoder = Rdmtx::Decoder.new
+  2.times { puts decoder.decode(image, 0) }
+
+  # Look where the symbol was found last time before scanning everything
+  found = decoder.track(image, 0)
+  puts decoder.track(image, 0, found[0][1]).inspect unless found.empty?
+
+  # Stop at the first symbol instead of scanning the whole image
+  puts rdmtx.each_decoded(image).first
+
+  # Raw pixels, here a mono export, skip the Image object entirely
+  gray = image.export_pixels_to_str(0, 0, image.columns, image.rows, "I")
+  puts rdmtx.decode_raw(gray, image.columns, image.rows, Rdmtx::PACK_8BPP_K)
+
+  # Fit the search settings to the images this decoder will see
+  decoder.profile = :fixed_size_label
+  calib = decoder.calibrate([image], 0)
+  puts "#{calib[:profile].inspect}: #{calib[:speedup]}x" if calib
+  puts decoder.decode(image, 0)
+
+  # Decodes release the GVL, so threads scan images in parallel
+  threads = (1..4).map { Thread.new { Rdmtx.new.decode(image, 0) } }
+  puts threads.map(&:value).inspect
 else
   rdmtx.encode("Hello you !!").write("output.png")
   puts "Written output.png"
+
+  # The module matrix alone, one bit per module
+  rows, cols, modules = rdmtx.encode_modules("Hello you !!")
+  modules.unpack("B*").first.scan(/.{#{(cols + 7) / 8 * 8}}/).each do |row|
+    puts row[0, cols].tr("01", " #")
+  end
+
+  # Raw gray pixels, written as a PGM without going through RMagick
+  width, height, gray = rdmtx.encode_raw("Hello you !!", Rdmtx::PACK_8BPP_K)
+  File.open("output.pgm", "wb") { |f| f.write("P5\n#{width} #{height}\n255\n" + gray) }
+
+  # Many payloads at once, encoded on every processor
+  labels = (1..100).map { |i| "Label #{i}" }
+  matrices = rdmtx.encode_many(labels)
+  puts "Encoded #{matrices.size} labels"
 end
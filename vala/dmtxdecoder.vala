@@ -0,0 +1,208 @@
+/* Dmtx.Decoder
+ * Reusable decoder for a stream of frames, e.g. from a GStreamer capture
+ * pipeline. The pixels of each frame are scanned where they are, and the
+ * image and decode are only created again when the frame geometry
+ * changes; in between they are rewound onto the next frame.
+ *
+ * Built on the decode loop shared by the wrappers, so compile it together
+ * with ../core/dmtxcore.c:
+ *
+ *   $ valac --pkg libdmtx -X -I../core app.vala dmtxdecoder.vala ../core/dmtxcore.c
+ *
+ * Add -D DMTX_GDK_PIXBUF --pkg gdk-pixbuf-2.0 for scan_pixbuf() and
+ * -D DMTX_GSTREAMER --pkg gstreamer-1.0 for scan_buffer().
+ */
+
+namespace Dmtx {
+  public errordomain DecoderError {
+    BAD_FRAME,
+    FAILED
+  }
+
+  /* A symbol found in a frame. The same symbol is passed to every call of
+   * the callback, and its message is only valid until the callback returns. */
+  [Compact]
+  public class Symbol {
+    public unowned uint8[] message;
+    /* x,y of the (0,0) (1,0) (1,1) (0,1) corners, rows counted from the top */
+    public int corners[8];
+    public int size_idx;
+    public int pad_count;
+  }
+
+  /* Returning false stops the scan of the frame. */
+  public delegate bool SymbolFunc (Symbol symbol);
+
+  public class Decoder : GLib.Object {
+    /* Milliseconds per frame, UNDEFINED for no limit */
+    public int timeout { get; set; default = UNDEFINED; }
+    /* Symbols to stop after in each frame, UNDEFINED for all */
+    public int max_count { get; set; default = UNDEFINED; }
+    /* Number of errors to correct, UNDEFINED for the most possible */
+    public int corrections { get; set; default = UNDEFINED; }
+    /* Pixels of the frame per pixel scanned */
+    public int shrink { get; set; default = 1; }
+    public bool mosaic { get; set; default = false; }
+
+    private Core.Decoder core;
+    private Symbol symbol;
+    private Time deadline;
+    private Property[] option_props;
+    private int[] option_values;
+    private bool has_bounds;
+    private int bounds[4];
+
+    construct {
+      core = Core.Decoder();
+      symbol = new Symbol();
+      option_props = {};
+      option_values = {};
+    }
+
+    ~Decoder () {
+      core.clear();
+    }
+
+    /* Set a decoding property (EDGE_MIN ... EDGE_THRESHOLD) for the frames
+     * to come. */
+    public bool set_option (Property prop, int value) {
+      int i;
+
+      for ( i = 0 ; i < option_props.length ; i++ ) {
+        if ( option_props[i] == prop )
+          break;
+      }
+      if ( i == option_props.length ) {
+        option_props += prop;
+        option_values += value;
+      }
+      else {
+        option_values[i] = value;
+      }
+
+      if ( core.decode != null )
+        return core.decode.set_property(prop, value);
+
+      return true;
+    }
+
+    /* Only scan the frame pixels x_min..x_max, y_min..y_max (inclusive,
+     * rows counted from the top). */
+    public bool set_bounds (int x_min, int x_max, int y_min, int y_max) {
+      bounds[0] = x_min;
+      bounds[1] = x_max;
+      bounds[2] = y_min;
+      bounds[3] = y_max;
+      has_bounds = true;
+
+      /* Rewinding keeps the bounds, so this lasts until the geometry changes */
+      if ( core.decode != null )
+        return Core.set_image_bounds(core.decode, x_min, x_max, y_min, y_max);
+
+      return true;
+    }
+
+    public void clear_bounds () {
+      has_bounds = false;
+
+      if ( core.decode != null )
+        Core.set_image_bounds(core.decode, 0, core.width - 1, 0, core.height - 1);
+    }
+
+    /* Scan a frame of packed pixels, rows rowstride bytes apart (0 if they
+     * are not padded), and pass each symbol decoded to func. The length of
+     * pixels has to cover the frame. Returns the number of symbols decoded. */
+    public int scan (uint8[] pixels, int width, int height, int rowstride, PackOrder packing, SymbolFunc func) throws DecoderError {
+      int bpp = Core.bytes_per_pixel(packing);
+      if ( bpp == 0 || width < 1 || height < 1 )
+        throw new DecoderError.BAD_FRAME("Unsupported frame format");
+
+      int stride = (rowstride > 0) ? rowstride : width * bpp;
+      if ( stride < width * bpp || pixels.length < stride * (height - 1) + width * bpp )
+        throw new DecoderError.BAD_FRAME("Frame is smaller than its geometry");
+
+      if ( !core.prepare(pixels, width, height, rowstride, packing, shrink) )
+        throw new DecoderError.FAILED("Unable to create decode");
+
+      unowned Decode dec = core.decode;
+      if ( core.fresh != 0 )
+        apply_options(dec);
+
+      if ( timeout != UNDEFINED )
+        deadline = Time().add(timeout);
+
+      int found = 0;
+      while ( max_count == UNDEFINED || found < max_count ) {
+        Region? reg;
+        if ( timeout != UNDEFINED )
+          reg = dec.find_next(deadline);
+        else
+          reg = dec.find_next(null);
+        if ( reg == null )
+          break;
+
+        Message? msg;
+        if ( mosaic )
+          msg = dec.mosaic_region(reg, corrections);
+        else
+          msg = dec.matrix_region(reg, corrections);
+        if ( msg == null )
+          continue;
+
+        symbol.message = msg.output;
+        symbol.size_idx = reg.size_idx;
+        symbol.pad_count = msg.pad_count;
+        Core.region_corners(dec, reg, symbol.corners);
+        found++;
+
+        bool more = func(symbol);
+        symbol.message = null;
+        if ( !more )
+          break;
+      }
+
+      return found;
+    }
+
+#if DMTX_GDK_PIXBUF
+    /* Scan an 8 bit RGB or RGBA pixbuf. */
+    public int scan_pixbuf (Gdk.Pixbuf pixbuf, SymbolFunc func) throws DecoderError {
+      if ( pixbuf.colorspace != Gdk.Colorspace.RGB || pixbuf.bits_per_sample != 8 )
+        throw new DecoderError.BAD_FRAME("Unsupported pixbuf format");
+
+      var packing = (pixbuf.n_channels == 4) ? PackOrder.32BPP_RGBX : PackOrder.24BPP_RGB;
+
+      return scan(pixbuf.get_pixels_with_length(), pixbuf.width, pixbuf.height, pixbuf.rowstride, packing, func);
+    }
+#endif
+
+#if DMTX_GSTREAMER
+    /* Scan a video buffer, mapped for reading while it is scanned. Planar
+     * YUV frames (I420, NV12, ...) can be scanned through their luma plane
+     * as PackOrder.8BPP_K with the stride of that plane. */
+    public int scan_buffer (Gst.Buffer buffer, int width, int height, int stride, PackOrder packing, SymbolFunc func) throws DecoderError {
+      Gst.MapInfo map;
+      if ( !buffer.map(out map, Gst.MapFlags.READ) )
+        throw new DecoderError.BAD_FRAME("Unable to map buffer");
+
+      int found;
+      try {
+        found = scan(map.data, width, height, stride, packing, func);
+      }
+      finally {
+        buffer.unmap(map);
+      }
+
+      return found;
+    }
+#endif
+
+    private void apply_options (Decode dec) {
+      for ( int i = 0 ; i < option_props.length ; i++ )
+        dec.set_property(option_props[i], option_values[i]);
+
+      if ( has_bounds )
+        Core.set_image_bounds(dec, bounds[0], bounds[1], bounds[2], bounds[3]);
+    }
+  }
+}
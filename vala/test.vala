@@ -72,5 +72,19 @@ public int main (string[] args) {
   /* Encode */
   dmtxCairoWrite(enc, cr, surface_size[0] * 0.25, surface_size[1] * 0.25, surface_size[0] * 0.5, surface_size[0] * 0.5);
 
+  /* Read the barcode back from the encoded image, without copying its pixels */
+  var img = new Dmtx.Image(enc.image.pxl, enc.image.width, enc.image.height, Dmtx.PackOrder.24BPP_RGB);
+  var dec = new Dmtx.Decode(img, 1);
+  var reg = dec.find_next(null);
+  if ( reg == null )
+    GLib.error("Unable to find the barcode.");
+
+  var msg = dec.matrix_region(reg, Dmtx.UNDEFINED);
+  if ( msg == null )
+    GLib.error("Unable to decode the barcode.");
+
+  GLib.stdout.write(msg.output);
+  GLib.stdout.putc('\n');
+
   return 0;
 }
\ No newline at end of file